@@ -0,0 +1,301 @@
+#ifndef YMD_BENCH_HH
+#define YMD_BENCH_HH 1
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ymd::bench {
+  template<typename T>
+  inline void do_not_optimize(const T& v){
+    asm volatile("" : : "r,m"(v) : "memory");
+  }
+
+  inline void clobber_memory(){ asm volatile("" : : : "memory"); }
+
+  using Clock = std::chrono::steady_clock;
+  using Params = std::vector<std::pair<std::string,std::size_t>>;
+
+  inline std::size_t param(const Params& params,const std::string& key){
+    for(auto& [k, v] : params){ if(k == key){ return v; } }
+    throw std::out_of_range("Unknown parameter: " + key);
+  }
+
+  // Accumulate only timed regions, so that per iteration setup is excluded.
+  class Stopwatch {
+  private:
+    Clock::time_point begin;
+    Clock::duration total;
+  public:
+    Stopwatch(): begin{}, total{Clock::duration::zero()} {}
+    void start(){ begin = Clock::now(); }
+    void stop(){ total += Clock::now() - begin; }
+    double seconds() const {
+      return std::chrono::duration<double>(total).count();
+    }
+  };
+
+  // Elapsed time of `f()` called `iterations` times
+  template<typename F>
+  inline double measure(std::size_t iterations,F&& f){
+    auto sw = Stopwatch{};
+    sw.start();
+    for(std::size_t i = 0; i < iterations; ++i){ f(); }
+    clobber_memory();
+    sw.stop();
+    return sw.seconds();
+  }
+
+  // Benchmark body: set up with `params`, run `iterations` times, and
+  // return the elapsed seconds of timed regions.
+  using Body = std::function<double(const Params&,std::size_t)>;
+
+  struct Benchmark {
+    std::string name;
+    std::vector<std::string> keys;
+    std::vector<std::vector<std::size_t>> axes;
+    Body body;
+    // Items processed by an iteration (e.g. batch size)
+    std::function<std::size_t(const Params&)> items;
+    // Cases returning false are skipped (e.g. too large memory)
+    std::function<bool(const Params&)> enabled;
+  };
+
+  struct Options {
+    double min_time = 0.1;
+    std::size_t repetitions = 3;
+    std::string filter = "";
+    std::string format = "console";
+    std::string out = "";
+    std::size_t min_log2 = 10;
+    std::size_t max_log2 = 20;
+    std::size_t log2_step = 2;
+    std::size_t max_bytes = std::size_t(1) << 30;
+    std::size_t max_threads = std::max(std::thread::hardware_concurrency(),1u);
+
+    std::vector<std::size_t> sizes() const {
+      auto v = std::vector<std::size_t>{};
+      for(auto l = min_log2; l <= max_log2; l += std::max(log2_step,std::size_t(1))){
+	v.push_back(std::size_t(1) << l);
+      }
+      return v;
+    }
+
+    std::vector<std::size_t> threads() const {
+      auto v = std::vector<std::size_t>{};
+      for(std::size_t t = 1; t <= max_threads; t *= 2){ v.push_back(t); }
+      return v;
+    }
+  };
+
+  struct Result {
+    std::string name;
+    Params params;
+    std::size_t iterations;
+    std::vector<double> ns;
+    std::size_t items;
+
+    std::string full_name() const {
+      auto s = name;
+      for(auto& [k, v] : params){ s += "/" + k + ":" + std::to_string(v); }
+      return s;
+    }
+
+    double min() const { return *std::min_element(ns.begin(),ns.end()); }
+    double median() const {
+      auto v = ns;
+      std::sort(v.begin(),v.end());
+      const auto n = v.size();
+      return (n % 2) ? v[n/2]: 0.5 * (v[n/2 - 1] + v[n/2]);
+    }
+    double mean() const {
+      return std::accumulate(ns.begin(),ns.end(),0.0) / ns.size();
+    }
+    double stddev() const {
+      const auto m = mean();
+      auto s = 0.0;
+      for(auto x : ns){ s += (x - m) * (x - m); }
+      return (ns.size() > 1) ? std::sqrt(s / (ns.size() - 1)): 0.0;
+    }
+    double items_per_second() const { return items * 1e9 / median(); }
+  };
+
+  inline Options parse_options(int argc,char** argv){
+    auto opt = Options{};
+    for(int i = 1; i < argc; ++i){
+      const auto arg = std::string{argv[i]};
+      const auto eq = arg.find('=');
+      if((arg.rfind("--",0) != 0) || (eq == std::string::npos)){
+	throw std::invalid_argument("Unknown argument: " + arg);
+      }
+      const auto key = arg.substr(2,eq-2);
+      const auto value = arg.substr(eq+1);
+
+      if(key == "min_time"){ opt.min_time = std::stod(value); }
+      else if(key == "repetitions"){ opt.repetitions = std::stoul(value); }
+      else if(key == "filter"){ opt.filter = value; }
+      else if(key == "format"){ opt.format = value; }
+      else if(key == "out"){ opt.out = value; }
+      else if(key == "min_log2"){ opt.min_log2 = std::stoul(value); }
+      else if(key == "max_log2"){ opt.max_log2 = std::stoul(value); }
+      else if(key == "log2_step"){ opt.log2_step = std::stoul(value); }
+      else if(key == "max_bytes"){ opt.max_bytes = std::stoull(value); }
+      else if(key == "max_threads"){ opt.max_threads = std::stoul(value); }
+      else { throw std::invalid_argument("Unknown option: " + key); }
+    }
+    if((opt.format != "console") && (opt.format != "json") &&
+       (opt.format != "csv")){
+      throw std::invalid_argument("Unknown format: " + opt.format);
+    }
+    opt.repetitions = std::max(opt.repetitions,std::size_t(1));
+    return opt;
+  }
+
+  inline std::vector<Params> product(const Benchmark& b){
+    auto cases = std::vector<Params>{Params{}};
+    for(std::size_t k = 0; k < b.keys.size(); ++k){
+      auto next = std::vector<Params>{};
+      for(auto& c : cases){
+	for(auto v : b.axes[k]){
+	  auto p = c;
+	  p.emplace_back(b.keys[k],v);
+	  next.push_back(std::move(p));
+	}
+      }
+      cases = std::move(next);
+    }
+    return cases;
+  }
+
+  inline Result run(const Benchmark& b,const Params& params,const Options& opt){
+    // Grow iterations until a run takes `min_time`.
+    auto iterations = std::size_t(1);
+    while(true){
+      const auto t = b.body(params,iterations);
+      if((t >= opt.min_time) || (iterations >= (std::size_t(1) << 30))){ break; }
+      const auto scale = (t > 0) ? 1.4 * opt.min_time / t: 10.0;
+      iterations = std::max(iterations + 1,
+			    std::size_t(iterations * std::min(scale,10.0)));
+    }
+
+    auto r = Result{b.name,params,iterations,{},b.items ? b.items(params): 1};
+    for(std::size_t i = 0; i < opt.repetitions; ++i){
+      r.ns.push_back(b.body(params,iterations) * 1e9 / iterations);
+    }
+    return r;
+  }
+
+  inline std::string escape(const std::string& s){
+    auto o = std::string{};
+    for(auto c : s){
+      if((c == '"') || (c == '\\')){ o += '\\'; }
+      o += c;
+    }
+    return o;
+  }
+
+  inline void write_json(std::ostream& os,const std::vector<Result>& results,
+			 const Options& opt){
+    const auto now = std::time(nullptr);
+    char date[32];
+    std::strftime(date,sizeof(date),"%Y-%m-%dT%H:%M:%SZ",std::gmtime(&now));
+
+    os << std::setprecision(10);
+    os << "{\n  \"context\": {\n"
+       << "    \"date\": \"" << date << "\",\n"
+       << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#if defined(__VERSION__)
+       << "    \"compiler\": \"" << escape(__VERSION__) << "\",\n"
+#endif
+       << "    \"min_time\": " << opt.min_time << ",\n"
+       << "    \"repetitions\": " << opt.repetitions << "\n"
+       << "  },\n  \"benchmarks\": [";
+
+    for(std::size_t i = 0; i < results.size(); ++i){
+      auto& r = results[i];
+      os << (i ? ",\n": "\n") << "    {\"name\": \"" << escape(r.full_name())
+	 << "\", \"benchmark\": \"" << escape(r.name) << "\", \"params\": {";
+      for(std::size_t j = 0; j < r.params.size(); ++j){
+	os << (j ? ", ": "") << "\"" << escape(r.params[j].first) << "\": "
+	   << r.params[j].second;
+      }
+      os << "}, \"iterations\": " << r.iterations
+	 << ", \"median_ns\": " << r.median()
+	 << ", \"min_ns\": " << r.min()
+	 << ", \"mean_ns\": " << r.mean()
+	 << ", \"stddev_ns\": " << r.stddev()
+	 << ", \"items_per_iteration\": " << r.items
+	 << ", \"items_per_second\": " << r.items_per_second() << "}";
+    }
+    os << "\n  ]\n}\n";
+  }
+
+  inline void write_csv(std::ostream& os,const std::vector<Result>& results){
+    os << std::setprecision(10);
+    os << "name,iterations,median_ns,min_ns,mean_ns,stddev_ns,"
+       << "items_per_iteration,items_per_second\n";
+    for(auto& r : results){
+      os << "\"" << r.full_name() << "\"," << r.iterations << ","
+	 << r.median() << "," << r.min() << "," << r.mean() << ","
+	 << r.stddev() << "," << r.items << "," << r.items_per_second() << "\n";
+    }
+  }
+
+  inline void write_console(std::ostream& os,const Result& r){
+    os << std::left << std::setw(64) << r.full_name() << std::right
+       << std::setw(14) << std::fixed << std::setprecision(1) << r.median()
+       << " ns" << std::setw(14) << std::scientific << std::setprecision(3)
+       << r.items_per_second() << " items/s" << std::setw(12)
+       << r.iterations << std::defaultfloat << std::endl;
+  }
+
+  // Run all enabled cases matching `--filter` (substring of full name),
+  // and write results with `--format` into `--out` (or standard output).
+  inline int run_all(const std::vector<Benchmark>& benchmarks,const Options& opt){
+    auto results = std::vector<Result>{};
+    const auto console = (opt.format == "console");
+
+    for(auto& b : benchmarks){
+      for(auto& params : product(b)){
+	auto r = Result{b.name,params,0,{},0};
+	if(!opt.filter.empty() &&
+	   (r.full_name().find(opt.filter) == std::string::npos)){ continue; }
+	if(b.enabled && !b.enabled(params)){ continue; }
+
+	results.push_back(run(b,params,opt));
+	if(console){ write_console(std::cout,results.back()); }
+	else { std::cerr << results.back().full_name() << std::endl; }
+      }
+    }
+
+    if(console && opt.out.empty()){ return 0; }
+
+    auto file = std::ofstream{};
+    if(!opt.out.empty()){
+      file.open(opt.out);
+      if(!file){
+	std::cerr << "Cannot open: " << opt.out << std::endl;
+	return 1;
+      }
+    }
+    auto& os = opt.out.empty() ? std::cout: static_cast<std::ostream&>(file);
+    if(opt.format == "csv"){ write_csv(os,results); }
+    else { write_json(os,results,opt); }
+    return 0;
+  }
+}
+
+#endif // YMD_BENCH_HH
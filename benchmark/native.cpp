@@ -0,0 +1,309 @@
+// Native micro-benchmarks of C++ cores
+//
+// Build & Run:
+//   g++ -std=c++17 -O3 -march=native -Icpprb -pthread
+//       -o benchmark/native benchmark/native.cpp
+//   benchmark/native --format=json --out=native.json --max_log2=26
+//
+// Options (--key=value):
+//   min_time     Minimum seconds of a measured run (default 0.1)
+//   repetitions  Measured runs of each case (default 3)
+//   filter       Run only cases whose name contains the string
+//   format       "console" (default), "json" or "csv"
+//   out          Output file. (console format writes JSON into the file)
+//   min_log2, max_log2, log2_step
+//                Buffer size sweep 2^min_log2 ... 2^max_log2 (default 10..20)
+//   max_bytes    Skip cases whose buffer is larger (default 1 GiB)
+//   max_threads  Thread count sweep 1, 2, 4, ... max_threads
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <SegmentTree.hh>
+#include <ReplayBuffer.hh>
+
+#include "bench.hh"
+
+using ymd::bench::Benchmark;
+using ymd::bench::Params;
+using ymd::bench::param;
+
+namespace {
+  constexpr std::size_t pool_size = 4096;
+
+  template<typename T>
+  std::vector<T> uniform(std::size_t n,T low,T high,std::uint64_t seed){
+    auto g = std::mt19937_64{seed};
+    auto v = std::vector<T>(n);
+    if constexpr (std::is_integral_v<T>){
+      auto d = std::uniform_int_distribution<T>{low,high};
+      for(auto& e : v){ e = d(g); }
+    }else{
+      auto d = std::uniform_real_distribution<T>{low,high};
+      for(auto& e : v){ e = d(g); }
+    }
+    return v;
+  }
+
+  template<std::size_t Arity>
+  using Tree = ymd::SegmentTree<float,false,ymd::SumOp<float>,Arity>;
+
+  template<std::size_t Arity>
+  Tree<Arity> make_tree(std::size_t size){
+    auto tree = Tree<Arity>{size,ymd::SumOp<float>{}};
+    auto v = uniform<float>(size,0.0f,1.0f,0);
+    tree.set(0,[it=v.begin()]() mutable { return *(it++); },size);
+    return tree;
+  }
+
+  template<std::size_t Arity>
+  double segment_tree_set(const Params& params,std::size_t iterations){
+    const auto size = param(params,"size");
+    auto tree = make_tree<Arity>(size);
+    const auto idx = uniform<std::size_t>(pool_size,0,size-1,1);
+    const auto v = uniform<float>(pool_size,0.0f,1.0f,2);
+
+    auto i = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      tree.set(idx[i],v[i]);
+      i = (i + 1) % pool_size;
+    });
+  }
+
+  template<std::size_t Arity>
+  double segment_tree_set_batch(const Params& params,std::size_t iterations){
+    const auto size = param(params,"size");
+    const auto batch = param(params,"batch");
+    auto tree = make_tree<Arity>(size);
+    const auto idx = uniform<std::size_t>(pool_size + batch,0,size-1,1);
+    const auto v = uniform<float>(pool_size + batch,0.0f,1.0f,2);
+
+    auto i = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      tree.set(idx.data() + i,v.data() + i,batch);
+      i = (i + 1) % pool_size;
+    });
+  }
+
+  template<std::size_t Arity>
+  double segment_tree_reduce(const Params& params,std::size_t iterations){
+    const auto size = param(params,"size");
+    auto tree = make_tree<Arity>(size);
+    const auto a = uniform<std::size_t>(pool_size,0,size-1,1);
+    const auto b = uniform<std::size_t>(pool_size,0,size-1,2);
+
+    auto i = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      ymd::bench::do_not_optimize(tree.reduce(std::min(a[i],b[i]),
+					      std::max(a[i],b[i]) + 1));
+      i = (i + 1) % pool_size;
+    });
+  }
+
+  template<std::size_t Arity>
+  double segment_tree_largest_region_index(const Params& params,
+					   std::size_t iterations){
+    const auto size = param(params,"size");
+    auto tree = make_tree<Arity>(size);
+    const auto total = tree.reduce(0,size);
+    const auto mass = uniform<float>(pool_size,0.0f,total,1);
+
+    auto i = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      const auto m = mass[i];
+      ymd::bench::do_not_optimize(tree.largest_region_index([=](auto v){
+	return v <= m;
+      },size));
+      i = (i + 1) % pool_size;
+    });
+  }
+
+  using Sampler = ymd::CppPrioritizedSampler<float>;
+
+  Sampler make_sampler(std::size_t size){
+    auto per = Sampler{size,0.6f};
+    auto p = uniform<float>(size,0.0f,1.0f,0);
+    per.set_priorities(0,p.data(),size,size);
+    per.set_seed(42);
+    return per;
+  }
+
+  double per_sample(const Params& params,std::size_t iterations){
+    const auto size = param(params,"size");
+    const auto batch = param(params,"batch");
+    auto per = make_sampler(size);
+    per.set_num_threads(param(params,"threads"));
+
+    auto weights = std::vector<float>{};
+    auto indexes = std::vector<std::size_t>{};
+    return ymd::bench::measure(iterations,[&](){
+      per.sample(batch,0.4f,weights,indexes,size);
+      ymd::bench::do_not_optimize(weights.data());
+    });
+  }
+
+  double per_update_priorities(const Params& params,std::size_t iterations){
+    const auto size = param(params,"size");
+    const auto batch = param(params,"batch");
+    auto per = make_sampler(size);
+    auto idx = uniform<std::size_t>(pool_size + batch,0,size-1,1);
+    auto p = uniform<float>(pool_size + batch,0.0f,1.0f,2);
+
+    auto i = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      per.update_priorities(idx.data() + i,p.data() + i,batch);
+      i = (i + 1) % pool_size;
+    });
+  }
+
+  double counter_rng_uniform_indexes(const Params& params,
+				     std::size_t iterations){
+    const auto size = param(params,"size");
+    const auto batch = param(params,"batch");
+    const auto rng = ymd::CppCounterRNG{42};
+    auto idx = std::vector<std::size_t>(batch);
+
+    auto stream = std::uint64_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      ymd::uniform_indexes(rng,stream++,batch,size,idx.data());
+      ymd::bench::do_not_optimize(idx.data());
+    });
+  }
+
+  double dimensional_buffer_store_data(const Params& params,
+				       std::size_t iterations){
+    const auto size = param(params,"size");
+    const auto dim = param(params,"dim");
+    const auto batch = std::min(param(params,"batch"),size);
+    auto buffer = ymd::DimensionalBuffer<float>{size,dim};
+    auto v = uniform<float>(batch * dim,0.0f,1.0f,0);
+
+    auto next_index = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      if(next_index + batch > size){ next_index = 0; }
+      buffer.store_data(v.data(),0,next_index,batch);
+      next_index += batch;
+    });
+  }
+
+  // Sparse rows: 1/16 of elements are non zero.
+  double compressed_store_gather(const Params& params,std::size_t iterations){
+    const auto size = param(params,"size");
+    const auto dim = param(params,"dim");
+    const auto batch = param(params,"batch");
+    auto store = ymd::CppCompressedStore{size,dim * sizeof(float),sizeof(float)};
+    store.set_num_threads(param(params,"threads"));
+
+    auto v = uniform<float>(size * dim,0.0f,1.0f,0);
+    for(std::size_t i = 0; i < v.size(); ++i){ if(i % 16){ v[i] = 0.0f; } }
+    store.store(0,size,v.data());
+
+    const auto idx = uniform<std::size_t>(pool_size + batch,0,size-1,1);
+    auto out = std::vector<float>(batch * dim);
+    auto i = std::size_t(0);
+    return ymd::bench::measure(iterations,[&](){
+      store.gather(idx.data() + i,batch,out.data());
+      ymd::bench::do_not_optimize(out.data());
+      i = (i + 1) % pool_size;
+    });
+  }
+
+  using Selective = ymd::CppSelectiveEnvironment<float,float,float,float>;
+
+  double selective_delete_episode(const Params& params,std::size_t iterations){
+    const auto episodes = param(params,"episodes");
+    const auto episode_len = param(params,"episode_len");
+    const auto dim = param(params,"dim");
+    auto env = Selective{episode_len,episodes,dim,1,1,param(params,"block") != 0};
+
+    auto obs = uniform<float>(episode_len * dim,0.0f,1.0f,0);
+    auto act = std::vector<float>(episode_len,0.0f);
+    auto rew = std::vector<float>(episode_len,1.0f);
+    auto done = std::vector<float>(episode_len,0.0f);
+    done.back() = 1.0f;
+
+    auto store = [&](){
+      env.store(obs.data(),act.data(),rew.data(),obs.data(),done.data(),
+		episode_len);
+    };
+    for(std::size_t e = 0; e < episodes; ++e){ store(); }
+
+    // Delete the oldest episode (the worst case of compaction), and refill.
+    auto sw = ymd::bench::Stopwatch{};
+    for(std::size_t i = 0; i < iterations; ++i){
+      sw.start();
+      ymd::bench::do_not_optimize(env.delete_episode(0));
+      ymd::bench::clobber_memory();
+      sw.stop();
+      store();
+    }
+    return sw.seconds();
+  }
+}
+
+int main(int argc,char** argv){
+  auto opt = ymd::bench::Options{};
+  try {
+    opt = ymd::bench::parse_options(argc,argv);
+  } catch(const std::exception& e){
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+
+  const auto sizes = opt.sizes();
+  const auto batches = std::vector<std::size_t>{32,256,1024};
+  const auto items_batch = [](const Params& p){ return param(p,"batch"); };
+  const auto fit = [&](std::size_t bytes_per_elem){
+    return [&opt,bytes_per_elem](const Params& p){
+      auto elems = param(p,"size");
+      for(auto& [k, v] : p){ if(k == "dim"){ elems *= v; } }
+      return elems * bytes_per_elem <= opt.max_bytes;
+    };
+  };
+
+  // SegmentTree<float> of Arity (2 or 4) stores about 2 floats per leaf.
+  // CppPrioritizedSampler tree node has sum and min.
+  const auto benchmarks = std::vector<Benchmark>{
+    {"SegmentTree::set/arity:2",{"size"},{sizes},
+     segment_tree_set<2>,nullptr,fit(8)},
+    {"SegmentTree::set/arity:4",{"size"},{sizes},
+     segment_tree_set<4>,nullptr,fit(8)},
+    {"SegmentTree::set(batch)/arity:2",{"size","batch"},{sizes,batches},
+     segment_tree_set_batch<2>,items_batch,fit(8)},
+    {"SegmentTree::set(batch)/arity:4",{"size","batch"},{sizes,batches},
+     segment_tree_set_batch<4>,items_batch,fit(8)},
+    {"SegmentTree::reduce/arity:2",{"size"},{sizes},
+     segment_tree_reduce<2>,nullptr,fit(8)},
+    {"SegmentTree::reduce/arity:4",{"size"},{sizes},
+     segment_tree_reduce<4>,nullptr,fit(8)},
+    {"SegmentTree::largest_region_index/arity:2",{"size"},{sizes},
+     segment_tree_largest_region_index<2>,nullptr,fit(8)},
+    {"SegmentTree::largest_region_index/arity:4",{"size"},{sizes},
+     segment_tree_largest_region_index<4>,nullptr,fit(8)},
+    {"CppPrioritizedSampler::sample",{"size","batch","threads"},
+     {sizes,batches,opt.threads()},
+     per_sample,items_batch,fit(16)},
+    {"CppPrioritizedSampler::update_priorities",{"size","batch"},
+     {sizes,batches},
+     per_update_priorities,items_batch,fit(16)},
+    {"CppCounterRNG::uniform_indexes",{"size","batch"},{sizes,batches},
+     counter_rng_uniform_indexes,items_batch,nullptr},
+    {"DimensionalBuffer::store_data",{"size","dim","batch"},
+     {sizes,{1,16,256},batches},
+     dimensional_buffer_store_data,items_batch,fit(sizeof(float))},
+    {"CppCompressedStore::gather",{"size","dim","batch","threads"},
+     {sizes,{256,4096},batches,opt.threads()},
+     compressed_store_gather,items_batch,fit(2 * sizeof(float))},
+    {"CppSelectiveEnvironment::delete_episode",
+     {"episodes","episode_len","dim","block"},
+     {{16,256},{100,1000},{1,64},{0,1}},
+     selective_delete_episode,nullptr,
+     [&opt](const Params& p){
+       return (param(p,"episodes") * param(p,"episode_len") *
+	       (2 * param(p,"dim") + 3) * sizeof(float)) <= opt.max_bytes;
+     }},
+  };
+
+  return ymd::bench::run_all(benchmarks,opt);
+}
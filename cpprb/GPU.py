@@ -0,0 +1,416 @@
+"""
+Replay buffers on GPU memory
+
+Transitions are stored on CUDA device memory through CuPy, and sampling,
+gathering and segment tree updates run as device kernels, so that sampled
+batches are device arrays without host to device copy.
+"""
+import numpy as np
+
+from .PyReplayBuffer import dict2buffer
+
+try:
+    import cupy as cp
+except ImportError:
+    cp = None
+
+
+def _require_cupy():
+    if cp is None:
+        raise ImportError("GPU buffers require CuPy. " +
+                          "(e.g. `pip install cupy-cuda12x`)")
+
+
+def as_device_array(x, dtype=None):
+    """
+    Convert into `cupy.ndarray` on the current device
+
+    Parameters
+    ----------
+    x : array like
+        Host values (`numpy.ndarray`, scalar, list) are copied. Device arrays
+        with `__cuda_array_interface__` (e.g. CUDA `torch.Tensor`) are used
+        without copy, and ones only with `__dlpack__` are imported via DLPack.
+    dtype : numpy.dtype, optional
+        Converted dtype
+
+    Returns
+    -------
+    cupy.ndarray
+    """
+    _require_cupy()
+    if ((not isinstance(x, (np.ndarray, cp.ndarray))) and
+        (not hasattr(x, "__cuda_array_interface__")) and
+        hasattr(x, "__dlpack__")):
+        x = cp.from_dlpack(x)
+    return cp.asarray(x, dtype=dtype)
+
+
+_kernels = {}
+
+def _kernel(name):
+    k = _kernels.get(name)
+    if k is not None:
+        return k
+
+    if name == "descent":
+        # Proportional descent of sum tree (1-based heap, leaves at [pow2, 2pow2))
+        k = cp.ElementwiseKernel(
+            "T mass_in, raw T tree_sum, uint64 pow2, uint64 stored",
+            "uint64 index",
+            """
+            T mass = mass_in;
+            unsigned long long node = 1;
+            while(node < pow2){
+              const unsigned long long left = 2 * node;
+              const T s = tree_sum[left];
+              if(s <= mass){
+                mass -= s;
+                node = left + 1;
+              }else{
+                node = left;
+              }
+            }
+            index = min(node - pow2, stored - 1);
+            """,
+            "cpprb_per_descent")
+    elif name == "update":
+        # Ancestors at `shift` levels above updated leaves. Duplicated
+        # ancestors write the same value, since their children are fixed.
+        k = cp.ElementwiseKernel(
+            "uint64 leaf, uint64 shift",
+            "raw T tree_sum, raw T tree_min",
+            """
+            const unsigned long long n = leaf >> shift;
+            const unsigned long long l = 2 * n;
+            tree_sum[n] = tree_sum[l] + tree_sum[l + 1];
+            tree_min[n] = min(tree_min[l], tree_min[l + 1]);
+            """,
+            "cpprb_per_update")
+    else:
+        raise KeyError(name)
+
+    _kernels[name] = k
+    return k
+
+
+class GPUReplayBuffer:
+    def __init__(self, size, env_dict=None, *, device: int = 0,
+                 default_dtype=None, seed=None):
+        """
+        Initialize GPUReplayBuffer
+
+        Parameters
+        ----------
+        size : int
+            Buffer size
+        env_dict : dict of dict, optional
+            Environment definition. (See `ReplayBuffer`)
+        device : int, optional
+            CUDA device ID. Default is `0`.
+        default_dtype : numpy.dtype, optional
+            Fallback dtype. Default is `numpy.single`.
+        seed : int, optional
+            Seed of device random number generator
+
+        Raises
+        ------
+        ImportError
+            If CuPy is not installed.
+
+        Notes
+        -----
+        `add()` accepts host arrays and device arrays (CuPy arrays, and ones
+        with `__cuda_array_interface__` or `__dlpack__`). `sample()` returns
+        `cupy.ndarray`, which can be passed to other frameworks without copy,
+        e.g. `torch.from_dlpack(sample["obs"])`.
+
+        Neither `next_of`, `stack_compress`, `Nstep` nor `mmap_prefix` is
+        supported.
+        """
+        _require_cupy()
+        self.buffer_size = int(size)
+        self.env_dict = env_dict.copy() if env_dict else {}
+        self.device = cp.cuda.Device(device)
+
+        with self.device:
+            # side effect: Add "add_shape" key into self.env_dict
+            self.buffer = dict2buffer(self.buffer_size, self.env_dict,
+                                      default_dtype=default_dtype,
+                                      device=self.device.id)
+            self.rng = cp.random.RandomState(seed)
+
+        self.next_index = 0
+        self.stored_size = 0
+
+    def _store(self, kwargs):
+        # Returns (the first index, device positions, kept rows, step size)
+        values = {}
+        N = None
+        for name in self.buffer:
+            v = as_device_array(kwargs[name]).reshape(self.env_dict[name]["add_shape"])
+            if N is None:
+                N = v.shape[0]
+            elif N != v.shape[0]:
+                raise ValueError("All values must have the same step size")
+            values[name] = v
+
+        index = self.next_index
+        # Only the last rows are kept, when more than buffer size
+        rows = slice(max(N - self.buffer_size, 0), N)
+        pos = (cp.arange(rows.start, N) + index) % self.buffer_size
+        for name, b in self.buffer.items():
+            b[pos] = values[name][rows]
+
+        self.next_index = (index + N) % self.buffer_size
+        self.stored_size = min(self.stored_size + N, self.buffer_size)
+        return index, pos, rows, N
+
+    def add(self, **kwargs):
+        """
+        Add transition(s) into replay buffer
+
+        Parameters
+        ----------
+        **kwargs : array like
+            Transitions to be stored.
+
+        Returns
+        -------
+        int
+            The first index of stored position
+
+        Raises
+        ------
+        KeyError
+            If any values defined at constructor are missing.
+        ValueError
+            If values have different step sizes.
+        """
+        with self.device:
+            return self._store(kwargs)[0]
+
+    def _encode_sample(self, idx):
+        return {name: b[idx] for name, b in self.buffer.items()}
+
+    def _check_stored(self):
+        if self.stored_size == 0:
+            raise ValueError("Cannot sample from empty buffer")
+
+    def sample(self, batch_size):
+        """
+        Sample the stored transitions randomly on device
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+
+        Returns
+        -------
+        dict of cupy.ndarray
+            Sampled transitions
+
+        Raises
+        ------
+        ValueError
+            If no transitions are stored.
+        """
+        self._check_stored()
+        with self.device:
+            idx = self.rng.randint(0, self.stored_size, size=batch_size)
+            return self._encode_sample(idx)
+
+    def get_all_transitions(self):
+        """
+        Get all transitions stored in replay buffer
+
+        Returns
+        -------
+        dict of cupy.ndarray
+        """
+        with self.device:
+            return self._encode_sample(cp.arange(self.stored_size))
+
+    def get_stored_size(self):
+        return self.stored_size
+
+    def get_buffer_size(self):
+        return self.buffer_size
+
+    def get_next_index(self):
+        return self.next_index
+
+    def clear(self):
+        self.next_index = 0
+        self.stored_size = 0
+
+    def on_episode_end(self):
+        pass
+
+    def is_Nstep(self):
+        return False
+
+
+class GPUPrioritizedReplayBuffer(GPUReplayBuffer):
+    def __init__(self, size, env_dict=None, *, alpha=0.6, eps=1e-4, **kwargs):
+        """
+        Initialize GPUPrioritizedReplayBuffer
+
+        Parameters
+        ----------
+        size : int
+            Buffer size
+        env_dict : dict of dict, optional
+            Environment definition. (See `ReplayBuffer`)
+        alpha : float, optional
+            :math:`\\alpha` the exponent of the priorities. Default is `0.6`.
+        eps : float, optional
+            :math:`\\epsilon` small positive constant. Default is `1e-4`.
+        **kwargs
+            Other parameters of `GPUReplayBuffer`
+
+        Notes
+        -----
+        Sum and min segment trees of :math:`(p_{i} + \\epsilon)^{\\alpha}` are
+        kept on device like `PrioritizedReplayBuffer`. Sampling (stratified
+        proportional descent), weight calculation and updates are device
+        kernels, and the max priority is a device scalar, so that
+        `update_priorities()` with device TD errors never synchronizes host.
+        """
+        super().__init__(size, env_dict, **kwargs)
+        self.alpha = float(alpha)
+        self.eps = float(eps)
+
+        self.pow2 = 1
+        while self.pow2 < self.buffer_size:
+            self.pow2 *= 2
+        self.depth = self.pow2.bit_length() - 1
+
+        with self.device:
+            self.tree_sum = cp.zeros(2 * self.pow2, dtype=cp.float32)
+            self.tree_min = cp.full(2 * self.pow2, np.inf, dtype=cp.float32)
+            self.max_p = cp.ones((), dtype=cp.float32)
+
+    def _set_leaves(self, idx, v):
+        leaf = idx.astype(cp.uint64) + cp.uint64(self.pow2)
+        self.tree_sum[leaf] = v
+        self.tree_min[leaf] = v
+
+        update = _kernel("update")
+        for shift in range(1, self.depth + 1):
+            update(leaf, shift, self.tree_sum, self.tree_min)
+
+    def add(self, *, priorities=None, **kwargs):
+        """
+        Add transition(s) into replay buffer
+
+        Parameters
+        ----------
+        priorities : array like or float, optional
+            Priorities of transitions on host or device. When no priorities
+            are passed, the maximum priority until then is used.
+        **kwargs : array like
+            Transitions to be stored.
+
+        Returns
+        -------
+        int
+            The first index of stored position
+        """
+        with self.device:
+            index, pos, rows, N = self._store(kwargs)
+
+            if priorities is not None:
+                ps = as_device_array(priorities, cp.float32).ravel()
+                if ps.shape[0] != N:
+                    raise ValueError("`priorities` shape is incompatible")
+                self.max_p = cp.maximum(self.max_p, ps.max())
+                v = (ps[rows] + self.eps) ** self.alpha
+            else:
+                v = cp.broadcast_to((self.max_p + self.eps) ** self.alpha,
+                                    pos.shape)
+            self._set_leaves(pos, v)
+            return index
+
+    def sample(self, batch_size, beta=0.4):
+        """
+        Sample the stored transitions depending on priorities on device
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+        beta : float, optional
+            The exponent of weight. Default is `0.4`.
+
+        Returns
+        -------
+        dict of cupy.ndarray
+            Sampled transitions with 'weights' and 'indexes'
+        """
+        self._check_stored()
+        with self.device:
+            total = self.tree_sum[1]
+            u = self.rng.random_sample(batch_size, dtype=cp.float32)
+            mass = (u + cp.arange(batch_size, dtype=cp.float32)) * (total / batch_size)
+            idx = _kernel("descent")(mass, self.tree_sum, self.pow2,
+                                     self.stored_size)
+
+            # w_i / max_j w_j = (p_i / p_min)^(-beta)
+            w = (self.tree_sum[idx + cp.uint64(self.pow2)] / self.tree_min[1]) ** (-beta)
+
+            samples = self._encode_sample(idx)
+            samples["weights"] = w.astype(cp.float32, copy=False)
+            samples["indexes"] = idx
+            return samples
+
+    def update_priorities(self, indexes, priorities):
+        """
+        Update priorities
+
+        Parameters
+        ----------
+        indexes : array like
+            Indexes to update (e.g. sampled 'indexes') on host or device
+        priorities : array like
+            Priorities (e.g. TD errors) on host or device
+
+        Raises
+        ------
+        ValueError
+            If sizes of `indexes` and `priorities` are different.
+
+        Notes
+        -----
+        Indexes are not validated to avoid host synchronization; they are
+        clipped into buffer size. When the same index appears multiple
+        times, one of them is used.
+        """
+        with self.device:
+            idx = as_device_array(indexes).ravel().astype(cp.uint64, copy=False)
+            ps = as_device_array(priorities, cp.float32).ravel()
+            if idx.shape[0] != ps.shape[0]:
+                raise ValueError("`indexes` and `priorities` must have the same size")
+            if idx.shape[0] == 0:
+                return
+
+            idx = cp.minimum(idx, cp.uint64(self.buffer_size - 1))
+            self.max_p = cp.maximum(self.max_p, ps.max())
+            self._set_leaves(idx, (ps + self.eps) ** self.alpha)
+
+    def get_max_priority(self):
+        return float(self.max_p)
+
+    def get_priority_sum(self):
+        return float(self.tree_sum[1])
+
+    def get_priority_min(self):
+        return float(self.tree_min[1])
+
+    def clear(self):
+        super().clear()
+        with self.device:
+            self.tree_sum.fill(0)
+            self.tree_min.fill(np.inf)
+            self.max_p.fill(1)
@@ -1,7 +1,13 @@
 import numpy as np
 
+from .PyReplayBuffer import LaBERSampler, PrioritizedReplayBuffer
+
+
 class LaBER:
-    def __init__(self, batch_size: int, m: int = 4, *, eps: float = 1e-6):
+    _weight = None
+
+    def __init__(self, batch_size: int, m: int = 4, *, eps: float = 1e-6,
+                 seed=None):
         """
         Initialize LaBER (sub-)class
 
@@ -16,8 +22,19 @@ class LaBER:
             Default value is `4`.
         eps : float, option
             Small positive values to avoid 0 priority. Default value is `1e-6`.
+        seed : int, optional
+            Seed of (sub-)sampling. If `None` (default), sampling is not
+            reproducible.
+
+        Notes
+        -----
+        Large batch can be passed to `__call__()`, or sampled by two stage
+        methods, `sample_candidates()` and `subsample()`, which gather
+        full transitions only for the final `batch_size` ones.
         """
-        self.rng = np.random.default_rng()
+        self.rng = np.random.default_rng(seed)
+        self.seed = seed
+        self._native = None
 
         self.batch_size = int(batch_size)
         if self.batch_size <= 0:
@@ -64,18 +81,106 @@ class LaBER:
     def _normalize_weight(self, p, _idx):
         raise NotImplementedError
 
+    def sample_candidates(self, buffer, *, fields=None, beta: float = 0.4):
+        """
+        Sample `m * batch_size` candidates (stage 1)
+
+        Parameters
+        ----------
+        buffer : ReplayBuffer or PrioritizedReplayBuffer
+            Buffer to be sampled. Prioritized buffer samples candidates
+            depending on its priorities.
+        fields : iterable of str, optional
+            Names of values required to compute surrogate priorities.
+            Other values are not gathered. Default is `None` (no values).
+        beta : float, optional
+            Exponent of importance sampling weights for prioritized buffer.
+            Default value is `0.4`.
+
+        Returns
+        -------
+        candidates : dict of numpy.ndarray
+            `fields` values and 'indexes' of candidates. Prioritized buffer
+            also returns 'weights'.
+        """
+        fields = () if fields is None else fields
+        N = self.idx.shape[0]
+
+        if isinstance(buffer, PrioritizedReplayBuffer):
+            sample = buffer.sample(N, beta, fields=fields)
+            sample["indexes"] = np.array(sample["indexes"], copy=True)
+            sample["weights"] = np.array(sample["weights"], copy=True)
+            return sample
+
+        stored_size = buffer.get_stored_size()
+        if stored_size == 0:
+            raise ValueError("`buffer` is empty")
+        indexes = self.rng.integers(0, stored_size, N, dtype=np.uint64)
+        sample = buffer.gather_transitions(indexes, fields=fields)
+        sample["indexes"] = indexes
+        return sample
+
+    def subsample(self, buffer, candidates, *, priorities, out=None):
+        """
+        Sub-sample from candidates and gather full transitions (stage 2)
+
+        Parameters
+        ----------
+        buffer : ReplayBuffer or PrioritizedReplayBuffer
+            Buffer sampled at `sample_candidates()`, which must not be
+            modified after that.
+        candidates : dict of numpy.ndarray
+            Candidates returned by `sample_candidates()`
+        priorities : array-like of float
+            Surrogate priorities of candidates
+        out : dict of numpy.ndarray, optional
+            Preallocated output arrays. (See `ReplayBuffer.sample()`)
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            `batch_size` transitions with 'weights' and 'indexes' (buffer
+            indexes). For prioritized buffer, 'weights' are products of
+            LaBER weights and importance sampling weights of candidates.
+        """
+        if self._weight is None:
+            raise NotImplementedError
+        if self._native is None:
+            self._native = LaBERSampler(self.batch_size, eps=self.eps,
+                                        weight=self._weight, seed=self.seed)
+
+        p = np.ravel(np.asarray(priorities, dtype=np.single))
+        if p.shape != self.idx.shape:
+            raise ValueError("`priorities` size must be `batch_size * m`")
+
+        _idx, weights = self._native.subsample(p)
+        indexes = np.asarray(candidates["indexes"])[_idx]
+        if "weights" in candidates:
+            weights *= np.asarray(candidates["weights"])[_idx]
+
+        sample = buffer.gather_transitions(indexes, out=out)
+        sample["weights"] = weights
+        sample["indexes"] = indexes
+        return sample
+
 
 class LaBERmean(LaBER):
+    _weight = "mean"
+
     def _normalize_weight(self, p, _idx):
         return p.mean() / p[_idx]
 
 
 class LaBERlazy(LaBER):
+    _weight = "lazy"
+
     def _normalize_weight(self, p, _idx):
         return 1.0 / p[_idx]
 
 
 class LaBERmax(LaBER):
+    _weight = "max"
+
     def _normalize_weight(self, p, _idx):
         p_idx = 1.0 / p[_idx]
         return p_idx / p_idx.max()
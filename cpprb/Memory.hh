@@ -0,0 +1,223 @@
+#ifndef YMD_MEMORY_HH
+#define YMD_MEMORY_HH 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ymd {
+  enum class HugePage : int {
+    None = 0, Transparent = 1, Huge2MB = 2, Huge1GB = 3
+  };
+
+  // Placement of large allocation
+  //   huge_page: Transparent advises transparent huge page (MADV_HUGEPAGE).
+  //              Huge2MB / Huge1GB map reserved hugetlb pages, and fall back
+  //              to Transparent when no hugetlb pages are available.
+  //              Allocation smaller than the huge page uses normal pages.
+  //   numa_node: Bind memory to the node when numa_node >= 0.
+  //   interleave: Interleave memory over all nodes (prior to numa_node).
+  //   prefault_threads: The number of threads touching pages just after
+  //                     allocation, so that page faults do not occur at
+  //                     (first) sampling. 0 means lazy.
+  // Anything unsupported by the platform is ignored (best effort).
+  struct MemoryPolicy {
+    HugePage huge_page = HugePage::None;
+    int numa_node = -1;
+    bool interleave = false;
+    std::size_t prefault_threads = 0;
+
+    bool is_default() const noexcept {
+      return (huge_page == HugePage::None) && (numa_node < 0) &&
+	!interleave && (prefault_threads == 0);
+    }
+  };
+
+  inline MemoryPolicy make_memory_policy(int huge_page,int numa_node,
+					 bool interleave,
+					 std::size_t prefault_threads) noexcept {
+    return MemoryPolicy{HugePage(huge_page),numa_node,interleave,
+			prefault_threads};
+  }
+
+  // Policy of internally allocated buffers (DimensionalBuffer, SegmentTree).
+  // It is read at construction, so set it before constructing buffers.
+  inline MemoryPolicy& default_memory_policy() noexcept {
+    static MemoryPolicy policy{};
+    return policy;
+  }
+
+  inline void set_default_memory_policy(const MemoryPolicy& policy) noexcept {
+    default_memory_policy() = policy;
+  }
+
+  namespace memory_detail {
+    inline constexpr std::size_t alignment = 64;
+
+    // Smaller allocation without policy stays at heap.
+    inline constexpr std::size_t mmap_threshold = std::size_t(1) << 21;
+
+    inline constexpr std::size_t page_size(HugePage h) noexcept {
+      switch(h){
+      case HugePage::Huge1GB: return std::size_t(1) << 30;
+      case HugePage::Huge2MB:
+      case HugePage::Transparent: return std::size_t(1) << 21;
+      default: return std::size_t(4096);
+      }
+    }
+
+    inline void prefault(char* p,std::size_t bytes,std::size_t page,
+			 std::size_t threads){
+      const auto pages = (bytes + page - 1) / page;
+      threads = std::min(threads,pages);
+      if(threads == 0){ return; }
+
+      auto touch = [=](std::size_t begin,std::size_t end){
+	for(auto i = begin; i < end; ++i){
+	  *reinterpret_cast<volatile char*>(p + i*page) = 0;
+	}
+      };
+
+      auto workers = std::vector<std::thread>{};
+      workers.reserve(threads - 1);
+      const auto per_thread = (pages + threads - 1) / threads;
+      for(std::size_t t = 1; t < threads; ++t){
+	workers.emplace_back(touch,
+			     std::min(t*per_thread,pages),
+			     std::min((t+1)*per_thread,pages));
+      }
+      touch(0,std::min(per_thread,pages));
+      for(auto& w : workers){ w.join(); }
+    }
+
+#if defined(__linux__)
+    inline void numa(void* p,std::size_t bytes,const MemoryPolicy& policy){
+#if defined(SYS_mbind)
+      // MPOL_BIND = 2, MPOL_INTERLEAVE = 3 (linux/mempolicy.h)
+      constexpr std::size_t bits = 8 * sizeof(unsigned long);
+      constexpr std::size_t max_node = 1024;
+      unsigned long mask[max_node / bits] = {};
+
+      int mode;
+      if(policy.interleave){
+	// Nodes without memory are dropped by kernel.
+	std::fill(std::begin(mask),std::end(mask),~0ul);
+	mode = 3;
+      }else if((policy.numa_node >= 0) &&
+	       (std::size_t(policy.numa_node) < max_node)){
+	mask[policy.numa_node / bits] = 1ul << (policy.numa_node % bits);
+	mode = 2;
+      }else{
+	return;
+      }
+      syscall(SYS_mbind,p,bytes,mode,mask,max_node + 1,0);
+#else
+      (void)p; (void)bytes; (void)policy;
+#endif
+    }
+
+    // Map at least `bytes`. `mapped` receives the mapped size and `page`
+    // receives the size of actually obtained page, which is the base page
+    // size when hugetlb pages are not available (or transparent huge page is
+    // only advised).
+    inline void* map(std::size_t bytes,HugePage huge_page,
+		     std::size_t& mapped,std::size_t& page){
+      void* p = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+      if((huge_page == HugePage::Huge2MB) || (huge_page == HugePage::Huge1GB)){
+	// Page size is encoded at MAP_HUGE_SHIFT (= 26)
+	const int shift = (huge_page == HugePage::Huge1GB) ? 30: 21;
+	page = page_size(huge_page);
+	mapped = (bytes + page - 1) / page * page;
+	p = mmap(nullptr,mapped,PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << 26),
+		 -1,0);
+      }
+#endif
+
+      if(p == MAP_FAILED){
+	page = std::size_t(sysconf(_SC_PAGESIZE));
+	mapped = (bytes + page - 1) / page * page;
+	p = mmap(nullptr,mapped,PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+	if(p == MAP_FAILED){ throw std::bad_alloc{}; }
+
+#if defined(MADV_HUGEPAGE)
+	if(huge_page != HugePage::None){
+	  madvise(p,mapped,MADV_HUGEPAGE);
+	}
+#endif
+      }
+      return p;
+    }
+#endif
+  }
+
+  // Allocate zero filled memory (at least 64 byte aligned).
+  // `mapped` receives the mapped size, which must be passed to
+  // `deallocate_memory`. (0 means heap)
+  inline void* allocate_memory(std::size_t bytes,const MemoryPolicy& policy,
+			       std::size_t& mapped){
+    using namespace memory_detail;
+    bytes = std::max(bytes,std::size_t(1));
+
+#if defined(__linux__)
+    // Allocation smaller than a huge page stays at normal pages, so that
+    // small ones (e.g. frame store segments) do not consume huge pages.
+    auto normal = policy;
+    if(bytes < page_size(policy.huge_page)){ normal.huge_page = HugePage::None; }
+
+    if(!normal.is_default() || (bytes >= mmap_threshold)){
+      auto page = std::size_t(0);
+      auto p = map(bytes,normal.huge_page,mapped,page);
+      numa(p,mapped,normal);
+      prefault(static_cast<char*>(p),mapped,page,normal.prefault_threads);
+      return p;
+    }
+#endif
+
+    mapped = 0;
+    auto p = ::operator new(bytes,std::align_val_t{alignment});
+    std::memset(p,0,bytes);
+    return p;
+  }
+
+  inline void deallocate_memory(void* p,std::size_t mapped) noexcept {
+    if(!p){ return; }
+#if defined(__linux__)
+    if(mapped){
+      munmap(p,mapped);
+      return;
+    }
+#endif
+    ::operator delete(p,std::align_val_t{memory_detail::alignment});
+  }
+
+  // Zero filled array of trivial type
+  template<typename T>
+  std::shared_ptr<T[]> allocate_array(std::size_t n,
+				      const MemoryPolicy& policy = default_memory_policy()){
+    static_assert(std::is_trivially_copyable_v<T>,
+		  "Policy allocation requires trivially copyable type");
+    auto mapped = std::size_t(0);
+    auto p = static_cast<T*>(allocate_memory(n * sizeof(T),policy,mapped));
+    return std::shared_ptr<T[]>(p,[mapped](T* p){
+      deallocate_memory(p,mapped);
+    });
+  }
+}
+
+#endif // YMD_MEMORY_HH
@@ -0,0 +1,272 @@
+import collections
+import threading
+
+import numpy as np
+
+from .PyReplayBuffer import PrioritizedReplayBuffer
+
+
+class Prefetcher:
+    def __init__(self, buffer, batch_size: int, prefetch: int = 2, *,
+                 beta: float = 0.4, on_update: str = "invalidate"):
+        """
+        Initialize Prefetcher, which samples batches in background thread
+
+        Sampled values are gathered natively with GIL released, so that
+        sampling overlaps with the training step of the main thread.
+
+        Parameters
+        ----------
+        buffer : ReplayBuffer or PrioritizedReplayBuffer
+            Buffer to be sampled. While prefetching, modify it only through
+            `add()`, `on_episode_end()`, `update_priorities()` and `clear()`
+            of this class.
+        batch_size : int
+            Batch size
+        prefetch : int, optional
+            The number of batches kept ready. Default value is `2`.
+        beta : float, optional
+            Exponent of importance sampling weights for prioritized buffer.
+            Prefetched batches keep weights with `beta` at sampling.
+            Default value is `0.4`.
+        on_update : {"invalidate", "carry"}, optional
+            What to do with prefetched batches of prioritized buffer whose
+            indexes are updated by `update_priorities()`. "invalidate"
+            (default) discards and resamples them. "carry" keeps them with
+            weights at sampling.
+
+        Notes
+        -----
+        A batch returned by `next_batch()` is valid until the following
+        `next_batch()` call, since its arrays are reused for prefetching.
+
+        If the prioritized buffer is constructed with `check_for_update=True`,
+        `update_priorities()` ignores indexes of the last returned batch which
+        are overwritten after its (actual) sampling.
+        """
+        if not hasattr(buffer, "empty_sample"):
+            raise TypeError("`buffer` must support `sample(..., out=...)`")
+        self.buffer = buffer
+
+        self.batch_size = int(batch_size)
+        if self.batch_size <= 0:
+            raise ValueError("`batch_size` must be positive integer.")
+
+        self.prefetch = int(prefetch)
+        if self.prefetch <= 0:
+            raise ValueError("`prefetch` must be positive integer.")
+
+        if on_update not in ("invalidate", "carry"):
+            raise ValueError("`on_update` must be \"invalidate\" or \"carry\"")
+        self.on_update = on_update
+
+        self.beta = beta
+        self.is_per = isinstance(buffer, PrioritizedReplayBuffer)
+
+        # Lock order: `self._buffer_lock` -> `self._cv`
+        self._buffer_lock = threading.Lock()
+        self._cv = threading.Condition()
+
+        # Ready batches: [sample, overwritten], where `overwritten` traces
+        # batch indexes overwritten after sampling.
+        self._ready = collections.deque()
+        self._held = None
+        self._free = collections.deque(self.buffer.empty_sample(self.batch_size)
+                                       for _ in range(self.prefetch + 1))
+
+        self._closed = False
+        self._error = None
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def _run(self):
+        try:
+            while True:
+                with self._cv:
+                    self._cv.wait_for(lambda: (self._closed or
+                                               (self._free and
+                                                self.buffer.get_stored_size() > 0)))
+                    if self._closed:
+                        return
+                    out = self._free.popleft()
+
+                with self._buffer_lock:
+                    if self.buffer.get_stored_size() == 0:
+                        with self._cv:
+                            self._free.append(out)
+                        continue
+
+                    if self.is_per:
+                        sample = self.buffer.sample(self.batch_size, self.beta,
+                                                    out=out)
+                    else:
+                        sample = self.buffer.sample(self.batch_size, out=out)
+
+                    with self._cv:
+                        self._ready.append([sample,
+                                            np.zeros(self.batch_size,
+                                                     dtype=np.bool_)])
+                        self._cv.notify_all()
+        except BaseException as e:
+            with self._cv:
+                self._error = e
+                self._closed = True
+                self._cv.notify_all()
+
+    def _trace(self, begin, N):
+        # Must be called with `self._buffer_lock` and `self._cv`
+        if not self.is_per:
+            return
+
+        size = self.buffer.get_buffer_size()
+        shift = np.uint64(size - begin)
+        for b in (self._ready if self._held is None
+                  else [*self._ready, self._held]):
+            b[1] |= ((b[0]["indexes"] + shift) % size) < N
+
+    def next_batch(self, timeout=None):
+        """
+        Get the next prefetched batch
+
+        Parameters
+        ----------
+        timeout : float, optional
+            Timeout in seconds. If `None` (default), wait forever.
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            Sampled batch. (See `ReplayBuffer.sample()`)
+
+        Raises
+        ------
+        TimeoutError
+            If no batch is ready within `timeout`.
+        RuntimeError
+            If this Prefetcher is closed.
+        """
+        with self._cv:
+            if self._held is not None:
+                self._free.append(self._held[0])
+                self._held = None
+                self._cv.notify_all()
+
+            if not self._cv.wait_for(lambda: self._ready or self._closed,
+                                     timeout):
+                raise TimeoutError("No batch is ready")
+
+            if self._error is not None:
+                raise RuntimeError("Prefetcher thread failed") from self._error
+            if not self._ready:
+                raise RuntimeError("Prefetcher is closed")
+
+            self._held = self._ready.popleft()
+            self._cv.notify_all()
+            return self._held[0]
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        try:
+            return self.next_batch()
+        except RuntimeError:
+            if self._error is not None:
+                raise
+            raise StopIteration
+
+    def add(self, **kwargs):
+        """
+        Add transition(s) into buffer
+
+        Parameters
+        ----------
+        **kwargs : array like or float or int
+            Transitions to be stored. (See `ReplayBuffer.add()`)
+
+        Returns
+        -------
+        : int or None
+            The first index of stored position.
+        """
+        with self._buffer_lock:
+            index = self.buffer.add(**kwargs)
+            if index is not None:
+                N = ((self.buffer.get_next_index() - index) %
+                     self.buffer.get_buffer_size()) or self.buffer.get_buffer_size()
+                with self._cv:
+                    self._trace(index, N)
+                    self._cv.notify_all()
+        return index
+
+    def on_episode_end(self):
+        """
+        Call `on_episode_end()` of buffer
+        """
+        with self._buffer_lock:
+            begin = self.buffer.get_next_index()
+            self.buffer.on_episode_end()
+            N = ((self.buffer.get_next_index() - begin) %
+                 self.buffer.get_buffer_size())
+            with self._cv:
+                if N > 0:
+                    self._trace(begin, N)
+                self._cv.notify_all()
+
+    def update_priorities(self, indexes, priorities):
+        """
+        Update priorities of prioritized buffer
+
+        Parameters
+        ----------
+        indexes : array_like
+            indexes to update priorities
+        priorities : array_like
+            priorities to update
+        """
+        with self._buffer_lock:
+            with self._cv:
+                if self._held is not None:
+                    # Restart trace of buffer from the sampling of held batch
+                    held, overwritten = self._held
+                    self.buffer._mark_sampled(held["indexes"][overwritten])
+
+            self.buffer.update_priorities(indexes, priorities)
+
+            if self.on_update == "invalidate":
+                idx = np.asarray(indexes)
+                with self._cv:
+                    ready = collections.deque()
+                    for b in self._ready:
+                        if np.isin(b[0]["indexes"], idx).any():
+                            self._free.append(b[0])
+                        else:
+                            ready.append(b)
+                    self._ready = ready
+                    self._cv.notify_all()
+
+    def clear(self):
+        """
+        Clear buffer and discard prefetched batches
+        """
+        with self._buffer_lock:
+            self.buffer.clear()
+            with self._cv:
+                self._free.extend(b[0] for b in self._ready)
+                self._ready.clear()
+                self._cv.notify_all()
+
+    def close(self):
+        """
+        Stop background thread
+        """
+        with self._cv:
+            self._closed = True
+            self._cv.notify_all()
+        self._thread.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
@@ -3,8 +3,10 @@
 
 import ctypes
 from logging import getLogger, StreamHandler, Formatter, INFO
-from multiprocessing import Event, Lock, Process
+from multiprocessing import Lock, Process
 from multiprocessing.sharedctypes import Value, RawValue, RawArray
+import os
+import threading
 import time
 from typing import Any, Dict, Callable, Optional
 import warnings
@@ -13,6 +15,8 @@ cimport numpy as np
 import numpy as np
 import cython
 from cython.operator cimport dereference
+from libc.stdint cimport int64_t, uint8_t, uint64_t
+from libc.string cimport memcpy
 
 from cpprb.ReplayBuffer cimport *
 
@@ -20,6 +24,8 @@ from .VectorWrapper cimport *
 from .VectorWrapper import (VectorWrapper,
                             VectorInt,VectorSize_t,
                             VectorDouble,PointerDouble,VectorFloat)
+from . import checkpoint
+from .metrics import Metrics, now as _now
 
 def default_logger(level=INFO):
     """
@@ -44,6 +50,16 @@ def default_logger(level=INFO):
 
     return logger
 
+# (kind, itemsize) of native byte order numpy dtype -> ymd::DType
+_BATCH_DTYPES = {("b",1): 0, ("i",1): 1, ("u",1): 2, ("i",2): 3, ("u",2): 4,
+                 ("i",4): 5, ("u",4): 6, ("i",8): 7, ("u",8): 8,
+                 ("f",4): 9, ("f",8): 10, ("f",2): 11}
+
+cdef inline int batch_dtype(dtype):
+    if not dtype.isnative:
+        return -1
+    return _BATCH_DTYPES.get((dtype.kind, dtype.itemsize), -1)
+
 cdef double [::1] Cdouble(array):
     return np.ravel(np.array(array,copy=False,dtype=np.double,ndmin=1,order='C'))
 
@@ -58,6 +74,177 @@ cdef inline const float [::1] Cfloat(array):
 def unwrap(d):
     return d[np.newaxis][0]
 
+cdef uint64_t random_seed():
+    return int.from_bytes(os.urandom(8),"little")
+
+cdef uint64_t split_seed(uint64_t seed,uint64_t k):
+    cdef CppCounterRNG rng = CppCounterRNG(seed)
+    return rng.split(k).get_seed()
+
+cdef np.ndarray uniform_index_array(uint64_t seed,uint64_t stream,
+                                    size_t N,size_t high):
+    r"""Uniform indexes in [0, high) of the counter based RNG stream
+    """
+    if high == 0:
+        raise ValueError("Cannot sample from empty buffer")
+    cdef np.ndarray idx = np.empty(N,dtype=np.uint64)
+    uniform_indexes(CppCounterRNG(seed),stream,N,high,
+                    <size_t*>np.PyArray_DATA(idx))
+    return idx
+
+# Never be a stable slot sequence, since its active writer bits are set.
+SEQ_UNKNOWN = np.iinfo(np.uint64).max
+
+def open_memmap(fname,shape,dtype,mode):
+    """Map file as numpy.memmap
+
+    Parameters
+    ----------
+    fname : str
+        File name
+    shape : tuple of int
+        Array shape
+    dtype : numpy.dtype
+        Array dtype
+    mode : {"w+", "r+"}
+        "w+" creates (or truncates) file. "r+" maps existing file, whose size
+        must match with `shape` and `dtype`.
+
+    Raises
+    ------
+    ValueError
+        If existing file size mismatches.
+    """
+    if mode == "r+":
+        nbytes = int(np.prod(shape)) * np.dtype(dtype).itemsize
+        if os.path.getsize(fname) != nbytes:
+            raise ValueError(f"{fname} mismatches buffer configuration")
+    elif mode != "w+":
+        raise ValueError(f"Unknown mmap_mode: {mode}")
+    return np.memmap(fname,shape=tuple(shape),dtype=dtype,mode=mode)
+
+
+class StorageCodec:
+    """Conversion between compute dtype and reduced precision storage dtype
+
+    Floating point storage (`numpy.half` or "bfloat16") is a cast, and
+    integer storage is affine quantization, `x = scale * q + offset`.
+    Stored values are expanded at native gather with the same rule.
+    """
+    _codes = {np.dtype(np.half): 1,
+              np.dtype(np.uint8): 3, np.dtype(np.int8): 4,
+              np.dtype(np.uint16): 5, np.dtype(np.int16): 6}
+
+    def __init__(self,dtype,storage_dtype,scale=1.0,offset=0.0):
+        self.dtype = np.dtype(dtype)
+        if self.dtype not in (np.dtype(np.single),np.dtype(np.double)):
+            raise ValueError("`dtype` with `storage_dtype` must be " +
+                             "numpy.single or numpy.double")
+
+        if isinstance(storage_dtype,str) and storage_dtype == "bfloat16":
+            self.storage = np.dtype(np.uint16)
+            self.code = 2
+        else:
+            self.storage = np.dtype(storage_dtype)
+            if self.storage not in self._codes:
+                raise ValueError(f"Unsupported `storage_dtype`: {storage_dtype}")
+            self.code = self._codes[self.storage]
+
+        self.scale = float(scale)
+        self.offset = float(offset)
+        if self.scale == 0.0:
+            raise ValueError("`scale` must not be 0")
+
+    def encode(self,v):
+        v = np.asarray(v,dtype=self.dtype)
+        if self.code == 1:
+            return v.astype(np.half)
+        if self.code == 2:
+            # Round to nearest even, and keep NaN as quiet NaN
+            u = v.astype(np.single).view(np.uint32)
+            r = (u + np.uint32(0x7FFF) + ((u >> np.uint32(16)) & np.uint32(1)))
+            r = (r >> np.uint32(16)).astype(np.uint16)
+            return np.where(np.isnan(v),np.uint16(0x7FC0),r)
+
+        info = np.iinfo(self.storage)
+        q = np.rint((v - self.offset) / self.scale)
+        return np.clip(q,info.min,info.max).astype(self.storage)
+
+    def decode(self,q):
+        q = np.asarray(q)
+        if self.code == 1:
+            return q.astype(self.dtype)
+        if self.code == 2:
+            return ((q.astype(np.uint32) << np.uint32(16))
+                    .view(np.single).astype(self.dtype))
+        return q.astype(self.dtype) * self.dtype.type(self.scale) + \
+            self.dtype.type(self.offset)
+
+    def spec(self):
+        return [self.code, self.scale, self.offset]
+
+
+class CacheJournal:
+    """Append only journal of episode end cache for warm restart
+
+    Each record is a key (uint64) followed by raw cached values, so that
+    later record overwrites former one with the same key. Records whose
+    key is not flagged as cached any more are dropped at loading.
+    """
+    def __init__(self,fname,layout,mode):
+        self.fname = fname
+        self.dtype = np.dtype([("key",np.uint64)] +
+                              [(k,dtype,shape) for k, shape, dtype in layout])
+        self.records = 0
+        if mode == "w+" or not os.path.exists(fname):
+            open(fname,"wb").close()
+        self.f = open(fname,"ab",buffering=0)
+
+    def load(self,cached):
+        n = os.path.getsize(self.fname) // self.dtype.itemsize
+        cache = {}
+        for r in np.fromfile(self.fname,dtype=self.dtype,count=n):
+            k = int(r["key"])
+            if cached[k]:
+                cache[k] = {name: np.array(r[name])
+                            for name in self.dtype.names[1:]}
+        self.compact(cache)
+        return cache
+
+    def append(self,key,values):
+        r = np.zeros(1,dtype=self.dtype)
+        r["key"] = key
+        for k, v in values.items():
+            r[k] = v
+        self.f.write(r.tobytes())
+        self.records += 1
+
+    def compact(self,cache):
+        self.f.close()
+        tmp = f"{self.fname}.tmp"
+        with open(tmp,"wb") as f:
+            for k, values in cache.items():
+                r = np.zeros(1,dtype=self.dtype)
+                r["key"] = k
+                for name, v in values.items():
+                    r[name] = v
+                f.write(r.tobytes())
+        os.replace(tmp,self.fname)
+        self.f = open(self.fname,"ab",buffering=0)
+        self.records = len(cache)
+
+    def clear(self):
+        self.compact({})
+
+
+cdef np.ndarray check_out(out,name,shape,dtype):
+    a = out[name]
+    if ((not isinstance(a,np.ndarray)) or
+        (a.shape != shape) or (a.dtype != dtype) or
+        (not a.flags.c_contiguous) or (not a.flags.writeable)):
+        raise ValueError(f"out['{name}'] must be writeable C-contiguous array " +
+                         f"with shape={shape} and dtype={np.dtype(dtype)}")
+    return a
 
 @cython.embedsignature(True)
 cdef class Environment:
@@ -121,7 +308,7 @@ cdef class Environment:
         pass
 
     cdef size_t _add(self,double [::1] o,double [::1] a,double [::1] r,
-                     double [::1] no,double [::1] d):
+                     double [::1] no,double [::1] d) except *:
         raise NotImplementedError
 
     def add(self,obs,act,rew,next_obs,done):
@@ -223,7 +410,8 @@ cdef class SelectiveEnvironment(Environment):
     Base class for episode level management envirionment
     """
     cdef CppSelectiveEnvironment[double,double,double,double] *buffer
-    def __cinit__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,**kwargs):
+    def __cinit__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,
+                  episode_blocks=False,**kwargs):
         self.buffer_size = episode_len * Nepisodes
 
         self.buffer = new CppSelectiveEnvironment[double,double,
@@ -231,7 +419,8 @@ cdef class SelectiveEnvironment(Environment):
                                                                  Nepisodes,
                                                                  self.obs_dim,
                                                                  self.act_dim,
-                                                                 self.rew_dim)
+                                                                 self.rew_dim,
+                                                                 episode_blocks)
 
         self.buffer.get_buffer_pointers(self.obs.ptr,
                                         self.act.ptr,
@@ -239,7 +428,8 @@ cdef class SelectiveEnvironment(Environment):
                                         self.next_obs.ptr,
                                         self.done.ptr)
 
-    def __init__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,**kwargs):
+    def __init__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,
+                 episode_blocks=False,**kwargs):
         """
         Parameters
         ----------
@@ -253,13 +443,24 @@ cdef class SelectiveEnvironment(Environment):
             the max size of stored episodes
         rew_dim : int, optional
             reward (rew) dimension
+        episode_blocks : bool, optional
+            If `True` (default is `False`), each episode is stored at its own
+            block of `episode_len` steps. Adding and deleting episodes never
+            move stored environments, and the oldest episode is overwritten
+            when all `Nepisodes` blocks are used. An episode longer than
+            `episode_len` is rejected by `add()`.
         """
         pass
 
     cdef size_t _add(self,double [::1] obs,double [::1] act, double [::1] rew,
-                     double [::1] next_obs, double [::1] done):
-        return self.buffer.store(&obs[0],&act[0],&rew[0],
-                                 &next_obs[0],&done[0],done.shape[0])
+                     double [::1] next_obs, double [::1] done) except *:
+        cdef size_t index = self.buffer.store(&obs[0],&act[0],&rew[0],
+                                              &next_obs[0],&done[0],
+                                              done.shape[0])
+        if index == <size_t>-1:
+            raise ValueError("Episode is longer than `episode_len`, " +
+                             "which cannot be stored into a block")
+        return index
 
     cpdef void clear(self) except *:
         """
@@ -320,6 +521,8 @@ cdef class SelectiveEnvironment(Environment):
         Delete specified episode
 
         The stored environment after specified episode are moved to backward.
+        With `episode_blocks=True`, nothing is moved and the block of the
+        episode is reused by the following episode.
 
         Parameters
         ----------
@@ -365,6 +568,14 @@ cdef class SelectiveEnvironment(Environment):
                 'next_obs': self.next_obs.as_numpy(),
                 'done': self.done.as_numpy()}
 
+    def _block_indexes(self,positions):
+        cdef const size_t [::1] p = Csize(positions)
+        idx = np.empty(p.shape[0],dtype=np.uint64)
+        cdef size_t [::1] _idx = idx
+        if p.shape[0] > 0 and not self.buffer.get_indexes(&p[0],p.shape[0],&_idx[0]):
+            raise IndexError("position is out of stored size")
+        return idx
+
     def _encode_sample(self,indexes):
         self.buffer.get_buffer_pointers(self.obs.ptr,
                                         self.act.ptr,
@@ -385,7 +596,8 @@ cdef class SelectiveReplayBuffer(SelectiveEnvironment):
     def __cinit__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,**kwargs):
         pass
 
-    def __init__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,**kwargs):
+    def __init__(self,episode_len,obs_dim=1,act_dim=1,*,Nepisodes=10,rew_dim=1,
+                 episode_blocks=False,**kwargs):
         """
         Parameters
         ----------
@@ -399,6 +611,9 @@ cdef class SelectiveReplayBuffer(SelectiveEnvironment):
             the max size of stored episodes whose default value is 10
         rew_dim : int, optional
             reward (rew) dimension whose dimension is 1
+        episode_blocks : bool, optional
+            Whether each episode is stored at fixed size block with FIFO
+            eviction of the oldest episode. (See `SelectiveEnvironment`)
         """
         pass
 
@@ -417,6 +632,8 @@ cdef class SelectiveReplayBuffer(SelectiveEnvironment):
             batch size of samples, which might contains the same event multiple times.
         """
         cdef idx = np.random.randint(0,self.get_stored_size(),batch_size)
+        if self.buffer.is_block():
+            idx = self._block_indexes(idx)
         return self._encode_sample(idx)
 
 
@@ -467,10 +684,109 @@ cdef class SharedBuffer:
         return (SharedBuffer,(self.view.shape,self.dtype,self.data))
 
 
+_huge_pages = {None: 0, "thp": 1, "2MB": 2, "1GB": 3}
+
+cdef MemoryPolicy to_memory_policy(policy) except *:
+    policy = policy or {}
+    unknown = set(policy) - {"huge_page","numa_node","interleave","prefault_threads"}
+    if unknown:
+        raise ValueError(f"Unknown memory policy: {unknown}")
+    if policy.get("huge_page") not in _huge_pages:
+        raise ValueError(f"`huge_page` must be one of {list(_huge_pages)}")
+
+    numa_node = policy.get("numa_node")
+    return make_memory_policy(_huge_pages[policy.get("huge_page")],
+                              -1 if numa_node is None else numa_node,
+                              policy.get("interleave",False),
+                              policy.get("prefault_threads",0))
+
+
+def set_memory_policy(policy=None):
+    """
+    Set memory policy of natively allocated buffers
+
+    The policy is used by buffers constructed after this call, which allocate
+    memory internally (e.g. `SelectiveReplayBuffer`).
+
+    Parameters
+    ----------
+    policy : dict, optional
+        Memory policy (See `PolicyMemory`). `None` (default) resets it.
+    """
+    set_default_memory_policy(to_memory_policy(policy))
+
+
+@cython.embedsignature(True)
+cdef class PolicyMemory:
+    """Zero filled memory allocated with memory policy
+
+    Memory policy is a dict with the following optional keys;
+
+    - "huge_page": None (default), "thp" (transparent huge page), "2MB" or
+      "1GB". Explicit huge pages fall back to "thp" if none is reserved.
+      Allocation smaller than the huge page uses normal pages.
+    - "numa_node": NUMA node to bind memory.
+    - "interleave": If `True`, memory is interleaved over NUMA nodes.
+    - "prefault_threads": The number of threads prefaulting pages at
+      allocation. Default is 0 (lazy).
+
+    Unsupported options on the platform are ignored.
+    """
+    cdef void* ptr
+    cdef size_t nbytes
+    cdef size_t mapped
+    cdef Py_ssize_t shape[1]
+    cdef Py_ssize_t strides[1]
+
+    def __cinit__(self,size_t nbytes,policy=None):
+        cdef MemoryPolicy p = to_memory_policy(policy)
+        self.nbytes = nbytes
+        self.ptr = allocate_memory(nbytes,p,self.mapped)
+        self.shape[0] = nbytes
+        self.strides[0] = 1
+
+    def __dealloc__(self):
+        deallocate_memory(self.ptr,self.mapped)
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        buffer.buf = self.ptr
+        buffer.format = 'B'
+        buffer.len = self.nbytes
+        buffer.readonly = 0
+        buffer.ndim = 1
+        buffer.shape = self.shape
+        buffer.strides = self.strides
+        buffer.suboffsets = NULL
+        buffer.itemsize = 1
+        buffer.internal = NULL
+        buffer.obj = self
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        pass
+
+    def as_array(self,shape,dtype):
+        """
+        View as numpy.ndarray
+
+        Parameters
+        ----------
+        shape : tuple of int
+            Array shape
+        dtype : numpy.dtype
+            Array dtype
+        """
+        return np.frombuffer(self,dtype=dtype,
+                             count=int(np.prod(shape))).reshape(shape)
+
+
 def dict2buffer(buffer_size: int,env_dict: Dict,*,
                 stack_compress = None, default_dtype = None,
                 mmap_prefix: Optional[str] = None,
-                shared: bool = False):
+                mmap_mode: str = "w+",
+                shared: bool = False,
+                codecs: Optional[Dict] = None,
+                memory_policy: Optional[Dict] = None,
+                device: Optional[int] = None):
     """Create buffer from env_dict
 
     Parameters
@@ -486,30 +802,61 @@ def dict2buffer(buffer_size: int,env_dict: Dict,*,
     mmap_prefix : str, optional
         File name prefix to save buffer data using mmap. If `None` (default),
         save only on memory.
+    mmap_mode : {"w+", "r+"}, optional
+        "w+" (default) creates new files. "r+" maps existing files, and keeps
+        their values.
+    codecs : dict of StorageCodec, optional
+        Fields allocated with reduced precision storage dtype.
+    memory_policy : dict, optional
+        Memory policy of arrays (See `PolicyMemory`). Ignored with
+        `mmap_prefix` or `shared`.
+    device : int, optional
+        CUDA device ID. If specified, arrays are allocated on the device
+        memory as `cupy.ndarray`, which supports `__cuda_array_interface__`
+        and DLPack.
 
     Returns
     -------
     buffer : dict of numpy.ndarray
         buffer for environment specified by env_dict.
+
+    Raises
+    ------
+    ValueError
+        If `device` is specified with `stack_compress`, `mmap_prefix`,
+        `shared`, `codecs` or `memory_policy`.
     """
     cdef buffer = {}
     cdef bool compress_any = stack_compress
     default_dtype = default_dtype or np.single
 
+    if (device is not None) and (compress_any or mmap_prefix or shared or
+                                 codecs or memory_policy):
+        raise ValueError("`device` cannot be used with `stack_compress`, " +
+                         "`mmap_prefix`, `shared`, `codecs` nor `memory_policy`")
+
     def zeros(name,shape,dtype):
+        if device is not None:
+            import cupy
+            with cupy.cuda.Device(device):
+                return cupy.zeros(tuple(int(s) for s in shape),dtype=dtype)
+
         if shared:
             return SharedBuffer(shape,dtype)
 
         if mmap_prefix:
-            if not isinstance(shape,tuple):
-                shape = tuple(shape)
-            return np.memmap(f"{mmap_prefix}_{name}.dat",
-                             shape=shape,dtype=dtype,mode="w+")
+            return open_memmap(f"{mmap_prefix}_{name}.dat",shape,dtype,mmap_mode)
+        elif memory_policy and not np.dtype(dtype).hasobject:
+            shape = tuple(int(s) for s in shape)
+            return PolicyMemory(int(np.prod(shape)) * np.dtype(dtype).itemsize,
+                                memory_policy).as_array(shape,dtype)
         else:
             return np.zeros(shape=shape,dtype=dtype)
 
     for name, defs in env_dict.items():
         shape = np.insert(np.asarray(defs.get("shape",1)),0,buffer_size)
+        dtype = (codecs[name].storage if (codecs and name in codecs)
+                 else defs.get("dtype",default_dtype))
 
         if compress_any and np.isin(name,
                                     stack_compress,
@@ -517,16 +864,16 @@ def dict2buffer(buffer_size: int,env_dict: Dict,*,
             buffer_shape = np.insert(np.delete(shape,-1),1,shape[-1])
             buffer_shape[0] += buffer_shape[1] - 1
             buffer_shape[1] = 1
-            memory = zeros(name, buffer_shape,
-                           dtype=defs.get("dtype",default_dtype))
+            memory = zeros(name, buffer_shape, dtype=dtype)
             strides = np.append(np.delete(memory.strides,1),memory.strides[1])
             buffer[name] = np.lib.stride_tricks.as_strided(memory,
                                                            shape=shape,
                                                            strides=strides)
         else:
-            buffer[name] = zeros(name,shape,dtype=defs.get("dtype",default_dtype))
+            buffer[name] = zeros(name,shape,dtype=dtype)
 
-        buffer[name][:] = 1
+        if not (mmap_prefix and mmap_mode == "r+"):
+            buffer[name][:] = 1
 
         shape[0] = -1
         defs["add_shape"] = shape
@@ -556,6 +903,7 @@ cdef class StepChecker:
     """
     cdef check_str
     cdef check_shape
+    cdef size_t check_elems
 
     def __init__(self,env_dict,special_keys = None):
         """Initialize StepChecker class.
@@ -571,6 +919,9 @@ cdef class StepChecker:
                 continue
             self.check_str = name
             self.check_shape = defs["add_shape"]
+            self.check_elems = 1
+            for d in self.check_shape[1:]:
+                self.check_elems *= d
 
     cdef size_t step_size(self,kwargs) except *:
         """Return step size.
@@ -580,7 +931,12 @@ cdef class StepChecker:
         kwargs: dict
             Added values.
         """
-        return np.reshape(kwargs[self.check_str],self.check_shape,order='A').shape[0]
+        # Same as `np.reshape(v, add_shape).shape[0]` without reshaping.
+        cdef size_t size = np.size(kwargs[self.check_str])
+        if (self.check_elems == 0) or (size % self.check_elems != 0):
+            raise ValueError(f"cannot reshape array of size {size} " +
+                             f"into shape {tuple(self.check_shape)}")
+        return size // self.check_elems
 
 @cython.embedsignature(True)
 cdef class NstepBuffer:
@@ -589,10 +945,8 @@ cdef class NstepBuffer:
     This buffer temporary stores environment values and returns Nstep-modified
     environment values for `ReplayBuffer`
     """
-    cdef buffer
-    cdef size_t buffer_size
+    cdef CppNstepBuffer[double] nstep
     cdef default_dtype
-    cdef size_t stored_size
     cdef size_t Nstep_size
     cdef float Nstep_gamma
     cdef Nstep_rew
@@ -600,11 +954,19 @@ cdef class NstepBuffer:
     cdef env_dict
     cdef stack_compress
     cdef StepChecker size_check
+    cdef fields
+    cdef rews
+    cdef nexts
+    cdef vector[void*] fields_in
+    cdef vector[double*] rews_in
+    cdef vector[void*] nexts_in
+    cdef vector[void*] fields_out
+    cdef vector[double*] rews_out
+    cdef vector[void*] nexts_out
 
     def __cinit__(self,env_dict=None,Nstep=None,*,
                   stack_compress = None,default_dtype = None,next_of = None):
         self.env_dict = env_dict.copy() if env_dict else {}
-        self.stored_size = 0
         self.stack_compress = None # stack_compress is not support yet.
         self.default_dtype = default_dtype or np.single
 
@@ -617,10 +979,35 @@ cdef class NstepBuffer:
         self.Nstep_rew = find_array(Nstep,"rew")
         self.Nstep_next = find_array(Nstep,"next")
 
-        self.buffer_size = self.Nstep_size - 1
-        self.buffer = dict2buffer(self.buffer_size,self.env_dict,
-                                  stack_compress = self.stack_compress,
-                                  default_dtype = self.default_dtype)
+        self.nstep.reset(self.Nstep_size,self.Nstep_gamma)
+        self.fields = []
+        self.rews = []
+        self.nexts = []
+        for name, defs in self.env_dict.items():
+            shape = np.insert(np.asarray(defs.get("shape",1)),0,-1)
+            defs["add_shape"] = shape
+            dim = int(np.prod(shape[1:]))
+
+            if name == "done":
+                if dim != 1:
+                    raise ValueError("`done` must be scalar per step")
+            elif self.Nstep_rew is not None and name in self.Nstep_rew:
+                self.nstep.add_reward(dim)
+                self.rews.append(name)
+            elif self.Nstep_next is not None and name in self.Nstep_next:
+                self.nstep.add_next(dim * self._dtype(name).itemsize)
+                self.nexts.append(name)
+            else:
+                self.nstep.add_field(dim * self._dtype(name).itemsize)
+                self.fields.append(name)
+
+        self.fields_in.resize(len(self.fields))
+        self.fields_out.resize(len(self.fields))
+        self.rews_in.resize(len(self.rews))
+        self.rews_out.resize(len(self.rews))
+        self.nexts_in.resize(len(self.nexts))
+        self.nexts_out.resize(len(self.nexts))
+
         self.size_check = StepChecker(self.env_dict)
 
     def __init__(self,env_dict=None,Nstep=None,*,
@@ -649,6 +1036,9 @@ cdef class NstepBuffer:
         -----
         Currently, memory compression features (`stack_compress` and `next_of`) are
         not supported yet. (Fall back to usual storing)
+
+        Nstep reward and "done" are accumulated in double precision by native
+        ring window, and are converted to the specified dtypes at output.
         """
         pass
 
@@ -667,155 +1057,90 @@ cdef class NstepBuffer:
             store enough cache items, returns 'None'.
         """
         cdef size_t N = self.size_check.step_size(kwargs)
-        cdef ssize_t end = self.stored_size + N
-
-        cdef ssize_t i
-        cdef ssize_t stored_begin
-        cdef ssize_t stored_end
-        cdef ssize_t ext_begin
-        cdef ssize_t max_slide
-
-        # Case 1
-        #   If Nstep buffer don't become full, store all the input transitions.
-        #   These transitions are partially calculated.
-        if end <= self.buffer_size:
-            for name, stored_b in self.buffer.items():
-                if self.Nstep_rew is not None and np.isin(name,self.Nstep_rew).any():
-                    # Calculate later.
-                    pass
-                elif (self.Nstep_next is not None
-                      and np.isin(name,self.Nstep_next).any()):
-                    # Do nothing.
-                    pass
-                else:
-                    stored_b[self.stored_size:end] = self._extract(kwargs,name)
-
-            # Nstep reward must be calculated after "done" filling
-            gamma = (1.0 - self.buffer["done"][:end]) * self.Nstep_gamma
-
-            if self.Nstep_rew is not None:
-                max_slide = min(self.Nstep_size - self.stored_size,N)
-                max_slide *= -1
-                for name in self.Nstep_rew:
-                    ext_b = self._extract(kwargs,name).copy()
-                    self.buffer[name][self.stored_size:end] = ext_b
-
-                    for i in range(self.stored_size-1,max_slide,-1):
-                        stored_begin = max(i,0)
-                        stored_end = i+N
-                        ext_begin = max(-i,0)
-                        ext_b[ext_begin:] *= gamma[stored_begin:stored_end]
-                        self.buffer[name][stored_begin:stored_end] +=ext_b[ext_begin:]
-
-            self.stored_size = end
+        cdef size_t M = self.nstep.output_size(N)
+        cdef size_t i
+        cdef np.ndarray a
+
+        # Keep references until native copy
+        inputs = []
+
+        cdef np.ndarray done = self._extract(kwargs,"done",np.double)
+        for i, name in enumerate(self.fields):
+            a = self._extract(kwargs,name)
+            inputs.append(a)
+            self.fields_in[i] = np.PyArray_DATA(a)
+        for i, name in enumerate(self.rews):
+            a = self._extract(kwargs,name,np.double)
+            inputs.append(a)
+            self.rews_in[i] = <double*> np.PyArray_DATA(a)
+        for i, name in enumerate(self.nexts):
+            a = self._extract(kwargs,name)
+            inputs.append(a)
+            self.nexts_in[i] = np.PyArray_DATA(a)
+
+        out = self._empty(M)
+        self.nstep.add(N,<const double*> np.PyArray_DATA(done),
+                       self.fields_in.data(),self.rews_in.data(),
+                       self.nexts_in.data(),
+                       <double*> np.PyArray_DATA(out["done"]),
+                       self.fields_out.data(),self.rews_out.data(),
+                       self.nexts_out.data())
+
+        if M == 0:
             return None
 
-        # Case 2
-        #   If we have enough transitions, return calculated transtions
-        cdef size_t diff_N = self.buffer_size - self.stored_size
-        cdef size_t add_N = N - diff_N
-        cdef bool NisBigger = (add_N > self.buffer_size)
-        end = self.buffer_size if NisBigger else add_N
-
-        # Nstep reward must be calculated before "done" filling
-        cdef ssize_t spilled_N
-        gamma = np.ones((self.stored_size + N,1),dtype=np.single)
-        gamma[:self.stored_size] -= self.buffer["done"][:self.stored_size]
-        gamma[self.stored_size:] -= self._extract(kwargs,"done")
-        gamma *= self.Nstep_gamma
-        if self.Nstep_rew is not None:
-            max_slide = min(self.Nstep_size - self.stored_size,N)
-            max_slide *= -1
-            for name in self.Nstep_rew:
-                stored_b = self.buffer[name]
-                ext_b = self._extract(kwargs,name)
-
-                copy_ext = ext_b.copy()
-                if diff_N:
-                    stored_b[self.stored_size:] = ext_b[:diff_N]
-                    ext_b = ext_b[diff_N:]
-
-                for i in range(self.stored_size-1,max_slide,-1):
-                    stored_begin = max(i,0)
-                    stored_end = i+N
-                    ext_begin = max(-i,0)
-                    copy_ext[ext_begin:] *= gamma[stored_begin:stored_end]
-                    if stored_end <= self.buffer_size:
-                        stored_b[stored_begin:stored_end] += copy_ext[ext_begin:]
-                    else:
-                        spilled_N = stored_end - self.buffer_size
-                        stored_b[stored_begin:] += copy_ext[ext_begin:-spilled_N]
-                        ext_b[:spilled_N] += copy_ext[-spilled_N:]
-
-                self._roll(stored_b,ext_b,end,NisBigger,kwargs,name,add_N)
-
-        for name, stored_b in self.buffer.items():
-            if self.Nstep_rew is not None and np.isin(name,self.Nstep_rew).any():
-                # Calculated.
-                pass
-            elif (self.Nstep_next is not None
-                  and np.isin(name,self.Nstep_next).any()):
-                kwargs[name] = self._extract(kwargs,name)[diff_N:]
-            else:
-                ext_b = self._extract(kwargs,name)
-
-                if diff_N:
-                    stored_b[self.stored_size:] = ext_b[:diff_N]
-                    ext_b = ext_b[diff_N:]
-
-                self._roll(stored_b,ext_b,end,NisBigger,kwargs,name,add_N)
-
-        done = kwargs["done"]
+        return self._output(out)
 
-        for i in range(1,self.buffer_size):
-            if i <= add_N:
-                done[:-i] += kwargs["done"][i:]
-                done[-i:] += self.buffer["done"][:i]
-            else:
-                done += self.buffer["done"][i-add_N:i]
+    cdef np.ndarray _extract(self,kwargs,name,dtype=None):
+        _dict = self.env_dict[name]
+        return np.ascontiguousarray(
+            np.reshape(np.array(kwargs[name],copy=False,ndmin=2,
+                                dtype=dtype or self._dtype(name)),
+                       _dict["add_shape"]))
 
-        self.stored_size = self.buffer_size
-        return kwargs
+    cdef _dtype(self,name):
+        return np.dtype(self.env_dict[name].get("dtype",self.default_dtype))
 
-    cdef _extract(self,kwargs,name):
-        _dict = self.env_dict[name]
-        return np.reshape(np.array(kwargs[name],copy=False,ndmin=2,
-                                   dtype=_dict.get("dtype",self.default_dtype)),
-                          _dict["add_shape"])
-
-    cdef void _roll(self,stored_b,ext_b,
-                    ssize_t end,bool NisBigger,kwargs,name,size_t add_N):
-        # Swap numpy.ndarray
-        # https://stackoverflow.com/a/33362030
-        stored_b[:end], ext_b[-end:] = ext_b[-end:], stored_b[:end].copy()
-        if NisBigger:
-            # buffer: XXXX, add: YYYYY
-            # buffer: YYYY, add: YXXXX
-            ext_b = np.roll(ext_b,end,axis=0)
-            # buffer: YYYY, add: XXXXY
-        else:
-            # buffer: XXXZZZZ, add: YYY
-            # buffer: YYYZZZZ, add: XXX
-            stored_b[:] = np.roll(stored_b,-end,axis=0)[:]
-            # buffer: ZZZZYYY, add: XXX
-        kwargs[name] = ext_b[:add_N]
+    cdef _empty(self,size_t M):
+        # Allocate output arrays and set their pointers
+        cdef size_t i
+        cdef np.ndarray a
+
+        out = {"done": np.empty((M,1),dtype=np.double)}
+        for i, name in enumerate(self.fields):
+            a = np.empty((M,*self.env_dict[name]["add_shape"][1:]),
+                         dtype=self._dtype(name))
+            out[name] = a
+            self.fields_out[i] = np.PyArray_DATA(a)
+        for i, name in enumerate(self.rews):
+            a = np.empty((M,*self.env_dict[name]["add_shape"][1:]),dtype=np.double)
+            out[name] = a
+            self.rews_out[i] = <double*> np.PyArray_DATA(a)
+        for i, name in enumerate(self.nexts):
+            a = np.empty((M,*self.env_dict[name]["add_shape"][1:]),
+                         dtype=self._dtype(name))
+            out[name] = a
+            self.nexts_out[i] = np.PyArray_DATA(a)
+        return out
+
+    cdef _output(self,out):
+        for name in ("done",*self.rews):
+            out[name] = out[name].astype(self._dtype(name),copy=False)
+        return out
 
     cpdef void clear(self):
         """Clear the bufer.
         """
-        self.stored_size = 0
+        self.nstep.clear()
 
     cpdef on_episode_end(self):
         """Terminate episode.
         """
-        kwargs = {k: v[:self.stored_size].copy() for k, v in self.buffer.items()}
-        done = kwargs["done"]
-
-        for i in range(1,self.stored_size):
-            done[:-i] += kwargs["done"][i:]
-
-        self.clear()
-        return kwargs
+        out = self._empty(self.nstep.get_stored_size())
+        self.nstep.on_episode_end(<double*> np.PyArray_DATA(out["done"]),
+                                  self.fields_out.data(),self.rews_out.data(),
+                                  self.nexts_out.data())
+        return self._output(out)
 
     cpdef size_t get_Nstep_size(self):
         """Get Nstep size
@@ -835,10 +1160,23 @@ cdef class RingBufferIndex:
     cdef buffer_size
     cdef is_full
 
-    def __init__(self,buffer_size):
-        self.index = RawValue(ctypes.c_size_t,0)
+    def __init__(self,buffer_size,state=None):
+        """
+        Parameters
+        ----------
+        buffer_size : int
+            Buffer size
+        state : numpy.ndarray, optional
+            Writable uint64 array (e.g. `numpy.memmap`), whose first 2
+            elements keep the next index and the full flag.
+        """
+        if state is None:
+            self.index = RawValue(ctypes.c_size_t,0)
+            self.is_full = RawValue(ctypes.c_int,0)
+        else:
+            self.index = ctypes.c_size_t.from_buffer(state,0)
+            self.is_full = ctypes.c_uint64.from_buffer(state,8)
         self.buffer_size = RawValue(ctypes.c_size_t,buffer_size)
-        self.is_full = RawValue(ctypes.c_int,0)
 
     cdef size_t get_next_index(self):
         return self.index.value
@@ -878,31 +1216,49 @@ cdef class RingBufferIndex:
         else:
             return self.index.value
 
+    cdef void restore(self,size_t next_index,bool is_full):
+        self.index.value = next_index % self.buffer_size.value
+        self.is_full.value = is_full
+
 
 cdef class ProcessSafeRingBufferIndex(RingBufferIndex):
     """Process Safe Ring Buffer Index class
+
+    Index is derived from a single monotonic 64bit counter at shared memory,
+    so that `fetch_add` is an atomic operation without any locks.
     """
-    cdef lock
+    cdef counter
+    cdef CppThreadSafeRingBufferIndex* ptr
+
+    def __init__(self,buffer_size,counter=None):
+        self.buffer_size = buffer_size
+        self.counter = counter or RawArray(ctypes.c_uint64,1)
+        cdef uint64_t [:] view_counter = self.counter
 
-    def __init__(self,buffer_size):
-        super().__init__(buffer_size)
-        self.lock = Lock()
+        self.ptr = new CppThreadSafeRingBufferIndex(buffer_size,
+                                                    &view_counter[0],
+                                                    counter is None)
+
+    def __dealloc__(self):
+        del self.ptr
+
+    def __reduce__(self):
+        return (ProcessSafeRingBufferIndex, (self.buffer_size, self.counter))
 
     cdef size_t get_next_index(self):
-        with self.lock:
-            return RingBufferIndex.get_next_index(self)
+        return self.ptr.get_next_index()
 
     cdef size_t fetch_add(self,size_t N):
-        with self.lock:
-            return RingBufferIndex.fetch_add(self,N)
+        return self.ptr.fetch_add(N)
 
     cdef void clear(self):
-        with self.lock:
-            RingBufferIndex.clear(self)
+        self.ptr.clear()
 
     cdef size_t get_stored_size(self):
-        with self.lock:
-            return RingBufferIndex.get_stored_size(self)
+        return self.ptr.get_stored_size()
+
+    cdef uint64_t get_count(self):
+        return self.ptr.get_count()
 
 
 @cython.embedsignature(True)
@@ -940,17 +1296,62 @@ cdef class ReplayBuffer:
     cdef NstepBuffer nstep
     cdef bool use_nstep
     cdef size_t cache_size
+    cdef cached
+    cdef CppSampleGather gather
+    cdef sample_layout
+    cdef bool native_gather
+    cdef CppBatchStore batch_store
+    cdef add_layout
+    cdef bool native_add
+    cdef vector[CppFrameStore] frame_store
+    cdef frame_names
+    cdef vector[CppCompressedStore] compressed_store
+    cdef compressed_names
+    cdef episode_id
+    cdef uint64_t episode_count
+    cdef mmap_mode
+    cdef state
+    cdef journal
+    cdef codecs
+    cdef memory_policy
+    cdef metrics
+    cdef size_t row_bytes
+    cdef uint64_t seed
+    cdef uint64_t sample_count
 
     def __cinit__(self,size,env_dict=None,*,
                   next_of=None,stack_compress=None,default_dtype=None,Nstep=None,
-                  mmap_prefix =None,
+                  mmap_prefix =None,mmap_mode="w+",memory_policy=None,
+                  stats=False,seed=None,num_threads=1,frame_store=True,
                   **kwargs):
         self.env_dict = env_dict.copy() if env_dict else {}
         cdef special_keys = []
 
         self.buffer_size = size
-        self.index = RingBufferIndex(self.buffer_size)
-        self.episode_len = 0
+        self.mmap_mode = mmap_mode
+        self.memory_policy = memory_policy
+
+        # State on mmap: [next_index, is_full, episode_len, episode_count,
+        #                 buffer_size, reserved...]
+        self.state = None
+        if mmap_prefix:
+            self.state = open_memmap(f"{mmap_prefix}_state.dat",(8,),np.uint64,
+                                     mmap_mode)
+            if mmap_mode == "w+":
+                self.state[4] = self.buffer_size
+            elif self.state[4] != self.buffer_size:
+                raise ValueError(f"Stored data and Buffer mismatch for buffer_size")
+
+        self.index = RingBufferIndex(self.buffer_size,self.state)
+        self.episode_len = self.state[2] if mmap_prefix else 0
+
+        # Episode of each index for sequence sampling
+        if mmap_prefix:
+            self.episode_id = open_memmap(f"{mmap_prefix}_episode_id.dat",
+                                          (self.buffer_size,),np.uint64,mmap_mode)
+        else:
+            self.episode_id = np.zeros(self.buffer_size,dtype=np.uint64)
+        self.episode_count = self.state[3] if mmap_prefix else 0
 
         self.compress_any = stack_compress
         self.stack_compress = np.array(stack_compress,ndmin=1,copy=False)
@@ -974,11 +1375,22 @@ cdef class ReplayBuffer:
             self.next_of = None
             self.has_next_of = False
 
+        self._init_codecs()
+        self._init_compressed_store(mmap_prefix,num_threads)
+        self._init_frame_store(mmap_prefix,frame_store)
+
         # side effect: Add "add_shape" key into self.env_dict
-        self.buffer = dict2buffer(self.buffer_size,self.env_dict,
+        framed = [name for name, _ in self.frame_names]
+        framed.extend(self.compressed_names)
+        self.buffer = dict2buffer(self.buffer_size,
+                                  {k: v for k, v in self.env_dict.items()
+                                   if k not in framed},
                                   stack_compress = self.stack_compress,
                                   default_dtype = self.default_dtype,
-                                  mmap_prefix = mmap_prefix)
+                                  mmap_prefix = mmap_prefix,
+                                  mmap_mode = mmap_mode,
+                                  codecs = self.codecs,
+                                  memory_policy = memory_policy)
 
         self.size_check = StepChecker(self.env_dict,special_keys)
 
@@ -996,11 +1408,299 @@ cdef class ReplayBuffer:
         if self.has_next_of:
             self.cache_size += 1
             for name in self.next_of:
-                self.next_[name] = self.buffer[name][0].copy()
+                if mmap_prefix:
+                    b = self.buffer[name]
+                    self.next_[name] = open_memmap(f"{mmap_prefix}_next_{name}.dat",
+                                                   b.shape[1:],b.dtype,mmap_mode)
+                    if mmap_mode == "w+":
+                        self.next_[name][...] = b[0]
+                else:
+                    self.next_[name] = self.buffer[name][0].copy()
+
+        # Flags of cached indexes, which are scanned at native sampling
+        self.cached = None
+        self.journal = None
+        if self.cache is not None:
+            if mmap_prefix:
+                self.cached = open_memmap(f"{mmap_prefix}_cached.dat",
+                                          (self.buffer_size,),np.uint8,mmap_mode)
+                layout = []
+                if self.has_next_of:
+                    layout.extend((f"next_{name}",self.buffer[name].shape[1:],
+                                   self.buffer[name].dtype)
+                                  for name in self.next_of)
+                if self.compress_any:
+                    layout.extend((name,self.buffer[name].shape[1:],
+                                   self.buffer[name].dtype)
+                                  for name in self.stack_compress)
+                self.journal = CacheJournal(f"{mmap_prefix}_cache.dat",layout,
+                                            mmap_mode)
+                if mmap_mode == "r+":
+                    self.cache = self.journal.load(self.cached)
+            else:
+                self.cached = np.zeros(self.buffer_size,dtype=np.uint8)
+        self._init_gather()
+        self._init_batch_store()
+
+        self.seed = random_seed() if seed is None else seed
+        self.sample_count = 0
+
+        self.metrics = Metrics() if stats else None
+        # Input bytes of a transition (including "next_***")
+        next_names = [name for name, has_next in self.frame_names if has_next]
+        if self.has_next_of:
+            next_names.extend(self.next_of)
+        self.row_bytes = 0
+        for name, v in self.env_dict.items():
+            self.row_bytes += ((2 if name in next_names else 1) *
+                               np.dtype(v.get("dtype",self.default_dtype)).itemsize *
+                               int(np.prod(v.get("shape",1))))
+
+    cdef void _init_codecs(self) except *:
+        r"""Set up reduced precision storage specified by "storage_dtype"
+        """
+        self.codecs = {}
+        for name, defs in self.env_dict.items():
+            if defs.get("storage_dtype") is None:
+                continue
+
+            if ((self.compress_any and name in self.stack_compress) or
+                (self.has_next_of and name in self.next_of)):
+                raise ValueError(f"\"{name}\" with `storage_dtype` cannot be " +
+                                 "`stack_compress` nor `next_of`")
+
+            self.codecs[name] = StorageCodec(defs.get("dtype",self.default_dtype),
+                                             defs["storage_dtype"],
+                                             defs.get("scale",1.0),
+                                             defs.get("offset",0.0))
+
+    cdef void _init_compressed_store(self,mmap_prefix,num_threads) except *:
+        r"""Move "compress" values to native compressed stores
+
+        Each row is stored as a compressed blob, and is decompressed at
+        native gather over `num_threads` threads.
+        """
+        self.compressed_names = []
+        for name, defs in self.env_dict.items():
+            method = defs.get("compress")
+            if not method:
+                continue
+
+            if not ((method is True) or (method == "rle")):
+                raise ValueError(f"Unsupported `compress` for \"{name}\": {method}")
+            if mmap_prefix:
+                raise ValueError("`compress` cannot be used with `mmap_prefix`")
+            if ((self.compress_any and name in self.stack_compress) or
+                (self.has_next_of and name in self.next_of) or
+                (name in self.codecs)):
+                raise ValueError(f"\"{name}\" with `compress` cannot be " +
+                                 "`stack_compress`, `next_of` nor have " +
+                                 "`storage_dtype`")
+
+            dtype = np.dtype(defs.get("dtype",self.default_dtype))
+            if dtype.hasobject:
+                raise ValueError(f"\"{name}\" with `compress` cannot have " +
+                                 "object dtype")
+
+            shape = np.insert(np.asarray(defs.get("shape",1)),0,-1)
+            defs["add_shape"] = shape
+            self.compressed_store.push_back(
+                CppCompressedStore(self.buffer_size,
+                                   int(np.prod(shape[1:])) * dtype.itemsize,
+                                   dtype.itemsize))
+            self.compressed_store.back().set_num_threads(num_threads)
+            self.compressed_names.append(name)
+
+    cdef void _init_frame_store(self,mmap_prefix,frame_store) except *:
+        r"""Move "stack_compress" and "next_of" values to native frame stores
+
+        Values are stored as ids of deduplicated frames, so that neither
+        strided buffer nor cache for episode ends is necessary. Buffers on
+        mmap, ones with Python objects and ones with `frame_store=False`
+        keep the strided buffer and cache.
+        """
+        self.frame_names = []
+        if ((not (self.compress_any or self.has_next_of)) or mmap_prefix or
+            (not frame_store)):
+            return
+
+        for defs in self.env_dict.values():
+            if np.dtype(defs.get("dtype",self.default_dtype)).hasobject:
+                return
+
+        framed = list(self.stack_compress) if self.compress_any else []
+        if self.has_next_of:
+            framed.extend(name for name in self.next_of if name not in framed)
+
+        cdef size_t stack
+        cdef bool has_next
+        cdef MemoryPolicy policy = default_memory_policy()
+        if self.memory_policy:
+            policy = to_memory_policy(self.memory_policy)
+        for name in framed:
+            defs = self.env_dict[name]
+            shape = np.insert(np.asarray(defs.get("shape",1)),0,-1)
+            defs["add_shape"] = shape
+
+            stack = shape[-1] if (self.compress_any and
+                                  name in self.stack_compress) else 1
+            has_next = self.has_next_of and (name in self.next_of)
+            self.frame_store.push_back(
+                CppFrameStore(self.buffer_size,
+                              int(np.prod(shape[1:])) // stack,
+                              np.dtype(defs.get("dtype",self.default_dtype)).itemsize,
+                              stack,has_next,policy))
+            self.frame_names.append((name,has_next))
+
+        self.compress_any = False
+        self.stack_compress = None
+        self.has_next_of = False
+        self.next_of = None
+        self.cache = None
+
+    cdef void _init_batch_store(self) except *:
+        r"""Register buffer layouts to native batch store
+
+        Added values are copied into buffers with GIL released. If any buffer
+        is not C-contiguous array of native numeric type, `add()` falls back
+        to numpy fancy indexing.
+        """
+        cdef np.ndarray b
+
+        self.batch_store.reset(self.buffer_size)
+        self.add_layout = []
+        self.native_add = False
+
+        arrays = [self.episode_id, *self.buffer.values()]
+        for b in arrays:
+            if ((batch_dtype(b.dtype) < 0) or (not b.flags.c_contiguous) or
+                (not b.flags.writeable)):
+                return
+
+        # Episode id is broadcasted from `self.episode_count`.
+        b = self.episode_id
+        self.batch_store.add_field(np.PyArray_DATA(b),1,batch_dtype(b.dtype))
+
+        for name, b in self.buffer.items():
+            row_elems = int(np.prod(b.shape[1:],dtype=np.int64))
+            self.batch_store.add_field(np.PyArray_DATA(b),row_elems,
+                                       batch_dtype(b.dtype))
+            self.add_layout.append((name,row_elems,b.dtype,
+                                    self.env_dict[name]["add_shape"]))
+        self.native_add = True
+
+    cdef void _add_native(self,kwargs,size_t N,size_t index) except *:
+        cdef vector[const void*] srcs
+        cdef vector[int] dtypes
+        cdef vector[uint8_t] broadcast
+        cdef np.ndarray a
+        cdef int code
+        cdef size_t row_elems
+        cdef bool ok
+        inputs = []
+
+        srcs.push_back(<const void*>&self.episode_count)
+        dtypes.push_back(batch_dtype(self.episode_id.dtype))
+        broadcast.push_back(1)
+
+        # Shapes and dtypes are checked once for each value.
+        for name, row_elems, dtype, add_shape in self.add_layout:
+            a = np.asarray(kwargs[name])
+            if name in self.codecs:
+                a = self.codecs[name].encode(np.reshape(a,add_shape))
+
+            code = batch_dtype(a.dtype)
+            if (code < 0) or not CppBatchStore.can_convert(code,batch_dtype(dtype)):
+                a = a.astype(dtype)
+                code = batch_dtype(a.dtype)
+            if not a.flags.c_contiguous:
+                a = np.ascontiguousarray(a)
+
+            if <size_t>a.size == N * row_elems:
+                broadcast.push_back(0)
+            elif <size_t>a.size == row_elems:
+                broadcast.push_back(1)
+            else:
+                raise ValueError(f"cannot reshape array of size {a.size} " +
+                                 f"into shape {tuple(add_shape)} for \"{name}\"")
+            inputs.append(a)
+            srcs.push_back(np.PyArray_DATA(a))
+            dtypes.push_back(code)
+
+        with nogil:
+            ok = self.batch_store.store(srcs.data(),dtypes.data(),broadcast.data(),
+                                        N,index)
+        if not ok:
+            raise ValueError("Unsupported dtype conversion at `add()`")
+
+    cdef void _init_gather(self) except *:
+        r"""Register buffer layouts to native gather engine
+
+        Sampled fields are gathered with GIL released. If any `dtype` holds
+        Python objects, sampling falls back to numpy fancy indexing.
+        """
+        cdef np.ndarray b
+        cdef np.ndarray latest
+        cdef size_t k
+
+        self.gather.reset(self.buffer_size)
+        self.sample_layout = []
+
+        self.native_gather = True
+        for b in self.buffer.values():
+            if b.dtype.hasobject:
+                if self.compressed_names:
+                    raise ValueError("`compress` cannot be used with object dtype")
+                self.native_gather = False
+                return
+
+        for name, b in self.buffer.items():
+            k = self.gather.add_field[np.npy_intp](np.PyArray_DATA(b),
+                                                   np.PyArray_ITEMSIZE(b),
+                                                   np.PyArray_NDIM(b),
+                                                   np.PyArray_DIMS(b),
+                                                   np.PyArray_STRIDES(b),
+                                                   0, NULL)
+            if name in self.codecs:
+                c = self.codecs[name]
+                if not self.gather.set_storage(k,c.code,c.dtype.itemsize,
+                                               c.scale,c.offset):
+                    raise ValueError(f"Unsupported `storage_dtype` for \"{name}\"")
+                self.sample_layout.append((name, b.shape[1:], c.dtype))
+            else:
+                self.sample_layout.append((name, b.shape[1:], b.dtype))
+
+        if self.has_next_of:
+            for name in self.next_of:
+                b = self.buffer[name]
+                latest = self.next_[name]
+                self.gather.add_field[np.npy_intp](np.PyArray_DATA(b),
+                                                   np.PyArray_ITEMSIZE(b),
+                                                   np.PyArray_NDIM(b),
+                                                   np.PyArray_DIMS(b),
+                                                   np.PyArray_STRIDES(b),
+                                                   1, np.PyArray_DATA(latest))
+                self.sample_layout.append((f"next_{name}", b.shape[1:], b.dtype))
+
+        # Frame store outputs follow the gather outputs.
+        for name, has_next in self.frame_names:
+            defs = self.env_dict[name]
+            shape = tuple(defs["add_shape"][1:])
+            dtype = np.dtype(defs.get("dtype",self.default_dtype))
+            self.sample_layout.append((name, shape, dtype))
+            if has_next:
+                self.sample_layout.append((f"next_{name}", shape, dtype))
+
+        # Compressed store outputs follow the frame store outputs.
+        for name in self.compressed_names:
+            defs = self.env_dict[name]
+            self.sample_layout.append((name, tuple(defs["add_shape"][1:]),
+                                       np.dtype(defs.get("dtype",self.default_dtype))))
 
     def __init__(self,size,env_dict=None,*,
                  next_of=None,stack_compress=None,default_dtype=None,Nstep=None,
-                 mmap_prefix =None,
+                 mmap_prefix =None,mmap_mode="w+",memory_policy=None,
+                 stats=False,seed=None,num_threads=1,frame_store=True,
                  **kwargs):
         r"""Initialize ReplayBuffer
 
@@ -1028,6 +1728,60 @@ cdef class ReplayBuffer:
         mmap_prefix : str, optional
             File name prefix to save buffer data using mmap. If `None` (default),
             save only on memory.
+        mmap_mode : {"w+", "r+"}, optional
+            "w+" (default) creates new mmap files. "r+" opens existing files
+            created with the same `mmap_prefix` and configuration, and resumes
+            the buffer from them.
+        memory_policy : dict, optional
+            Huge page and NUMA placement of buffer memory (and priorities of
+            `PrioritizedReplayBuffer`), e.g. `{"huge_page": "2MB",
+            "interleave": True, "prefault_threads": 8}`. (See `PolicyMemory`)
+            Ignored with `mmap_prefix`.
+        stats : bool, optional
+            If `True`, record call counts, latency histograms and copied bytes
+            of hot paths, which are read by `get_stats()`. Default is `False`.
+        seed : int, optional
+            Seed of sampling. The same seed reproduces the same indexes for
+            the same sequence of calls. If `None` (default), the seed is
+            taken from `os.urandom`.
+        num_threads : int, optional
+            The number of threads compressing and decompressing "compress"
+            values. Default is `1`.
+        frame_store : bool, optional
+            If `True` (default), `next_of` and `stack_compress` values are
+            stored in native frame store. If `False`, they are stored in
+            strided buffer with cache for episode ends (the previous
+            behavior).
+
+        Notes
+        -----
+        Values of `next_of` and `stack_compress` are stored as deduplicated
+        frames (the last axis of `stack_compress` values is stacked frames),
+        and are rebuilt at sampling. Frames are allocated by fixed size
+        segment with `memory_policy`, and segments without live frames are
+        reused. Unless `mmap_prefix` is specified,
+        `save_transitions(safe=False)` saves them with safe mode.
+
+        A value of `env_dict` can specify reduced precision storage with
+        "storage_dtype" (`numpy.half`, "bfloat16", or integer types for
+        affine quantization with "scale" (default 1) and "offset" (default 0),
+        `x = scale * q + offset`). Values are converted at `add()`, and
+        are expanded into "dtype" (`numpy.single` or `numpy.double`) at
+        sampling. Neither `stack_compress` nor `next_of` values can have it.
+
+        A value of `env_dict` with `"compress": "rle"` (or `True`) is stored
+        compressed; each transition is byte shuffled and run length coded
+        into size class slabs at `add()`, and is decompressed at sampling.
+        It suits highly compressible values like sparse grids and images
+        with large static regions. (Incompressible transitions are kept as
+        they are.) `get_stats()` reports its raw, compressed and allocated
+        bytes. Neither `stack_compress`, `next_of`, "storage_dtype",
+        `mmap_prefix` nor format version 2 checkpoint can be used with it.
+
+        With `mmap_prefix`, the ring buffer index, episode state, `next_of`
+        values, episode end cache and priorities of `PrioritizedReplayBuffer`
+        are also kept at files, which are updated at every call. Pending
+        Nstep transitions are not kept.
         """
         pass
 
@@ -1058,6 +1812,7 @@ cdef class ReplayBuffer:
         All values must be passed by key-value style (keyword arguments).
         It is user responsibility that all the values have the same step-size.
         """
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
         if self.use_nstep:
             kwargs = self.nstep.add(**kwargs)
             if kwargs is None:
@@ -1068,16 +1823,24 @@ cdef class ReplayBuffer:
         cdef size_t index = self.index.fetch_add(N)
         cdef size_t end = index + N
         cdef size_t remain = 0
-        cdef add_idx = np.arange(index,end)
+        cdef add_idx = None
         cdef size_t key_min = 0
 
         if end > self.buffer_size:
             remain = end - self.buffer_size
-            add_idx[add_idx >= self.buffer_size] -= self.buffer_size
+
+        if (not self.native_add) or (self.cache is not None):
+            add_idx = np.arange(index,end)
+            if remain:
+                add_idx[add_idx >= self.buffer_size] -= self.buffer_size
+
+        if not self.native_add:
+            self.episode_id[add_idx] = self.episode_count
 
         if self.cache is not None:
-            for _i in add_idx:
+            for _i in add_idx[self.cached[add_idx] != 0]:
                 self.cache.pop(_i, None)
+            self.cached[add_idx] = 0
 
         if self.compress_any and (remain or
                                   self.get_stored_size() == self.buffer_size):
@@ -1086,9 +1849,15 @@ cdef class ReplayBuffer:
                              min(key_min + self.cache_size, self.buffer_size)):
                 self.add_cache_i(key, index)
 
-        for name, b in self.buffer.items():
-            b[add_idx] = np.reshape(np.array(kwargs[name],copy=False,ndmin=2),
+        if self.native_add:
+            self._add_native(kwargs,N,index)
+        else:
+            for name, b in self.buffer.items():
+                stored = np.reshape(np.array(kwargs[name],copy=False,ndmin=2),
                                     self.env_dict[name]["add_shape"])
+                if name in self.codecs:
+                    stored = self.codecs[name].encode(stored)
+                b[add_idx] = stored
 
         if self.has_next_of:
             for name in self.next_of:
@@ -1097,9 +1866,47 @@ cdef class ReplayBuffer:
                                                           ndmin=2),
                                                  self.env_dict[name]["add_shape"])[-1]
 
+        cdef size_t f
+        cdef np.ndarray value
+        cdef np.ndarray next_value
+        for f in range(self.frame_store.size()):
+            name, has_next = self.frame_names[f]
+            value = self._frame_input(kwargs,name,name)
+            if has_next:
+                next_value = self._frame_input(kwargs,f"next_{name}",name)
+                self.frame_store[f].store(index,N,np.PyArray_DATA(value),
+                                          np.PyArray_DATA(next_value))
+            else:
+                self.frame_store[f].store(index,N,np.PyArray_DATA(value),NULL)
+
+        for f in range(self.compressed_store.size()):
+            name = self.compressed_names[f]
+            value = self._frame_input(kwargs,name,name)
+            self.compressed_store[f].store(index,N,np.PyArray_DATA(value))
+
         self.episode_len += N
+        self._sync_state()
+        if self.metrics is not None:
+            self.metrics.observe("add",t0,N,N * self.row_bytes)
         return index
 
+    cdef void _compact_journal(self) except *:
+        if ((self.journal is not None) and
+            (self.journal.records > 2 * len(self.cache) + 1024)):
+            self.journal.compact(self.cache)
+
+    cdef void _sync_state(self) except *:
+        if self.state is not None:
+            self.state[2] = self.episode_len
+            self.state[3] = self.episode_count
+
+    cdef np.ndarray _frame_input(self,kwargs,key,name):
+        _dict = self.env_dict[name]
+        return np.ascontiguousarray(
+            np.reshape(np.array(kwargs[key],copy=False,ndmin=2,
+                                dtype=_dict.get("dtype",self.default_dtype)),
+                       _dict["add_shape"]))
+
     def get_all_transitions(self,shuffle: bool=False):
         r"""
         Get all transitions stored in replay buffer.
@@ -1121,7 +1928,8 @@ cdef class ReplayBuffer:
 
         return self._encode_sample(idx)
 
-    def save_transitions(self, file, *, safe=True):
+    def save_transitions(self, file, *, safe=True, version=1,
+                         compression=None, num_threads=None):
         r"""
         Save transitions to file
 
@@ -1132,7 +1940,30 @@ cdef class ReplayBuffer:
         safe : bool, optional
             If `False`, we try more aggressive compression
             which might encounter future incompatibility
+        version : {1, 2}, optional
+            File format version. Version 1 (default) is compressed by
+            `numpy.savez_compressed`. Version 2 is chunked raw binary
+            (See `cpprb.checkpoint`), which stores internal state as it is,
+            so that it can be loaded only by the same configured buffer.
+            `safe` is ignored.
+        compression : {None, "lz4", "zstd"}, optional
+            Per chunk compression for version 2. `lz4` or `zstandard`
+            package is required.
+        num_threads : int, optional
+            The number of threads writing (compressing) chunks for version 2.
+
+        Raises
+        ------
+        ValueError : When version 2 is not supported for this buffer.
         """
+        if version == 2:
+            meta, arrays = self._checkpoint_state()
+            checkpoint.write(file, meta, arrays, compression=compression,
+                             num_threads=num_threads)
+            return None
+        elif version != 1:
+            raise ValueError(f"Unknown Format Version: {version}")
+
         FORMAT_VERSION = 1
         if (safe or not (self.compress_any or self.has_next_of)):
             data = {"safe": True,
@@ -1144,10 +1975,8 @@ cdef class ReplayBuffer:
         else:
             self.add_cache()
             N = self.get_stored_size()
-            if N == self.get_buffer_size():
-                b = self.buffer
-            else:
-                b = {k: v[:N] for k, v in self.buffer.items()}
+            b = {k: (self.codecs[k].decode(v[:N]) if k in self.codecs else v[:N])
+                 for k, v in self.buffer.items()}
 
             data = {"safe": False,
                     "version": FORMAT_VERSION,
@@ -1157,6 +1986,116 @@ cdef class ReplayBuffer:
                     "next_of": self.next_of}
         np.savez_compressed(file, **data)
 
+    def _checkpoint_state(self):
+        if self.cache is not None:
+            raise ValueError("Format version 2 does not support `stack_compress` " +
+                             "nor `next_of` with `mmap_prefix` or object dtype")
+        if self.compressed_names:
+            raise ValueError("Format version 2 does not support `compress`")
+
+        cdef size_t N = self.get_stored_size()
+        meta = {"buffer_size": self.buffer_size,
+                "stored_size": N,
+                "next_index": self.get_next_index(),
+                "episode_len": self.episode_len,
+                "episode_count": self.episode_count,
+                "Nstep": bool(self.is_Nstep()),
+                "frames": [name for name, _ in self.frame_names],
+                "storage": {k: c.spec() for k, c in self.codecs.items()}}
+        arrays = {f"buffer/{k}": v[:N] for k, v in self.buffer.items()}
+        arrays["episode_id"] = self.episode_id[:N]
+
+        cdef size_t f
+        for f in range(self.frame_store.size()):
+            name = self.frame_names[f][0]
+            arrays[f"frames/{name}/state"] = self._frame_state(f)
+            arrays[f"frames/{name}/ids"] = self._frame_ids(f)
+            arrays[f"frames/{name}/frames"] = self._frame_frames(f)
+
+        return meta, arrays
+
+    cdef _frame_state(self,size_t f):
+        cdef np.ndarray state = np.empty(self.frame_store[f].get_state_size(),
+                                         dtype=np.uint64)
+        self.frame_store[f].get_state(<uint64_t*>np.PyArray_DATA(state))
+        return state
+
+    cdef _frame_ids(self,size_t f):
+        if self.frame_store[f].ids_size() == 0:
+            return np.zeros(0,dtype=np.uint64)
+        return np.asarray(<uint64_t[:self.frame_store[f].ids_size()]>
+                          self.frame_store[f].ids_data())
+
+    cdef _frame_frames(self,size_t f):
+        cdef np.ndarray frames = np.empty(self.frame_store[f].frames_size(),
+                                          dtype=np.uint8)
+        if frames.shape[0] > 0:
+            self.frame_store[f].copy_frames(<uint8_t*>np.PyArray_DATA(frames))
+        return frames
+
+    def _restore_state(self, reader):
+        meta = reader.meta
+        if self.cache is not None:
+            raise ValueError("Format version 2 does not support `stack_compress` " +
+                             "nor `next_of` with `mmap_prefix` or object dtype")
+        if self.compressed_names:
+            raise ValueError("Format version 2 does not support `compress`")
+        if meta["buffer_size"] != self.buffer_size:
+            raise ValueError(f"Stored data and Buffer mismatch for buffer_size")
+        if meta["Nstep"] != bool(self.is_Nstep()):
+            raise ValueError(f"Stored data and Buffer mismatch for Nstep")
+        if ({k for k in reader.fields if k.startswith("buffer/")} !=
+            {f"buffer/{k}" for k in self.buffer}):
+            raise ValueError(f"Stored data and Buffer mismatch for fields")
+        if meta["frames"] != [name for name, _ in self.frame_names]:
+            raise ValueError(f"Stored data and Buffer mismatch for " +
+                             "stack_compress / next_of")
+        if meta.get("storage",{}) != {k: c.spec() for k, c in self.codecs.items()}:
+            raise ValueError(f"Stored data and Buffer mismatch for storage_dtype")
+
+        cdef size_t N = meta["stored_size"]
+        for k, v in self.buffer.items():
+            if ((reader.dtype(f"buffer/{k}") != v.dtype) or
+                (reader.shape(f"buffer/{k}") != (N, *v.shape[1:]))):
+                raise ValueError(f"Stored data and Buffer mismatch for {k}")
+
+        cdef size_t f
+        cdef np.ndarray state
+        cdef np.ndarray frames
+        states = []
+        for f in range(self.frame_store.size()):
+            name = self.frame_names[f][0]
+            state = reader.read(f"frames/{name}/state")
+            if ((state.shape[0] != self.frame_store[f].get_state_size()) or
+                (reader.shape(f"frames/{name}/ids") !=
+                 (self.frame_store[f].ids_size(),)) or
+                (state[0] > state[1]) or
+                (reader.shape(f"frames/{name}/frames") !=
+                 ((state[1] - state[0]) *
+                  self.frame_store[f].get_frame_bytes(),))):
+                raise ValueError(f"Stored data and Buffer mismatch for {name}")
+            states.append(state)
+
+        self.clear()
+
+        for k, v in self.buffer.items():
+            reader.read_into(f"buffer/{k}", v[:N])
+        reader.read_into("episode_id", self.episode_id[:N])
+
+        for f in range(self.frame_store.size()):
+            name = self.frame_names[f][0]
+            state = states[f]
+            self.frame_store[f].set_state(<const uint64_t*>np.PyArray_DATA(state))
+            reader.read_into(f"frames/{name}/ids", self._frame_ids(f))
+            frames = reader.read(f"frames/{name}/frames")
+            if frames.shape[0] > 0:
+                self.frame_store[f].restore_frames(<const uint8_t*>np.PyArray_DATA(frames))
+
+        self.index.restore(meta["next_index"], N == self.buffer_size)
+        self.episode_len = meta["episode_len"]
+        self.episode_count = meta["episode_count"]
+        self._sync_state()
+
     def _load_transitions_v1(self, data):
         d = unwrap(data["data"])
         N = data["Nstep"]
@@ -1222,12 +2161,23 @@ cdef class ReplayBuffer:
         ------
         ValueError : When file format is wrong.
 
+        Notes
+        -----
+        Format version is detected automatically. Version 2 file is read
+        straight into internal arrays without `add()` nor `pickle`, however,
+        it must be saved by the same configured buffer.
+
         Warnings
         --------
         In order to avoid security vulnerability,
         you MUST NOT load untrusted file, since this method is
         based on `pickle` through `joblib.load`.
         """
+        if checkpoint.is_checkpoint(file):
+            with checkpoint.Reader(file) as reader:
+                self._restore_state(reader)
+            return None
+
         with np.load(file, allow_pickle=True) as data:
             version = data["version"]
             N = data["Nstep"]
@@ -1240,7 +2190,132 @@ cdef class ReplayBuffer:
             else:
                 raise ValueError(f"Unknown Format Version: {version}")
 
-    def _encode_sample(self,idx):
+    def _encode_sample(self,idx,out=None,fields=None):
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
+        cdef const size_t [::1] _idx
+        cdef size_t N
+        if not self.native_gather:
+            sample = self._encode_sample_numpy(idx,out,fields)
+        else:
+            _idx = Csize(idx)
+            N = _idx.shape[0]
+            sample = self._gather(&_idx[0] if N > 0 else NULL, N, out, fields)
+
+        if self.metrics is not None:
+            self.metrics.observe("encode_sample",t0,len(idx),
+                                 sum(v.nbytes for v in sample.values()))
+        return sample
+
+    def gather_transitions(self,indexes,*,fields=None,out=None):
+        r"""Gather stored transitions at indexes
+
+        Parameters
+        ----------
+        indexes : array_like of int
+            Buffer indexes (e.g. 'indexes' of prioritized sample)
+        fields : iterable of str, optional
+            Names of gathered values. Other values are never copied.
+            If `None` (default), all values are gathered.
+        out : dict of numpy.ndarray, optional
+            Preallocated output arrays. (See `sample()`)
+
+        Returns
+        -------
+        sample : dict of ndarray
+            Transitions at `indexes`
+
+        Raises
+        ------
+        KeyError
+            If `fields` has unknown name.
+        """
+        return self._encode_sample(np.array(indexes,copy=False,ndmin=1),
+                                   out,self._check_fields(fields))
+
+    def _check_fields(self,fields):
+        if fields is None:
+            return None
+        fields = set([fields] if isinstance(fields,str) else fields)
+        if self.native_gather:
+            names = set(name for name, _, _ in self.sample_layout)
+        else:
+            names = set(self.buffer.keys())
+            if self.has_next_of:
+                names.update(f"next_{name}" for name in self.next_of)
+        unknown = fields - names
+        if unknown:
+            raise KeyError(f"Unknown fields: {sorted(unknown)}")
+        return fields
+
+    cdef _gather(self,const size_t* idx,size_t N,out,fields=None):
+        cdef size_t next_index = self.get_next_index()
+        cdef const uint8_t [::1] cached
+        cdef const uint8_t* cached_ptr = NULL
+        cdef vector[void*] outputs
+        cdef vector[size_t] hits
+        cdef np.ndarray a
+        cdef sample = {} if out is None else out
+        cdef bool ok
+
+        outputs.reserve(self.gather.get_field_size())
+        for name, shape, dtype in self.sample_layout:
+            if (fields is not None) and (name not in fields):
+                outputs.push_back(NULL)
+                continue
+
+            if out is None:
+                a = np.empty((N,*shape),dtype=dtype)
+                sample[name] = a
+            else:
+                a = check_out(out,name,(N,*shape),dtype)
+            outputs.push_back(np.PyArray_DATA(a))
+
+        if self.cached is not None:
+            cached = self.cached
+            cached_ptr = &cached[0]
+
+        # "next_of" for the latest index is substituted in native code, too.
+        cdef size_t j = self.gather.get_field_size()
+        cdef size_t f
+        with nogil:
+            ok = self.gather.gather(idx,N,next_index,outputs.data(),
+                                    cached_ptr,hits)
+            if ok:
+                for f in range(self.frame_store.size()):
+                    if self.frame_store[f].has_next():
+                        self.frame_store[f].gather(idx,N,outputs[j],outputs[j+1])
+                        j += 2
+                    else:
+                        self.frame_store[f].gather(idx,N,outputs[j],NULL)
+                        j += 1
+                for f in range(self.compressed_store.size()):
+                    self.compressed_store[f].gather(idx,N,outputs[j])
+                    j += 1
+        if not ok:
+            raise IndexError(f"index is out of bounds for buffer size {self.buffer_size}")
+
+        if (self.metrics is not None) and (self.cached is not None):
+            self.metrics.count("cache_lookups",N)
+            self.metrics.count("cache_hits",hits.size())
+
+        # Cache for episode ends stored at `self.cache`
+        cdef size_t h, i
+        cdef cache_i
+        for h in hits:
+            i = idx[h]
+            cache_i = self.cache[i]
+            if self.has_next_of:
+                for name in self.next_of:
+                    if f"next_{name}" in sample:
+                        sample[f"next_{name}"][h] = cache_i[f"next_{name}"]
+            if self.compress_any:
+                for name in self.stack_compress:
+                    if name in sample:
+                        sample[name][h] = cache_i[name]
+
+        return sample
+
+    def _encode_sample_numpy(self,idx,out=None,fields=None):
         cdef sample = {}
         cdef next_idx
         cdef cache_idx
@@ -1248,7 +2323,8 @@ cdef class ReplayBuffer:
 
         idx = np.array(idx,copy=False,ndmin=1)
         for name, b in self.buffer.items():
-            sample[name] = b[idx]
+            sample[name] = (self.codecs[name].decode(b[idx])
+                            if name in self.codecs else b[idx])
 
         if self.has_next_of:
             next_idx = idx + 1
@@ -1264,65 +2340,250 @@ cdef class ReplayBuffer:
 
         cdef size_t i,_i
         cdef size_t N = idx.shape[0]
+        cdef size_t n_hits = 0
         if self.cache is not None:
             # Cache for episode ends stored at `self.cache`
             for _i in range(N):
                 i = idx[_i]
                 if i in self.cache:
+                    n_hits += 1
                     if self.has_next_of:
                         for name in self.next_of:
                             sample[f"next_{name}"][_i] = self.cache[i][f"next_{name}"]
                     if self.compress_any:
                         for name in self.stack_compress:
                             sample[name][_i] = self.cache[i][name]
+            if self.metrics is not None:
+                self.metrics.count("cache_lookups",N)
+                self.metrics.count("cache_hits",n_hits)
 
-        return sample
+        if fields is not None:
+            sample = {k: v for k, v in sample.items() if k in fields}
 
-    def sample(self,batch_size):
+        if out is None:
+            return sample
+
+        for name, v in sample.items():
+            check_out(out,name,v.shape,v.dtype)[...] = v
+        return out
+
+    def empty_sample(self,batch_size):
+        r"""Allocate output arrays for `sample(batch_size, out=...)`
+
+        Parameters
+        ----------
+        batch_size : int
+            batch size of output arrays
+
+        Returns
+        -------
+        out : dict of numpy.ndarray
+            Uninitialized C-contiguous arrays with the same keys, shapes
+            and dtypes as the sampled transitions.
+
+        Notes
+        -----
+        Any dict of arrays with the same layout can be used as `out`,
+        e.g. ones allocated at page-locked (pinned) memory.
+        """
+        if not self.native_gather:
+            return {k: np.empty_like(v)
+                    for k, v in self._encode_sample_numpy(np.zeros(batch_size,
+                                                                   dtype=np.uint64)).items()}
+        return {name: np.empty((batch_size,*shape),dtype=dtype)
+                for name, shape, dtype in self.sample_layout}
+
+    def sample(self,batch_size,*,out=None):
         r"""Sample the stored transitions randomly with speciped size
 
         Parameters
         ----------
         batch_size : int
             sampled batch size
+        out : dict of numpy.ndarray, optional
+            Preallocated output arrays (e.g. allocated by `empty_sample()`).
+            If specified, sampled transitions are written into them in place
+            and `out` itself is returned.
 
         Returns
         -------
         sample : dict of ndarray
             Batch size of sampled transitions, which might contains
             the same transition multiple times.
+
+        Raises
+        ------
+        KeyError
+            If `out` misses any key.
+        ValueError
+            If any array of `out` is not writeable C-contiguous array
+            with the sampled shape and dtype.
+
+        Notes
+        -----
+        The arrays of `out` are overwritten at every call with the same `out`.
+        It is user responsibility not to reuse them until the previous
+        contents are consumed (e.g. until the host to device copy finishes).
         """
-        cdef idx = np.random.randint(0,self.get_stored_size(),batch_size)
-        return self._encode_sample(idx)
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
+        cdef idx = self._uniform_indexes(batch_size)
+        samples = self._encode_sample(idx,out)
+        if self.metrics is not None:
+            self.metrics.observe("sample",t0,batch_size)
+        return samples
 
-    cpdef void clear(self) except *:
-        r"""Clear replay buffer.
+    cdef np.ndarray _uniform_indexes(self,size_t batch_size):
+        cdef np.ndarray idx = uniform_index_array(self.seed,self.sample_count,
+                                                  batch_size,
+                                                  self.get_stored_size())
+        self.sample_count += 1
+        return idx
 
-        Set `index` and `stored_size` to 0.
+    def set_seed(self,seed=None):
+        r"""Reset random number generator of sampling
 
-        Example
-        -------
-        >>> rb = ReplayBuffer(5,{"done",{}})
-        >>> rb.add(1)
-        >>> rb.get_stored_size()
-        1
-        >>> rb.get_next_index()
-        1
-        >>> rb.clear()
-        >>> rb.get_stored_size()
-        0
-        >>> rb.get_next_index()
-        0
+        Parameters
+        ----------
+        seed : int, optional
+            New seed. If `None` (default), the seed is taken from `os.urandom`.
+
+        Notes
+        -----
+        Sampled indexes depend only on the seed, the number of previous
+        sampling calls after it and the stored size.
         """
-        self.index.clear()
-        self.episode_len = 0
+        self.seed = random_seed() if seed is None else seed
+        self.sample_count = 0
 
-        self.cache = {} if (self.has_next_of or self.compress_any) else None
+    def split(self,k):
+        r"""Switch sampling to the `k`-th child stream of the current seed
 
-        if self.use_nstep:
-            self.nstep.clear()
+        Parameters
+        ----------
+        k : int
+            Child stream ID (e.g. worker ID)
 
-    cpdef size_t get_stored_size(self):
+        Returns
+        -------
+        seed : int
+            Seed of the child stream
+
+        Notes
+        -----
+        Child streams of different `k` are independent, and the same `k`
+        reproduces the same stream, so that copies of a seeded buffer
+        (e.g. ones passed to worker processes) can sample independently.
+        """
+        self.set_seed(split_seed(self.seed,k))
+        return self.seed
+
+    def sample_sequences(self,batch_size,seq_len,burn_in=0):
+        r"""Sample fixed length sequences of transitions for recurrent models
+
+        Parameters
+        ----------
+        batch_size : int
+            the number of sampled sequences
+        seq_len : int
+            sequence length including burn-in steps
+        burn_in : int, optional
+            the number of steps before the sampled index. Default is `0`.
+
+        Returns
+        -------
+        sample : dict of ndarray
+            Sequences of transitions with shape of `(batch_size, seq_len, ...)`,
+            which also includes 'mask' with shape of `(batch_size, seq_len)`.
+
+        Raises
+        ------
+        ValueError
+            If `seq_len` is not positive, or `burn_in` is not in
+            `[0, seq_len)`.
+
+        Notes
+        -----
+        The `burn_in`-th step of each sequence is the sampled index. Steps
+        which are out of the episode of the sampled index (or not stored yet)
+        are masked with `False`, and are filled with the nearest valid step.
+        Episodes are separated by `on_episode_end()`.
+        """
+        self._check_sequences(seq_len,burn_in)
+        cdef idx = self._uniform_indexes(batch_size)
+        return self._encode_sequences(idx,seq_len,burn_in)
+
+    def _check_sequences(self,seq_len,burn_in):
+        if seq_len <= 0:
+            raise ValueError("`seq_len` must be positive")
+        if not (0 <= burn_in < seq_len):
+            raise ValueError("`burn_in` must be in [0, `seq_len`)")
+
+    def _encode_sequences(self,starts,seq_len,burn_in):
+        self._check_sequences(seq_len,burn_in)
+
+        cdef const size_t [::1] _starts = Csize(starts)
+        cdef size_t B = _starts.shape[0]
+        cdef size_t T = seq_len
+        cdef const uint64_t [::1] episodes = self.episode_id
+        cdef size_t stored_size = self.get_stored_size()
+        cdef size_t next_index = self.get_next_index()
+
+        idx = np.empty(B*T,dtype=np.uint64)
+        mask = np.empty((B,T),dtype=np.bool_)
+        cdef size_t [::1] _idx = idx
+        cdef uint8_t [:,::1] _mask = mask.view(np.uint8)
+
+        if B > 0:
+            with nogil:
+                sequence_indexes(&_starts[0],B,T,<size_t>burn_in,
+                                 self.buffer_size,stored_size,next_index,
+                                 &episodes[0],&_idx[0],&_mask[0,0])
+
+        sample = {k: v.reshape(B,T,*v.shape[1:])
+                  for k, v in self._encode_sample(idx).items()}
+        sample["mask"] = mask
+        return sample
+
+    cpdef void clear(self) except *:
+        r"""Clear replay buffer.
+
+        Set `index` and `stored_size` to 0.
+
+        Example
+        -------
+        >>> rb = ReplayBuffer(5,{"done",{}})
+        >>> rb.add(1)
+        >>> rb.get_stored_size()
+        1
+        >>> rb.get_next_index()
+        1
+        >>> rb.clear()
+        >>> rb.get_stored_size()
+        0
+        >>> rb.get_next_index()
+        0
+        """
+        self.index.clear()
+        self.episode_len = 0
+
+        self.cache = {} if (self.has_next_of or self.compress_any) else None
+        if self.cached is not None:
+            self.cached[:] = 0
+        if self.journal is not None:
+            self.journal.clear()
+
+        cdef size_t f
+        for f in range(self.frame_store.size()):
+            self.frame_store[f].clear()
+        for f in range(self.compressed_store.size()):
+            self.compressed_store[f].clear()
+        self.episode_count += 1
+        self._sync_state()
+
+        if self.use_nstep:
+            self.nstep.clear()
+
+    cpdef size_t get_stored_size(self):
         r"""Get stored size
 
         Returns
@@ -1404,6 +2665,9 @@ cdef class ReplayBuffer:
                 cache_key[name] = self.buffer[name][key].copy()
 
         self.cache[key] = cache_key
+        self.cached[key] = 1
+        if self.journal is not None:
+            self.journal.append(key,cache_key)
 
     cpdef void on_episode_end(self) except *:
         r"""Call on episode end
@@ -1425,7 +2689,14 @@ cdef class ReplayBuffer:
 
         self.add_cache()
 
+        cdef size_t f
+        for f in range(self.frame_store.size()):
+            self.frame_store[f].on_episode_end()
+
+        self.episode_count += 1
         self.episode_len = 0
+        self._compact_journal()
+        self._sync_state()
 
     cpdef size_t get_current_episode_len(self):
         r"""Get current episode length
@@ -1445,6 +2716,45 @@ cdef class ReplayBuffer:
         """
         return self.use_nstep
 
+    def get_stats(self):
+        r"""Get recorded stats
+
+        Returns
+        -------
+        stats : dict
+            `{"gauges": {name: value}, "counters": {name: int},
+            "latency": {name: dict}}`. A "latency" value has call "count",
+            "sum", "max", approximate "p50" and "p99" (in seconds) and
+            "buckets". Without `stats=True`, only "gauges" are filled.
+
+        See Also
+        --------
+        cpprb.metrics.to_prometheus : Format stats for Prometheus
+        """
+        stats = (self.metrics.to_dict() if self.metrics is not None
+                 else {"counters": {}, "latency": {}})
+        stats["gauges"] = {"stored_size": self.get_stored_size(),
+                           "buffer_size": self.get_buffer_size(),
+                           "episode_count": self.episode_count}
+
+        cdef size_t f
+        for f in range(self.compressed_store.size()):
+            name = self.compressed_names[f]
+            stats["gauges"][f"{name}_raw_bytes"] = \
+                self.compressed_store[f].get_stored_size() * \
+                self.compressed_store[f].get_row_bytes()
+            stats["gauges"][f"{name}_compressed_bytes"] = \
+                self.compressed_store[f].get_compressed_bytes()
+            stats["gauges"][f"{name}_allocated_bytes"] = \
+                self.compressed_store[f].get_allocated_bytes()
+        return stats
+
+    def reset_stats(self):
+        r"""Reset recorded counters and latency histograms
+        """
+        if self.metrics is not None:
+            self.metrics.reset()
+
 @cython.embedsignature(True)
 cdef class PrioritizedReplayBuffer(ReplayBuffer):
     r"""Prioritized replay buffer class to store transitions with priorities.
@@ -1460,12 +2770,47 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
     cdef bool [:] unchange_since_sample
     cdef vector[size_t] idx_vec
     cdef vector[float] ps_vec
+    cdef per_memory
 
     def __cinit__(self,size,env_dict=None,*,alpha=0.6,Nstep=None,eps=1e-4,
-                  check_for_update=False,**kwrags):
+                  check_for_update=False,seed=None,num_threads=1,**kwrags):
         self.alpha = alpha
-        self.per = new CppPrioritizedSampler[float](size,alpha)
-        self.per.set_eps(eps)
+
+        cdef size_t pow2size = 1
+        while pow2size < size:
+            pow2size *= 2
+
+        # Max priority followed by fused (sum, min) pairs of segment tree
+        cdef size_t per_size = 1 + 2*(2*pow2size-1)
+        cdef float [:] view_per
+        self.per_memory = None
+        if kwrags.get("mmap_prefix"):
+            self.per_memory = open_memmap(f"{kwrags['mmap_prefix']}_per.dat",
+                                          (per_size,),np.single,
+                                          self.mmap_mode)
+        elif self.memory_policy:
+            self.per_memory = PolicyMemory(per_size * sizeof(float),
+                                           self.memory_policy).as_array((per_size,),
+                                                                        np.single)
+
+        if self.per_memory is not None:
+            view_per = self.per_memory
+            self.per = new CppPrioritizedSampler[float](size,alpha,
+                                                        &view_per[0],
+                                                        &view_per[1],
+                                                        NULL,NULL,
+                                                        not (kwrags.get("mmap_prefix") and
+                                                             self.mmap_mode == "r+"),
+                                                        eps)
+        else:
+            self.per = new CppPrioritizedSampler[float](size,alpha)
+            self.per.set_eps(eps)
+
+        # `seed` is also taken (or generated) by `ReplayBuffer`.
+        self.per.set_seed(self.seed)
+        self.per.set_num_threads(num_threads)
+        if self.metrics is not None:
+            self.per.enable_stats(True)
         self.weights = VectorFloat()
         self.indexes = VectorSize_t()
 
@@ -1485,7 +2830,7 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         self.ps_vec = vector[float]()
 
     def __init__(self,size,env_dict=None,*,alpha=0.6,Nstep=None,eps=1e-4,
-                 check_for_update=False,**kwargs):
+                 check_for_update=False,seed=None,num_threads=1,**kwargs):
         r"""Initialize PrioritizedReplayBuffer
 
         Parameters
@@ -1507,6 +2852,14 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
             this buffer traces updated indices after the last calling of
             `sample()` method to avoid mis-updating priorities of already
             overwritten values. This feature is designed for multiprocess learning.
+        seed : int, optional
+            Seed of sampling. The same seed reproduces the same indexes for
+            the same sequence of calls, regardless of `num_threads`. If `None`
+            (default), the seed is taken from `os.urandom`.
+        num_threads : int, optional
+            The number of threads for sampling and weight calculation of
+            `sample()` (and for "compress" values). Default value is `1`.
+            Large batches (>= 1024) only are split over threads.
 
         See Also
         --------
@@ -1518,6 +2871,10 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         The minimum and summation over certain ranges of pre-calculated priorities
         :math:`(p_{i} + \epsilon )^{ \alpha }` are stored with segment tree, which
         enable fast sampling.
+
+        Sampling is stratified; the i-th index is drawn from the i-th of
+        `batch_size` equal mass regions by a counter based random number
+        (hash of seed, call count and i). Sampling releases GIL.
         """
         pass
 
@@ -1575,6 +2932,7 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
 
         cdef size_t index = maybe_index
         cdef const float [:] ps
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
 
         if priorities is not None:
             ps = np.ravel(np.array(priorities,copy=False,ndmin=1,dtype=np.single))
@@ -1582,6 +2940,9 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         else:
             self.per.set_priorities(index,N,self.get_buffer_size())
 
+        if self.metrics is not None:
+            self.metrics.observe("set_priorities",t0,N)
+
         if self.check_for_update:
             if index+N <= self.buffer_size:
                 self.unchange_since_sample[index:index+N] = False
@@ -1591,7 +2952,26 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
 
         return index
 
-    def sample(self,batch_size,beta = 0.4):
+    def empty_sample(self,batch_size):
+        r"""Allocate output arrays for `sample(batch_size, out=...)`
+
+        Parameters
+        ----------
+        batch_size : int
+            batch size of output arrays
+
+        Returns
+        -------
+        out : dict of numpy.ndarray
+            Uninitialized C-contiguous arrays with the same keys, shapes
+            and dtypes as the sampled transitions, 'weights' and 'indexes'.
+        """
+        out = super().empty_sample(batch_size)
+        out['weights'] = np.empty(batch_size,dtype=np.single)
+        out['indexes'] = np.empty(batch_size,dtype=np.uint64)
+        return out
+
+    def sample(self,batch_size,beta = 0.4,*,out=None,fields=None):
         r"""Sample the stored transitions.
 
         Transitions are sampled depending on correspoinding priorities
@@ -1604,6 +2984,15 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         beta : float, optional
             The exponent of weight for relaxation of importance
             sampling effect, whose default value is 0.4
+        out : dict of numpy.ndarray, optional
+            Preallocated output arrays (e.g. allocated by `empty_sample()`)
+            including 'weights' (`numpy.single`) and 'indexes' (`numpy.uint64`).
+            If specified, samples are written into them in place and `out`
+            itself is returned.
+        fields : iterable of str, optional
+            Names of gathered values. Other values are never copied, e.g.
+            to compute surrogate priorities from large batch. (See `LaBER`)
+            If `None` (default), all values are gathered.
 
         Returns
         -------
@@ -1616,12 +3005,88 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         usual importance sampling.
         The 'weights' are also normalized by the weight for minimum priority
         (:math:`= w_{i}/\max_{j}(w_{j})`), which ensure the weights :math:`\leq` 1.
+
+        Without `out`, 'weights' and 'indexes' are views of internal vectors,
+        which are overwritten at the next `sample()` call. With `out`, the
+        arrays of `out` are overwritten at every call with the same `out`.
+        """
+        fields = self._check_fields(fields)
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
+        cdef size_t _batch_size = batch_size
+        cdef float _beta = beta
+        cdef size_t stored_size = self.get_stored_size()
+        with nogil:
+            self.per.sample(_batch_size,_beta,
+                            self.weights.vec,self.indexes.vec,stored_size)
+        cdef size_t N = self.indexes.vec.size()
+        cdef np.ndarray w
+        cdef np.ndarray i
+        cdef int64_t t1 = 0
+        if self.metrics is not None:
+            self.metrics.observe("sample_priorities",t0,N)
+            t1 = _now()
+
+        if self.native_gather:
+            samples = self._gather(self.indexes.vec.data(),N,out,fields)
+            if self.metrics is not None:
+                self.metrics.observe("encode_sample",t1,N,
+                                     sum(v.nbytes for v in samples.values()))
+        else:
+            samples = self._encode_sample(self.indexes.as_numpy(),out,fields)
+
+        if out is None:
+            samples['weights'] = self.weights.as_numpy()
+            samples['indexes'] = self.indexes.as_numpy()
+        else:
+            w = check_out(out,'weights',(N,),np.single)
+            i = check_out(out,'indexes',(N,),np.uint64)
+            memcpy(np.PyArray_DATA(w),self.weights.vec.data(),N*sizeof(float))
+            memcpy(np.PyArray_DATA(i),self.indexes.vec.data(),N*sizeof(size_t))
+
+        if self.check_for_update:
+            self.unchange_since_sample[:] = True
+
+        if self.metrics is not None:
+            self.metrics.observe("sample",t0,N)
+        return samples
+
+    def sample_sequences(self,batch_size,seq_len,burn_in=0,beta=0.4):
+        r"""Sample fixed length sequences depending on priorities
+
+        Parameters
+        ----------
+        batch_size : int
+            the number of sampled sequences
+        seq_len : int
+            sequence length including burn-in steps
+        burn_in : int, optional
+            the number of steps before the sampled index. Default is `0`.
+        beta : float, optional
+            The exponent of weight for relaxation of importance
+            sampling effect, whose default value is 0.4
+
+        Returns
+        -------
+        sample : dict of ndarray
+            Sequences of transitions with shape of `(batch_size, seq_len, ...)`,
+            which also includes 'mask', 'weights' and 'indexes'.
+
+        See Also
+        --------
+        ReplayBuffer.sample_sequences : Sequence layout and 'mask'
+        update_sequence_priorities : Update priorities of sampled sequences
+
+        Notes
+        -----
+        The priority of the sampled index (the `burn_in`-th step) is the
+        priority of the sequence.
         """
+        self._check_sequences(seq_len,burn_in)
         self.per.sample(batch_size,beta,
                         self.weights.vec,self.indexes.vec,
                         self.get_stored_size())
         cdef idx = self.indexes.as_numpy()
-        samples = self._encode_sample(idx)
+        samples = self._encode_sequences(idx,seq_len,burn_in)
         samples['weights'] = self.weights.as_numpy()
         samples['indexes'] = idx
 
@@ -1630,6 +3095,89 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
 
         return samples
 
+    def update_sequence_priorities(self,indexes,priorities,*,eta=0.9,mask=None):
+        r"""Update priorities of sequences by their step priorities
+
+        Parameters
+        ----------
+        indexes : array_like
+            sampled indexes of sequences with shape of `(batch_size,)`
+        priorities : array_like
+            step priorities (e.g. absolute TD errors) of sequences with
+            shape of `(batch_size, L)`
+        eta : float, optional
+            mixture of max and mean. The priority of a sequence becomes
+            :math:`\eta \max_{i} p_{i} + (1-\eta) \bar{p}`. Default is `0.9`.
+        mask : array_like of bool, optional
+            valid steps with shape of `(batch_size, L)`. Priorities at invalid
+            steps are ignored. Sequences without any valid steps are skipped.
+
+        Raises
+        ------
+        TypeError: When `indexes` or `priorities` are `None`
+        ValueError: When shapes are incompatible
+        """
+        if priorities is None:
+            raise TypeError("`properties` must not be `None`")
+
+        cdef const size_t [::1] idx = Csize(indexes)
+        cdef size_t N = idx.shape[0]
+        ps = np.array(priorities,copy=False,dtype=np.single,ndmin=2,order='C')
+        if ps.shape[0] != N:
+            raise ValueError("`priorities` shape is incompatible")
+        ps = ps.reshape(N,-1)
+
+        m = None
+        if mask is not None:
+            m = np.array(mask,copy=False,dtype=np.bool_,order='C')
+            if m.size != ps.size:
+                raise ValueError("`mask` shape is incompatible")
+            m = m.reshape(ps.shape).view(np.uint8)
+
+        keep = np.asarray(idx) < self.get_stored_size()
+        if self.check_for_update:
+            keep &= np.asarray(self.unchange_since_sample)[np.asarray(idx)
+                                                           % self.buffer_size]
+        if not keep.all():
+            idx = Csize(np.asarray(idx)[keep])
+            N = idx.shape[0]
+            ps = ps[keep]
+            if m is not None:
+                m = m[keep]
+
+        if N == 0:
+            return None
+
+        cdef const float [:,::1] _ps = np.ascontiguousarray(ps)
+        cdef const uint8_t [:,::1] _m
+        cdef const uint8_t* m_ptr = NULL
+        if m is not None:
+            _m = np.ascontiguousarray(m)
+            m_ptr = &_m[0,0]
+
+        self.per.update_sequence_priorities(&idx[0],&_ps[0,0],N,
+                                            _ps.shape[1],eta,m_ptr)
+
+    def _mark_sampled(self,overwritten=None):
+        r"""Restart tracing of updated indices as if `sample()` is called now
+
+        This is used to deliver a batch which was sampled in advance
+        (e.g. by `Prefetcher`). If this buffer is not constructed with
+        `check_for_update=True`, do nothing.
+
+        Parameters
+        ----------
+        overwritten : array like of int, optional
+            Indices which were overwritten after the actual sampling.
+        """
+        if not self.check_for_update:
+            return
+
+        self.unchange_since_sample[:] = True
+        if overwritten is not None:
+            np.asarray(self.unchange_since_sample)[np.asarray(overwritten,
+                                                              dtype=np.intp)] = False
+
     def update_priorities(self,indexes,priorities):
         r"""Update priorities
 
@@ -1653,11 +3201,14 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         if priorities is None:
             raise TypeError("`properties` must not be `None`")
 
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
         cdef const size_t [:] idx = Csize(indexes)
         cdef const float [:] ps = Cfloat(priorities)
 
         if not self.check_for_update:
             self.per.update_priorities(&idx[0],&ps[0],idx.shape[0])
+            if self.metrics is not None:
+                self.metrics.observe("update_priorities",t0,idx.shape[0])
             return None
 
         self.idx_vec.clear()
@@ -1676,6 +3227,10 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         if N > 0:
             self.per.update_priorities(self.idx_vec.data(),self.ps_vec.data(),N)
 
+        if self.metrics is not None:
+            self.metrics.observe("update_priorities",t0,N)
+            self.metrics.count("update_priorities_skipped",idx.shape[0] - N)
+
     cpdef void clear(self) except *:
         r"""Clear replay buffer
         """
@@ -1694,6 +3249,84 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
         """
         return self.per.get_max_priority()
 
+    def get_priority_sum(self):
+        r"""Get the sum of stored sampling priorities
+
+        Returns
+        -------
+        sum : float
+            :math:`\sum_{i} (p_{i} + \epsilon)^{\alpha}` over stored transitions
+        """
+        return self.per.get_sum(self.get_stored_size())
+
+    def get_priority_min(self):
+        r"""Get the minimum of stored sampling priorities
+
+        Returns
+        -------
+        min : float
+            :math:`\min_{i} (p_{i} + \epsilon)^{\alpha}` over stored transitions.
+            If no transitions are stored, the max value of float is returned.
+        """
+        return self.per.get_min(self.get_stored_size())
+
+    def set_seed(self,seed=None):
+        r"""Reset random number generators of sampling
+
+        Parameters
+        ----------
+        seed : int, optional
+            New seed. If `None` (default), the seed is taken from `os.urandom`.
+        """
+        super().set_seed(seed)
+        self.per.set_seed(self.seed)
+
+    def get_stats(self):
+        r"""Get recorded stats
+
+        Returns
+        -------
+        stats : dict
+            Stats of `ReplayBuffer.get_stats()` with "max_priority" gauge.
+            With `stats=True`, counters of segment tree updates are also
+            included.
+        """
+        stats = super().get_stats()
+        stats["gauges"]["max_priority"] = self.get_max_priority()
+        cdef TreeStats tree
+        if self.metrics is not None:
+            tree = self.per.get_tree_stats()
+            stats["counters"].update(tree_full_rebuilds=tree.full_rebuilds,
+                                     tree_incremental_updates=tree.incremental_updates,
+                                     tree_updated_leaves=tree.updated_leaves)
+        return stats
+
+    def reset_stats(self):
+        r"""Reset recorded counters and latency histograms
+        """
+        super().reset_stats()
+        if self.metrics is not None:
+            self.per.enable_stats(True)
+
+    def _checkpoint_state(self):
+        meta, arrays = super()._checkpoint_state()
+        meta["max_priority"] = float(self.per.get_max_priority())
+        arrays["per/tree"] = self._tree()
+        return meta, arrays
+
+    cdef _tree(self):
+        return np.asarray(<float[:self.per.tree_data_size()]>self.per.tree_data())
+
+    def _restore_state(self, reader):
+        if (("per/tree" not in reader) or
+            (reader.dtype("per/tree") != np.single) or
+            (reader.shape("per/tree") != (self.per.tree_data_size(),))):
+            raise ValueError(f"Stored data and Buffer mismatch for priorities")
+
+        super()._restore_state(reader)
+        reader.read_into("per/tree", self._tree())
+        self.per.set_max_priority(reader.meta["max_priority"])
+
     cpdef void on_episode_end(self) except *:
         r"""Call on episode end
 
@@ -1715,7 +3348,14 @@ cdef class PrioritizedReplayBuffer(ReplayBuffer):
 
         self.add_cache()
 
+        cdef size_t f
+        for f in range(self.frame_store.size()):
+            self.frame_store[f].on_episode_end()
+
+        self.episode_count += 1
         self.episode_len = 0
+        self._compact_journal()
+        self._sync_state()
 
 
 @cython.embedsignature(True)
@@ -1768,13 +3408,15 @@ cdef class ReverseReplayBuffer(ReplayBuffer):
         """
         super().__init__(size, env_dict, **kwargs)
 
-    def sample(self, batch_size):
+    def sample(self, batch_size, *, out=None):
         r"""Sample the stored transitions reversely
 
         Parameters
         ----------
         batch_size : int
             sampled batch size
+        out : dict of numpy.ndarray, optional
+            Preallocated output arrays. See `ReplayBuffer.sample()`.
 
         Returns
         -------
@@ -1782,8 +3424,11 @@ cdef class ReverseReplayBuffer(ReplayBuffer):
             Batch size of sampled transitions, which might contains
             the same transition multiple times.
         """
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
         cdef size_t nidx = self.get_next_index()
         cdef size_t ssize = self.get_stored_size()
+        if ssize == 0:
+            raise ValueError("Cannot sample from empty buffer")
 
         cdef size_t tmp_nidx = nidx
         if tmp_nidx <= self.last_sampled_index:
@@ -1794,18 +3439,254 @@ cdef class ReverseReplayBuffer(ReplayBuffer):
         else:
             self.last_sampled_index = (self.last_sampled_index or ssize) - 1
 
-        cdef idx = np.zeros(batch_size, dtype = np.uint)
+        cdef np.ndarray idx = np.empty(batch_size, dtype = np.uint64)
+        reverse_indexes(self.last_sampled_index,self.stride,ssize,batch_size,
+                        <size_t*>np.PyArray_DATA(idx))
 
-        # Ensure (idx >= 0).all()
-        cdef size_t i
-        cdef size_t tmp = self.last_sampled_index
-        for i in range(batch_size):
-            idx[i] = tmp
-            while tmp < self.stride:
-                tmp += ssize
-            tmp -= self.stride
+        samples = self._encode_sample(idx,out)
+        if self.metrics is not None:
+            self.metrics.observe("sample",t0,batch_size)
+        return samples
 
-        return self._encode_sample(idx)
+
+@cython.embedsignature(True)
+cdef class LaBERSampler:
+    r"""Native sub-sampler of Large Batch Experience Replay (LaBER)
+
+    Ref: https://arxiv.org/abs/2110.01528
+    """
+    cdef CppLaBER[float]* laber
+    cdef size_t batch_size
+    cdef float eps
+    cdef int weight
+
+    def __cinit__(self,batch_size,*,eps=1e-6,weight="mean",seed=None):
+        self.laber = new CppLaBER[float]()
+
+    def __init__(self,batch_size,*,eps=1e-6,weight="mean",seed=None):
+        r"""Initialize LaBERSampler
+
+        Parameters
+        ----------
+        batch_size : int
+            The number of sub-sampled transitions
+        eps : float, optional
+            Small positive values to avoid 0 priority. Default value is `1e-6`.
+        weight : {"mean", "lazy", "max"}, optional
+            Normalization of weights. (See `LaBERmean`, `LaBERlazy` and
+            `LaBERmax`) Default value is "mean".
+        seed : int, optional
+            Seed of sub-sampling. If `None` (default), the seed is taken
+            from `std::random_device`.
+        """
+        if batch_size <= 0:
+            raise ValueError("`batch_size` must be positive integer.")
+        self.batch_size = batch_size
+
+        if eps < 0:
+            raise ValueError("`eps` must be non negative")
+        self.eps = eps
+
+        modes = {"mean": 0, "lazy": 1, "max": 2}
+        if weight not in modes:
+            raise ValueError("`weight` must be \"mean\", \"lazy\" or \"max\"")
+        self.weight = modes[weight]
+
+        if seed is not None:
+            self.laber.set_seed(seed)
+
+    def __dealloc__(self):
+        del self.laber
+
+    def subsample(self,priorities):
+        r"""Sub-sample from large batch
+
+        Parameters
+        ----------
+        priorities : array-like of float
+            Surrogate priorities of large batch
+
+        Returns
+        -------
+        indexes : numpy.ndarray of numpy.uint64
+            Sub-sampled positions in large batch (not buffer indexes)
+        weights : numpy.ndarray of numpy.single
+            Normalized weights of sub-sampled transitions
+
+        Raises
+        ------
+        ValueError
+            If any priority is negative or not finite, or all are 0.
+        """
+        cdef const float [::1] p = Cfloat(priorities)
+        cdef size_t N = p.shape[0]
+        if N == 0:
+            raise ValueError("`priorities` must not be empty")
+
+        idx = np.empty(self.batch_size,dtype=np.uint64)
+        w = np.empty(self.batch_size,dtype=np.single)
+        cdef size_t [::1] _idx = idx
+        cdef float [::1] _w = w
+        cdef bool ok
+        with nogil:
+            ok = self.laber.sample[float](&p[0],N,self.batch_size,self.eps,
+                                          self.weight,&_idx[0],&_w[0])
+        if not ok:
+            raise ValueError("`priorities` must be non negative finite values " +
+                             "with positive sum")
+        return idx, w
+
+
+@cython.embedsignature(True)
+cdef class PrioritizedSampler:
+    r"""Native prioritized sampler without transition storage
+
+    Priorities of external storage (e.g. `TieredPrioritizedReplayBuffer`)
+    are kept in sum and min segment tree like `PrioritizedReplayBuffer`.
+    """
+    cdef CppPrioritizedSampler[float]* per
+    cdef VectorFloat weights
+    cdef VectorSize_t indexes
+    cdef size_t size
+
+    def __cinit__(self,size,*,alpha=0.6,eps=1e-4,seed=None,num_threads=1):
+        self.per = new CppPrioritizedSampler[float](size,alpha)
+
+    def __init__(self,size,*,alpha=0.6,eps=1e-4,seed=None,num_threads=1):
+        r"""Initialize PrioritizedSampler
+
+        Parameters
+        ----------
+        size : int
+            The number of indexes
+        alpha : float, optional
+            :math:`\alpha` the exponent of the priorities. Default is `0.6`.
+        eps : float, optional
+            :math:`\epsilon` small positive constant. Default is `1e-4`.
+        seed : int, optional
+            Seed of sampling. If `None` (default), the seed is taken from
+            `os.urandom`.
+        num_threads : int, optional
+            The number of threads for sampling. Default value is `1`.
+        """
+        self.size = size
+        self.per.set_eps(eps)
+        self.per.set_seed(random_seed() if seed is None else seed)
+        self.per.set_num_threads(num_threads)
+        self.weights = VectorFloat()
+        self.indexes = VectorSize_t()
+
+    def __dealloc__(self):
+        del self.per
+
+    def set_priorities(self,index,N,priorities=None):
+        r"""Set priorities of `N` indexes from `index` (wrapped by size)
+
+        Parameters
+        ----------
+        index : int
+            The first index
+        N : int
+            The number of indexes
+        priorities : array-like of float, optional
+            Priorities. If `None` (default), the max priority is used.
+        """
+        cdef const float [:] ps
+        if priorities is None:
+            self.per.set_priorities(index,N,self.size)
+            return
+
+        ps = Cfloat(priorities)
+        if ps.shape[0] != N:
+            raise ValueError("`priorities` shape is incompatible")
+        if N > 0:
+            self.per.set_priorities(index,&ps[0],N,self.size)
+
+    def sample(self,batch_size,beta,stored_size):
+        r"""Sample indexes depending on priorities
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+        beta : float
+            The exponent of weight
+        stored_size : int
+            Indexes `[0, stored_size)` are sampled.
+
+        Returns
+        -------
+        indexes : numpy.ndarray of numpy.uint64
+        weights : numpy.ndarray of numpy.single
+        """
+        if stored_size == 0:
+            raise ValueError("Cannot sample from empty buffer")
+        cdef size_t _batch_size = batch_size
+        cdef float _beta = beta
+        cdef size_t _stored_size = stored_size
+        with nogil:
+            self.per.sample(_batch_size,_beta,
+                            self.weights.vec,self.indexes.vec,_stored_size)
+        return self.indexes.as_numpy(copy=True), self.weights.as_numpy(copy=True)
+
+    def update_priorities(self,indexes,priorities):
+        r"""Update priorities
+
+        Parameters
+        ----------
+        indexes : array-like of int
+            Indexes to update
+        priorities : array-like of float
+            Priorities
+        """
+        cdef const size_t [:] idx = Csize(indexes)
+        cdef const float [:] ps = Cfloat(priorities)
+        if idx.shape[0] != ps.shape[0]:
+            raise ValueError("`indexes` and `priorities` must have the same size")
+        if idx.shape[0] > 0:
+            self.per.update_priorities(&idx[0],&ps[0],idx.shape[0])
+
+    def get_max_priority(self):
+        return self.per.get_max_priority()
+
+    def get_priority_sum(self,stored_size):
+        return self.per.get_sum(stored_size)
+
+    def get_priority_min(self,stored_size):
+        return self.per.get_min(stored_size)
+
+    def set_seed(self,seed):
+        self.per.set_seed(seed)
+
+    def clear(self):
+        clear(self.per)
+
+
+cdef class SlotSeqLock:
+    """Per-slot sequence lock at shared memory
+
+    Explorers never wait. The learner never waits either, but retries the
+    slots being written or overwritten during its copy.
+    """
+    cdef size_t size
+    cdef seq
+    cdef CppSlotSeqLock* lock
+
+    def __init__(self,size,seq=None):
+        self.size = size
+        self.seq = seq or RawArray(ctypes.c_uint64,size)
+        cdef uint64_t [:] view_seq = self.seq
+
+        self.lock = new CppSlotSeqLock(size,&view_seq[0])
+
+    def __dealloc__(self):
+        del self.lock
+
+    cdef CppSlotSeqLock* ptr(self):
+        return self.lock
+
+    def __reduce__(self):
+        return (SlotSeqLock,(self.size,self.seq))
 
 
 @cython.embedsignature(True)
@@ -1841,11 +3722,15 @@ cdef class MPReplayBuffer:
     cdef ProcessSafeRingBufferIndex index
     cdef default_dtype
     cdef StepChecker size_check
-    cdef explorer_ready
-    cdef explorer_count
-    cdef learner_ready
-
-    def __init__(self,size,env_dict=None,*,default_dtype=None,logger=None,**kwargs):
+    cdef SlotSeqLock seqlock
+    cdef metrics
+    cdef size_t row_bytes
+    cdef uint64_t seed
+    cdef uint64_t sample_count
+    cdef double write_timeout
+
+    def __init__(self,size,env_dict=None,*,default_dtype=None,logger=None,
+                 stats=False,seed=None,write_timeout=10.0,**kwargs):
         r"""Initialize ReplayBuffer
 
         Parameters
@@ -1858,6 +3743,17 @@ cdef class MPReplayBuffer:
             defines "shape" (default 1) and "dtypes" (fallback to `default_dtype`)
         default_dtype : numpy.dtype, optional
             fallback dtype for not specified in `env_dict`. default is numpy.single
+        stats : bool, optional
+            If `True`, record call counts, latency histograms and seqlock
+            retries, which are read by `get_stats()`. Stats are recorded
+            per process. Default is `False`.
+        seed : int, optional
+            Seed of sampling. If `None` (default), the seed is taken from
+            `os.urandom`. Copies passed to other processes have the same
+            seed. (See `split()`)
+        write_timeout : float, optional
+            Seconds until `sample()` gives up slots whose write never
+            finishes (e.g. explorer killed during `add()`). Default is 10.
         """
         self.env_dict = env_dict.copy() if env_dict else {}
         cdef special_keys = []
@@ -1874,31 +3770,17 @@ cdef class MPReplayBuffer:
 
         self.size_check = StepChecker(self.env_dict,special_keys)
 
-        self.learner_ready = Event()
-        self.learner_ready.clear()
-        self.explorer_ready = Event()
-        self.explorer_ready.set()
-
-        self.explorer_count = Value(ctypes.c_size_t,0)
-
-    cdef void _lock_explorer(self) except *:
-        self.explorer_ready.wait() # Wait permission
-        self.learner_ready.clear()  # Block learner
-        with self.explorer_count.get_lock():
-            self.explorer_count.value += 1
+        self.seqlock = SlotSeqLock(self.buffer_size)
 
-    cdef void _unlock_explorer(self) except *:
-        with self.explorer_count.get_lock():
-            self.explorer_count.value -= 1
-        if self.explorer_count.value == 0:
-            self.learner_ready.set()
+        self.metrics = Metrics() if stats else None
+        self.row_bytes = sum(b[0].nbytes for b in self.buffer.values())
 
-    cdef void _lock_learner(self) except *:
-        self.explorer_ready.clear() # New explorer cannot enter into critical section
-        self.learner_ready.wait() # Wait until all explorer exit from critical section
+        self.seed = random_seed() if seed is None else seed
+        self.sample_count = 0
 
-    cdef void _unlock_learner(self) except *:
-        self.explorer_ready.set() # Allow workers to enter into critical section
+        self.write_timeout = write_timeout
+        if not (self.write_timeout > 0):
+            raise ValueError("`write_timeout` must be positive.")
 
     def add(self,*,**kwargs):
         r"""Add transition(s) into replay buffer.
@@ -1928,6 +3810,7 @@ cdef class MPReplayBuffer:
         All values must be passed by key-value style (keyword arguments).
         It is user responsibility that all the values have the same step-size.
         """
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
         cdef size_t N = self.size_check.step_size(kwargs)
 
         cdef size_t index = self.index.fetch_add(N)
@@ -1937,14 +3820,16 @@ cdef class MPReplayBuffer:
         if end > self.buffer_size:
             add_idx[add_idx >= self.buffer_size] -= self.buffer_size
 
+        self.seqlock.ptr().write_begin(index,N)
+        try:
+            for name, b in self.buffer.items():
+                b[add_idx] = np.reshape(np.array(kwargs[name],copy=False,ndmin=2),
+                                        self.env_dict[name]["add_shape"])
+        finally:
+            self.seqlock.ptr().write_end(index,N)
 
-        self._lock_explorer()
-
-        for name, b in self.buffer.items():
-            b[add_idx] = np.reshape(np.array(kwargs[name],copy=False,ndmin=2),
-                                    self.env_dict[name]["add_shape"])
-
-        self._unlock_explorer()
+        if self.metrics is not None:
+            self.metrics.observe("add",t0,N,N * self.row_bytes)
         return index
 
     def get_all_transitions(self,shuffle: bool=False):
@@ -1966,11 +3851,7 @@ cdef class MPReplayBuffer:
         if shuffle:
             np.random.shuffle(idx)
 
-        self._lock_learner()
-        ret = self._encode_sample(idx)
-        self._unlock_learner()
-
-        return ret
+        return self._encode_sample_consistent(idx)[0]
 
     def _encode_sample(self,idx):
         cdef sample = {}
@@ -1982,6 +3863,93 @@ cdef class MPReplayBuffer:
 
         return sample
 
+    def _encode_sample_consistent(self,idx):
+        r"""Encode sample, retrying rows overwritten during copy
+
+        Still overwritten rows are retried (after short backoff when writers
+        keep rewriting them) until all rows are consistent. Rows being
+        written are not waited, but retried, too.
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            sampled transitions
+        seq : numpy.ndarray
+            slot sequences at which the rows are read
+
+        Raises
+        ------
+        RuntimeError
+            If any rows stay in the same unfinished write for `write_timeout`
+        """
+        cdef const size_t [::1] _idx = Csize(idx)
+        cdef size_t N = _idx.shape[0]
+        idx = np.asarray(_idx)
+
+        if N == 0:
+            return self._encode_sample(idx), np.empty(0,dtype=np.uint64)
+
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
+        cdef size_t n_retry = 0
+        cdef size_t n_failed
+        cdef size_t rounds = 0
+        cdef uint64_t [::1] _seq
+        cdef uint8_t [::1] _retry
+
+        # `pos`: positions of `idx` being read. (`None` means all)
+        # `t_write`: since when unfinished writes are observed
+        pos = None
+        t_write = None
+        sample = None
+        seq = None
+        while True:
+            part_seq = np.empty(N,dtype=np.uint64)
+            retry = np.empty(N,dtype=np.uint8)
+            _seq = part_seq
+            _retry = retry
+
+            self.seqlock.ptr().read_begin(&_idx[0],N,&_seq[0])
+            if (rounds == 0) and (self.metrics is not None):
+                self.metrics.observe("seqlock_wait",t0)
+            part = self._encode_sample(np.asarray(_idx))
+            n_failed = self.seqlock.ptr().read_validate(&_idx[0],N,&_seq[0],
+                                                        &_retry[0])
+            if pos is None:
+                sample = part
+                seq = part_seq
+            else:
+                for name, v in part.items():
+                    sample[name][pos] = v
+                seq[pos] = part_seq
+
+            if n_failed == 0:
+                break
+
+            n_retry += n_failed
+            if (retry == 2).any():
+                if t_write is None:
+                    t_write = time.monotonic()
+                elif time.monotonic() - t_write > self.write_timeout:
+                    raise RuntimeError("Slots are being written over " +
+                                       f"{self.write_timeout} seconds. " +
+                                       "Writer might die during add().")
+            else:
+                t_write = None
+
+            failed = np.flatnonzero(retry)
+            pos = failed if pos is None else pos[failed]
+            _idx = Csize(idx[pos])
+            N = _idx.shape[0]
+
+            rounds += 1
+            if rounds > 4:
+                time.sleep(min(1e-6 * (1 << min(rounds - 4, 10)), 1e-3))
+
+        if self.metrics is not None:
+            self.metrics.count("seqlock_retries",n_retry)
+
+        return sample, seq
+
     def sample(self,batch_size):
         r"""Sample the stored transitions randomly with speciped size
 
@@ -1998,13 +3966,15 @@ cdef class MPReplayBuffer:
             Batch size of sampled transitions, which might contains
             the same transition multiple times.
         """
-        cdef idx = np.random.randint(0,self.get_stored_size(),batch_size)
-
-        self._lock_learner()
-        ret =  self._encode_sample(idx)
-        self._unlock_learner()
-
-        return ret
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
+        cdef idx = uniform_index_array(self.seed,self.sample_count,batch_size,
+                                       self.get_stored_size())
+        self.sample_count += 1
+        samples = self._encode_sample_consistent(idx)[0]
+        if self.metrics is not None:
+            self.metrics.observe("sample",t0,batch_size,
+                                 sum(v.nbytes for v in samples.values()))
+        return samples
 
     cpdef void clear(self) except *:
         r"""Clear replay buffer.
@@ -2081,21 +4051,74 @@ cdef class MPReplayBuffer:
         """
         return False
 
+    def set_seed(self,seed=None):
+        r"""Reset random number generator of sampling at this process
+
+        Parameters
+        ----------
+        seed : int, optional
+            New seed. If `None` (default), the seed is taken from `os.urandom`.
+        """
+        self.seed = random_seed() if seed is None else seed
+        self.sample_count = 0
+
+    def split(self,k):
+        r"""Switch sampling at this process to the `k`-th child stream
+
+        Parameters
+        ----------
+        k : int
+            Child stream ID (e.g. process ID)
+
+        Returns
+        -------
+        seed : int
+            Seed of the child stream
+
+        Notes
+        -----
+        Copies passed to other processes share the seed. Calling `split()`
+        with different `k` at each process makes their samples independent
+        and reproducible.
+        """
+        self.set_seed(split_seed(self.seed,k))
+        return self.seed
+
+    def get_stats(self):
+        r"""Get recorded stats of this process
+
+        Returns
+        -------
+        stats : dict
+            `{"gauges": {name: value}, "counters": {name: int},
+            "latency": {name: dict}}`. (See `ReplayBuffer.get_stats()`)
+        """
+        stats = (self.metrics.to_dict() if self.metrics is not None
+                 else {"counters": {}, "latency": {}})
+        stats["gauges"] = {"stored_size": self.get_stored_size(),
+                           "buffer_size": self.get_buffer_size()}
+        return stats
+
+    def reset_stats(self):
+        r"""Reset recorded counters and latency histograms of this process
+        """
+        if self.metrics is not None:
+            self.metrics.reset()
+
 
 cdef class ThreadSafePrioritizedSampler:
     cdef size_t size
     cdef float alpha
     cdef float eps
     cdef max_p
-    cdef sum
-    cdef sum_a#nychanged
-    cdef min
-    cdef min_a#nychanged
+    cdef tree
+    cdef tree_a#nychanged
+    cdef tree_d#irty
+    cdef uint64_t seed
     cdef CppThreadSafePrioritizedSampler[float]* per
 
     def __init__(self,size,alpha,eps,max_p=None,
-                 sum=None,sum_a=None,
-                 min=None,min_a=None):
+                 tree=None,tree_a=None,tree_d=None,seed=None):
         self.size = size
         self.alpha = alpha
         self.eps = eps
@@ -2107,39 +4130,42 @@ cdef class ThreadSafePrioritizedSampler:
         while pow2size < size:
             pow2size *= 2
 
-        self.sum   = sum   or RawArray(ctypes.c_float,2*pow2size-1)
-        self.sum_a = sum_a or RawArray(ctypes.c_bool ,1)
-        self.min   = min   or RawArray(ctypes.c_float,2*pow2size-1)
-        self.min_a = min_a or RawArray(ctypes.c_bool ,1)
+        # Fused (sum, min) pairs for binary segment tree
+        self.tree   = tree   or RawArray(ctypes.c_float,2*(2*pow2size-1))
+        self.tree_a = tree_a or RawArray(ctypes.c_bool ,1)
+
+        # Dirty leaves bitmap for incremental update
+        self.tree_d = tree_d or RawArray(ctypes.c_uint64,(pow2size+63)//64)
 
-        cdef float [:] view_sum   = self.sum
-        cdef bool  [:] view_sum_a = self.sum_a
-        cdef float [:] view_min   = self.min
-        cdef bool  [:] view_min_a = self.min_a
+        cdef float    [:] view_tree   = self.tree
+        cdef bool     [:] view_tree_a = self.tree_a
+        cdef uint64_t [:] view_tree_d = self.tree_d
 
-        cdef bool init = ((max_p is None) and
-                          (sum   is None) and
-                          (sum_a is None) and
-                          (min   is None) and
-                          (min_a is None))
+        cdef bool init = ((max_p  is None) and
+                          (tree   is None) and
+                          (tree_a is None) and
+                          (tree_d is None))
 
         self.per = new CppThreadSafePrioritizedSampler[float](size,alpha,
                                                               &view_max_p[0],
-                                                              &view_sum[0],
-                                                              &view_sum_a[0],
-                                                              &view_min[0],
-                                                              &view_min_a[0],
+                                                              &view_tree[0],
+                                                              &view_tree_a[0],
+                                                              &view_tree_d[0],
                                                               init,
                                                               eps)
+        self.set_seed(random_seed() if seed is None else seed)
 
     cdef CppThreadSafePrioritizedSampler[float]* ptr(self):
         return self.per
 
+    def set_seed(self,seed):
+        self.seed = seed
+        self.per.set_seed(seed)
+
     def __reduce__(self):
         return (ThreadSafePrioritizedSampler,
                 (self.size,self.alpha,self.eps,self.max_p,
-                 self.sum,self.sum_a,
-                 self.min,self.min_a))
+                 self.tree,self.tree_a,self.tree_d,self.seed))
 
 
 @cython.embedsignature(True)
@@ -2154,16 +4180,19 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
     -----
     This class assumes single learner (`sample`, `update_priorities`) and
     multiple explorers (`add`).
+
+    Explorers never wait for the learner. Overwriting after `sample` is
+    detected from the shared ring index and per-slot sequences, so that
+    `update_priorities` ignores overwritten indices without any lock.
     """
     cdef VectorFloat weights
     cdef VectorSize_t indexes
     cdef ThreadSafePrioritizedSampler per
-    cdef unchange_since_sample
+    cdef uint64_t sample_count
+    cdef sampled_seq
+    cdef last_idx
     cdef helper
     cdef terminate
-    cdef explorer_per_count
-    cdef learner_per_ready
-    cdef explorer_per_ready
     cdef vector[size_t] idx_vec
     cdef vector[float] ps_vec
 
@@ -2198,52 +4227,66 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         """
         super().__init__(size,env_dict,**kwargs)
 
-        self.per = ThreadSafePrioritizedSampler(size,alpha,eps)
+        self.per = ThreadSafePrioritizedSampler(size,alpha,eps,seed=self.seed)
+        if self.metrics is not None:
+            self.per.ptr().enable_stats(True)
 
         self.weights = VectorFloat()
         self.indexes = VectorSize_t()
 
-        shm = RawArray(np.ctypeslib.as_ctypes_type(np.bool_),
-                       int(np.array(size,copy=False,dtype='int').prod()))
-        self.unchange_since_sample = np.ctypeslib.as_array(shm)
-        self.unchange_since_sample[:] = True
+        # Learner local trace of overwriting after the last `sample()`
+        #   * Ring index count at the last `sample()`
+        #   * Slot sequences of the last sampled indexes
+        self.sample_count = 0
+        self.sampled_seq = None
+        self.last_idx = None
 
         self.helper = None
         self.terminate = Value(ctypes.c_bool)
         self.terminate.value = False
 
-        self.learner_per_ready = Event()
-        self.learner_per_ready.clear()
-        self.explorer_per_ready = Event()
-        self.explorer_per_ready.set()
-        self.explorer_per_count = Value(ctypes.c_size_t,0)
-
         self.idx_vec = vector[size_t]()
         self.ps_vec = vector[float]()
 
-    cdef void _lock_explorer_per(self) except *:
-        self.explorer_per_ready.wait() # Wait permission
-        self.learner_per_ready.clear()  # Block learner
-        with self.explorer_per_count.get_lock():
-            self.explorer_per_count.value += 1
-
-    cdef void _unlock_explorer_per(self) except *:
-        with self.explorer_per_count.get_lock():
-            self.explorer_per_count.value -= 1
-        if self.explorer_per_count.value == 0:
-            self.learner_per_ready.set()
-
-    cdef void _lock_learner_per(self) except *:
-        self.explorer_per_ready.clear()
-        self.learner_per_ready.wait()
+    cdef _unchange_since_sample(self,idx):
+        r"""Check whether indices are not overwritten after the last `sample()`
 
-    cdef void _unlock_learner_per(self) except *:
-        self.explorer_per_ready.set()
+        Parameters
+        ----------
+        idx : numpy.ndarray of numpy.uint64
+            indices to check
 
-    cdef void _lock_learner_unlock_learner_per(self) except *:
-        self.explorer_ready.clear()
-        self.explorer_per_ready.set()
-        self.learner_ready.wait()
+        Returns
+        -------
+        numpy.ndarray of bool
+        """
+        cdef uint64_t written = self.index.get_count() - self.sample_count
+        if written >= self.buffer_size:
+            return np.zeros(idx.shape[0],dtype=np.bool_)
+
+        # Slots reserved after the last `sample()`
+        cdef size_t begin = self.sample_count % self.buffer_size
+        unchange = ((idx + (self.buffer_size - begin)) % self.buffer_size) >= written
+
+        if self.sampled_seq is None:
+            return unchange
+
+        # Sampled slots which were reserved before, but written after
+        # the last `sample()`
+        seq = self.sampled_seq[idx]
+        known = np.flatnonzero(seq != SEQ_UNKNOWN)
+        cdef size_t M = known.shape[0]
+        if M == 0:
+            return unchange
+
+        cdef const size_t [::1] known_idx = Csize(idx[known])
+        cdef const uint64_t [::1] known_seq = np.ascontiguousarray(seq[known])
+        retry = np.empty(M,dtype=np.uint8)
+        cdef uint8_t [::1] _retry = retry
+        self.seqlock.ptr().read_validate(&known_idx[0],M,&known_seq[0],&_retry[0])
+        unchange[known] &= (retry == 0)
+
+        return unchange
 
     def add(self,*,priorities = None,**kwargs):
         r"""Add transition(s) into replay buffer.
@@ -2276,6 +4319,7 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         All values must be passed by key-value style (keyword arguments).
         It is user responsibility that all the values have the same step-size.
         """
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
         cdef size_t N = self.size_check.step_size(kwargs)
         cdef const float [:] ps
 
@@ -2292,29 +4336,22 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         if end > self.buffer_size:
             add_idx[add_idx >= self.buffer_size] -= self.buffer_size
 
+        self.seqlock.ptr().write_begin(index,N)
+        try:
+            if priorities is not None:
+                ps = np.ravel(np.array(priorities,copy=False,ndmin=1,dtype=np.single))
+                self.per.ptr().set_priorities(index,&ps[0],N,self.get_buffer_size())
+            else:
+                self.per.ptr().set_priorities(index,N,self.get_buffer_size())
 
-        self._lock_explorer_per()
-
-        if priorities is not None:
-            ps = np.ravel(np.array(priorities,copy=False,ndmin=1,dtype=np.single))
-            self.per.ptr().set_priorities(index,&ps[0],N,self.get_buffer_size())
-        else:
-            self.per.ptr().set_priorities(index,N,self.get_buffer_size())
-
-        if index+N <= self.buffer_size:
-            self.unchange_since_sample[index:index+N] = False
-        else:
-            self.unchange_since_sample[index:] = False
-            self.unchange_since_sample[:index+N-self.buffer_size] = False
-
-        self._lock_explorer()
-        self._unlock_explorer_per()
+            for name, b in self.buffer.items():
+                b[add_idx] = np.reshape(np.array(kwargs[name],copy=False,ndmin=2),
+                                        self.env_dict[name]["add_shape"])
+        finally:
+            self.seqlock.ptr().write_end(index,N)
 
-        for name, b in self.buffer.items():
-            b[add_idx] = np.reshape(np.array(kwargs[name],copy=False,ndmin=2),
-                                    self.env_dict[name]["add_shape"])
-
-        self._unlock_explorer()
+        if self.metrics is not None:
+            self.metrics.observe("add",t0,N,N * self.row_bytes)
         return index
 
     def sample(self,batch_size,beta = 0.4):
@@ -2343,21 +4380,30 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         The 'weights' are also normalized by the weight for minimum priority
         (:math:`= w_{i}/\max_{j}(w_{j})`), which ensure the weights :math:`\leq` 1.
         """
-        self._lock_learner_per()
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
+        cdef uint64_t count = self.index.get_count()
         self.per.ptr().sample(batch_size,beta,
                               self.weights.vec,self.indexes.vec,
                               self.get_stored_size())
         cdef idx = self.indexes.as_numpy()
+        if self.metrics is not None:
+            self.metrics.observe("sample_priorities",t0,idx.shape[0])
 
-        self._lock_learner_unlock_learner_per()
+        samples, seq = self._encode_sample_consistent(idx)
 
-        samples = self._encode_sample(idx)
-        self.unchange_since_sample[:] = True
-        self._unlock_learner()
+        if self.sampled_seq is None:
+            self.sampled_seq = np.full(self.buffer_size,SEQ_UNKNOWN,dtype=np.uint64)
+        elif self.last_idx is not None:
+            self.sampled_seq[self.last_idx] = SEQ_UNKNOWN
+        self.sampled_seq[idx] = seq
+        self.last_idx = idx.copy()
+        self.sample_count = count
 
         samples['weights'] = self.weights.as_numpy()
         samples['indexes'] = idx
 
+        if self.metrics is not None:
+            self.metrics.observe("sample",t0,idx.shape[0])
         return samples
 
     def update_priorities(self,indexes,priorities):
@@ -2382,6 +4428,7 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         if priorities is None:
             raise TypeError("`properties` must not be `None`")
 
+        cdef int64_t t0 = _now() if self.metrics is not None else 0
         cdef const size_t [:] idx = Csize(indexes)
         cdef const float [:] ps = Cfloat(priorities)
 
@@ -2391,23 +4438,29 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         self.ps_vec.clear()
         self.ps_vec.reserve(ps.shape[0])
 
-        self._lock_learner_per()
         cdef size_t stored_size = self.get_stored_size()
+        cdef const uint8_t [:] unchange = self._unchange_since_sample(np.asarray(idx)).view(np.uint8)
         for _i in range(idx.shape[0]):
-            if idx[_i] < stored_size and self.unchange_since_sample[idx[_i]]:
+            if idx[_i] < stored_size and unchange[_i]:
                 self.idx_vec.push_back(idx[_i])
                 self.ps_vec.push_back(ps[_i])
 
         cdef N = self.idx_vec.size()
         if N > 0:
             self.per.ptr().update_priorities(self.idx_vec.data(),self.ps_vec.data(),N)
-        self._unlock_learner_per()
+
+        if self.metrics is not None:
+            self.metrics.observe("update_priorities",t0,N)
+            self.metrics.count("update_priorities_skipped",idx.shape[0] - N)
 
     cpdef void clear(self) except *:
         r"""Clear replay buffer
         """
         super(MPPrioritizedReplayBuffer,self).clear()
         clear(self.per.ptr())
+        self.sample_count = 0
+        self.sampled_seq = None
+        self.last_idx = None
 
     cpdef float get_max_priority(self):
         r"""Get the max priority of stored priorities
@@ -2419,6 +4472,44 @@ cdef class MPPrioritizedReplayBuffer(MPReplayBuffer):
         """
         return self.per.ptr().get_max_priority()
 
+    def set_seed(self,seed=None):
+        r"""Reset random number generators of sampling at this process
+
+        Parameters
+        ----------
+        seed : int, optional
+            New seed. If `None` (default), the seed is taken from `os.urandom`.
+        """
+        super().set_seed(seed)
+        self.per.set_seed(self.seed)
+
+    def get_stats(self):
+        r"""Get recorded stats of this process
+
+        Returns
+        -------
+        stats : dict
+            Stats of `MPReplayBuffer.get_stats()` with "max_priority" gauge.
+            With `stats=True`, counters of segment tree updates are also
+            included.
+        """
+        stats = super().get_stats()
+        stats["gauges"]["max_priority"] = self.get_max_priority()
+        cdef TreeStats tree
+        if self.metrics is not None:
+            tree = self.per.ptr().get_tree_stats()
+            stats["counters"].update(tree_full_rebuilds=tree.full_rebuilds,
+                                     tree_incremental_updates=tree.incremental_updates,
+                                     tree_updated_leaves=tree.updated_leaves)
+        return stats
+
+    def reset_stats(self):
+        r"""Reset recorded counters and latency histograms of this process
+        """
+        super().reset_stats()
+        if self.metrics is not None:
+            self.per.ptr().enable_stats(True)
+
     cpdef void on_episode_end(self) except *:
         r"""Call on episode end
 
@@ -2488,7 +4579,11 @@ def train(buffer: ReplayBuffer,
           obs_update: Optional[Callable] = None,
           rew_sum: Optional[Callable[[float, Any], float]] = None,
           episode_callback: Optional[Callable[[int,int,float],Any]] = None,
-          logger = None):
+          logger = None,
+          vectorized: bool = False,
+          pipeline: bool = False,
+          replay_ratio: float = 1.0,
+          prefetch: int = 2):
     r"""
     Train RL policy (model)
 
@@ -2523,11 +4618,52 @@ def train(buffer: ReplayBuffer,
         Callable for episode summarization
     logger: logging.Logger (optional)
         Custom Logger
+    vectorized: bool (optional)
+        If `True`, `env` is a vectorized environment with `num_envs` (e.g.
+        `gym.vector.VectorEnv`), whose `step(actions)` returns batches and
+        resets finished environments automatically. `get_action`,
+        `after_step`, `done_check`, `obs_update` and `rew_sum` receive and
+        return batches, and a whole batch is added at once. The default
+        value is `False`
+    pipeline: bool (optional)
+        If `True`, sampling and `update_policy` run at a learner thread
+        while environment stepping and adding run at the caller thread.
+        The default value is `False`
+    replay_ratio: float (optional)
+        The number of `update_policy` calls per added transition after
+        warmup. The default value is `1.0`
+    prefetch: int (optional)
+        The number of batches sampled in advance by `Prefetcher` when
+        `pipeline=True`. The default value is `2`
 
     Raises
     ------
     ValueError:
        When `max_step` is larger than `size_t` limit
+    ValueError:
+       When `replay_ratio` is negative
+    ValueError:
+       When Nstep buffer is used with multiple environments
+    TypeError:
+       When `pipeline=True` and `buffer` is neither sampled by `Prefetcher`
+       nor thread safe
+
+    Notes
+    -----
+    Without `vectorized` and `pipeline`, a transition is added, and a batch
+    is sampled and updated at each step. With either of them, updates are
+    scheduled by `replay_ratio` instead, and episode rewards are summed
+    unless `rew_sum` is passed.
+
+    With `pipeline=True`, `ReplayBuffer` and `PrioritizedReplayBuffer` are
+    sampled through `Prefetcher`, and buffers without `empty_sample()`
+    (e.g. `MPPrioritizedReplayBuffer`, `ShardedPrioritizedReplayBuffer`)
+    are used directly, so that they must be thread safe. Environment
+    stepping runs at most one step ahead of the scheduled updates, and the
+    remaining updates are finished before return.
+
+    Multiple environments add interleaved transitions, so that buffers
+    with `next_of`, `stack_compress` or `Nstep` are not supported with them.
 
     Warnings
     --------
@@ -2542,6 +4678,26 @@ def train(buffer: ReplayBuffer,
         raise ValueError(f"max_steps ({max_steps}) is too big. " +
                          f"max_steps < {size_t_limit}")
 
+    if replay_ratio < 0:
+        raise ValueError(f"replay_ratio ({replay_ratio}) must not be negative")
+
+    if vectorized or pipeline:
+        return _train_vectorized(buffer,env,get_action,update_policy,
+                                 max_steps=max(max_steps,0),
+                                 max_episodes=max_episodes,
+                                 batch_size=batch_size,
+                                 n_warmups=max(n_warmups,0),
+                                 after_step=after_step,
+                                 done_check=done_check,
+                                 obs_update=obs_update,
+                                 rew_sum=rew_sum,
+                                 episode_callback=episode_callback,
+                                 logger=logger,
+                                 vectorized=vectorized,
+                                 pipeline=pipeline,
+                                 replay_ratio=replay_ratio,
+                                 prefetch=prefetch)
+
     cdef bool use_per = isinstance(buffer,PrioritizedReplayBuffer)
     cdef bool has_after_step = after_step
     cdef bool has_check = done_check
@@ -2627,3 +4783,232 @@ def train(buffer: ReplayBuffer,
         else:
             obs = obs_update(transition) if has_obs_update else transition["next_obs"]
             episode_step += 1
+
+
+class _PipelineLearner:
+    """
+    Learner thread of pipelined `train`
+
+    Updates are scheduled by `grant()` of the actor, and each of them
+    samples a batch, calls `update_policy`, and updates priorities.
+    """
+    def __init__(self, buffer, sampler, update_policy, batch_size, use_per):
+        self.buffer = buffer
+        self.sampler = sampler
+        self.update_policy = update_policy
+        self.batch_size = batch_size
+        self.use_per = use_per
+
+        self.cv = threading.Condition()
+        self.budget = 0
+        self.updates = 0
+        self.step = 0
+        self.episode = 0
+        self.closed = False
+        self.error = None
+
+        self.thread = threading.Thread(target=self._run, daemon=True)
+        self.thread.start()
+
+    def _run(self):
+        try:
+            while True:
+                with self.cv:
+                    self.cv.wait_for(lambda: (self.closed or
+                                              (self.updates < self.budget)))
+                    if self.updates >= self.budget:
+                        return
+                    step, episode = self.step, self.episode
+
+                if self.sampler is not None:
+                    sample = self.sampler.next_batch()
+                else:
+                    sample = self.buffer.sample(self.batch_size)
+                absTD = self.update_policy(sample,step,episode)
+
+                if self.use_per:
+                    target = self.buffer if self.sampler is None else self.sampler
+                    target.update_priorities(sample["indexes"],absTD)
+
+                with self.cv:
+                    self.updates += 1
+                    self.cv.notify_all()
+        except BaseException as e:
+            with self.cv:
+                self.error = e
+                self.cv.notify_all()
+
+    def _check(self):
+        # Must be called with `self.cv`
+        if self.error is not None:
+            raise RuntimeError("Learner thread failed") from self.error
+
+    def grant(self, budget, step, episode):
+        with self.cv:
+            self._check()
+            self.budget = budget
+            self.step = step
+            self.episode = episode
+            self.cv.notify_all()
+
+    def throttle(self, lag):
+        """
+        Wait until scheduled but not finished updates are at most `lag`
+        """
+        with self.cv:
+            self.cv.wait_for(lambda: ((self.error is not None) or
+                                      (self.budget - self.updates <= lag)))
+            self._check()
+
+    def close(self):
+        """
+        Finish scheduled updates and stop thread
+        """
+        with self.cv:
+            self.closed = True
+            self.cv.notify_all()
+        self.thread.join()
+        with self.cv:
+            self._check()
+
+    def stop(self):
+        """
+        Stop thread without the rest of scheduled updates
+        """
+        with self.cv:
+            self.closed = True
+            self.budget = self.updates
+            self.cv.notify_all()
+        self.thread.join()
+
+
+def _train_vectorized(buffer, env, get_action, update_policy, *,
+                      max_steps, max_episodes, batch_size, n_warmups,
+                      after_step, done_check, obs_update, rew_sum,
+                      episode_callback, logger, vectorized, pipeline,
+                      replay_ratio, prefetch):
+    # Vectorized and/or pipelined version of `train`
+    # (Only transitions after warmup give updates.)
+    use_per = isinstance(buffer,(PrioritizedReplayBuffer,
+                                 MPPrioritizedReplayBuffer))
+    n_envs = int(getattr(env,"num_envs",1)) if vectorized else 1
+    if (n_envs > 1) and hasattr(buffer,"is_Nstep") and buffer.is_Nstep():
+        raise ValueError("Nstep buffer does not support multiple environments")
+
+    obs = env.reset()
+
+    sampler = None
+    learner = None
+    sink = buffer
+    if pipeline:
+        if hasattr(buffer,"empty_sample"):
+            from .Prefetcher import Prefetcher
+            sampler = Prefetcher(buffer,batch_size,prefetch)
+            sink = sampler
+        elif not isinstance(buffer,(MPReplayBuffer,MPPrioritizedReplayBuffer)):
+            from .Sharded import ShardedPrioritizedReplayBuffer
+            if not isinstance(buffer,ShardedPrioritizedReplayBuffer):
+                raise TypeError(f"{type(buffer).__name__} cannot be sampled " +
+                                "at learner thread")
+        learner = _PipelineLearner(buffer,sampler,update_policy,
+                                   batch_size,use_per)
+
+    if max_episodes is None:
+        max_episodes = float("inf")
+
+    lag = max(replay_ratio * n_envs, 1.0)
+    credit = 0.0
+    updates = 0
+
+    step = 0
+    episode = 0
+    episode_steps = np.zeros(n_envs,dtype=np.int64)
+    episode_rewards = np.zeros(n_envs,dtype=np.float64)
+    episode_start_times = np.full(n_envs,time.perf_counter())
+
+    try:
+        while (step < max_steps) and (episode < max_episodes):
+            if learner is not None:
+                learner.throttle(lag)
+
+            # Step environment(s)
+            action = get_action(obs,step,episode,step < n_warmups)
+            if after_step:
+                transition = after_step(obs,action,env.step(action),step,episode)
+            else:
+                next_obs, reward, done, _ = env.step(action)
+                transition = {"obs": obs,
+                              "act": action,
+                              "rew": reward,
+                              "next_obs": next_obs,
+                              "done": done}
+
+            # Add to buffer
+            sink.add(**transition)
+            prev_step = step
+            step += n_envs
+
+            # Schedule updates
+            # For Nstep, ReplayBuffer can be empty after `add(**transition)` method
+            if buffer.get_stored_size() > 0:
+                credit += replay_ratio * max(step - max(prev_step,n_warmups),0)
+            if learner is not None:
+                learner.grant(int(credit),step,episode)
+            else:
+                while updates < int(credit):
+                    sample = buffer.sample(batch_size)
+                    absTD = update_policy(sample,step,episode)
+                    if use_per:
+                        buffer.update_priorities(sample["indexes"],absTD)
+                    updates += 1
+
+            # Summarize reward
+            if rew_sum:
+                episode_rewards = np.asarray(rew_sum(episode_rewards,transition),
+                                             dtype=np.float64).reshape(n_envs)
+            else:
+                episode_rewards += np.asarray(transition["rew"]).reshape(n_envs)
+            episode_steps += 1
+
+            # Prepare the next step
+            dones = np.asarray(done_check(transition) if done_check
+                               else transition["done"]).reshape(n_envs)
+            if dones.any():
+                episode_end_time = time.perf_counter()
+                for i in np.flatnonzero(dones):
+                    SPS = episode_steps[i] / max(episode_end_time -
+                                                 episode_start_times[i],1e-9)
+                    logger.info(f"{episode: 6}th Episode: " +
+                                f"{episode_steps[i]: 5} Steps " +
+                                f"({step: 7} Total Steps), " +
+                                f"{episode_rewards[i]: =+7.2f} Reward, " +
+                                f"{SPS: =+5.2f} Steps/s")
+
+                    # Summary
+                    if episode_callback:
+                        episode_callback(episode,episode_steps[i]-1,
+                                         episode_rewards[i])
+                    episode += 1
+
+                episode_rewards[dones] = 0.0
+                episode_steps[dones] = 0
+                episode_start_times[dones] = episode_end_time
+
+                if n_envs == 1:
+                    sink.on_episode_end()
+
+            if vectorized:
+                # Finished environments are reset automatically.
+                obs = obs_update(transition) if obs_update else transition["next_obs"]
+            elif dones.any():
+                obs = env.reset()
+            else:
+                obs = obs_update(transition) if obs_update else transition["next_obs"]
+
+        if learner is not None:
+            learner.close()
+    finally:
+        if learner is not None:
+            learner.stop()
+        if sampler is not None:
+            sampler.close()
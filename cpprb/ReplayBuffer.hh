@@ -2,6 +2,8 @@
 #define YMD_REPLAY_BUFFER_HH 1
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <random>
 #include <utility>
@@ -13,7 +15,9 @@
 #include <atomic>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
 #include <numeric>
+#include <thread>
 
 #include "SegmentTree.hh"
 
@@ -44,8 +48,8 @@ namespace ymd {
 	view{}
     {
       if(!buffer){
-	buffer = new T[size * dim]{};
-	view.reset(buffer);
+	view = allocate_array<T>(size * dim);
+	buffer = view.get();
       }
     }
     DimensionalBuffer(): DimensionalBuffer{std::size_t(1),std::size_t(1)}  {}
@@ -130,6 +134,1011 @@ namespace ymd {
     std::size_t get_buffer_size() const noexcept { return buffer_size; }
   };
 
+  template<typename Float>
+  class CppNstepBuffer {
+  private:
+    std::size_t Nstep_size;
+    Float gamma;
+    std::size_t begin;
+    std::size_t count;
+    std::vector<std::size_t> field_bytes;
+    std::vector<std::vector<std::uint8_t>> fields;
+    std::vector<std::size_t> rew_dims;
+    std::vector<std::vector<Float>> rews;
+    std::vector<std::size_t> next_bytes;
+    std::vector<std::vector<std::uint8_t>> nexts;
+    std::vector<Float> done;
+    std::vector<Float> discount;
+
+    std::size_t slot(std::size_t i) const noexcept {
+      return (begin + i) % Nstep_size;
+    }
+
+    void emit(std::size_t i,std::size_t j,Float* done_out,
+	      void* const* fields_out,Float* const* rews_out,
+	      void* const* nexts_out) const noexcept {
+      const auto s = slot(i);
+      done_out[j] = done[s];
+      for(std::size_t k = 0; k < fields.size(); ++k){
+	std::memcpy(static_cast<std::uint8_t*>(fields_out[k]) + j*field_bytes[k],
+		    fields[k].data() + s*field_bytes[k],field_bytes[k]);
+      }
+      for(std::size_t k = 0; k < rews.size(); ++k){
+	std::copy_n(rews[k].data() + s*rew_dims[k],rew_dims[k],
+		    rews_out[k] + j*rew_dims[k]);
+      }
+      for(std::size_t k = 0; k < nexts.size(); ++k){
+	std::memcpy(static_cast<std::uint8_t*>(nexts_out[k]) + j*next_bytes[k],
+		    nexts[k].data(),next_bytes[k]);
+      }
+    }
+  public:
+    // Window of the last `Nstep_size` steps. Each pending transition keeps
+    // its discounted reward sum, done sum and the discount for the next
+    // reward, so that a new step updates them in place without any shift.
+    // When the window is full, the oldest transition is emitted together
+    // with the next values of the newest step.
+    CppNstepBuffer(std::size_t Nstep_size=1,Float gamma=Float(0.99))
+      : Nstep_size{std::max(Nstep_size,std::size_t(1))},
+	gamma{gamma},
+	begin{0},
+	count{0},
+	field_bytes{},
+	fields{},
+	rew_dims{},
+	rews{},
+	next_bytes{},
+	nexts{},
+	done(this->Nstep_size),
+	discount(this->Nstep_size) {}
+    CppNstepBuffer(const CppNstepBuffer&) = default;
+    CppNstepBuffer(CppNstepBuffer&&) = default;
+    CppNstepBuffer& operator=(const CppNstepBuffer&) = default;
+    CppNstepBuffer& operator=(CppNstepBuffer&&) = default;
+    ~CppNstepBuffer() = default;
+
+    void reset(std::size_t size,Float g){
+      *this = CppNstepBuffer{size,g};
+    }
+
+    // Field copied as it is. (`row_bytes` per step)
+    std::size_t add_field(std::size_t row_bytes){
+      field_bytes.push_back(row_bytes);
+      fields.emplace_back(Nstep_size * row_bytes);
+      return fields.size() - 1;
+    }
+
+    // Field summed with discount. (`dim` Float per step)
+    std::size_t add_reward(std::size_t dim){
+      rew_dims.push_back(dim);
+      rews.emplace_back(Nstep_size * dim);
+      return rews.size() - 1;
+    }
+
+    // Field taken from the newest step. (`row_bytes` per step)
+    std::size_t add_next(std::size_t row_bytes){
+      next_bytes.push_back(row_bytes);
+      nexts.emplace_back(row_bytes);
+      return nexts.size() - 1;
+    }
+
+    // The number of transitions emitted by `add` of `N` steps
+    std::size_t output_size(std::size_t N) const noexcept {
+      return (count + N >= Nstep_size) ? count + N - (Nstep_size - 1) : 0;
+    }
+
+    void add(std::size_t N,const Float* done_in,
+	     const void* const* fields_in,const Float* const* rews_in,
+	     const void* const* nexts_in,
+	     Float* done_out,void* const* fields_out,Float* const* rews_out,
+	     void* const* nexts_out) noexcept {
+      std::size_t j = 0;
+      for(std::size_t n = 0; n < N; ++n){
+	const auto d = done_in[n];
+	const auto g = gamma * (Float(1) - d);
+
+	for(std::size_t i = 0; i < count; ++i){
+	  const auto s = slot(i);
+	  for(std::size_t k = 0; k < rews.size(); ++k){
+	    const auto dim = rew_dims[k];
+	    auto r = rews[k].data() + s*dim;
+	    auto in = rews_in[k] + n*dim;
+	    for(std::size_t l = 0; l < dim; ++l){ r[l] += discount[s] * in[l]; }
+	  }
+	  done[s] += d;
+	  discount[s] *= g;
+	}
+
+	const auto s = slot(count);
+	for(std::size_t k = 0; k < fields.size(); ++k){
+	  std::memcpy(fields[k].data() + s*field_bytes[k],
+		      static_cast<const std::uint8_t*>(fields_in[k]) + n*field_bytes[k],
+		      field_bytes[k]);
+	}
+	for(std::size_t k = 0; k < rews.size(); ++k){
+	  std::copy_n(rews_in[k] + n*rew_dims[k],rew_dims[k],
+		      rews[k].data() + s*rew_dims[k]);
+	}
+	for(std::size_t k = 0; k < nexts.size(); ++k){
+	  std::memcpy(nexts[k].data(),
+		      static_cast<const std::uint8_t*>(nexts_in[k]) + n*next_bytes[k],
+		      next_bytes[k]);
+	}
+	done[s] = d;
+	discount[s] = g;
+	++count;
+
+	if(count == Nstep_size){
+	  emit(0,j++,done_out,fields_out,rews_out,nexts_out);
+	  begin = slot(1);
+	  --count;
+	}
+      }
+    }
+
+    // Emit all the pending transitions (`get_stored_size()`) and clear.
+    void on_episode_end(Float* done_out,void* const* fields_out,
+			Float* const* rews_out,void* const* nexts_out) noexcept {
+      for(std::size_t i = 0; i < count; ++i){
+	emit(i,i,done_out,fields_out,rews_out,nexts_out);
+      }
+      clear();
+    }
+
+    void clear() noexcept {
+      begin = 0;
+      count = 0;
+    }
+
+    std::size_t get_stored_size() const noexcept { return count; }
+    std::size_t get_Nstep_size() const noexcept { return Nstep_size; }
+  };
+
+  // Reduced precision storage of field (See CppSampleGather::set_storage)
+  enum class StorageType : int {
+    Raw = 0, Float16 = 1, BFloat16 = 2,
+    UInt8 = 3, Int8 = 4, UInt16 = 5, Int16 = 6
+  };
+
+  inline float half_to_float(std::uint16_t h) noexcept {
+    const std::uint32_t sign = std::uint32_t(h & 0x8000u) << 16;
+    std::uint32_t exp = (h >> 10) & 0x1Fu;
+    std::uint32_t man = h & 0x3FFu;
+
+    if(exp == 0x1Fu){
+      // Inf / NaN
+      exp = 0xFFu;
+    }else if(exp != 0){
+      exp += 127 - 15;
+    }else if(man != 0){
+      // Subnormal half is normal float
+      exp = 127 - 15 + 1;
+      while(!(man & 0x400u)){
+	man <<= 1;
+	--exp;
+      }
+      man &= 0x3FFu;
+    }
+
+    const std::uint32_t bits = sign | (exp << 23) | (man << 13);
+    float f;
+    std::memcpy(&f,&bits,sizeof(f));
+    return f;
+  }
+
+  inline float bfloat16_to_float(std::uint16_t h) noexcept {
+    const std::uint32_t bits = std::uint32_t(h) << 16;
+    float f;
+    std::memcpy(&f,&bits,sizeof(f));
+    return f;
+  }
+
+  class CppSampleGather {
+  private:
+    // Expand n stored values at the beginning of row into output type
+    using Expand = void(*)(char*,std::size_t,double,double);
+
+    struct Field {
+      const char* src;
+      std::ptrdiff_t index_stride;
+      std::size_t row_bytes;
+      std::size_t itemsize;
+      std::size_t chunk;
+      std::vector<std::size_t> shape;
+      std::vector<std::ptrdiff_t> strides;
+      std::size_t shift;
+      const char* latest;
+      Expand expand;
+      std::size_t out_row_bytes;
+      double scale;
+      double offset;
+    };
+    std::size_t buffer_size;
+    std::vector<Field> fields;
+
+    // Output is not smaller than stored value, so that backward loop never
+    // overwrites values not expanded yet.
+    template<typename In,typename Out,typename F>
+    static void expand_backward(char* row,std::size_t n,F&& f) noexcept {
+      for(std::size_t j = n; j-- > 0;){
+	In v;
+	std::memcpy(&v,row + j*sizeof(In),sizeof(In));
+	const Out o = f(v);
+	std::memcpy(row + j*sizeof(Out),&o,sizeof(Out));
+      }
+    }
+
+    template<typename Out>
+    static void expand_half(char* row,std::size_t n,double,double) noexcept {
+      expand_backward<std::uint16_t,Out>(row,n,[](auto h){
+	return Out(half_to_float(h));
+      });
+    }
+
+    template<typename Out>
+    static void expand_bfloat16(char* row,std::size_t n,double,double) noexcept {
+      expand_backward<std::uint16_t,Out>(row,n,[](auto h){
+	return Out(bfloat16_to_float(h));
+      });
+    }
+
+    template<typename In,typename Out>
+    static void expand_affine(char* row,std::size_t n,
+			      double scale,double offset) noexcept {
+      const auto s = Out(scale);
+      const auto o = Out(offset);
+      expand_backward<In,Out>(row,n,[=](auto q){ return s * Out(q) + o; });
+    }
+
+    template<typename Out>
+    static Expand expand_for(StorageType storage) noexcept {
+      switch(storage){
+      case StorageType::Float16:  return &expand_half<Out>;
+      case StorageType::BFloat16: return &expand_bfloat16<Out>;
+      case StorageType::UInt8:    return &expand_affine<std::uint8_t ,Out>;
+      case StorageType::Int8:     return &expand_affine<std::int8_t  ,Out>;
+      case StorageType::UInt16:   return &expand_affine<std::uint16_t,Out>;
+      case StorageType::Int16:    return &expand_affine<std::int16_t ,Out>;
+      default:                    return nullptr;
+      }
+    }
+
+    static std::size_t storage_itemsize(StorageType storage) noexcept {
+      switch(storage){
+      case StorageType::UInt8:
+      case StorageType::Int8:  return 1;
+      case StorageType::Raw:   return 0;
+      default:                 return 2;
+      }
+    }
+
+    template<typename T>
+    static void copy_strided(const char* src,std::ptrdiff_t stride,
+			     std::size_t n,char* dst) noexcept {
+      auto d = reinterpret_cast<T*>(dst);
+      for(std::size_t j = 0; j < n; ++j){
+	std::memcpy(d + j,src + j*stride,sizeof(T));
+      }
+    }
+
+    static void copy_inner(const Field& f,std::size_t dim,
+			   const char* src,char*& dst) noexcept {
+      const auto n = f.shape[dim];
+      const auto stride = f.strides[dim];
+
+      if(dim + 1 < f.shape.size()){
+	for(std::size_t j = 0; j < n; ++j){
+	  copy_inner(f,dim+1,src + j*stride,dst);
+	}
+	return;
+      }
+
+      if(f.chunk == f.itemsize){
+	switch(f.chunk){
+	case 1: copy_strided<std::uint8_t >(src,stride,n,dst); break;
+	case 2: copy_strided<std::uint16_t>(src,stride,n,dst); break;
+	case 4: copy_strided<std::uint32_t>(src,stride,n,dst); break;
+	case 8: copy_strided<std::uint64_t>(src,stride,n,dst); break;
+	default:
+	  for(std::size_t j = 0; j < n; ++j){
+	    std::memcpy(dst + j*f.chunk,src + j*stride,f.chunk);
+	  }
+	}
+      }else{
+	for(std::size_t j = 0; j < n; ++j){
+	  std::memcpy(dst + j*f.chunk,src + j*stride,f.chunk);
+	}
+      }
+      dst += n*f.chunk;
+    }
+
+    static void copy_row(const Field& f,const char* src,char* dst) noexcept {
+      if(f.shape.empty()){
+	std::memcpy(dst,src,f.chunk);
+      }else{
+	copy_inner(f,0,src,dst);
+      }
+    }
+  public:
+    // Field: (possibly strided) array whose 1st dimension is buffer index.
+    //        Sampled rows are written into C-contiguous outputs. Field with
+    //        shift = 1 reads the next index, and `latest` substitutes the
+    //        row at `next_index`. Field with null output is skipped.
+    CppSampleGather(std::size_t buffer_size=1)
+      : buffer_size{buffer_size}, fields{} {}
+    CppSampleGather(const CppSampleGather&) = default;
+    CppSampleGather(CppSampleGather&&) = default;
+    CppSampleGather& operator=(const CppSampleGather&) = default;
+    CppSampleGather& operator=(CppSampleGather&&) = default;
+    ~CppSampleGather() = default;
+
+    void reset(std::size_t size){
+      buffer_size = size;
+      fields.clear();
+    }
+
+    template<typename S>
+    std::size_t add_field(const void* src,std::size_t itemsize,std::size_t ndim,
+			  const S* shape,const S* strides,
+			  std::size_t shift = std::size_t(0),
+			  const void* latest = nullptr){
+      auto f = Field{static_cast<const char*>(src),
+		     std::ptrdiff_t(strides[0]),
+		     itemsize,itemsize,itemsize,{},{},
+		     shift,static_cast<const char*>(latest),
+		     nullptr,0,1.0,0.0};
+
+      for(std::size_t d = 1; d < ndim; ++d){
+	f.row_bytes *= std::size_t(shape[d]);
+	if(shape[d] == 1){ continue; }
+	if(!f.shape.empty() &&
+	   f.strides.back() == std::ptrdiff_t(shape[d]) * std::ptrdiff_t(strides[d])){
+	  f.shape.back() *= std::size_t(shape[d]);
+	  f.strides.back() = std::ptrdiff_t(strides[d]);
+	}else{
+	  f.shape.push_back(std::size_t(shape[d]));
+	  f.strides.push_back(std::ptrdiff_t(strides[d]));
+	}
+      }
+
+      // Contiguous innermost dimension is copied as a single chunk.
+      if(!f.shape.empty() && f.strides.back() == std::ptrdiff_t(f.chunk)){
+	f.chunk *= f.shape.back();
+	f.shape.pop_back();
+	f.strides.pop_back();
+      }
+
+      f.out_row_bytes = f.row_bytes;
+      fields.push_back(std::move(f));
+      return fields.size() - 1;
+    }
+
+    // Field k stores reduced precision values, which are expanded into
+    // float (out_itemsize = 4) or double (out_itemsize = 8) outputs.
+    // Integer storage is dequantized as `scale * q + offset`.
+    // Return false when the combination is not supported.
+    bool set_storage(std::size_t k,int storage,std::size_t out_itemsize,
+		     double scale = 1.0,double offset = 0.0){
+      if(k >= fields.size()){ return false; }
+      auto& f = fields[k];
+      const auto type = StorageType(storage);
+
+      if(type == StorageType::Raw){
+	f.expand = nullptr;
+	f.out_row_bytes = f.row_bytes;
+	return true;
+      }
+
+      if(storage_itemsize(type) != f.itemsize){ return false; }
+      switch(out_itemsize){
+      case sizeof(float):  f.expand = expand_for<float >(type); break;
+      case sizeof(double): f.expand = expand_for<double>(type); break;
+      default: return false;
+      }
+      if(!f.expand){ return false; }
+
+      f.out_row_bytes = f.row_bytes / f.itemsize * out_itemsize;
+      f.scale = scale;
+      f.offset = offset;
+      return true;
+    }
+
+    std::size_t get_field_size() const noexcept { return fields.size(); }
+    std::size_t get_buffer_size() const noexcept { return buffer_size; }
+
+    template<typename I>
+    bool gather(const I* indexes,std::size_t N,std::size_t next_index,
+		void* const* outputs,const std::uint8_t* cached,
+		std::vector<std::size_t>& hits) const {
+      hits.clear();
+      if(std::any_of(indexes,indexes+N,
+		     [size=buffer_size](auto i){ return std::size_t(i) >= size; })){
+	return false;
+      }
+
+      for(std::size_t k = 0; k < fields.size(); ++k){
+	const auto& f = fields[k];
+	auto dst = static_cast<char*>(outputs[k]);
+	if(!dst){ continue; }
+
+	for(std::size_t n = 0; n < N; ++n, dst += f.out_row_bytes){
+	  auto i = std::size_t(indexes[n]) + f.shift;
+	  if(i >= buffer_size){ i -= buffer_size; }
+
+	  if(f.shift && f.latest && (i == next_index)){
+	    std::memcpy(dst,f.latest,f.row_bytes);
+	  }else{
+	    copy_row(f,f.src + std::ptrdiff_t(i) * f.index_stride,dst);
+	  }
+
+	  if(f.expand){
+	    f.expand(dst,f.row_bytes / f.itemsize,f.scale,f.offset);
+	  }
+	}
+      }
+
+      if(cached){
+	for(std::size_t n = 0; n < N; ++n){
+	  if(cached[indexes[n]]){ hits.push_back(n); }
+	}
+      }
+      return true;
+    }
+  };
+
+  // Element type of batch store. (`Float16` is copied only into `Float16`.)
+  enum class DType : int {
+    Bool = 0, Int8 = 1, UInt8 = 2, Int16 = 3, UInt16 = 4,
+    Int32 = 5, UInt32 = 6, Int64 = 7, UInt64 = 8,
+    Float32 = 9, Float64 = 10, Float16 = 11
+  };
+
+  // Scatter added rows into (C-contiguous) ring buffers.
+  // Each field is written by one or two (wrapped) contiguous copies, and
+  // conversion between element types is instantiated at compile time.
+  class CppBatchStore {
+  private:
+    using Copy = void(*)(const void*,std::size_t,void*);
+
+    struct Field {
+      char* dst;
+      std::size_t row_elems;
+      std::size_t itemsize;
+      DType dtype;
+    };
+    std::size_t buffer_size;
+    std::vector<Field> fields;
+
+    template<typename In,typename Out>
+    static void convert(const void* src,std::size_t n,void* dst) noexcept {
+      if constexpr (std::is_same_v<In,Out>){
+	std::memcpy(dst,src,n * sizeof(Out));
+      }else{
+	auto s = static_cast<const In*>(src);
+	auto d = static_cast<Out*>(dst);
+	for(std::size_t i = 0; i < n; ++i){
+	  if constexpr (std::is_same_v<Out,bool>){
+	    d[i] = (s[i] != In{0});
+	  }else{
+	    d[i] = static_cast<Out>(s[i]);
+	  }
+	}
+      }
+    }
+
+    template<typename Out>
+    static Copy copy_into(DType in) noexcept {
+      switch(in){
+      case DType::Bool:    return &convert<bool         ,Out>;
+      case DType::Int8:    return &convert<std::int8_t  ,Out>;
+      case DType::UInt8:   return &convert<std::uint8_t ,Out>;
+      case DType::Int16:   return &convert<std::int16_t ,Out>;
+      case DType::UInt16:  return &convert<std::uint16_t,Out>;
+      case DType::Int32:   return &convert<std::int32_t ,Out>;
+      case DType::UInt32:  return &convert<std::uint32_t,Out>;
+      case DType::Int64:   return &convert<std::int64_t ,Out>;
+      case DType::UInt64:  return &convert<std::uint64_t,Out>;
+      case DType::Float32: return &convert<float        ,Out>;
+      case DType::Float64: return &convert<double       ,Out>;
+      default:             return nullptr;
+      }
+    }
+
+    static Copy copy_for(DType in,DType out) noexcept {
+      switch(out){
+      case DType::Bool:    return copy_into<bool         >(in);
+      case DType::Int8:    return copy_into<std::int8_t  >(in);
+      case DType::UInt8:   return copy_into<std::uint8_t >(in);
+      case DType::Int16:   return copy_into<std::int16_t >(in);
+      case DType::UInt16:  return copy_into<std::uint16_t>(in);
+      case DType::Int32:   return copy_into<std::int32_t >(in);
+      case DType::UInt32:  return copy_into<std::uint32_t>(in);
+      case DType::Int64:   return copy_into<std::int64_t >(in);
+      case DType::UInt64:  return copy_into<std::uint64_t>(in);
+      case DType::Float32: return copy_into<float        >(in);
+      case DType::Float64: return copy_into<double       >(in);
+      case DType::Float16:
+	return (in == DType::Float16) ? &convert<std::uint16_t,std::uint16_t>: nullptr;
+      default:             return nullptr;
+      }
+    }
+
+  public:
+    static std::size_t dtype_itemsize(int dtype) noexcept {
+      switch(DType(dtype)){
+      case DType::Bool:
+      case DType::Int8:
+      case DType::UInt8:   return 1;
+      case DType::Int16:
+      case DType::UInt16:
+      case DType::Float16: return 2;
+      case DType::Int32:
+      case DType::UInt32:
+      case DType::Float32: return 4;
+      default:             return 8;
+      }
+    }
+
+    static bool can_convert(int in,int out) noexcept {
+      return copy_for(DType(in),DType(out)) != nullptr;
+    }
+
+    CppBatchStore(std::size_t buffer_size=1)
+      : buffer_size{buffer_size}, fields{} {}
+    CppBatchStore(const CppBatchStore&) = default;
+    CppBatchStore(CppBatchStore&&) = default;
+    CppBatchStore& operator=(const CppBatchStore&) = default;
+    CppBatchStore& operator=(CppBatchStore&&) = default;
+    ~CppBatchStore() = default;
+
+    void reset(std::size_t size){
+      buffer_size = size;
+      fields.clear();
+    }
+
+    // `dst` is C-contiguous (buffer_size, row_elems) array of `dtype`.
+    std::size_t add_field(void* dst,std::size_t row_elems,int dtype){
+      fields.push_back(Field{static_cast<char*>(dst),row_elems,
+			     dtype_itemsize(dtype),DType(dtype)});
+      return fields.size() - 1;
+    }
+
+    std::size_t get_field_size() const noexcept { return fields.size(); }
+
+    // Store N rows of every field from `index` (wrapped at buffer end).
+    // srcs[k] is C-contiguous N rows of dtypes[k], or a single row repeated
+    // when broadcast[k] is true. When N exceeds buffer size, only the last
+    // rows are stored. Return false if any conversion is not supported.
+    bool store(const void* const* srcs,const int* dtypes,
+	       const std::uint8_t* broadcast,std::size_t N,
+	       std::size_t index) const noexcept {
+      for(std::size_t k = 0; k < fields.size(); ++k){
+	if(!copy_for(DType(dtypes[k]),fields[k].dtype)){ return false; }
+      }
+      if((N == 0) || (buffer_size == 0)){ return true; }
+
+      auto skip = std::size_t(0);
+      if(N > buffer_size){
+	skip = N - buffer_size;
+	index = (index + skip) % buffer_size;
+	N = buffer_size;
+      }
+      index %= buffer_size;
+      const auto first = std::min(N,buffer_size - index);
+
+      for(std::size_t k = 0; k < fields.size(); ++k){
+	const auto& f = fields[k];
+	const auto copy = copy_for(DType(dtypes[k]),f.dtype);
+	const auto src = static_cast<const char*>(srcs[k]);
+	const auto src_row = f.row_elems * dtype_itemsize(dtypes[k]);
+	const auto dst_row = f.row_elems * f.itemsize;
+
+	if(broadcast[k]){
+	  for(std::size_t n = 0; n < N; ++n){
+	    copy(src,f.row_elems,f.dst + ((index + n) % buffer_size) * dst_row);
+	  }
+	  continue;
+	}
+
+	copy(src + skip * src_row,first * f.row_elems,f.dst + index * dst_row);
+	if(first < N){
+	  copy(src + (skip + first) * src_row,(N - first) * f.row_elems,f.dst);
+	}
+      }
+      return true;
+    }
+  };
+
+  // Window of `T` indexes for each start, whose `burn_in`-th step is the
+  // start itself. Steps out of the stored range or out of the episode of
+  // the start are masked and filled with the nearest valid index.
+  template<typename I,typename E>
+  inline void sequence_indexes(const I* starts,std::size_t B,std::size_t T,
+			       std::size_t burn_in,std::size_t buffer_size,
+			       std::size_t stored_size,std::size_t next_index,
+			       const E* episodes,std::size_t* indexes,
+			       std::uint8_t* mask) noexcept {
+    // Logical position 0 is the oldest stored transition.
+    const auto oldest = (stored_size < buffer_size) ? std::size_t(0) : next_index;
+
+    for(std::size_t b = 0; b < B; ++b){
+      const auto s = std::size_t(starts[b]);
+      const auto pos = (s + buffer_size - oldest) % buffer_size;
+      auto idx = indexes + b*T;
+      auto m = mask + b*T;
+
+      idx[burn_in] = s;
+      m[burn_in] = 1;
+
+      bool valid = true;
+      for(std::size_t t = burn_in; t-- > 0;){
+	const auto back = burn_in - t;
+	const auto i = (s + buffer_size - (back % buffer_size)) % buffer_size;
+	valid = valid && (back <= pos) && (episodes[i] == episodes[s]);
+	idx[t] = valid ? i : idx[t+1];
+	m[t] = valid;
+      }
+
+      valid = true;
+      for(std::size_t t = burn_in + 1; t < T; ++t){
+	const auto forward = t - burn_in;
+	const auto i = (s + forward) % buffer_size;
+	valid = valid && (pos + forward < stored_size) && (episodes[i] == episodes[s]);
+	idx[t] = valid ? i : idx[t-1];
+	m[t] = valid;
+      }
+    }
+  }
+
+  class CppFrameStore {
+  private:
+    std::size_t buffer_size;
+    std::size_t frame_elems;
+    std::size_t itemsize;
+    std::size_t stack;
+    std::size_t width;
+    std::size_t frame_bytes;
+    std::size_t segment_frames;
+    MemoryPolicy policy;
+    std::uint64_t base;
+    std::uint64_t frame_count;
+    std::size_t stored;
+    std::size_t next_slot;
+    bool has_prev;
+    std::vector<std::uint64_t> ids;
+    std::vector<std::uint64_t> prev;
+    std::deque<std::shared_ptr<std::uint8_t[]>> segments;
+    std::shared_ptr<std::uint8_t[]> spare;
+    std::vector<std::uint8_t> tmp;
+
+    static constexpr const std::size_t segment_bytes = std::size_t(1) << 20;
+
+    // Frames [base, frame_count) are kept in FIFO of fixed size segments.
+    // Live frames are at most (buffer_size + 1) * width (+ the new one).
+    static std::size_t segment_size(std::size_t buffer_size,std::size_t width,
+				    std::size_t frame_bytes) noexcept {
+      const auto bound = (buffer_size + 1) * width + 1;
+      return std::clamp(segment_bytes / std::max(frame_bytes,std::size_t(1)),
+			std::size_t(1),bound);
+    }
+
+    std::shared_ptr<std::uint8_t[]> allocate_segment() const {
+      return allocate_array<std::uint8_t>(segment_frames * frame_bytes,policy);
+    }
+
+    template<typename F>
+    void for_each_segment(F&& f) const {
+      // f(segment, first frame offset from base, the number of frames)
+      const auto n = std::size_t(frame_count - base);
+      for(std::size_t s = 0, off = 0; off < n; ++s, off += segment_frames){
+	f(segments[s].get(),off,std::min(segment_frames,n - off));
+      }
+    }
+
+    template<typename T>
+    static void extract_strided(const std::uint8_t* src,std::size_t stride,
+				std::size_t n,std::uint8_t* dst) noexcept {
+      for(std::size_t e = 0; e < n; ++e){
+	std::memcpy(dst + e*sizeof(T),src + e*stride,sizeof(T));
+      }
+    }
+
+    template<typename T>
+    static void scatter_strided(const std::uint8_t* src,std::size_t n,
+				std::size_t stride,std::uint8_t* dst) noexcept {
+      for(std::size_t e = 0; e < n; ++e){
+	std::memcpy(dst + e*stride,src + e*sizeof(T),sizeof(T));
+      }
+    }
+
+    // Frame `k` of a stacked row is the slice of the last axis.
+    void extract(const std::uint8_t* row,std::size_t k,
+		 std::uint8_t* dst) const noexcept {
+      if(stack == 1){
+	std::memcpy(dst,row,frame_bytes);
+	return;
+      }
+      const auto src = row + k*itemsize;
+      const auto stride = stack*itemsize;
+      switch(itemsize){
+      case 1: extract_strided<std::uint8_t >(src,stride,frame_elems,dst); break;
+      case 2: extract_strided<std::uint16_t>(src,stride,frame_elems,dst); break;
+      case 4: extract_strided<std::uint32_t>(src,stride,frame_elems,dst); break;
+      case 8: extract_strided<std::uint64_t>(src,stride,frame_elems,dst); break;
+      default:
+	for(std::size_t e = 0; e < frame_elems; ++e){
+	  std::memcpy(dst + e*itemsize,src + e*stride,itemsize);
+	}
+      }
+    }
+
+    void scatter(const std::uint8_t* src,std::size_t k,
+		 std::uint8_t* row) const noexcept {
+      if(stack == 1){
+	std::memcpy(row,src,frame_bytes);
+	return;
+      }
+      const auto dst = row + k*itemsize;
+      const auto stride = stack*itemsize;
+      switch(itemsize){
+      case 1: scatter_strided<std::uint8_t >(src,frame_elems,stride,dst); break;
+      case 2: scatter_strided<std::uint16_t>(src,frame_elems,stride,dst); break;
+      case 4: scatter_strided<std::uint32_t>(src,frame_elems,stride,dst); break;
+      case 8: scatter_strided<std::uint64_t>(src,frame_elems,stride,dst); break;
+      default:
+	for(std::size_t e = 0; e < frame_elems; ++e){
+	  std::memcpy(dst + e*stride,src + e*itemsize,itemsize);
+	}
+      }
+    }
+
+    std::uint8_t* frame(std::uint64_t id) noexcept {
+      const auto off = std::size_t(id - base);
+      return segments[off / segment_frames].get() + (off % segment_frames)*frame_bytes;
+    }
+    const std::uint8_t* frame(std::uint64_t id) const noexcept {
+      const auto off = std::size_t(id - base);
+      return segments[off / segment_frames].get() + (off % segment_frames)*frame_bytes;
+    }
+
+    // Frames referenced by a later transition are the ones of the previous
+    // transition or newer ones, so that the oldest live transition has the
+    // minimum live frame id.
+    std::uint64_t min_live(std::size_t oldest) const noexcept {
+      auto m = frame_count;
+      if(has_prev){ m = std::min(m,*std::min_element(prev.begin(),prev.end())); }
+
+      if(oldest < buffer_size){
+	auto b = ids.begin() + oldest*width;
+	m = std::min(m,*std::min_element(b,b+width));
+      }
+      return m;
+    }
+
+    // The oldest transition except the one being overwritten at `slot`
+    std::size_t oldest_except(std::size_t slot) const noexcept {
+      const auto oldest = (stored < buffer_size) ? 0 : (slot + 1) % buffer_size;
+      return ((stored == 0) || (oldest == slot)) ? buffer_size : oldest;
+    }
+
+    void reserve(std::uint64_t live){
+      // Segments without live frames are recycled, so that live frames are
+      // never moved. (One of them is kept as spare.)
+      while(!segments.empty() && (base + segment_frames <= live)){
+	if(!spare){ spare = std::move(segments.front()); }
+	segments.pop_front();
+	base += segment_frames;
+      }
+      if(segments.empty()){ base = frame_count; }
+
+      if(frame_count < base + segments.size() * segment_frames){ return; }
+      segments.push_back(spare ? std::move(spare) : allocate_segment());
+      spare.reset();
+    }
+
+    std::uint64_t find_or_alloc(std::size_t slot,const std::uint64_t* cand,
+				std::size_t n_cand){
+      for(std::size_t c = 0; c < n_cand; ++c){
+	if(std::memcmp(frame(cand[c]),tmp.data(),frame_bytes) == 0){
+	  return cand[c];
+	}
+      }
+
+      reserve(min_live(oldest_except(slot)));
+      std::memcpy(frame(frame_count),tmp.data(),frame_bytes);
+      return frame_count++;
+    }
+  public:
+    // Stacked values of (frame..., stack) are stored as frame ids into
+    // deduplicated frames. A frame of a new transition shares the previous
+    // transition's frame (or the other frame of itself) with equal contents,
+    // so that stacked observations and their `next` are stored roughly once
+    // per step. Frames are never overwritten while any stored transition
+    // refers to them, thus episode ends need no cache.
+    //
+    // Frames are allocated by segment with memory policy, and segments
+    // whose frames are no longer referred are reused without copy.
+    CppFrameStore(std::size_t buffer_size=1,std::size_t frame_elems=1,
+		  std::size_t itemsize=1,std::size_t stack=1,bool has_next=false,
+		  const MemoryPolicy& policy = default_memory_policy())
+      : buffer_size{buffer_size},
+	frame_elems{frame_elems},
+	itemsize{itemsize},
+	stack{std::max(stack,std::size_t(1))},
+	width{this->stack * (has_next ? 2 : 1)},
+	frame_bytes{frame_elems * itemsize},
+	segment_frames{segment_size(buffer_size,width,frame_bytes)},
+	policy{policy},
+	base{0},
+	frame_count{0},
+	stored{0},
+	next_slot{0},
+	has_prev{false},
+	ids(buffer_size * width,0),
+	prev(width,0),
+	segments{},
+	spare{},
+	tmp(frame_bytes) {}
+    CppFrameStore(const CppFrameStore& other)
+      : CppFrameStore{} { *this = other; }
+    CppFrameStore(CppFrameStore&&) = default;
+    CppFrameStore& operator=(const CppFrameStore& other){
+      if(this == &other){ return *this; }
+
+      // Frames are copied, since segments are shared pointers.
+      buffer_size = other.buffer_size;
+      frame_elems = other.frame_elems;
+      itemsize = other.itemsize;
+      stack = other.stack;
+      width = other.width;
+      frame_bytes = other.frame_bytes;
+      segment_frames = other.segment_frames;
+      policy = other.policy;
+      base = other.base;
+      frame_count = other.frame_count;
+      stored = other.stored;
+      next_slot = other.next_slot;
+      has_prev = other.has_prev;
+      ids = other.ids;
+      prev = other.prev;
+      tmp = other.tmp;
+      spare.reset();
+      segments.clear();
+      for(const auto& seg: other.segments){
+	segments.push_back(allocate_segment());
+	std::memcpy(segments.back().get(),seg.get(),segment_frames * frame_bytes);
+      }
+      return *this;
+    }
+    CppFrameStore& operator=(CppFrameStore&&) = default;
+    ~CppFrameStore() = default;
+
+    // value, next: C-contiguous N rows. (next is required for `has_next`)
+    void store(std::size_t index,std::size_t N,
+	       const void* value,const void* next = nullptr){
+      const auto row_bytes = frame_bytes * stack;
+      const auto has_next = (width > stack);
+      auto cand = std::vector<std::uint64_t>{};
+      cand.reserve(2);
+
+      for(std::size_t n = 0; n < N; ++n){
+	const auto slot = (index + n) % buffer_size;
+	auto id = ids.data() + slot*width;
+
+	for(std::size_t p = 0; p < width; ++p){
+	  const auto is_next = (p >= stack);
+	  const auto k = is_next ? p - stack : p;
+	  extract(static_cast<const std::uint8_t*>(is_next ? next : value)
+		  + n*row_bytes,k,tmp.data());
+
+	  // Candidates: previous `next` (or shifted previous value),
+	  //             shifted value of itself, the last frame of itself
+	  cand.clear();
+	  if(!is_next && has_prev){
+	    if(has_next){
+	      cand.push_back(prev[stack + k]);
+	    }else if(k + 1 < stack){
+	      cand.push_back(prev[k + 1]);
+	    }
+	  }
+	  if(is_next && (k + 1 < stack)){ cand.push_back(id[k + 1]); }
+	  if(p > 0){ cand.push_back(id[p - 1]); }
+
+	  id[p] = find_or_alloc(slot,cand.data(),cand.size());
+	}
+
+	std::copy_n(id,width,prev.begin());
+	has_prev = true;
+	stored = std::min(stored + 1,buffer_size);
+	next_slot = (slot + 1) % buffer_size;
+      }
+    }
+
+    template<typename I>
+    void gather(const I* indexes,std::size_t N,
+		void* value,void* next = nullptr) const noexcept {
+      const auto row_bytes = frame_bytes * stack;
+      for(std::size_t n = 0; n < N; ++n){
+	const auto id = ids.data() + std::size_t(indexes[n])*width;
+	if(value){
+	  for(std::size_t k = 0; k < stack; ++k){
+	    scatter(frame(id[k]),k,static_cast<std::uint8_t*>(value) + n*row_bytes);
+	  }
+	}
+	if(next && (width > stack)){
+	  for(std::size_t k = 0; k < stack; ++k){
+	    scatter(frame(id[stack + k]),k,
+		    static_cast<std::uint8_t*>(next) + n*row_bytes);
+	  }
+	}
+      }
+    }
+
+    // Frames of a new episode do not share ones of the previous episode.
+    void on_episode_end() noexcept { has_prev = false; }
+
+    void clear() noexcept {
+      stored = 0;
+      next_slot = 0;
+      has_prev = false;
+    }
+
+    // State for checkpoint: base, frame_count, stored, next_slot,
+    //                       has_prev, prev[width]
+    std::size_t get_state_size() const noexcept { return 5 + width; }
+    void get_state(std::uint64_t* state) const noexcept {
+      state[0] = base;
+      state[1] = frame_count;
+      state[2] = stored;
+      state[3] = next_slot;
+      state[4] = has_prev;
+      std::copy(prev.begin(),prev.end(),state + 5);
+    }
+    // Frames must be restored by `restore_frames()` after `set_state()`.
+    void set_state(const std::uint64_t* state){
+      frame_count = state[1];
+      base = std::min(state[0],frame_count);
+      stored = std::min(std::size_t(state[2]),buffer_size);
+      next_slot = std::size_t(state[3]) % buffer_size;
+      has_prev = state[4];
+      std::copy_n(state + 5,width,prev.begin());
+
+      spare.reset();
+      segments.clear();
+      const auto n = std::size_t(frame_count - base);
+      for(std::size_t off = 0; off < n; off += segment_frames){
+	segments.push_back(allocate_segment());
+      }
+    }
+    std::uint64_t* ids_data() noexcept { return ids.data(); }
+    std::size_t ids_size() const noexcept { return ids.size(); }
+
+    // Frames [base, frame_count) in order
+    std::size_t frames_size() const noexcept {
+      return std::size_t(frame_count - base) * frame_bytes;
+    }
+    void copy_frames(std::uint8_t* out) const noexcept {
+      for_each_segment([&](const std::uint8_t* seg,std::size_t off,std::size_t n){
+	std::memcpy(out + off*frame_bytes,seg,n*frame_bytes);
+      });
+    }
+    void restore_frames(const std::uint8_t* in) noexcept {
+      for_each_segment([&](std::uint8_t* seg,std::size_t off,std::size_t n){
+	std::memcpy(seg,in + off*frame_bytes,n*frame_bytes);
+      });
+    }
+
+    bool has_next() const noexcept { return width > stack; }
+    std::size_t get_frame_bytes() const noexcept { return frame_bytes; }
+    std::size_t get_capacity() const noexcept {
+      return segments.size() * segment_frames;
+    }
+    std::size_t get_stored_frames() const noexcept {
+      if(stored == 0){ return 0; }
+      return std::size_t(frame_count - min_live((stored < buffer_size) ? 0 : next_slot));
+    }
+  };
+
   template<bool MultiThread,typename T> struct ThreadSafe{
     using type = std::atomic<T>;
     static inline auto fetch_add(volatile type* v,T N,const std::memory_order& order){
@@ -138,31 +1147,281 @@ namespace ymd {
     static inline auto store(volatile type* v,T N,const std::memory_order& order){
       v->store(N,order);
     }
-    static inline auto load(const volatile type* v,const std::memory_order& order){
-      return v->load(order);
+    static inline auto load(const volatile type* v,const std::memory_order& order){
+      return v->load(order);
+    }
+    static inline auto store_max(volatile type* v,T N){
+      auto tmp = v->load(std::memory_order_acquire);
+      while(tmp < N &&  !v->compare_exchange_weak(tmp,N)){}
+    }
+  };
+
+  template<typename T> struct ThreadSafe<false,T>{
+    using type = T;
+    static inline auto fetch_add(T* v,T N,const std::memory_order){
+      return std::exchange(*v,(*v + N));
+    }
+    static inline auto store(T* v,T N,const std::memory_order&){
+      *v = N;
+    }
+    static inline auto load(const T* v,const std::memory_order&){
+      return *v;
+    }
+    static inline auto store_max(T* v,T N){
+      if(*v < N){ *v = N; }
+    }
+  };
+
+  template<bool MultiThread=false>
+  class CppRingBufferIndex {
+  private:
+    using ThreadSafeCounter_t = ThreadSafe<MultiThread,std::uint64_t>;
+    static_assert(!MultiThread ||
+		  std::atomic<std::uint64_t>::is_always_lock_free,
+		  "Shared counter requires lock-free 64bit atomic");
+    static_assert(sizeof(typename ThreadSafeCounter_t::type)==sizeof(std::uint64_t),
+		  "Counter must be placeable at external std::uint64_t");
+
+    // Monotonic counter of stored items. Both next index (count % size) and
+    // stored size (min(count, size)) are derived from it.
+    typename ThreadSafeCounter_t::type* counter;
+    std::shared_ptr<typename ThreadSafeCounter_t::type> counter_view;
+    const std::size_t buffer_size;
+
+    std::uint64_t load() const {
+      return ThreadSafeCounter_t::load(counter,std::memory_order_acquire);
+    }
+  public:
+    CppRingBufferIndex(std::size_t buffer_size,
+		       std::uint64_t* counter_ptr = nullptr,
+		       bool initialize = true)
+      : counter{(typename ThreadSafeCounter_t::type*)counter_ptr},
+	counter_view{},
+	buffer_size{buffer_size}
+    {
+      if(!counter){
+	counter = new typename ThreadSafeCounter_t::type{};
+	counter_view.reset(counter);
+	initialize = true;
+      }
+      if(initialize){ clear(); }
+    }
+    CppRingBufferIndex(): CppRingBufferIndex{std::size_t(1)} {}
+    CppRingBufferIndex(const CppRingBufferIndex&) = default;
+    CppRingBufferIndex(CppRingBufferIndex&&) = default;
+    CppRingBufferIndex& operator=(const CppRingBufferIndex&) = delete;
+    CppRingBufferIndex& operator=(CppRingBufferIndex&&) = delete;
+    ~CppRingBufferIndex() = default;
+
+    std::size_t fetch_add(std::size_t N){
+      auto c = ThreadSafeCounter_t::fetch_add(counter,std::uint64_t(N),
+					      std::memory_order_acq_rel);
+      return std::size_t(c % buffer_size);
+    }
+    std::size_t get_next_index() const { return std::size_t(load() % buffer_size); }
+    std::size_t get_stored_size() const {
+      return std::size_t(std::min(load(),std::uint64_t(buffer_size)));
+    }
+    std::uint64_t get_count() const { return load(); }
+    std::size_t get_buffer_size() const noexcept { return buffer_size; }
+    void clear(){
+      ThreadSafeCounter_t::store(counter,std::uint64_t(0),std::memory_order_release);
+    }
+  };
+
+  using CppThreadSafeRingBufferIndex = CppRingBufferIndex<true>;
+
+  class CppSlotSeqLock {
+  private:
+    using ThreadSafeSeq_t = ThreadSafe<true,std::uint64_t>;
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+		  "Shared sequence requires lock-free 64bit atomic");
+
+    // Sequence of slot: [generation (48bit) | active writers (16bit)]
+    // Writer: +writer at begin, +(generation - writer) at end.
+    // Reader: accept a copy only if the sequence is inactive and unchanged.
+    static constexpr const std::uint64_t writer = 1;
+    static constexpr const std::uint64_t generation = std::uint64_t(1) << 16;
+    static constexpr const std::uint64_t active_mask = generation - 1;
+
+    typename ThreadSafeSeq_t::type* seq;
+    std::shared_ptr<typename ThreadSafeSeq_t::type[]> view;
+    std::size_t buffer_size;
+
+    template<typename F>
+    void for_each_slot(std::size_t index,std::size_t N,F&& f){
+      for(std::size_t n = 0, i = index; n < N; ++n){
+	f(seq[i]);
+	if(++i == buffer_size){ i = 0; }
+      }
+    }
+  public:
+    CppSlotSeqLock(std::size_t buffer_size,std::uint64_t* seq_ptr = nullptr)
+      : seq{(typename ThreadSafeSeq_t::type*)seq_ptr},
+	view{},
+	buffer_size{buffer_size}
+    {
+      if(!seq){
+	seq = new typename ThreadSafeSeq_t::type[buffer_size]{};
+	view.reset(seq);
+      }
+    }
+    CppSlotSeqLock(): CppSlotSeqLock{std::size_t(1)} {}
+    CppSlotSeqLock(const CppSlotSeqLock&) = default;
+    CppSlotSeqLock(CppSlotSeqLock&&) = default;
+    CppSlotSeqLock& operator=(const CppSlotSeqLock&) = default;
+    CppSlotSeqLock& operator=(CppSlotSeqLock&&) = default;
+    ~CppSlotSeqLock() = default;
+
+    void write_begin(std::size_t index,std::size_t N){
+      for_each_slot(index,N,[](auto& s){
+	ThreadSafeSeq_t::fetch_add(&s,writer,std::memory_order_relaxed);
+      });
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void write_end(std::size_t index,std::size_t N){
+      for_each_slot(index,N,[](auto& s){
+	ThreadSafeSeq_t::fetch_add(&s,generation - writer,std::memory_order_release);
+      });
+    }
+
+    template<typename I>
+    void read_begin(const I* indexes,std::size_t N,std::uint64_t* out) const {
+      // Spin shortly for slots being written now. Slots still being written
+      // (e.g. by dead writer) are never waited, but reported by read_validate.
+      for(std::size_t n = 0; n < N; ++n){
+	const auto& s = seq[indexes[n]];
+	auto v = ThreadSafeSeq_t::load(&s,std::memory_order_acquire);
+	for(auto spin = 0; (v & active_mask) && (spin < 64); ++spin){
+	  v = ThreadSafeSeq_t::load(&s,std::memory_order_acquire);
+	}
+	out[n] = v;
+      }
+    }
+
+    // retry: 0 (consistent), 1 (written during read) or
+    //        2 (the same write is still in progress)
+    template<typename I>
+    std::size_t read_validate(const I* indexes,std::size_t N,
+			      const std::uint64_t* begin,std::uint8_t* retry) const {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      auto n_retry = std::size_t(0);
+      for(std::size_t n = 0; n < N; ++n){
+	const auto v = ThreadSafeSeq_t::load(seq + indexes[n],std::memory_order_relaxed);
+	retry[n] = (v != begin[n]) ? 1 : ((v & active_mask) ? 2 : 0);
+	n_retry += (retry[n] != 0);
+      }
+      return n_retry;
+    }
+
+    std::size_t get_buffer_size() const noexcept { return buffer_size; }
+  };
+
+  // Ordered blocks of stored episodes (page table of block storage)
+  // Removed entries are left as tombstones, and the i-th live entry is found
+  // by Fenwick tree over slots. Slots are compacted when 2 * capacity slots
+  // are used (at least capacity removals), so that every operation is
+  // O(log capacity) amortized.
+  class EpisodeTable {
+  private:
+    static constexpr const std::size_t tombstone
+      = std::numeric_limits<std::size_t>::max();
+
+    std::vector<std::size_t> slots;
+    std::vector<std::size_t> tree;
+    std::size_t head;
+    std::size_t live;
+
+    void add(std::size_t pos,bool inc){
+      for(++pos; pos < tree.size(); pos += pos & (~pos + 1)){
+	inc ? ++tree[pos]: --tree[pos];
+      }
+    }
+
+    // Slot of the k-th live entry
+    std::size_t find(std::size_t k) const {
+      auto pos = std::size_t(0);
+      auto step = std::size_t(1);
+      while(2 * step < tree.size()){ step *= 2; }
+      for(; step; step /= 2){
+	if((pos + step < tree.size()) && (tree[pos + step] <= k)){
+	  pos += step;
+	  k -= tree[pos];
+	}
+      }
+      return pos;
     }
-    static inline auto store_max(volatile type* v,T N){
-      auto tmp = v->load(std::memory_order_acquire);
-      while(tmp < N &&  !v->compare_exchange_weak(tmp,N)){}
+
+    void remove_slot(std::size_t pos){
+      slots[pos] = tombstone;
+      add(pos,false);
+      --live;
+      while((head < slots.size()) && (slots[head] == tombstone)){ ++head; }
+      while(!slots.empty() && (slots.back() == tombstone)){ slots.pop_back(); }
+      if(slots.empty()){ head = 0; }
     }
-  };
 
-  template<typename T> struct ThreadSafe<false,T>{
-    using type = T;
-    static inline auto fetch_add(T* v,T N,const std::memory_order){
-      return std::exchange(*v,(*v + N));
+    void compact(){
+      auto end = std::remove(slots.begin() + head,slots.end(),tombstone);
+      std::move(slots.begin() + head,end,slots.begin());
+      slots.resize(live);
+      head = 0;
+
+      // Linear construction of Fenwick tree of [1,...,1 (live),0,...]
+      std::fill(tree.begin(),tree.end(),std::size_t(0));
+      for(std::size_t i = 1; i < tree.size(); ++i){
+	tree[i] += (i <= live);
+	if(const auto j = i + (i & (~i + 1)); j < tree.size()){ tree[j] += tree[i]; }
+      }
     }
-    static inline auto store(T* v,T N,const std::memory_order&){
-      *v = N;
+  public:
+    explicit EpisodeTable(std::size_t capacity)
+      : slots{},tree(2 * capacity + 1,std::size_t(0)),head{0},live{0} {
+      slots.reserve(2 * capacity);
     }
-    static inline auto load(const T* v,const std::memory_order&){
-      return *v;
+
+    std::size_t size() const noexcept { return live; }
+    bool empty() const noexcept { return live == 0; }
+    std::size_t front() const { return slots[head]; }
+    std::size_t back() const { return slots.back(); }
+    std::size_t operator[](std::size_t i) const { return slots[find(i)]; }
+
+    void push_back(std::size_t b){
+      if(slots.size() + 1 == tree.size()){ compact(); }
+      slots.push_back(b);
+      add(slots.size() - 1,true);
+      ++live;
     }
-    static inline auto store_max(T* v,T N){
-      if(*v < N){ *v = N; }
+
+    void pop_front(){ remove_slot(head); }
+    void erase(std::size_t i){ remove_slot(find(i)); }
+
+    template<typename F>
+    void for_each(F&& f) const {
+      for(auto i = head; i < slots.size(); ++i){
+	if(slots[i] != tombstone){ f(slots[i]); }
+      }
+    }
+
+    void clear(){
+      slots.clear();
+      std::fill(tree.begin(),tree.end(),std::size_t(0));
+      head = 0;
+      live = 0;
     }
   };
 
+  // Episode level storage
+  //   Contiguous (default): Episodes are stored one after another until the
+  //                         buffer is full. Deletion moves the following
+  //                         transitions backward.
+  //   Block: Each episode occupies a fixed size (`episode_len`) block.
+  //          Blocks are managed by page table (the oldest episode first) and
+  //          free list, so that insertion and deletion never move
+  //          transitions, and the oldest episode is evicted when all blocks
+  //          are used (FIFO). An episode longer than `episode_len` is
+  //          rejected, since it cannot be returned as a contiguous block.
   template<typename Observation,typename Action,typename Reward,typename Done>
   class CppSelectiveEnvironment :public Environment<Observation,Action,Reward,Done>{
   public:
@@ -174,16 +1433,113 @@ namespace ymd {
     const std::size_t Nepisodes;
     std::vector<std::size_t> episode_begins;
 
+    bool block;
+    EpisodeTable page_table;
+    std::vector<std::size_t> block_len;
+    std::vector<std::size_t> free_blocks;
+    bool is_open;
+    std::size_t stored;
+    std::vector<std::size_t> order;
+    std::vector<std::size_t> offsets;
+    bool offsets_dirty;
+
+    std::size_t open_block(){
+      if(free_blocks.empty()){
+	const auto oldest = page_table.front();
+	page_table.pop_front();
+	stored -= block_len[oldest];
+	free_blocks.push_back(oldest);
+      }
+      const auto b = free_blocks.back();
+      free_blocks.pop_back();
+      block_len[b] = 0;
+      page_table.push_back(b);
+      is_open = true;
+      return b;
+    }
+
+    template<typename Done_t>
+    bool fit_blocks(const Done_t* done,std::size_t N) const {
+      auto len = is_open ? block_len[page_table.back()]: std::size_t(0);
+      for(std::size_t n = 0; n < N; ++n){
+	if(++len > episode_len){ return false; }
+	if(done[n]){ len = 0; }
+      }
+      return true;
+    }
+
+    template<typename Obs_t,typename Act_t,typename Rew_t,
+	     typename Next_Obs_t,typename Done_t>
+    std::size_t store_block(Obs_t* obs,Act_t* act,Rew_t* rew,
+			    Next_Obs_t* next_obs, Done_t* done,std::size_t N){
+      if(!fit_blocks(done,N)){ return npos; }
+
+      auto first = next_block_index();
+      for(auto shift = std::size_t(0); shift < N;){
+	const auto b = is_open ? page_table.back(): open_block();
+	const auto begin = done + shift;
+	auto n = N - shift;
+	const auto d = std::find_if(begin,begin + n,[](auto v){ return v; });
+	const auto end_episode = (d != begin + n);
+	if(end_episode){ n = std::distance(begin,d) + 1; }
+
+	const auto index = b * episode_len + block_len[b];
+	if(shift == 0){ first = index; }
+	this->Env_t::store(obs,act,rew,next_obs,done,shift,index,n);
+
+	block_len[b] += n;
+	stored += n;
+	shift += n;
+	if(end_episode){ is_open = false; }
+      }
+      offsets_dirty = true;
+      return first;
+    }
+
+    std::size_t next_block_index() const {
+      if(is_open){
+	return page_table.back() * episode_len + block_len[page_table.back()];
+      }
+      return (free_blocks.empty() ? page_table.front(): free_blocks.back())
+	* episode_len;
+    }
+
+    void update_offsets(){
+      if(!offsets_dirty){ return; }
+      order.clear();
+      page_table.for_each([this](auto b){ this->order.push_back(b); });
+      offsets.resize(order.size() + 1);
+      offsets[0] = 0;
+      for(std::size_t i = 0; i < order.size(); ++i){
+	offsets[i+1] = offsets[i] + block_len[order[i]];
+      }
+      offsets_dirty = false;
+    }
+
   public:
+    // Returned by `store` when an episode does not fit its block.
+    static constexpr const std::size_t npos
+      = std::numeric_limits<std::size_t>::max();
+
     CppSelectiveEnvironment(std::size_t episode_len,std::size_t Nepisodes,
 			    std::size_t obs_dim,std::size_t act_dim,
-			    std::size_t rew_dim=1)
+			    std::size_t rew_dim=1,bool block=false)
       : Env_t{episode_len * Nepisodes,obs_dim,act_dim,rew_dim},
 	next_index{std::size_t(0)},
 	episode_len{episode_len},
 	Nepisodes{Nepisodes},
-	episode_begins{std::size_t(0)} {
+	episode_begins{std::size_t(0)},
+	block{block},
+	page_table{block ? Nepisodes: std::size_t(0)},
+	block_len(block ? Nepisodes: std::size_t(0),std::size_t(0)),
+	free_blocks{},
+	is_open{false},
+	stored{0},
+	order{},
+	offsets{},
+	offsets_dirty{true} {
 	  episode_begins.reserve(Nepisodes);
+	  if(block){ clear_blocks(); }
 	}
     CppSelectiveEnvironment(): CppSelectiveEnvironment{std::size_t(1),
 						       std::size_t(1),
@@ -200,6 +1556,8 @@ namespace ymd {
     std::size_t store(Obs_t* obs,Act_t* act,Rew_t* rew,
 		      Next_Obs_t* next_obs, Done_t* done,
 		      std::size_t N = std::size_t(1)){
+      if(block){ return store_block(obs,act,rew,next_obs,done,N); }
+
       const auto buffer_size = this->get_buffer_size();
       auto shift = std::size_t(0);
       auto copy_N = std::min(N,buffer_size - next_index);
@@ -223,6 +1581,13 @@ namespace ymd {
 	return;
       }
 
+      if(block){
+	const auto b = page_table[i];
+	this->Env_t::get(b * episode_len,obs,act,rew,next_obs,done);
+	ep_len = block_len[b];
+	return;
+      }
+
       auto begin = episode_begins[i];
       this->Env_t::get(begin,obs,act,rew,next_obs,done);
 
@@ -241,6 +1606,18 @@ namespace ymd {
     }
 
     std::size_t delete_episode(std::size_t i){
+      if(block){
+	if(i >= page_table.size()){ return std::size_t(0); }
+
+	const auto b = page_table[i];
+	if(i + 1 == page_table.size()){ is_open = false; }
+	page_table.erase(i);
+	free_blocks.push_back(b);
+	stored -= block_len[b];
+	offsets_dirty = true;
+	return std::exchange(block_len[b],std::size_t(0));
+      }
+
       if(i > episode_begins.size() -1){
 	return std::size_t(0);
       }
@@ -286,101 +1663,859 @@ namespace ymd {
       episode_begins.pop_back();
       return delete_size;
     }
-    std::size_t get_next_index() const { return next_index; }
-    std::size_t get_stored_size() const { return next_index; }
-    auto get_stored_episode_size() const {
+    std::size_t get_next_index() const {
+      return block ? next_block_index(): next_index;
+    }
+    std::size_t get_stored_size() const { return block ? stored: next_index; }
+    std::size_t get_stored_episode_size() const {
+      if(block){ return page_table.size(); }
+
       constexpr const std::size_t zero(0), one(1);
       return episode_begins.size() - ((next_index==episode_begins.back())? one: zero);
     }
+    bool is_block() const noexcept { return block; }
+
+    // Convert positions in [0, stored size) ordered by episodes into
+    // buffer indexes. Return false if any position is out of range.
+    template<typename I>
+    bool get_indexes(const I* positions,std::size_t N,std::size_t* indexes){
+      const auto size = get_stored_size();
+      if(std::any_of(positions,positions+N,
+		     [=](auto p){ return std::size_t(p) >= size; })){
+	return false;
+      }
+
+      if(!block){
+	std::copy_n(positions,N,indexes);
+	return true;
+      }
+
+      update_offsets();
+      for(std::size_t n = 0; n < N; ++n){
+	const auto p = std::size_t(positions[n]);
+	const auto e = std::size_t(std::upper_bound(offsets.begin(),offsets.end(),p)
+				   - offsets.begin()) - 1;
+	indexes[n] = order[e] * episode_len + (p - offsets[e]);
+      }
+      return true;
+    }
+
+    void clear_blocks(){
+      page_table.clear();
+      std::fill(block_len.begin(),block_len.end(),std::size_t(0));
+      free_blocks.resize(Nepisodes);
+      // Pop from back, so that blocks are used from the beginning.
+      std::iota(free_blocks.rbegin(),free_blocks.rend(),std::size_t(0));
+      is_open = false;
+      stored = 0;
+      offsets_dirty = true;
+    }
+
     virtual void clear(){
       next_index = std::size_t(0);
       episode_begins.resize(1);
+      if(block){ clear_blocks(); }
+    }
+  };
+
+  // Counter based random number generator
+  // The n-th number of stream `s` is a hash of (seed, s, n) (splitmix64
+  // finalizer), so that numbers do not depend on the order of generation,
+  // and samples split over threads reproduce single thread ones.
+  class CppCounterRNG {
+  private:
+    std::uint64_t seed;
+
+    static constexpr std::uint64_t mix(std::uint64_t z) noexcept {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+  public:
+    explicit CppCounterRNG(std::uint64_t seed = 0): seed{seed} {}
+
+    void set_seed(std::uint64_t s) noexcept { seed = s; }
+    std::uint64_t get_seed() const noexcept { return seed; }
+
+    std::uint64_t operator()(std::uint64_t stream,std::uint64_t n) const noexcept {
+      return mix(mix(seed + 0x9e3779b97f4a7c15ull * (stream + 1)) +
+		 0x9e3779b97f4a7c15ull * (n + 1));
+    }
+
+    // Uniform real number in [0, 1)
+    template<typename Real>
+    Real uniform(std::uint64_t stream,std::uint64_t n) const noexcept {
+      if constexpr (sizeof(Real) <= sizeof(float)){
+	return Real((*this)(stream,n) >> 40) * Real(1.0 / (1ull << 24));
+      }else{
+	return Real((*this)(stream,n) >> 11) * Real(1.0 / (1ull << 53));
+      }
+    }
+
+    // Uniform integer in [0, high) by multiply-shift (bias < high / 2^64)
+    std::uint64_t index(std::uint64_t stream,std::uint64_t n,
+			std::uint64_t high) const noexcept {
+      return mulhi((*this)(stream,n),high);
+    }
+
+    // Independent generator for the k-th child (e.g. process) stream.
+    // The last stream is reserved for it.
+    CppCounterRNG split(std::uint64_t k) const noexcept {
+      return CppCounterRNG{(*this)(~std::uint64_t(0),k)};
+    }
+  private:
+    static constexpr std::uint64_t mulhi(std::uint64_t a,
+					 std::uint64_t b) noexcept {
+#if defined(__SIZEOF_INT128__)
+      return std::uint64_t((static_cast<unsigned __int128>(a) * b) >> 64);
+#else
+      const auto a_lo = a & 0xffffffffull, a_hi = a >> 32;
+      const auto b_lo = b & 0xffffffffull, b_hi = b >> 32;
+      const auto m1 = a_hi * b_lo + ((a_lo * b_lo) >> 32);
+      const auto m2 = a_lo * b_hi + (m1 & 0xffffffffull);
+      return a_hi * b_hi + (m1 >> 32) + (m2 >> 32);
+#endif
+    }
+  };
+
+  // Uniform indexes in [0, high) of stream
+  inline void uniform_indexes(const CppCounterRNG& rng,std::uint64_t stream,
+			      std::size_t N,std::size_t high,std::size_t* out){
+    for(std::size_t i = 0; i < N; ++i){ out[i] = rng.index(stream,i,high); }
+  }
+
+  // Indexes going back from `last` by `stride` over ring buffer of
+  // `stored_size` (> 0)
+  inline void reverse_indexes(std::size_t last,std::size_t stride,
+			      std::size_t stored_size,std::size_t N,
+			      std::size_t* out){
+    stride %= stored_size;
+    for(std::size_t i = 0; i < N; ++i){
+      out[i] = last;
+      last = (last >= stride) ? last - stride: last + stored_size - stride;
+    }
+  }
+
+  // Persistent worker threads for data parallel loops.
+  // `run(n,f)` calls `f(0)`, ..., `f(n-1)` over workers and the caller,
+  // and returns after all of them finish. `f` must not throw.
+  class CppThreadPool {
+  private:
+    std::vector<std::thread> workers;
+    std::mutex run_mutex;
+    std::mutex m;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const std::function<void(std::size_t)>* job;
+    std::size_t n_jobs;
+    std::atomic<std::size_t> next_job;
+    std::size_t remaining;
+    std::size_t active;
+    std::uint64_t generation;
+    bool stop;
+
+    void work(const std::function<void(std::size_t)>& f,std::size_t n){
+      auto done = std::size_t(0);
+      for(auto i = next_job.fetch_add(1,std::memory_order_relaxed); i < n;
+	  i = next_job.fetch_add(1,std::memory_order_relaxed)){
+	f(i);
+	++done;
+      }
+
+      std::lock_guard<std::mutex> lock{m};
+      remaining -= done;
+      --active;
+      if((remaining == 0) && (active == 0)){ done_cv.notify_all(); }
+    }
+
+    void loop(){
+      auto seen = std::uint64_t(0);
+      for(;;){
+	std::unique_lock<std::mutex> lock{m};
+	start_cv.wait(lock,[&](){ return stop || (generation != seen); });
+	if(stop){ return; }
+	seen = generation;
+	if(remaining == 0){ continue; }
+
+	// The caller waits for `active == 0`, so that `job` lives
+	// until every worker leaves.
+	++active;
+	auto f = job;
+	auto n = n_jobs;
+	lock.unlock();
+	work(*f,n);
+      }
+    }
+  public:
+    explicit CppThreadPool(std::size_t threads)
+      : workers{},run_mutex{},m{},start_cv{},done_cv{},job{nullptr},n_jobs{0},next_job{0},
+	remaining{0},active{0},generation{0},stop{false}
+    {
+      threads = std::max(threads,std::size_t(1));
+      workers.reserve(threads - 1);
+      for(std::size_t i = 1; i < threads; ++i){
+	workers.emplace_back([this](){ this->loop(); });
+      }
+    }
+    CppThreadPool(const CppThreadPool&) = delete;
+    CppThreadPool& operator=(const CppThreadPool&) = delete;
+    ~CppThreadPool(){
+      {
+	std::lock_guard<std::mutex> lock{m};
+	stop = true;
+      }
+      start_cv.notify_all();
+      for(auto& w : workers){ w.join(); }
+    }
+
+    // The number of threads including the caller
+    std::size_t size() const noexcept { return workers.size() + 1; }
+
+    void run(std::size_t n,const std::function<void(std::size_t)>& f){
+      if(workers.empty() || (n <= 1)){
+	for(auto i = std::size_t(0); i < n; ++i){ f(i); }
+	return;
+      }
+
+      // Pool can be shared, but `run` is serialized.
+      std::lock_guard<std::mutex> run_lock{run_mutex};
+      {
+	std::lock_guard<std::mutex> lock{m};
+	job = &f;
+	n_jobs = n;
+	next_job.store(0,std::memory_order_relaxed);
+	remaining = n;
+	active = 1;
+	++generation;
+      }
+      start_cv.notify_all();
+
+      work(f,n);
+
+      std::unique_lock<std::mutex> lock{m};
+      done_cv.wait(lock,[&](){ return (remaining == 0) && (active == 0); });
+      job = nullptr;
+    }
+  };
+
+  // Run length coding of bytes for compressible rows (e.g. sparse grids,
+  // images with static regions). Token `c < 128` is followed by `c + 1`
+  // literal bytes, and token `c >= 128` is followed by a byte repeated
+  // `c - 125` (3 ... 130) times.
+  constexpr std::size_t rle_bound(std::size_t n) noexcept {
+    return n + n/128 + 2;
+  }
+
+  // `dst` must have `rle_bound(n)` bytes. Returns encoded bytes.
+  inline std::size_t rle_encode(const std::uint8_t* src,std::size_t n,
+				std::uint8_t* dst) noexcept {
+    auto o = std::size_t(0);
+    auto flush = [&](std::size_t begin,std::size_t end){
+      while(begin < end){
+	const auto k = std::min(end - begin,std::size_t(128));
+	dst[o++] = std::uint8_t(k - 1);
+	std::memcpy(dst + o,src + begin,k);
+	o += k;
+	begin += k;
+      }
+    };
+
+    auto literal = std::size_t(0);
+    auto i = std::size_t(0);
+    while(i < n){
+      auto r = std::size_t(1);
+      while((i + r < n) && (r < 130) && (src[i + r] == src[i])){ ++r; }
+      if(r >= 3){
+	flush(literal,i);
+	dst[o++] = std::uint8_t(125 + r);
+	dst[o++] = src[i];
+	literal = i + r;
+      }
+      i += r;
+    }
+    flush(literal,n);
+    return o;
+  }
+
+  // Returns `false` for broken input or size mismatch
+  inline bool rle_decode(const std::uint8_t* src,std::size_t n,
+			 std::uint8_t* dst,std::size_t dst_n) noexcept {
+    auto o = std::size_t(0);
+    auto i = std::size_t(0);
+    while(i < n){
+      const std::size_t c = src[i++];
+      if(c < 128){
+	const auto k = c + 1;
+	if((i + k > n) || (o + k > dst_n)){ return false; }
+	std::memcpy(dst + o,src + i,k);
+	i += k;
+	o += k;
+      }else{
+	const auto k = c - 125;
+	if((i >= n) || (o + k > dst_n)){ return false; }
+	std::memset(dst + o,src[i++],k);
+	o += k;
+      }
+    }
+    return o == dst_n;
+  }
+
+  // Transpose bytes of `n` elements into `itemsize` planes (and back), so
+  // that upper bytes of nearly constant numbers make long runs.
+  template<std::size_t S>
+  inline void shuffle_bytes_n(const std::uint8_t* src,std::size_t n,
+			      std::size_t itemsize,std::uint8_t* dst) noexcept {
+    const auto size = S ? S : itemsize;
+    for(std::size_t b = 0; b < size; ++b){
+      for(std::size_t e = 0; e < n; ++e){ dst[b*n + e] = src[e*size + b]; }
+    }
+  }
+  template<std::size_t S>
+  inline void unshuffle_bytes_n(const std::uint8_t* src,std::size_t n,
+				std::size_t itemsize,std::uint8_t* dst) noexcept {
+    const auto size = S ? S : itemsize;
+    for(std::size_t e = 0; e < n; ++e){
+      for(std::size_t b = 0; b < size; ++b){ dst[e*size + b] = src[b*n + e]; }
+    }
+  }
+
+  inline void shuffle_bytes(const std::uint8_t* src,std::size_t n,
+			    std::size_t itemsize,std::uint8_t* dst) noexcept {
+    switch(itemsize){
+    case 2: shuffle_bytes_n<2>(src,n,itemsize,dst); break;
+    case 4: shuffle_bytes_n<4>(src,n,itemsize,dst); break;
+    case 8: shuffle_bytes_n<8>(src,n,itemsize,dst); break;
+    default: shuffle_bytes_n<0>(src,n,itemsize,dst);
+    }
+  }
+  inline void unshuffle_bytes(const std::uint8_t* src,std::size_t n,
+			      std::size_t itemsize,std::uint8_t* dst) noexcept {
+    switch(itemsize){
+    case 2: unshuffle_bytes_n<2>(src,n,itemsize,dst); break;
+    case 4: unshuffle_bytes_n<4>(src,n,itemsize,dst); break;
+    case 8: unshuffle_bytes_n<8>(src,n,itemsize,dst); break;
+    default: unshuffle_bytes_n<0>(src,n,itemsize,dst);
+    }
+  }
+
+  // Compressed rows of a field. Each row is byte shuffled and run length
+  // coded at `store()`, and kept as a blob in size class slabs indexed by
+  // the fixed size slot array. Rows which do not shrink are kept as they
+  // are. Blobs of overwritten rows go back to free lists of their class.
+  // `gather()` decodes rows into C-contiguous outputs over thread pool.
+  class CppCompressedStore {
+  private:
+    struct Slot {
+      std::uint64_t handle;
+      std::uint32_t length;
+      std::uint32_t cls;
+    };
+    static constexpr const std::uint32_t empty = ~std::uint32_t(0);
+    static constexpr const std::size_t min_block = 64;
+    // Rows of at least `grain` bytes are coded in parallel.
+    static constexpr const std::size_t grain = std::size_t(1) << 16;
+
+    std::size_t buffer_size;
+    std::size_t row_bytes;
+    std::size_t itemsize;
+    std::size_t slab_bytes;
+    std::vector<Slot> slots;
+    std::vector<std::vector<std::uint8_t>> slabs;
+    std::vector<std::vector<std::uint64_t>> free_blocks;
+    std::uint64_t cursor;
+    std::size_t stored;
+    std::size_t compressed_bytes;
+    std::shared_ptr<CppThreadPool> pool;
+    std::vector<std::uint8_t> scratch;
+
+    // Size classes: 64, then 4 classes between powers of 2 (80, 96, 112,
+    // 128, 160, ...), so that a block wastes less than 25%.
+    static std::uint32_t class_of(std::size_t bytes) noexcept {
+      if(bytes <= min_block){ return 0; }
+      auto e = std::size_t(0);
+      for(auto v = bytes - 1; v > 1; v >>= 1){ ++e; }
+      const auto step = std::size_t(1) << (e - 2);
+      const auto q = (bytes - (std::size_t(1) << e) + step - 1) / step;
+      return std::uint32_t(1 + (e - 6)*4 + (q - 1));
+    }
+    static std::size_t class_size(std::uint32_t cls) noexcept {
+      if(cls == 0){ return min_block; }
+      const auto e = 6 + (cls - 1)/4;
+      const auto q = (cls - 1)%4 + 1;
+      return (std::size_t(1) << e) + q * (std::size_t(1) << (e - 2));
+    }
+
+    std::uint8_t* block(std::uint64_t handle) noexcept {
+      return slabs[handle / slab_bytes].data() + handle % slab_bytes;
+    }
+    const std::uint8_t* block(std::uint64_t handle) const noexcept {
+      return slabs[handle / slab_bytes].data() + handle % slab_bytes;
+    }
+
+    std::uint64_t allocate(std::uint32_t cls){
+      auto& blocks = free_blocks[cls];
+      if(!blocks.empty()){
+	const auto h = blocks.back();
+	blocks.pop_back();
+	return h;
+      }
+
+      const auto size = class_size(cls);
+      // Blocks never straddle slabs.
+      if(cursor + size > slabs.size() * slab_bytes){
+	cursor = slabs.size() * slab_bytes;
+	slabs.emplace_back(slab_bytes);
+      }
+      const auto h = cursor;
+      cursor += size;
+      return h;
+    }
+
+    void release(std::size_t slot){
+      auto& s = slots[slot];
+      if(s.cls == empty){ return; }
+      free_blocks[s.cls].push_back(s.handle);
+      compressed_bytes -= s.length;
+      s.cls = empty;
+    }
+
+    std::size_t chunks(std::size_t N) const noexcept {
+      if(!pool || (N < 2) || (N * row_bytes < grain)){ return 1; }
+      return std::min(4 * pool->size(),N);
+    }
+
+    template<typename F>
+    void parallel_for(std::size_t N,F&& f){
+      const auto n_chunks = chunks(N);
+      if(n_chunks == 1){
+	f(std::size_t(0),std::size_t(0),N);
+	return;
+      }
+      pool->run(n_chunks,[&](std::size_t c){
+	f(c,c * N / n_chunks,(c + 1) * N / n_chunks);
+      });
+    }
+
+    void reserve_scratch(){
+      // A row sized working region for each chunk
+      const auto n_chunks = pool ? 4 * pool->size() : std::size_t(1);
+      scratch.assign(n_chunks * row_bytes,0);
+    }
+  public:
+    CppCompressedStore(std::size_t buffer_size=1,std::size_t row_bytes=1,
+		       std::size_t itemsize=1)
+      : buffer_size{std::max(buffer_size,std::size_t(1))},
+	row_bytes{row_bytes},
+	itemsize{std::max(itemsize,std::size_t(1))},
+	slab_bytes{std::max(std::size_t(1) << 20,
+			    class_size(class_of(std::max(row_bytes,
+							 std::size_t(1)))))},
+	slots(this->buffer_size,Slot{0,0,empty}),
+	slabs{},
+	free_blocks(class_of(slab_bytes) + 1),
+	cursor{0},
+	stored{0},
+	compressed_bytes{0},
+	pool{nullptr},
+	scratch{}
+    {
+      reserve_scratch();
+    }
+    CppCompressedStore(const CppCompressedStore&) = default;
+    CppCompressedStore(CppCompressedStore&&) = default;
+    CppCompressedStore& operator=(const CppCompressedStore&) = default;
+    CppCompressedStore& operator=(CppCompressedStore&&) = default;
+    ~CppCompressedStore() = default;
+
+    void set_num_threads(std::size_t num_threads){
+      num_threads = std::max(num_threads,std::size_t(1));
+      if(num_threads == (pool ? pool->size(): std::size_t(1))){ return; }
+      pool = (num_threads > 1) ?
+	std::make_shared<CppThreadPool>(num_threads): nullptr;
+      reserve_scratch();
+    }
+    std::size_t get_num_threads() const noexcept {
+      return pool ? pool->size() : std::size_t(1);
+    }
+
+    // value: C-contiguous N rows. Only the last `buffer_size` rows are kept.
+    void store(std::size_t index,std::size_t N,const void* value){
+      const auto skip = (N > buffer_size) ? N - buffer_size : std::size_t(0);
+      const auto n = N - skip;
+      const auto src = static_cast<const std::uint8_t*>(value) + skip*row_bytes;
+      const auto bound = rle_bound(row_bytes);
+
+      auto coded = std::vector<std::uint8_t>(n * bound);
+      auto lengths = std::vector<std::size_t>(n);
+      parallel_for(n,[&](std::size_t c,std::size_t begin,std::size_t end){
+	auto tmp = this->scratch.data() + c*this->row_bytes;
+	for(auto r = begin; r < end; ++r){
+	  const auto row = src + r*this->row_bytes;
+	  auto out = coded.data() + r*bound;
+	  auto in = row;
+	  if((this->itemsize > 1) && (this->row_bytes % this->itemsize == 0)){
+	    shuffle_bytes(row,this->row_bytes/this->itemsize,this->itemsize,tmp);
+	    in = tmp;
+	  }
+	  lengths[r] = rle_encode(in,this->row_bytes,out);
+	  if(lengths[r] >= this->row_bytes){
+	    std::memcpy(out,row,this->row_bytes);
+	    lengths[r] = this->row_bytes;
+	  }
+	}
+      });
+
+      for(std::size_t r = 0; r < n; ++r){
+	const auto slot = (index + skip + r) % buffer_size;
+	release(slot);
+
+	const auto cls = class_of(std::max(lengths[r],std::size_t(1)));
+	const auto h = allocate(cls);
+	std::memcpy(block(h),coded.data() + r*bound,lengths[r]);
+	slots[slot] = Slot{h,std::uint32_t(lengths[r]),cls};
+	compressed_bytes += lengths[r];
+      }
+      stored = std::min(stored + n,buffer_size);
+    }
+
+    // Rows never stored are filled with 0.
+    template<typename I>
+    void gather(const I* indexes,std::size_t N,void* value) noexcept {
+      if(!value){ return; }
+      auto dst = static_cast<std::uint8_t*>(value);
+      const auto shuffled = ((itemsize > 1) && (row_bytes % itemsize == 0));
+
+      parallel_for(N,[&](std::size_t c,std::size_t begin,std::size_t end){
+	auto tmp = this->scratch.data() + c*this->row_bytes;
+	for(auto n = begin; n < end; ++n){
+	  const auto& s = this->slots[std::size_t(indexes[n])];
+	  auto out = dst + n*this->row_bytes;
+	  if(s.cls == empty){
+	    std::memset(out,0,this->row_bytes);
+	  }else if(s.length == this->row_bytes){
+	    std::memcpy(out,this->block(s.handle),this->row_bytes);
+	  }else if(shuffled){
+	    rle_decode(this->block(s.handle),s.length,tmp,this->row_bytes);
+	    unshuffle_bytes(tmp,this->row_bytes/this->itemsize,this->itemsize,out);
+	  }else{
+	    rle_decode(this->block(s.handle),s.length,out,this->row_bytes);
+	  }
+	}
+      });
+    }
+
+    void clear() noexcept {
+      for(auto& s : slots){ s.cls = empty; }
+      for(auto& b : free_blocks){ b.clear(); }
+      slabs.clear();
+      cursor = 0;
+      stored = 0;
+      compressed_bytes = 0;
+    }
+
+    std::size_t get_stored_size() const noexcept { return stored; }
+    std::size_t get_row_bytes() const noexcept { return row_bytes; }
+    // Bytes of coded rows currently referenced by slots
+    std::size_t get_compressed_bytes() const noexcept { return compressed_bytes; }
+    // Bytes of allocated slabs (including free blocks)
+    std::size_t get_allocated_bytes() const noexcept {
+      return slabs.size() * slab_bytes;
+    }
+  };
+
+  enum class LaBERWeight : int { Mean = 0, Lazy = 1, Max = 2 };
+
+  // Sub-sampler of Large Batch Experience Replay (LaBER)
+  // Ref: https://arxiv.org/abs/2110.01528
+  //
+  // B local indexes in [0, N) are drawn with probability
+  // p_i = (priority_i + eps) / sum_j (priority_j + eps) by binary search
+  // over cumulative sum, and weights are normalized as
+  //   Mean: mean(p) / p_i,  Lazy: 1 / p_i,  Max: (1 / p_i) / max(1 / p_sampled)
+  template<typename Priority>
+  class CppLaBER {
+  private:
+    CppCounterRNG rng;
+    std::uint64_t sample_count;
+    std::vector<double> cumsum;
+  public:
+    CppLaBER()
+      : rng{(std::uint64_t(std::random_device{}()) << 32) | std::random_device{}()},
+	sample_count{0},cumsum{} {}
+    CppLaBER(const CppLaBER&) = default;
+    CppLaBER(CppLaBER&&) = default;
+    CppLaBER& operator=(const CppLaBER&) = default;
+    CppLaBER& operator=(CppLaBER&&) = default;
+    ~CppLaBER() = default;
+
+    void set_seed(std::uint64_t seed){
+      rng.set_seed(seed);
+      sample_count = 0;
+    }
+
+    // Return false when any (priority + eps) is negative or not finite,
+    // or all of them are zero.
+    template<typename P>
+    bool sample(const P* priorities,std::size_t N,std::size_t B,Priority eps,
+		int weight,std::size_t* indexes,Priority* weights) noexcept {
+      if(N == 0){ return B == 0; }
+
+      cumsum.resize(N);
+      auto total = 0.0;
+      for(std::size_t i = 0; i < N; ++i){
+	const auto p = double(priorities[i]) + double(eps);
+	if(!(p >= 0.0) || !std::isfinite(p)){ return false; }
+	total += p;
+	cumsum[i] = total;
+      }
+      if(!(total > 0.0) || !std::isfinite(total)){ return false; }
+
+      const auto stream = sample_count++;
+      auto min_p = std::numeric_limits<double>::max();
+      for(std::size_t b = 0; b < B; ++b){
+	const auto mass = rng.uniform<double>(stream,b) * total;
+	auto i = std::size_t(std::upper_bound(cumsum.begin(),cumsum.end(),mass)
+			     - cumsum.begin());
+	i = std::min(i,N - 1);
+	indexes[b] = i;
+
+	const auto p = double(priorities[i]) + double(eps);
+	min_p = std::min(min_p,p);
+	switch(LaBERWeight(weight)){
+	case LaBERWeight::Mean: weights[b] = Priority(total / (N * p)); break;
+	case LaBERWeight::Lazy: weights[b] = Priority(total / p); break;
+	default: weights[b] = Priority(1.0 / p); break;
+	}
+      }
+
+      if(LaBERWeight(weight) == LaBERWeight::Max){
+	for(std::size_t b = 0; b < B; ++b){ weights[b] *= Priority(min_p); }
+      }
+      return true;
     }
   };
 
-  template<typename Priority,bool MultiThread = false>
+  // pow(x, a) of float for a > 0 without libm call, so that a loop over
+  // priorities is vectorized under the default (trapping, errno setting) math.
+  // Evaluated as exp2(a * log2(x)) in double, whose error is below float
+  // rounding. Branches are replaced by bitwise select, since conditional
+  // float operations block vectorization with trapping math.
+  inline float pow_float(float x,double a) noexcept {
+    const bool regular = (x > 0.0f) & (x < std::numeric_limits<float>::infinity());
+
+    // x = m * 2^e, sqrt(1/2) <= m < sqrt(2). (Subnormal x is scaled by 2^64.)
+    const bool subnormal = (x < std::numeric_limits<float>::min());
+    const float xs = x * (subnormal ? 18446744073709551616.0f : 1.0f);
+    std::int32_t bits;
+    std::memcpy(&bits,&xs,sizeof(bits));
+    std::int32_t e = ((bits >> 23) & 0xff) - 127;
+    std::int32_t mbits = (bits & 0x007fffff) | 0x3f800000;
+    const std::int32_t adjust = ((mbits & 0x007fffff) > 0x3504f3) ? 1 : 0;
+    mbits -= adjust << 23;
+    e += adjust - (subnormal ? 64 : 0);
+    float mf;
+    std::memcpy(&mf,&mbits,sizeof(mf));
+
+    // log(m) = 2 atanh(s), s = (m - 1) / (m + 1), |s| < 0.172
+    const double m = mf;
+    const double s = (m - 1.0) / (m + 1.0);
+    const double s2 = s * s;
+    const double t = 1.0/3 + s2*(1.0/5 + s2*(1.0/7 + s2*(1.0/9 + s2*(1.0/11 +
+		     s2*(1.0/13 + s2*(1.0/15))))));
+    const double log2m = (2.0 * 1.4426950408889634) * s * (1.0 + s2 * t);
+
+    // Clamp y into [-300, 300] and NaN to -300 for integer conversion.
+    // (std::fmin / std::fmax are not vectorized)
+    double y = a * (double(e) + log2m);
+    {
+      const double lo = -300.0, hi = 300.0;
+      std::int64_t yb, lb, hb;
+      std::memcpy(&yb,&y,sizeof(yb));
+      std::memcpy(&lb,&lo,sizeof(lb));
+      std::memcpy(&hb,&hi,sizeof(hb));
+      const std::int64_t ml = -std::int64_t(!(y >= lo));
+      const std::int64_t mh = -std::int64_t(y > hi);
+      yb = (yb & ~ml) | (lb & ml);
+      yb = (yb & ~mh) | (hb & mh);
+      std::memcpy(&y,&yb,sizeof(y));
+    }
+
+    // 2^y = 2^n * exp(g), n = round(y), |g| <= ln(2) / 2
+    const double n = (y + 6755399441055744.0) - 6755399441055744.0;
+    const double g = (y - n) * 0.6931471805599453;
+    const double ex = 1.0 + g*(1.0 + g*(1.0/2 + g*(1.0/6 + g*(1.0/24 +
+		      g*(1.0/120 + g*(1.0/720 + g*(1.0/5040 + g*(1.0/40320 +
+		      g*(1.0/362880 + g*(1.0/3628800))))))))));
+
+    // 2^n as product of two normal floats, which rounds to inf or subnormal.
+    const auto k = std::int32_t(n);
+    std::int32_t k1 = k / 2;
+    k1 = (k1 < -126) ? -126 : ((k1 > 127) ? 127 : k1);
+    std::int32_t k2 = k - k1;
+    k2 = (k2 < -126) ? -126 : ((k2 > 127) ? 127 : k2);
+    const std::int32_t b1 = (k1 + 127) << 23, b2 = (k2 + 127) << 23;
+    float f1, f2;
+    std::memcpy(&f1,&b1,sizeof(f1));
+    std::memcpy(&f2,&b2,sizeof(f2));
+    const float r = float(ex) * f1 * f2;
+
+    // pow(0, a) = 0, pow(inf, a) = inf, otherwise NaN
+    const float special
+      = (x >= 0.0f) ? x : std::numeric_limits<float>::quiet_NaN();
+
+    std::int32_t rb, sb;
+    std::memcpy(&rb,&r,sizeof(rb));
+    std::memcpy(&sb,&special,sizeof(sb));
+    const std::int32_t mask = -std::int32_t(regular);
+    const std::int32_t ob = (rb & mask) | (sb & ~mask);
+    float o;
+    std::memcpy(&o,&ob,sizeof(o));
+    return o;
+  }
+
+  template<typename Priority,bool MultiThread = false,std::size_t Arity = 2>
   class CppPrioritizedSampler {
   private:
     using ThreadSafePriority_t = ThreadSafe<MultiThread,Priority>;
+    using Node_t = SumMin<Priority>;
+    using Tree_t = SegmentTree<Node_t,MultiThread,SumMinOp<Priority>,Arity>;
+    static_assert(sizeof(Node_t) == 2 * sizeof(Priority),
+		  "SumMin<Priority> must be packed for external buffer");
     Priority alpha;
     typename ThreadSafePriority_t::type* max_priority;
     std::shared_ptr<typename ThreadSafePriority_t::type> max_priority_view;
     const Priority default_max_priority;
-    SegmentTree<Priority,MultiThread> sum;
-    SegmentTree<Priority,MultiThread> min;
-    std::mt19937 g;
+    Tree_t tree;
+    CppCounterRNG rng;
+    std::uint64_t sample_count;
+    std::shared_ptr<CppThreadPool> pool;
     Priority eps;
+    std::vector<Node_t> leaves;
+
+    static constexpr Node_t leaf(Priority v){ return Node_t{v,v}; }
+    static constexpr Node_t empty_leaf(){
+      return Node_t{Priority{0},std::numeric_limits<Priority>::max()};
+    }
+
+    // Split [0,N) into chunks for thread pool. (Single thread tree is not
+    // modified by descent, so that it can be read concurrently.)
+    template<typename F>
+    void parallel_for(std::size_t N,F&& f){
+      constexpr const std::size_t grain = 512;
+      if(MultiThread || !pool || (N < 2 * grain)){
+	f(std::size_t(0),N);
+	return;
+      }
+
+      const auto chunks = std::min(4 * pool->size(),(N + grain - 1) / grain);
+      pool->run(chunks,[&](std::size_t c){
+	f(c * N / chunks,(c + 1) * N / chunks);
+      });
+    }
 
     void sample_proportional(std::size_t batch_size,
 			     std::vector<std::size_t>& indexes,
 			     std::size_t stored_size){
-      indexes.resize(0);
-      indexes.reserve(batch_size);
+      indexes.resize(batch_size);
 
-      auto every_range_len
-	= Priority{1.0} * sum.reduce(0,stored_size) / batch_size;
+      // `reduce` also applies pending (multi thread) updates before descent.
+      const auto every_range_len
+	= Priority{1.0} * tree.reduce(0,stored_size).sum / batch_size;
+      const auto stream = sample_count++;
 
-      std::generate_n(std::back_inserter(indexes),batch_size,
-		      [=,i=std::size_t(0),
-		       d=std::uniform_real_distribution<Priority>{}]()mutable{
-			auto mass = (d(this->g) + (i++))*every_range_len;
-			return this->sum.largest_region_index([=](auto v){
-								return v <= mass;
-							      },stored_size);
-		      });
+      parallel_for(batch_size,[&](std::size_t begin,std::size_t end){
+	for(auto i = begin; i < end; ++i){
+	  const auto mass
+	    = (rng.template uniform<Priority>(stream,i) + i) * every_range_len;
+	  indexes[i] = this->tree.largest_region_index([=](const auto& v){
+							 return v.sum <= mass;
+						       },stored_size);
+	}
+      });
     }
 
     void set_weights(const std::vector<std::size_t>& indexes,Priority beta,
 		     std::vector<Priority>& weights,std::size_t stored_size) {
-      weights.resize(0);
-      weights.reserve(indexes.size());
+      weights.resize(indexes.size());
 
       auto b_size = stored_size;
-      auto inv_sum = Priority{1.0} / sum.reduce(0,b_size);
-      auto p_min = min.reduce(0,b_size) * inv_sum;
+      const auto r = tree.reduce(0,b_size);
+      auto inv_sum = Priority{1.0} / r.sum;
+      auto p_min = r.min * inv_sum;
       auto inv_max_weight = Priority{1.0} / std::pow(p_min * b_size,-beta);
 
-      std::transform(indexes.begin(),indexes.end(),std::back_inserter(weights),
-		     [=](auto idx){
-		       auto p_sample = this->sum.get(idx) * inv_sum;
-		       return std::pow(p_sample*b_size,-beta)*inv_max_weight;
-		     });
+      parallel_for(indexes.size(),[&](std::size_t begin,std::size_t end){
+	for(auto i = begin; i < end; ++i){
+	  auto p_sample = this->tree.get(indexes[i]).sum * inv_sum;
+	  weights[i] = std::pow(p_sample*b_size,-beta)*inv_max_weight;
+	}
+      });
     }
 
-    template<typename F>
-    void set_priorities(std::size_t next_index,F&& f,
-			std::size_t N,std::size_t buffer_size){
-      sum.set(next_index,std::forward<F>(f),N,buffer_size);
-      min.set(next_index,std::forward<F>(f),N,buffer_size);
+    template<typename P>
+    void transform_priorities(const P* p,std::size_t N,Node_t* out) const {
+      // Straight loop over contiguous arrays without dependency between
+      // iterations. std::pow is not vectorized without -fno-math-errno,
+      // so that float priorities use pow_float instead.
+      const auto a = alpha;
+      const auto e = eps;
+      if constexpr (std::is_same_v<Priority,float>){
+	if(a > 0){
+	  const auto ad = double(a);
+	  for(auto i = std::size_t(0); i < N; ++i){
+	    out[i] = leaf(pow_float(Priority(p[i]) + e,ad));
+	  }
+	  return;
+	}
+      }
+      for(auto i = std::size_t(0); i < N; ++i){
+	out[i] = leaf(std::pow(Priority(p[i]) + e,a));
+      }
+    }
+
+    // Scalar paths use the same transform as batch ones, so that stored
+    // leaves do not depend on call shape.
+    Node_t transform_priority(Priority p) const {
+      Node_t v;
+      transform_priorities(&p,1,&v);
+      return v;
     }
 
     void set_priority(std::size_t next_index,Priority p){
-      auto v = std::pow(p+eps,alpha);
-      sum.set(next_index,v);
-      min.set(next_index,v);
+      tree.set(next_index,transform_priority(p));
     }
 
   public:
+    static constexpr std::size_t tree_storage_size(std::size_t buffer_size){
+      // Number of Priority required for external tree buffer
+      return 2 * Tree_t::storage_size(PowerOf2(buffer_size));
+    }
+
+    static constexpr std::size_t tree_dirty_storage_size(std::size_t buffer_size){
+      // Number of std::uint64_t required for external dirty bitmap
+      return Tree_t::dirty_storage_size(PowerOf2(buffer_size));
+    }
+
     CppPrioritizedSampler(std::size_t buffer_size,Priority alpha,
 			  Priority* max_p = nullptr,
-			  Priority* sum_ptr = nullptr,
-			  bool* sum_anychanged = nullptr,
-			  Priority* min_ptr = nullptr,
-			  bool* min_anychanged = nullptr,
+			  Priority* tree_ptr = nullptr,
+			  bool* tree_anychanged = nullptr,
+			  std::uint64_t* tree_dirty = nullptr,
 			  bool initialize = true,
 			  Priority eps = Priority{1e-4})
       : alpha{alpha},
 	max_priority{(typename ThreadSafePriority_t::type*)max_p},
 	max_priority_view{},
 	default_max_priority{1.0},
-	sum{PowerOf2(buffer_size),[](auto a,auto b){ return a+b; },
-	    Priority{0},
-	    sum_ptr,sum_anychanged,initialize},
-	min{PowerOf2(buffer_size),[](Priority a,Priority b){ return  std::min(a,b); },
-	    std::numeric_limits<Priority>::max(),
-	    min_ptr,min_anychanged,initialize},
-	g{std::random_device{}()},
-	eps{eps}
+	tree{PowerOf2(buffer_size),SumMinOp<Priority>{},
+	     empty_leaf(),
+	     reinterpret_cast<Node_t*>(tree_ptr),tree_anychanged,initialize,
+	     tree_dirty},
+	rng{(std::uint64_t(std::random_device{}()) << 32) | std::random_device{}()},
+	sample_count{0},
+	pool{},
+	eps{eps},
+	leaves{}
     {
       if(!max_priority){
 	max_priority = new typename ThreadSafePriority_t::type{};
@@ -404,17 +2539,46 @@ namespace ymd {
       sample_proportional(batch_size,indexes,stored_size);
       set_weights(indexes,beta,weights,stored_size);
     }
+
+    // Sampling depends only on seed, the number of previous `sample` calls
+    // and priorities. (not on the number of threads)
+    void set_seed(std::uint64_t seed){
+      rng.set_seed(seed);
+      sample_count = 0;
+    }
+
+    // Threads for sampling and weight calculation. Multi thread sampler
+    // ignores it, since its tree might be updated concurrently.
+    void set_num_threads(std::size_t num_threads){
+      num_threads = std::max(num_threads,std::size_t(1));
+      if(num_threads == (pool ? pool->size(): std::size_t(1))){ return; }
+      pool = (num_threads > 1) ?
+	std::make_shared<CppThreadPool>(num_threads): nullptr;
+    }
+    std::size_t get_num_threads() const noexcept {
+      return pool ? pool->size(): std::size_t(1);
+    }
     virtual void clear(){
       ThreadSafePriority_t::store(max_priority,default_max_priority,
 				  std::memory_order_release);
-      sum.clear();
-      min.clear(std::numeric_limits<Priority>::max());
+      tree.clear(empty_leaf());
     }
 
     Priority get_max_priority() const {
       return ThreadSafePriority_t::load(max_priority,std::memory_order_acquire);
     }
 
+    // Sum and minimum of stored (transformed) priorities `(p + eps)^alpha`
+    Priority get_sum(std::size_t stored_size){
+      return tree.reduce(0,stored_size).sum;
+    }
+    Priority get_min(std::size_t stored_size){
+      return tree.reduce(0,stored_size).min;
+    }
+
+    void enable_stats(bool enable){ tree.enable_stats(enable); }
+    TreeStats get_tree_stats() const { return tree.get_stats(); }
+
     template<typename P,
 	     std::enable_if_t<std::is_convertible_v<P,Priority>,
 			      std::nullptr_t> = nullptr>
@@ -435,18 +2599,20 @@ namespace ymd {
 			std::size_t N,std::size_t buffer_size){
       ThreadSafePriority_t::store_max(max_priority, *std::max_element(p,p+N));
 
-      set_priorities(next_index,
-		     [=]() mutable { return std::pow(eps + *(p++),alpha); },
-		     N,buffer_size);
+      std::vector<Node_t> local{};
+      auto& v = MultiThread ? local: leaves;
+      v.resize(N);
+      transform_priorities(p,N,v.data());
+      tree.set(next_index,[it=v.data()]() mutable { return *(it++); },
+	       N,buffer_size);
     }
 
     void set_priorities(std::size_t next_index,
 			std::size_t N,std::size_t buffer_size){
-      const auto v = std::pow(ThreadSafePriority_t::load(max_priority,
-							 std::memory_order_acquire)
-			      + eps,
-			      alpha);
-      set_priorities(next_index,[=](){ return v; },N,buffer_size);
+      const auto v
+	= transform_priority(ThreadSafePriority_t::load(max_priority,
+							std::memory_order_acquire));
+      tree.set(next_index,[=](){ return v; },N,buffer_size);
     }
 
     template<typename I,typename P,
@@ -455,20 +2621,19 @@ namespace ymd {
 	     std::enable_if_t<std::is_convertible_v<P,Priority>,
 			      std::nullptr_t> = nullptr>
     void update_priorities(I* indexes, P* priorities,std::size_t N =1){
+      if(!N){ return; }
 
-      const auto max_p =
-	std::accumulate(indexes,indexes+N,
-			ThreadSafePriority_t::load(max_priority,
-						   std::memory_order_acquire),
-			[=,p=priorities]
-			(auto max_p, auto index) mutable {
-			  Priority v = std::pow(*p + this->eps,this->alpha);
-			  this->sum.set(index,v);
-			  this->min.set(index,v);
+      // (1) Transform whole batch, (2) write leaves,
+      // (3) update union of ancestors level by level.
+      std::vector<Node_t> local{};
+      auto& v = MultiThread ? local: leaves;
+      v.resize(N);
+      transform_priorities(priorities,N,v.data());
+      tree.set(indexes,v.data(),N);
 
-			  return std::max<Priority>(max_p,*(p++));
-			});
-      ThreadSafePriority_t::store_max(max_priority,max_p);
+      ThreadSafePriority_t::store_max(max_priority,
+				      Priority(*std::max_element(priorities,
+								 priorities+N)));
     }
 
     template<typename I,typename P,
@@ -483,14 +2648,59 @@ namespace ymd {
 			std::min(indexes.size(),priorities.size()));
     }
 
+    // Sequence priority: eta * max + (1 - eta) * mean over `L` priorities
+    // of each index. Steps with `mask == 0` are ignored, and sequences
+    // without any valid steps keep their priorities.
+    template<typename I,typename P,
+	     std::enable_if_t<std::is_convertible_v<I,std::size_t>,
+			      std::nullptr_t> = nullptr,
+	     std::enable_if_t<std::is_convertible_v<P,Priority>,
+			      std::nullptr_t> = nullptr>
+    void update_sequence_priorities(I* indexes,P* priorities,
+				    std::size_t N,std::size_t L,Priority eta,
+				    const std::uint8_t* mask = nullptr){
+      auto idx = std::vector<std::size_t>{};
+      auto ps = std::vector<Priority>{};
+      idx.reserve(N);
+      ps.reserve(N);
+
+      for(std::size_t n = 0; n < N; ++n){
+	auto p_max = Priority{0};
+	auto p_sum = Priority{0};
+	std::size_t count = 0;
+	for(std::size_t l = 0; l < L; ++l){
+	  if(mask && !mask[n*L + l]){ continue; }
+	  const auto p = Priority(priorities[n*L + l]);
+	  p_max = std::max(p_max,p);
+	  p_sum += p;
+	  ++count;
+	}
+	if(!count){ continue; }
+
+	idx.push_back(indexes[n]);
+	ps.push_back(eta * p_max + (Priority{1} - eta) * p_sum / count);
+      }
+
+      update_priorities(idx.data(),ps.data(),idx.size());
+    }
+
     void set_eps(Priority eps){
       this->eps = eps;
     }
 
+    // Raw sum/min tree storage (`tree_data_size()` Priority) for checkpoint
+    Priority* tree_data() noexcept {
+      return reinterpret_cast<Priority*>(tree.data());
+    }
+    std::size_t tree_data_size() const noexcept { return 2 * tree.data_size(); }
+
+    void set_max_priority(Priority p){
+      ThreadSafePriority_t::store(max_priority,p,std::memory_order_release);
+    }
+
     void weak_update_changed(){
       if constexpr (MultiThread) {
-	sum.weak_update_changed();
-	min.weak_update_changed();
+	tree.weak_update_changed();
       }
     }
   };
@@ -1,5 +1,6 @@
 from libcpp.vector cimport vector
 from libcpp cimport bool
+from libc.stdint cimport uint8_t, uint64_t
 
 cdef extern from "ReplayBuffer.hh" namespace "ymd":
     void clear[B](B*)
@@ -7,27 +8,56 @@ cdef extern from "ReplayBuffer.hh" namespace "ymd":
     size_t get_stored_size[B](B*)
     size_t get_next_index[B](B*)
 
+    cdef cppclass MemoryPolicy:
+        MemoryPolicy()
+    MemoryPolicy make_memory_policy(int,int,bool,size_t)
+    void set_default_memory_policy(const MemoryPolicy&)
+    MemoryPolicy& default_memory_policy()
+    void* allocate_memory(size_t,const MemoryPolicy&,size_t&) except +
+    void deallocate_memory(void*,size_t)
+
     cdef cppclass CppSelectiveEnvironment[Obs,Act,Rew,Done]:
         CppSelectiveEnvironment(size_t,size_t,size_t,size_t,size_t) except +
+        CppSelectiveEnvironment(size_t,size_t,size_t,size_t,size_t,bool) except +
         size_t store[O,A,R,NO,D](O*,A*,R*,NO*,D*,size_t)
         void get_episode(size_t,size_t&,
                          Obs*&,Act*&,Rew*&,Obs*&,Done*&)
         size_t delete_episode(size_t)
         size_t get_stored_episode_size()
         void get_buffer_pointers(Obs*&,Act*&,Rew*&,Obs*&,Done*&)
+        bool is_block()
+        bool get_indexes[I](const I*,size_t,size_t*)
+    cdef cppclass TreeStats:
+        uint64_t full_rebuilds
+        uint64_t incremental_updates
+        uint64_t updated_leaves
     cdef cppclass CppPrioritizedSampler[Prio]:
         CppPrioritizedSampler(size_t,Prio) except +
-        void sample(size_t,Prio,vector[Prio]&,vector[size_t]&,size_t)
+        CppPrioritizedSampler(size_t,Prio,Prio*,Prio*,bool*,uint64_t*,
+                              bool,Prio) except +
+        void sample(size_t,Prio,vector[Prio]&,vector[size_t]&,size_t) nogil
+        void set_seed(uint64_t)
+        void set_num_threads(size_t) except +
+        size_t get_num_threads()
         void set_priorities(size_t)
         void set_priorities[P](size_t,P)
         void set_priorities(size_t,size_t,size_t)
         void set_priorities[P](size_t,P*,size_t,size_t)
         void update_priorities[I,P](I*,P*,size_t)
+        void update_sequence_priorities[I,P](I*,P*,size_t,size_t,Prio,
+                                             const uint8_t*) except +
         Prio get_max_priority()
+        Prio get_sum(size_t)
+        Prio get_min(size_t)
+        void enable_stats(bool)
+        TreeStats get_tree_stats()
         void set_eps(Prio)
+        Prio* tree_data()
+        size_t tree_data_size()
+        void set_max_priority(Prio)
     cdef cppclass CppThreadSafePrioritizedSampler[Prio]:
         CppThreadSafePrioritizedSampler(size_t,Prio,Prio*,
-                                        Prio*,bool*,Prio*,bool*,
+                                        Prio*,bool*,uint64_t*,
                                         bool,float) except +
         void sample(size_t,Prio,vector[Prio]&,vector[size_t]&,size_t)
         void set_priorities(size_t)
@@ -36,3 +66,97 @@ cdef extern from "ReplayBuffer.hh" namespace "ymd":
         void set_priorities[P](size_t,P*,size_t,size_t)
         void update_priorities[I,P](I*,P*,size_t)
         Prio get_max_priority()
+        void enable_stats(bool)
+        TreeStats get_tree_stats()
+    cdef cppclass CppNstepBuffer[Float]:
+        CppNstepBuffer()
+        CppNstepBuffer(size_t,Float)
+        void reset(size_t,Float)
+        size_t add_field(size_t)
+        size_t add_reward(size_t)
+        size_t add_next(size_t)
+        size_t output_size(size_t)
+        void add(size_t,const Float*,void**,Float**,void**,
+                 Float*,void**,Float**,void**)
+        void on_episode_end(Float*,void**,Float**,void**)
+        void clear()
+        size_t get_stored_size()
+        size_t get_Nstep_size()
+    cdef cppclass CppSampleGather:
+        CppSampleGather()
+        CppSampleGather(size_t)
+        void reset(size_t)
+        size_t add_field[S](const void*,size_t,size_t,const S*,const S*,
+                            size_t,const void*) except +
+        size_t get_field_size()
+        bool set_storage(size_t,int,size_t,double,double)
+        bool gather[I](const I*,size_t,size_t,void**,const uint8_t*,
+                       vector[size_t]&) nogil
+    cdef cppclass CppBatchStore:
+        CppBatchStore()
+        CppBatchStore(size_t)
+        void reset(size_t)
+        size_t add_field(void*,size_t,int) except +
+        size_t get_field_size()
+        bool store(const void**,const int*,const uint8_t*,size_t,size_t) nogil
+        @staticmethod
+        bool can_convert(int,int)
+    cdef cppclass CppFrameStore:
+        CppFrameStore()
+        CppFrameStore(size_t,size_t,size_t,size_t,bool,
+                      const MemoryPolicy&) except +
+        void store(size_t,size_t,const void*,const void*) except +
+        void gather[I](const I*,size_t,void*,void*) nogil
+        void on_episode_end()
+        void clear()
+        size_t get_state_size()
+        void get_state(uint64_t*)
+        void set_state(const uint64_t*) except +
+        uint64_t* ids_data()
+        size_t ids_size()
+        size_t frames_size()
+        void copy_frames(uint8_t*)
+        void restore_frames(const uint8_t*)
+        size_t get_frame_bytes()
+        bool has_next() nogil
+        size_t get_capacity()
+        size_t get_stored_frames()
+    cdef cppclass CppCompressedStore:
+        CppCompressedStore()
+        CppCompressedStore(size_t,size_t,size_t) except +
+        void set_num_threads(size_t) except +
+        size_t get_num_threads()
+        void store(size_t,size_t,const void*) except +
+        void gather[I](const I*,size_t,void*) nogil
+        void clear()
+        size_t get_stored_size()
+        size_t get_row_bytes()
+        size_t get_compressed_bytes()
+        size_t get_allocated_bytes()
+    void sequence_indexes[I,E](const I*,size_t,size_t,size_t,size_t,size_t,size_t,
+                               const E*,size_t*,uint8_t*) nogil
+    cdef cppclass CppCounterRNG:
+        CppCounterRNG()
+        CppCounterRNG(uint64_t)
+        uint64_t get_seed()
+        uint64_t index(uint64_t,uint64_t,uint64_t) nogil
+        CppCounterRNG split(uint64_t)
+    void uniform_indexes(const CppCounterRNG&,uint64_t,size_t,size_t,size_t*) nogil
+    void reverse_indexes(size_t,size_t,size_t,size_t,size_t*) nogil
+    cdef cppclass CppLaBER[Prio]:
+        CppLaBER() except +
+        void set_seed(uint64_t)
+        bool sample[P](const P*,size_t,size_t,Prio,int,size_t*,Prio*) nogil
+    cdef cppclass CppThreadSafeRingBufferIndex:
+        CppThreadSafeRingBufferIndex(size_t,uint64_t*,bool) except +
+        size_t fetch_add(size_t)
+        size_t get_next_index()
+        size_t get_stored_size()
+        uint64_t get_count()
+        void clear()
+    cdef cppclass CppSlotSeqLock:
+        CppSlotSeqLock(size_t,uint64_t*) except +
+        void write_begin(size_t,size_t)
+        void write_end(size_t,size_t)
+        void read_begin[I](const I*,size_t,uint64_t*)
+        size_t read_validate[I](const I*,size_t,const uint64_t*,uint8_t*)
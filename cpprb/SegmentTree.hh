@@ -1,13 +1,17 @@
 #ifndef YMD_SEGMENTTREE_HH
 #define YMD_SEGMENTTREE_HH 1
 
+#include <algorithm>
 #include <type_traits>
 #include <functional>
 #include <utility>
 #include <vector>
-#include <set>
 #include <atomic>
+#include <cstdint>
 #include <memory>
+#include <new>
+
+#include "Memory.hh"
 
 namespace ymd {
   inline constexpr auto PowerOf2(const std::size_t n) noexcept {
@@ -16,99 +20,282 @@ namespace ymd {
     return m;
   }
 
-  template<typename T,bool MultiThread = false>
+  inline constexpr auto PowerOf(const std::size_t n,const std::size_t base) noexcept {
+    auto m = std::size_t(1);
+    while(m < n){ m *= base; }
+    return m;
+  }
+
+  template<typename T> struct SumOp {
+    constexpr T operator()(const T& a,const T& b) const { return a + b; }
+  };
+
+  template<typename T> struct MinOp {
+    constexpr T operator()(const T& a,const T& b) const { return std::min(a,b); }
+  };
+
+  template<typename T> struct SumMin {
+    T sum;
+    T min;
+
+    friend constexpr bool operator==(const SumMin& a,const SumMin& b){
+      return (a.sum == b.sum) && (a.min == b.min);
+    }
+    friend constexpr bool operator!=(const SumMin& a,const SumMin& b){
+      return !(a == b);
+    }
+  };
+
+  template<typename T> struct SumMinOp {
+    constexpr SumMin<T> operator()(const SumMin<T>& a,const SumMin<T>& b) const {
+      return {a.sum + b.sum, std::min(a.min,b.min)};
+    }
+  };
+
+  // Counters of internal node updates (collected only when enabled)
+  struct TreeStats {
+    std::uint64_t full_rebuilds = 0;
+    std::uint64_t incremental_updates = 0;
+    std::uint64_t updated_leaves = 0;
+  };
+
+  template<typename T,bool MultiThread = false,
+	   typename Operator = std::function<T(T,T)>,
+	   std::size_t Arity = 2>
   class SegmentTree {
+    static_assert(Arity >= 2,"Arity of SegmentTree must be 2 or larger");
   private:
-    using F = std::function<T(T,T)>;
+    // Layout: Implicit Arity-ary heap. Node e has children Arity*e+1, ...,
+    //         Arity*e+Arity. For Arity > 2, (Arity-1) padding nodes are put
+    //         in front so that every sibling group starts at a multiple of
+    //         Arity, which makes a group share a cache line.
+    static constexpr const std::size_t padding = (Arity > 2) ? Arity - 1: 0;
+
     const std::size_t buffer_size;
+    const std::size_t internal_size;
     T* buffer;
     std::shared_ptr<T[]> view;
-    F f;
+    T* node;
+    Operator f;
     std::atomic_bool *any_changed;
     std::shared_ptr<std::atomic_bool> any_changed_view;
+    std::atomic<std::uint64_t> *dirty;
+    std::shared_ptr<std::atomic<std::uint64_t>[]> dirty_view;
+    std::vector<std::size_t> nodes_to_update;
+    std::shared_ptr<TreeStats> stats;
 
-    auto _reduce(const std::size_t start,const std::size_t end,std::size_t index,
-		 const std::size_t region_s,const std::size_t region_e) const {
-      if((start <= region_s) && (region_e <= end)){
-	return buffer[index];
-      }
-
-      auto region_m = (region_s + region_e)/2;
+    static constexpr const std::size_t bits = 64;
 
-      if(end <= region_m){
-	return _reduce(start,end,2*index+1,region_s,region_m);
+    T _reduce(const std::size_t start,const std::size_t end,std::size_t index,
+	      const std::size_t region_s,const std::size_t region_e) const {
+      if((start <= region_s) && (region_e <= end)){
+	return node[index];
       }
 
-      if(region_m <= start){
-	return _reduce(start,end,2*index+2,region_m,region_e);
+      const auto width = (region_e - region_s)/Arity;
+      const auto c_begin = (start > region_s) ? (start - region_s)/width: 0;
+      const auto c_end = (std::min(end,region_e) - region_s + width - 1)/width;
+
+      auto child = child_left(index) + c_begin;
+      auto s = region_s + c_begin * width;
+      auto v = _reduce(start,end,child,s,s+width);
+      for(auto c = c_begin + 1; c < c_end; ++c){
+	++child;
+	s += width;
+	v = f(v,_reduce(start,end,child,s,s+width));
       }
-
-      return f(_reduce(start,end,2*index+1,region_s,region_m),
-	       _reduce(start,end,2*index+2,region_m,region_e));
+      return v;
     }
 
-    constexpr std::size_t parent(std::size_t node) const {
-      return node ? (node - 1)/2: node;
+    constexpr std::size_t parent(std::size_t e) const {
+      return e ? (e - 1)/Arity: e;
     }
 
-    constexpr auto child_left(std::size_t node) const {
-      return 2 * node + 1;
-    }
-
-    constexpr auto child_right(std::size_t node) const {
-      return 2 * node + 2;
+    constexpr auto child_left(std::size_t e) const {
+      return Arity * e + 1;
     }
 
     auto access_index(std::size_t i) const {
-      return buffer_size + i - 1;
+      return internal_size + i;
     }
 
     bool update_buffer(std::size_t i){
-      auto tmp = buffer[i];
-      buffer[i] = f(buffer[child_left(i)],buffer[child_right(i)]);
-      return tmp != buffer[i];
+      auto tmp = node[i];
+      auto c = child_left(i);
+      auto v = node[c];
+      for(auto j = std::size_t(1); j < Arity; ++j){
+	v = f(v,node[c+j]);
+      }
+      node[i] = v;
+      return tmp != node[i];
     }
 
     void update_all(){
-      for(std::size_t i = access_index(0) -1, end = -1; i != end; --i){
+      if(stats){ ++stats->full_rebuilds; }
+      for(std::size_t i = internal_size - 1, end = -1; i != end; --i){
 	update_buffer(i);
       }
+    }
+
+    void mark_dirty(std::size_t i,std::size_t N){
+      // Mark leaves [i,i+N) as dirty (MultiThread only)
+      if(!dirty){ return; }
+
+      while(N){
+	const auto w = i / bits;
+	const auto b = i % bits;
+	const auto n = std::min(N,bits - b);
+	const auto mask = (n == bits) ?
+	  ~std::uint64_t(0): (((std::uint64_t(1) << n) - 1) << b);
+	dirty[w].fetch_or(mask,std::memory_order_release);
+	i += n;
+	N -= n;
+      }
+    }
+
+    void update_nodes(std::vector<std::size_t>& nodes){
+      // Update ancestors of (sorted) same depth nodes level by level.
+      // Shared parents are de-duplicated, and the chain is pruned
+      // when a node is not changed.
+      if(stats){
+	++stats->incremental_updates;
+	stats->updated_leaves += nodes.size();
+      }
+      while(!nodes.empty() && nodes.front() != 0){
+	auto out = nodes.begin();
+	auto last = std::size_t(-1);
+	for(auto in = nodes.begin(); in != nodes.end(); ++in){
+	  const auto p = parent(*in);
+	  if(last == p){ continue; }
+	  last = p;
+	  if(update_buffer(p)){ *(out++) = p; }
+	}
+	nodes.erase(out,nodes.end());
+      }
+    }
+
+    void update_changed(){
+      if constexpr (MultiThread){
+	if(!any_changed->exchange(false,std::memory_order_acq_rel)){ return; }
+
+	if(!dirty){
+	  update_all();
+	  return;
+	}
+
+	nodes_to_update.clear();
+	const auto words = dirty_storage_size(buffer_size);
+	for(auto w = std::size_t(0); w < words; ++w){
+	  auto d = dirty[w].exchange(0,std::memory_order_acquire);
+	  while(d){
+	    const auto b = static_cast<std::size_t>(count_trailing_zero(d));
+	    nodes_to_update.push_back(access_index(w * bits + b));
+	    d &= d - 1;
+	  }
+	}
+
+	// Fall back to full rebuild when the incremental update is not cheaper.
+	auto depth = std::size_t(0);
+	for(auto m = buffer_size; m > 1; m /= Arity){ ++depth; }
+	if(nodes_to_update.size() * depth >= internal_size){
+	  update_all();
+	}else{
+	  update_nodes(nodes_to_update);
+	}
+      }
+    }
+
+    void initialize_dirty(){
       if constexpr (MultiThread){
 	any_changed->store(false,std::memory_order_release);
+	if(dirty){
+	  const auto words = dirty_storage_size(buffer_size);
+	  for(auto w = std::size_t(0); w < words; ++w){
+	    dirty[w].store(0,std::memory_order_release);
+	  }
+	}
       }
     }
 
+    static int count_trailing_zero(std::uint64_t v){
+#if defined(__GNUC__) || defined(__clang__)
+      return __builtin_ctzll(v);
+#else
+      auto n = 0;
+      while(!(v & 1)){ v >>= 1; ++n; }
+      return n;
+#endif
+    }
+
   public:
-    SegmentTree(std::size_t n,F f, T v = T{0},
+    static constexpr std::size_t capacity(std::size_t n){
+      return PowerOf(n,Arity);
+    }
+
+    static constexpr std::size_t storage_size(std::size_t n){
+      // Number of T required for external buffer
+      const auto leaf = capacity(n);
+      return padding + (leaf - 1)/(Arity - 1) + leaf;
+    }
+
+    static constexpr std::size_t dirty_storage_size(std::size_t n){
+      // Number of std::uint64_t required for external dirty bitmap
+      return (capacity(n) + bits - 1) / bits;
+    }
+
+    SegmentTree(std::size_t n,Operator f, T v = T{0},
 		T* buffer_ptr = nullptr,
 		bool* any_changed_ptr = nullptr,
-		bool initialize = true)
-      : buffer_size(n),
+		bool initialize = true,
+		std::uint64_t* dirty_ptr = nullptr)
+      : buffer_size(capacity(n)),
+	internal_size((buffer_size - 1)/(Arity - 1)),
 	buffer(buffer_ptr),
 	view{},
+	node{},
 	f(f),
 	any_changed{(std::atomic_bool*)any_changed_ptr},
-	any_changed_view{}
+	any_changed_view{},
+	dirty{(std::atomic<std::uint64_t>*)dirty_ptr},
+	dirty_view{},
+	nodes_to_update{},
+	stats{}
     {
+      static_assert(sizeof(std::atomic<std::uint64_t>) == sizeof(std::uint64_t),
+		    "std::atomic<std::uint64_t> must be compatible with std::uint64_t");
       if(!buffer){
-	buffer = new T[2*n-1];
-	view.reset(buffer);
+	view = allocate_array<T>(storage_size(n));
+	buffer = view.get();
       }
+      node = buffer + padding;
 
       if constexpr (MultiThread){
 	if(!any_changed){
 	  any_changed = new std::atomic_bool{true};
 	  any_changed_view.reset(any_changed);
+
+	  // Without external changed flag, dirty bitmap is owned, too.
+	  // (External flag w/o bitmap falls back to full rebuild.)
+	  if(!dirty){
+	    const auto words = dirty_storage_size(buffer_size);
+	    dirty = new std::atomic<std::uint64_t>[words];
+	    dirty_view.reset(dirty);
+	    for(auto w = std::size_t(0); w < words; ++w){
+	      dirty[w].store(0,std::memory_order_relaxed);
+	    }
+	    if(!initialize){ mark_dirty(0,buffer_size); }
+	  }
 	}
       }
 
       if(initialize){
-	std::fill_n(buffer+access_index(0),n,v);
+	std::fill_n(node+access_index(0),buffer_size,v);
 
 	update_all();
+	initialize_dirty();
       }
     }
-    SegmentTree(): SegmentTree{2,[](auto a,auto b){ return a+b; }} {}
+    SegmentTree(): SegmentTree{2,SumOp<T>{}} {}
     SegmentTree(const SegmentTree&) = default;
     SegmentTree(SegmentTree&&) = default;
     SegmentTree& operator=(const SegmentTree&) = default;
@@ -116,16 +303,32 @@ namespace ymd {
     ~SegmentTree() = default;
 
     T get(std::size_t i) const {
-      return buffer[access_index(i)];
+      return node[access_index(i)];
+    }
+
+    // Whole storage (`storage_size(n)` elements) for checkpoint.
+    // After writing it directly, internal nodes must be consistent.
+    T* data() noexcept { return buffer; }
+    const T* data() const noexcept { return buffer; }
+    std::size_t data_size() const noexcept { return storage_size(buffer_size); }
+
+    void weak_update_changed(){
+      // Reflect changed leaves to internal nodes (MultiThread only)
+      update_changed();
     }
 
     void set(std::size_t i,T v){
       auto n = access_index(i);
-      buffer[n] = std::move(v);
+      node[n] = std::move(v);
 
       if constexpr (MultiThread){
+	mark_dirty(i,1);
 	any_changed->store(true,std::memory_order_release);
       }else{
+	if(stats){
+	  ++stats->incremental_updates;
+	  ++stats->updated_leaves;
+	}
 	constexpr const std::size_t zero = 0;
 	auto updated = true;
 	while((n != zero) && updated){
@@ -142,22 +345,22 @@ namespace ymd {
       constexpr const std::size_t zero = 0;
       if(zero == max){ max = buffer_size; }
 
-      std::set<std::size_t> will_update{};
+      const auto any = (N != zero);
 
-      if constexpr (MultiThread){
-	if(N){ any_changed->store(true,std::memory_order_release); }
-      }
+      if constexpr (!MultiThread){ nodes_to_update.clear(); }
 
+      auto wrapped = zero;
       while(N){
 	auto copy_N = std::min(N,max-i);
-	std::generate_n(buffer+access_index(i),copy_N,f);
+	// Pass by reference so that stateful generator continues at wraparound
+	std::generate_n(node+access_index(i),copy_N,std::ref(f));
 
-	if constexpr (!MultiThread){
-	  for(auto n = std::size_t(0); n < copy_N; ++n){
-	    auto _i = access_index(i+n);
-	    if(_i != 0){
-	      will_update.insert(parent(_i));
-	    }
+	if constexpr (MultiThread){
+	  mark_dirty(i,copy_N);
+	}else{
+	  if(i == zero){ wrapped = nodes_to_update.size(); }
+	  for(auto n = zero; n < copy_N; ++n){
+	    nodes_to_update.push_back(access_index(i+n));
 	  }
 	}
 
@@ -165,13 +368,46 @@ namespace ymd {
 	i = zero;
       }
 
-      if constexpr (!MultiThread) {
-	while(!will_update.empty()){
-	  i = *(will_update.rbegin());
-	  auto updated = update_buffer(i);
-	  will_update.erase(i);
-	  if(i && updated){ will_update.insert(parent(i)); }
+      if constexpr (MultiThread){
+	if(any){ any_changed->store(true,std::memory_order_release); }
+      }else{
+	// Wrapped around leaves [0,...) come first to keep them sorted.
+	std::rotate(nodes_to_update.begin(),nodes_to_update.begin() + wrapped,
+		    nodes_to_update.end());
+	if(nodes_to_update.size() > max){
+	  // Wrapped around more than once
+	  std::sort(nodes_to_update.begin(),nodes_to_update.end());
+	  nodes_to_update.erase(std::unique(nodes_to_update.begin(),
+					    nodes_to_update.end()),
+				nodes_to_update.end());
 	}
+	update_nodes(nodes_to_update);
+      }
+    }
+
+    template<typename I,
+	     std::enable_if_t<std::is_convertible_v<I,std::size_t>,
+			      std::nullptr_t> = nullptr>
+    void set(const I* indexes,const T* values,std::size_t N){
+      // Batched set: write all leaves, then update the union of ancestors.
+      // (For duplicated indexes, the last value wins.)
+      for(auto n = std::size_t(0); n < N; ++n){
+	node[access_index(indexes[n])] = values[n];
+      }
+
+      if constexpr (MultiThread){
+	for(auto n = std::size_t(0); n < N; ++n){ mark_dirty(indexes[n],1); }
+	if(N){ any_changed->store(true,std::memory_order_release); }
+      }else{
+	nodes_to_update.clear();
+	nodes_to_update.reserve(N);
+	std::transform(indexes,indexes+N,std::back_inserter(nodes_to_update),
+		       [this](auto i){ return this->access_index(i); });
+	std::sort(nodes_to_update.begin(),nodes_to_update.end());
+	nodes_to_update.erase(std::unique(nodes_to_update.begin(),
+					  nodes_to_update.end()),
+			      nodes_to_update.end());
+	update_nodes(nodes_to_update);
       }
     }
 
@@ -181,48 +417,53 @@ namespace ymd {
 
     auto reduce(std::size_t start,std::size_t end) {
       // Operation on [start,end)  # buffer[end] is not included
-      if constexpr (MultiThread){
-	if(any_changed->load(std::memory_order_acquire)){
-	  update_all();
-	}
-      }
+      update_changed();
       return _reduce(start,end,0,0,buffer_size);
     }
 
-    auto largest_region_index(std::function<bool(T)> condition,
-			      std::size_t n=std::size_t(0)) {
+    template<typename F>
+    auto largest_region_index(F&& condition,std::size_t n=std::size_t(0)) {
       // max index of reduce( [0,index) ) -> true
+      //
+      // Single root-to-leaf descent: at each node the left child is merged
+      // into the accumulated prefix when the condition still holds.
+      // The condition must be monotonic (true for every shorter prefix).
 
       constexpr const std::size_t zero = 0;
       constexpr const std::size_t one  = 1;
-      constexpr const std::size_t two  = 2;
-
-      if constexpr (MultiThread){
-	if(any_changed->load(std::memory_order_acquire)){
-	  update_all();
-	}
-      }
 
-      std::size_t min = zero;
-      auto max = (zero != n) ? n: buffer_size;
+      update_changed();
 
-      auto index = (min + max)/two;
+      const auto max = (zero != n) ? n: buffer_size;
 
-      while(max - min > one){
-	if( condition(_reduce(zero,index,zero,zero,buffer_size)) ){
-	  min = index;
-	}else{
-	  max = index;
+      auto i = zero;
+      auto prefix = T{};
+      auto has_prefix = false;
+      while(i < internal_size){
+	auto c = child_left(i);
+	for(auto j = one; j < Arity; ++j, ++c){
+	  auto v = has_prefix ? f(prefix,node[c]): node[c];
+	  if(!condition(v)){ break; }
+	  prefix = std::move(v);
+	  has_prefix = true;
 	}
-	index = (min + max)/two;
+	i = c;
       }
 
-      return index;
+      return std::min(i - internal_size,max - one);
     }
 
+    // Start (or stop) collecting TreeStats. Restarting resets counters.
+    void enable_stats(bool enable){
+      stats = enable ? std::make_shared<TreeStats>(): nullptr;
+    }
+
+    TreeStats get_stats() const { return stats ? *stats: TreeStats{}; }
+
     void clear(T v = T{0}){
-      std::fill(buffer + access_index(0), buffer + access_index(buffer_size), v);
+      std::fill(node + access_index(0), node + access_index(buffer_size), v);
       update_all();
+      initialize_dirty();
     }
   };
 }
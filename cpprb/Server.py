@@ -0,0 +1,881 @@
+"""
+Replay buffer service over network
+
+Wire protocol (little endian)
+-----------------------------
+Every message is `frame | meta | data`.
+
+frame : magic (2s) | version (B) | op (B) | status (B) | reserved (3x)
+        | request id (I) | meta size (I) | data size (Q)
+meta  : op specific scalars | array descriptors
+data  : raw C-contiguous bytes of described arrays in order
+
+Array descriptors are `count (H)` followed by `name size (B) | name |
+dtype size (B) | dtype.str | ndim (B) | shape (Q * ndim)` of every array,
+so that the receiver reads array bytes directly into its own numpy arrays
+without intermediate copy. No pickle is used.
+
+Responses have the same op and request id as their requests. Clients can
+send multiple requests without waiting responses (pipelining). Responses of
+a connection are returned in request order.
+
+Messages larger than `max_message_size` are rejected before allocation,
+and the connection is closed.
+
+Authentication
+--------------
+Without `secret`, any peer reaching the address can add, sample and clear
+the buffer. With `secret`, the server sends a random nonce (32 bytes) just
+after accept, and the client must reply HMAC-SHA256(secret, nonce) before
+any message. Messages are not encrypted. Listen only on trusted networks.
+"""
+from concurrent.futures import Future
+import hmac
+import math
+import os
+import socket
+import struct
+import threading
+
+import numpy as np
+
+MAGIC = b"RB"
+VERSION = 1
+
+_FRAME = struct.Struct("<2sBBB3xIIQ")
+_COUNT = struct.Struct("<H")
+_SIZE = struct.Struct("<B")
+_DIM = struct.Struct("<Q")
+
+OP_INFO = 0
+OP_ADD = 1
+OP_SAMPLE = 2
+OP_UPDATE = 3
+OP_EPISODE_END = 4
+OP_CLEAR = 5
+
+_INFO = struct.Struct("<QQ")
+_ADD = struct.Struct("<q")
+_SAMPLE = struct.Struct("<Qd")
+
+STATUS_OK = 0
+STATUS_ERROR = 1
+
+_MAX_IOV = 512
+
+DEFAULT_MAX_MESSAGE_SIZE = 1 << 30
+
+_NONCE_SIZE = 32
+_AUTH_TIMEOUT = 10.0
+
+
+class RemoteError(RuntimeError):
+    """
+    Exception raised at server
+    """
+    pass
+
+
+def _as_bytes(a):
+    a = np.ascontiguousarray(a)
+    if a.dtype.hasobject:
+        raise ValueError("Object dtype cannot be sent")
+    return a, a.reshape(-1).view(np.uint8)
+
+
+def _owned(a):
+    a = np.asarray(a)
+    return a if a.flags.owndata else a.copy()
+
+
+def _encode_arrays(arrays):
+    meta = [_COUNT.pack(len(arrays))]
+    data = []
+    for name, a in arrays.items():
+        a, raw = _as_bytes(a)
+        n = name.encode("utf-8")
+        d = a.dtype.str.encode("ascii")
+        meta.extend((_SIZE.pack(len(n)), n, _SIZE.pack(len(d)), d,
+                     _SIZE.pack(a.ndim), *(_DIM.pack(s) for s in a.shape)))
+        data.append(raw)
+    return b"".join(meta), data
+
+
+def _decode_descriptors(meta, offset=0):
+    """
+    Decode array descriptors
+
+    Returns
+    -------
+    list of (str, numpy.dtype, tuple)
+        Name, dtype and shape of arrays
+    """
+    try:
+        return _decode(memoryview(meta), offset)
+    except (ValueError, TypeError, struct.error) as e:
+        # Data of broken message cannot be skipped.
+        raise ConnectionError("Broken array descriptors") from e
+
+
+def _decode(view, offset):
+    count, = _COUNT.unpack_from(view, offset)
+    offset += _COUNT.size
+
+    desc = []
+    for _ in range(count):
+        n, = _SIZE.unpack_from(view, offset)
+        name = bytes(view[offset+1:offset+1+n]).decode("utf-8")
+        offset += 1 + n
+
+        n, = _SIZE.unpack_from(view, offset)
+        dtype = np.dtype(bytes(view[offset+1:offset+1+n]).decode("ascii"))
+        offset += 1 + n
+        if dtype.hasobject:
+            raise ValueError("Object dtype cannot be received")
+
+        ndim, = _SIZE.unpack_from(view, offset)
+        offset += 1
+        shape = tuple(_DIM.unpack_from(view, offset + i * _DIM.size)[0]
+                      for i in range(ndim))
+        offset += ndim * _DIM.size
+        desc.append((name, dtype, shape))
+
+    if offset != view.nbytes:
+        raise ValueError("Broken array descriptors")
+    return desc
+
+
+def _nbytes(dtype, shape):
+    # Python int, which does not overflow for hostile shapes
+    return math.prod(shape) * dtype.itemsize
+
+
+def _digest(secret, nonce):
+    if isinstance(secret, str):
+        secret = secret.encode("utf-8")
+    return hmac.new(secret, nonce, "sha256").digest()
+
+
+class SocketConnection:
+    def __init__(self, sock):
+        """
+        Connection over stream socket
+
+        Parameters
+        ----------
+        sock : socket.socket
+            Connected stream socket
+        """
+        self.sock = sock
+
+    def send(self, buffers):
+        """
+        Send all buffers in order (scatter-gather)
+
+        Parameters
+        ----------
+        buffers : list of bytes-like
+            Buffers to be sent
+        """
+        views = [memoryview(b).cast("B") for b in buffers]
+        views = [v for v in views if v.nbytes > 0]
+        while views:
+            n = self.sock.sendmsg(views[:_MAX_IOV])
+            while n > 0:
+                if n >= views[0].nbytes:
+                    n -= views.pop(0).nbytes
+                else:
+                    views[0] = views[0][n:]
+                    n = 0
+
+    def recv_into(self, buffer):
+        """
+        Receive exactly `len(buffer)` bytes into buffer
+
+        Raises
+        ------
+        ConnectionError
+            If the connection is closed by the peer.
+        """
+        view = memoryview(buffer).cast("B")
+        while view.nbytes > 0:
+            n = self.sock.recv_into(view)
+            if n == 0:
+                raise ConnectionError("Connection is closed")
+            view = view[n:]
+
+    def settimeout(self, timeout):
+        self.sock.settimeout(timeout)
+
+    def close(self):
+        try:
+            self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        self.sock.close()
+
+
+class SocketListener:
+    def __init__(self, sock, address, path=None):
+        self.sock = sock
+        self.address = address
+        self.path = path
+
+    def accept(self):
+        sock, _ = self.sock.accept()
+        if sock.family in (socket.AF_INET, socket.AF_INET6):
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        return SocketConnection(sock)
+
+    def close(self):
+        try:
+            self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        self.sock.close()
+        if self.path is not None and os.path.exists(self.path):
+            os.unlink(self.path)
+
+
+class Transport:
+    """
+    Base class of transport
+
+    Transport creates connections. A connection must have `send(buffers)`,
+    `recv_into(buffer)` and `close()` (and optionally `settimeout(seconds)`
+    used for authentication), and a listener must have `accept()` returning
+    connection, `close()` and `address`.
+    """
+    def listen(self):
+        raise NotImplementedError
+
+    def connect(self):
+        raise NotImplementedError
+
+
+class TCPTransport(Transport):
+    def __init__(self, host: str = "127.0.0.1", port: int = 0):
+        """
+        TCP transport
+
+        Parameters
+        ----------
+        host : str, optional
+            Host name. Default value is "127.0.0.1"
+        port : int, optional
+            Port number. `0` (default) lets `listen()` choose free port,
+            which is written back to `port`.
+        """
+        self.host = host
+        self.port = int(port)
+
+    def listen(self):
+        sock = socket.create_server((self.host, self.port))
+        self.port = sock.getsockname()[1]
+        return SocketListener(sock, f"tcp://{self.host}:{self.port}")
+
+    def connect(self):
+        sock = socket.create_connection((self.host, self.port))
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        return SocketConnection(sock)
+
+
+class UnixTransport(Transport):
+    def __init__(self, path: str):
+        """
+        Unix domain socket transport for clients on the same host
+
+        Parameters
+        ----------
+        path : str
+            Socket file path
+        """
+        self.path = path
+
+    def listen(self):
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.bind(self.path)
+        sock.listen()
+        return SocketListener(sock, f"unix://{self.path}", self.path)
+
+    def connect(self):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(self.path)
+        return SocketConnection(sock)
+
+
+def make_transport(address):
+    """
+    Create transport from address
+
+    Parameters
+    ----------
+    address : str or Transport
+        "tcp://host:port", "unix:///path/to/socket" or `Transport` instance
+
+    Returns
+    -------
+    Transport
+    """
+    if isinstance(address, Transport):
+        return address
+
+    if address.startswith("tcp://"):
+        host, _, port = address[len("tcp://"):].rpartition(":")
+        return TCPTransport(host.strip("[]") or "127.0.0.1", int(port))
+
+    if address.startswith("unix://"):
+        return UnixTransport(address[len("unix://"):])
+
+    raise ValueError(f"Unknown address: {address}")
+
+
+def _send(conn, op, status, request_id, meta, data):
+    frame = _FRAME.pack(MAGIC, VERSION, op, status, request_id, len(meta),
+                        sum(d.nbytes for d in data))
+    conn.send([frame, meta, *data])
+
+
+def _recv_frame(conn, max_message_size):
+    frame = bytearray(_FRAME.size)
+    conn.recv_into(frame)
+    magic, version, op, status, request_id, meta_size, data_size = _FRAME.unpack(frame)
+    if magic != MAGIC:
+        raise ConnectionError("Unknown protocol")
+    if version != VERSION:
+        raise ConnectionError(f"Unknown protocol version: {version}")
+    if meta_size + data_size > max_message_size:
+        # Data of too large message is not drained.
+        raise ConnectionError(f"Too large message: {meta_size + data_size} bytes")
+
+    meta = bytearray(meta_size)
+    conn.recv_into(meta)
+    return op, status, request_id, meta, data_size
+
+
+def _drain(conn, size):
+    chunk = bytearray(min(size, 1 << 20))
+    while size > 0:
+        n = min(size, len(chunk))
+        conn.recv_into(memoryview(chunk)[:n])
+        size -= n
+
+
+class ReplayServer:
+    def __init__(self, buffer, transport="tcp://127.0.0.1:0", *,
+                 max_message_size: int = DEFAULT_MAX_MESSAGE_SIZE,
+                 secret=None):
+        """
+        Initialize ReplayServer, which serves buffer to remote clients
+
+        Parameters
+        ----------
+        buffer : ReplayBuffer or PrioritizedReplayBuffer or MPReplayBuffer or MPPrioritizedReplayBuffer
+            Buffer to be served. Calls from clients are serialized. While
+            serving, modify it only through clients.
+        transport : str or Transport, optional
+            Listening address. (See `make_transport()`)
+            Default value is "tcp://127.0.0.1:0" (free port).
+        max_message_size : int, optional
+            The maximum bytes of a received message. The connection sending
+            larger one is closed before allocation. Default value is 1 GiB.
+        secret : bytes or str, optional
+            Shared secret which clients must prove. If `None` (default),
+            clients are not authenticated. (See module documentation)
+
+        Notes
+        -----
+        Received transitions are read directly into reused staging arrays
+        and are copied into buffer by its (native) `add()`, so that no Python
+        object is created for each transition.
+
+        Prioritized buffers trace overwrites from the last `sample()` for
+        `update_priorities()`, so that only one client (the first one
+        calling `sample()` or `update_priorities()`) can call them. The
+        other clients get `RemoteError` until that client disconnects.
+        """
+        self.buffer = buffer
+        self.is_per = hasattr(buffer, "update_priorities")
+        self.transport = make_transport(transport)
+        self.max_message_size = int(max_message_size)
+        if self.max_message_size <= 0:
+            raise ValueError("`max_message_size` must be positive integer.")
+        self._secret = secret
+
+        self._lock = threading.Lock()
+        self._learner = None
+        self._conns_lock = threading.Lock()
+        self._conns = set()
+        self._threads = []
+        self._closed = False
+
+        self._listener = self.transport.listen()
+        self._thread = threading.Thread(target=self._accept, daemon=True)
+        self._thread.start()
+
+    @property
+    def address(self):
+        """
+        Listening address like "tcp://127.0.0.1:12345"
+        """
+        return self._listener.address
+
+    def _accept(self):
+        while True:
+            try:
+                conn = self._listener.accept()
+            except OSError:
+                return
+
+            with self._conns_lock:
+                if self._closed:
+                    conn.close()
+                    return
+                self._conns.add(conn)
+                t = threading.Thread(target=self._serve, args=(conn,),
+                                     daemon=True)
+                self._threads.append(t)
+            t.start()
+
+    def _recv_arrays(self, conn, meta, offset, data_size, staging):
+        desc = _decode_descriptors(meta, offset)
+        if sum(_nbytes(d, s) for _, d, s in desc) != data_size:
+            raise ConnectionError("Broken message size")
+
+        arrays = {}
+        for name, dtype, shape in desc:
+            a = staging.get(name)
+            n = _nbytes(dtype, shape)
+            if (a is None) or (a.dtype != dtype) or (a.nbytes < n):
+                grown = min(2 * (0 if a is None else a.nbytes),
+                            self.max_message_size)
+                a = np.empty(max(n, grown) // dtype.itemsize, dtype=dtype)
+                staging[name] = a
+            a = a[:n // dtype.itemsize].reshape(shape)
+            conn.recv_into(a.reshape(-1).view(np.uint8))
+            arrays[name] = a
+        return arrays
+
+    def _check_learner(self, conn):
+        # Must be called with `self._lock`
+        if not self.is_per:
+            return
+        if self._learner is None:
+            self._learner = conn
+        elif self._learner is not conn:
+            raise RuntimeError("Prioritized buffer is sampled by another client")
+
+    def _handle(self, conn, op, meta, data_size, staging, outs):
+        if op == OP_ADD:
+            kwargs = self._recv_arrays(conn, meta, 0, data_size, staging)
+            with self._lock:
+                index = self.buffer.add(**kwargs)
+            return _ADD.pack(-1 if index is None else index), []
+
+        if data_size > 0 and op != OP_UPDATE:
+            raise ConnectionError("Unexpected data")
+
+        if op == OP_INFO:
+            with self._lock:
+                return _INFO.pack(self.buffer.get_stored_size(),
+                                  self.buffer.get_buffer_size()), []
+
+        if op == OP_SAMPLE:
+            batch_size, beta = _SAMPLE.unpack(meta)
+            with self._lock:
+                self._check_learner(conn)
+                if self.buffer.get_stored_size() == 0:
+                    raise ValueError("No transitions are stored")
+
+                kwargs = {}
+                if hasattr(self.buffer, "empty_sample"):
+                    # Reuse output arrays for the same batch size, since the
+                    # previous response of this connection is already sent.
+                    if batch_size not in outs:
+                        outs.clear()
+                        outs[batch_size] = self.buffer.empty_sample(batch_size)
+                    kwargs["out"] = outs[batch_size]
+
+                if self.is_per:
+                    sample = self.buffer.sample(batch_size, beta, **kwargs)
+                else:
+                    sample = self.buffer.sample(batch_size, **kwargs)
+
+                if "out" not in kwargs:
+                    # Values like 'weights' and 'indexes' can be views of
+                    # internal arrays, which the next `sample()` overwrites.
+                    sample = {name: _owned(v) for name, v in sample.items()}
+            return _encode_arrays(sample)
+
+        if op == OP_UPDATE:
+            if not self.is_per:
+                _drain(conn, data_size)
+                raise TypeError("Buffer does not have priorities")
+            kwargs = self._recv_arrays(conn, meta, 0, data_size, staging)
+            with self._lock:
+                self._check_learner(conn)
+                self.buffer.update_priorities(kwargs["indexes"],
+                                              kwargs["priorities"])
+            return b"", []
+
+        if op == OP_EPISODE_END:
+            with self._lock:
+                if hasattr(self.buffer, "on_episode_end"):
+                    self.buffer.on_episode_end()
+            return b"", []
+
+        if op == OP_CLEAR:
+            with self._lock:
+                self.buffer.clear()
+            return b"", []
+
+        raise ConnectionError(f"Unknown op: {op}")
+
+    def _authenticate(self, conn):
+        if self._secret is None:
+            return
+        # Peer not replying is dropped, too.
+        settimeout = getattr(conn, "settimeout", None)
+        if settimeout is not None:
+            settimeout(_AUTH_TIMEOUT)
+
+        nonce = os.urandom(_NONCE_SIZE)
+        conn.send([nonce])
+        digest = bytearray(_NONCE_SIZE)
+        conn.recv_into(digest)
+        if not hmac.compare_digest(bytes(digest), _digest(self._secret, nonce)):
+            raise ConnectionError("Authentication failed")
+
+        if settimeout is not None:
+            settimeout(None)
+
+    def _serve(self, conn):
+        staging = {}
+        outs = {}
+        try:
+            self._authenticate(conn)
+            while True:
+                op, _, request_id, meta, data_size = _recv_frame(conn,
+                                                                 self.max_message_size)
+                try:
+                    meta, data = self._handle(conn, op, meta, data_size,
+                                              staging, outs)
+                except (ConnectionError, OSError):
+                    raise
+                except Exception as e:
+                    msg = f"{type(e).__name__}: {e}".encode("utf-8")
+                    _send(conn, op, STATUS_ERROR, request_id, msg, [])
+                    continue
+                _send(conn, op, STATUS_OK, request_id, meta, data)
+        except (ConnectionError, OSError, ValueError, struct.error):
+            pass
+        finally:
+            with self._lock:
+                if self._learner is conn:
+                    self._learner = None
+            with self._conns_lock:
+                self._conns.discard(conn)
+            conn.close()
+
+    def close(self):
+        """
+        Stop serving and close all connections
+        """
+        with self._conns_lock:
+            if self._closed:
+                return
+            self._closed = True
+            conns = list(self._conns)
+            threads = list(self._threads)
+
+        self._listener.close()
+        for conn in conns:
+            conn.close()
+        self._thread.join()
+        for t in threads:
+            t.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+
+class ReplayClient:
+    def __init__(self, transport, *, max_pending: int = 64,
+                 max_message_size: int = DEFAULT_MAX_MESSAGE_SIZE,
+                 secret=None):
+        """
+        Initialize ReplayClient connecting to ReplayServer
+
+        Parameters
+        ----------
+        transport : str or Transport
+            Server address. (See `make_transport()`)
+        max_pending : int, optional
+            The maximum number of requests waiting responses. Asynchronous
+            calls block when it is reached. Default value is `64`.
+        max_message_size : int, optional
+            The maximum bytes of a received response. Default value is 1 GiB.
+        secret : bytes or str, optional
+            Shared secret of the server. Required if the server has it.
+
+        Notes
+        -----
+        `*_async()` methods send requests and return
+        `concurrent.futures.Future` without waiting responses, so that
+        multiple calls are pipelined. Synchronous methods wait their results.
+        A client can be shared by threads.
+        """
+        self.max_pending = int(max_pending)
+        if self.max_pending <= 0:
+            raise ValueError("`max_pending` must be positive integer.")
+        self.max_message_size = int(max_message_size)
+        if self.max_message_size <= 0:
+            raise ValueError("`max_message_size` must be positive integer.")
+
+        self.conn = make_transport(transport).connect()
+        if secret is not None:
+            try:
+                nonce = bytearray(_NONCE_SIZE)
+                self.conn.recv_into(nonce)
+                self.conn.send([_digest(secret, bytes(nonce))])
+            except BaseException:
+                self.conn.close()
+                raise
+
+        self._send_lock = threading.Lock()
+        self._pending_lock = threading.Lock()
+        self._pending = {}
+        self._slots = threading.BoundedSemaphore(self.max_pending)
+        self._next_id = 0
+        self._error = None
+
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def _request(self, op, meta=b"", data=(), out=None):
+        self._slots.acquire()
+        future = Future()
+        try:
+            with self._send_lock:
+                if self._error is not None:
+                    raise ConnectionError("Connection is closed") from self._error
+
+                request_id = self._next_id
+                self._next_id = (self._next_id + 1) & 0xFFFFFFFF
+                with self._pending_lock:
+                    self._pending[request_id] = (future, op, out)
+                try:
+                    _send(self.conn, op, STATUS_OK, request_id, meta, list(data))
+                except BaseException:
+                    with self._pending_lock:
+                        self._pending.pop(request_id, None)
+                    raise
+        except BaseException:
+            self._slots.release()
+            raise
+        return future
+
+    def _recv_sample(self, meta, data_size, out):
+        desc = _decode_descriptors(meta)
+        if sum(_nbytes(d, s) for _, d, s in desc) != data_size:
+            raise ConnectionError("Broken message size")
+
+        sample = {} if out is None else out
+        error = None
+        for name, dtype, shape in desc:
+            a = None if out is None else out.get(name)
+            if (a is not None) and ((a.dtype != dtype) or (a.shape != shape) or
+                                    not a.flags.c_contiguous):
+                error = ValueError(f"`out[\"{name}\"]` mismatches for " +
+                                   f"dtype/shape: {dtype}{shape} vs " +
+                                   f"{a.dtype}{a.shape}")
+                a = None
+            if a is None:
+                a = np.empty(shape, dtype=dtype)
+                if error is None:
+                    sample[name] = a
+            self.conn.recv_into(a.reshape(-1).view(np.uint8))
+
+        if error is not None:
+            raise error
+        return sample
+
+    def _run(self):
+        try:
+            while True:
+                op, status, request_id, meta, data_size = _recv_frame(self.conn,
+                                                                      self.max_message_size)
+                with self._pending_lock:
+                    future, req_op, out = self._pending.pop(request_id)
+                self._slots.release()
+
+                if req_op != op:
+                    raise ConnectionError("Response mismatches request")
+
+                if status != STATUS_OK:
+                    _drain(self.conn, data_size)
+                    future.set_exception(RemoteError(meta.decode("utf-8")))
+                    continue
+
+                try:
+                    if op == OP_SAMPLE:
+                        future.set_result(self._recv_sample(meta, data_size,
+                                                            out))
+                        continue
+                    if data_size > 0:
+                        raise ConnectionError("Unexpected data")
+                except ValueError as e:
+                    future.set_exception(e)
+                    continue
+
+                if op == OP_ADD:
+                    index, = _ADD.unpack(meta)
+                    future.set_result(None if index < 0 else index)
+                elif op == OP_INFO:
+                    future.set_result(_INFO.unpack(meta))
+                else:
+                    future.set_result(None)
+        except BaseException as e:
+            with self._send_lock:
+                self._error = e
+            with self._pending_lock:
+                pending = list(self._pending.values())
+                self._pending.clear()
+            for future, _, _ in pending:
+                future.set_exception(ConnectionError("Connection is closed"))
+                self._slots.release()
+
+    def add_async(self, *, priorities=None, **kwargs):
+        """
+        Send transition(s) without waiting response
+
+        Parameters
+        ----------
+        priorities : array like or float, optional
+            Priorities for prioritized buffer
+        **kwargs : array like or float or int
+            Transitions to be stored. (See `ReplayBuffer.add()`)
+
+        Returns
+        -------
+        concurrent.futures.Future
+            Future of the first index of stored position.
+
+        Notes
+        -----
+        Values are sent before returning, so that they can be modified
+        just after this call.
+        """
+        if priorities is not None:
+            kwargs["priorities"] = priorities
+        meta, data = _encode_arrays({k: np.asarray(v) for k, v in kwargs.items()})
+        return self._request(OP_ADD, meta, data)
+
+    def add(self, **kwargs):
+        """
+        Add transition(s) into remote buffer
+
+        Returns
+        -------
+        : int or None
+            The first index of stored position.
+        """
+        return self.add_async(**kwargs).result()
+
+    def sample_async(self, batch_size, beta=0.4, *, out=None):
+        """
+        Request sample without waiting response
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+        beta : float, optional
+            Exponent of importance sampling weights for prioritized buffer.
+            Default value is `0.4`
+        out : dict of numpy.ndarray, optional
+            Preallocated C-contiguous output arrays. Received values are
+            written into them directly, and `out` itself is the result.
+            Missing keys are allocated and added into `out`.
+
+        Returns
+        -------
+        concurrent.futures.Future
+            Future of sample (dict of numpy.ndarray)
+        """
+        return self._request(OP_SAMPLE, _SAMPLE.pack(int(batch_size),
+                                                     float(beta)),
+                             out=out)
+
+    def sample(self, batch_size, beta=0.4, *, out=None):
+        """
+        Sample from remote buffer
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            Sampled transitions. (See `sample_async()`)
+        """
+        return self.sample_async(batch_size, beta, out=out).result()
+
+    def update_priorities_async(self, indexes, priorities):
+        """
+        Send priorities update without waiting response
+
+        Returns
+        -------
+        concurrent.futures.Future
+        """
+        meta, data = _encode_arrays({"indexes": np.ravel(np.asarray(indexes,
+                                                                    dtype=np.uint64)),
+                                     "priorities": np.ravel(np.asarray(priorities,
+                                                                       dtype=np.single))})
+        return self._request(OP_UPDATE, meta, data)
+
+    def update_priorities(self, indexes, priorities):
+        """
+        Update priorities of remote prioritized buffer
+        """
+        self.update_priorities_async(indexes, priorities).result()
+
+    def on_episode_end(self):
+        """
+        Call `on_episode_end()` of remote buffer
+        """
+        self._request(OP_EPISODE_END).result()
+
+    def clear(self):
+        """
+        Clear remote buffer
+        """
+        self._request(OP_CLEAR).result()
+
+    def get_stored_size(self):
+        """
+        Get stored size of remote buffer
+        """
+        return self._request(OP_INFO).result()[0]
+
+    def get_buffer_size(self):
+        """
+        Get buffer size of remote buffer
+        """
+        return self._request(OP_INFO).result()[1]
+
+    def close(self):
+        """
+        Close connection
+        """
+        self.conn.close()
+        self._thread.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
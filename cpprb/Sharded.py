@@ -0,0 +1,301 @@
+import threading
+
+import numpy as np
+
+from .PyReplayBuffer import PrioritizedReplayBuffer
+
+
+class ShardedPrioritizedReplayBuffer:
+    def __init__(self, size, env_dict=None, *, n_shards: int,
+                 routing: str = "round_robin", seed=None, **kwargs):
+        """
+        Initialize ShardedPrioritizedReplayBuffer
+
+        Transitions are stored into `n_shards` independent
+        `PrioritizedReplayBuffer` (shards), each of which has its own ring
+        buffer and segment tree, so that shards can be added, sampled and
+        updated concurrently by different threads. (Native sampling and
+        addition release GIL.)
+
+        Parameters
+        ----------
+        size : int
+            Total buffer size. Each shard has `ceil(size / n_shards)`.
+        env_dict : dict of dict, optional
+            Environment definition. (See `ReplayBuffer`)
+        n_shards : int
+            The number of shards
+        routing : {"round_robin", "actor"}, optional
+            Destination of `add()` without `shard`. "round_robin" (default)
+            rotates shards at every call. "actor" requires `actor`, and
+            stores into `actor % n_shards`.
+        seed : int, optional
+            Seed of shard `i` is `seed + i`, and shard allocation of
+            `sample()` is seeded by `seed`, too.
+        **kwargs
+            Other parameters passed to every `PrioritizedReplayBuffer`.
+
+        Notes
+        -----
+        Indexes returned by this class are global ones,
+        `shard * shard_size + index in shard`.
+        """
+        self.n_shards = int(n_shards)
+        if self.n_shards <= 0:
+            raise ValueError("`n_shards` must be positive integer.")
+
+        if routing not in ("round_robin", "actor"):
+            raise ValueError("`routing` must be \"round_robin\" or \"actor\"")
+        self.routing = routing
+
+        self.shard_size = -(-int(size) // self.n_shards)
+        self.shards = [PrioritizedReplayBuffer(self.shard_size, env_dict,
+                                               seed=(None if seed is None
+                                                     else seed + i),
+                                               **kwargs)
+                       for i in range(self.n_shards)]
+
+        # A lock for each shard. There is no lock over all shards.
+        self._locks = [threading.Lock() for _ in range(self.n_shards)]
+
+        # Snapshot of (p + eps)^alpha statistics of each shard, updated by its
+        # writer under its lock, so that others never read the shard trees.
+        self._sum = np.zeros(self.n_shards, dtype=np.double)
+        self._min = np.full(self.n_shards, np.inf, dtype=np.double)
+
+        self._next_lock = threading.Lock()
+        self._next = 0
+        self.rng = np.random.default_rng(seed)
+
+    def _refresh(self, s):
+        # Must be called with `self._locks[s]`
+        shard = self.shards[s]
+        if shard.get_stored_size() == 0:
+            self._sum[s] = 0.0
+            self._min[s] = np.inf
+        else:
+            self._sum[s] = shard.get_priority_sum()
+            self._min[s] = shard.get_priority_min()
+
+    def _route(self, shard, actor):
+        if shard is not None:
+            s = int(shard)
+        elif self.routing == "actor":
+            if actor is None:
+                raise ValueError("`actor` is required for `routing=\"actor\"`")
+            s = int(actor) % self.n_shards
+        else:
+            with self._next_lock:
+                s = self._next
+                self._next = (s + 1) % self.n_shards
+
+        if not (0 <= s < self.n_shards):
+            raise ValueError(f"`shard` must be in [0, {self.n_shards})")
+        return s
+
+    def _split(self, indexes):
+        indexes = np.asarray(indexes, dtype=np.uint64)
+        return ((indexes // np.uint64(self.shard_size)).astype(np.int64),
+                indexes % np.uint64(self.shard_size))
+
+    def add(self, *, shard=None, actor=None, **kwargs):
+        """
+        Add transition(s) into a shard
+
+        Parameters
+        ----------
+        shard : int, optional
+            Shard to store. If `None` (default), the shard is decided by
+            `routing`.
+        actor : int, optional
+            Actor id for `routing="actor"`
+        **kwargs : array like or float or int
+            Transitions (and `priorities`) to be stored.
+            (See `PrioritizedReplayBuffer.add()`)
+
+        Returns
+        -------
+        : int or None
+            The first global index of stored position.
+        """
+        s = self._route(shard, actor)
+        with self._locks[s]:
+            index = self.shards[s].add(**kwargs)
+            self._refresh(s)
+
+        if index is None:
+            return None
+        return s * self.shard_size + index
+
+    def on_episode_end(self, *, shard=None, actor=None):
+        """
+        Call `on_episode_end()` of shard(s)
+
+        Parameters
+        ----------
+        shard : int, optional
+            Shard whose episode ends. If both `shard` and `actor` are `None`,
+            episodes of all shards end.
+        actor : int, optional
+            Actor id for `routing="actor"`
+        """
+        if shard is None and actor is None:
+            targets = range(self.n_shards)
+        else:
+            targets = [self._route(shard, actor)]
+
+        for s in targets:
+            with self._locks[s]:
+                self.shards[s].on_episode_end()
+                self._refresh(s)
+
+    def _sample_from(self, s, batch_size, beta):
+        # Must be called with `self._locks[s]`
+        sample = self.shards[s].sample(batch_size, beta)
+        sample["weights"] = np.array(sample["weights"], copy=True)
+        sample["indexes"] = (np.array(sample["indexes"], dtype=np.uint64) +
+                             np.uint64(s * self.shard_size))
+        return sample
+
+    def sample(self, batch_size, beta=0.4):
+        """
+        Sample transitions from all shards depending on priorities
+
+        Batch size of each shard is allocated by systematic sampling over
+        the sums of shard priorities, then each shard samples its part
+        (stratified sampling inside shard).
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+        beta : float, optional
+            Exponent of importance sampling weights. Default value is `0.4`
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            Samples with 'weights' normalized by the maximum weight over all
+            shards and global 'indexes'. Samples are ordered by shards.
+
+        Raises
+        ------
+        ValueError
+            If no transitions are stored.
+        """
+        sums = self._sum.copy()
+        total = sums.sum()
+        if not total > 0:
+            raise ValueError("No transitions are stored")
+
+        u = (np.arange(batch_size) + self.rng.random()) * (total / batch_size)
+        s_of = np.minimum(np.searchsorted(np.cumsum(sums), u, side="right"),
+                          np.flatnonzero(sums)[-1])
+        counts = np.bincount(s_of, minlength=self.n_shards)
+
+        # Shard weights are normalized by shard minimum, (p / p_min_s)^-beta
+        p_min = self._min.min()
+
+        samples = []
+        for s in np.flatnonzero(counts):
+            with self._locks[s]:
+                sample = self._sample_from(s, int(counts[s]), beta)
+                p_min_s = self._min[s]
+            sample["weights"] *= np.single((p_min / p_min_s) ** beta)
+            samples.append(sample)
+
+        return {k: np.concatenate([sample[k] for sample in samples])
+                for k in samples[0].keys()}
+
+    def sample_shard(self, shard, batch_size, beta=0.4):
+        """
+        Sample transitions only from a shard
+
+        Each learner rank can sample its own shard concurrently.
+
+        Parameters
+        ----------
+        shard : int
+            Shard to be sampled
+        batch_size : int
+            Sampled batch size
+        beta : float, optional
+            Exponent of importance sampling weights. Default value is `0.4`
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            Samples with 'weights' and global 'indexes'.
+
+        Notes
+        -----
+        When every shard is sampled equally (e.g. one rank for each shard),
+        transition `i` at shard `s` is sampled with probability
+        `p_i / (n_shards * sum_s)`. The weights are importance sampling
+        weights of this probability, which are normalized by the maximum
+        weight over all shards.
+        """
+        s = self._route(shard, None)
+        with self._locks[s]:
+            if not self._sum[s] > 0:
+                raise ValueError(f"No transitions are stored at shard {s}")
+            sample = self._sample_from(s, batch_size, beta)
+            ratio_s = self._min[s] / self._sum[s]
+
+        valid = self._sum > 0
+        ratio = (self._min[valid] / self._sum[valid]).min()
+
+        # (p / p_min_s)^-beta -> (p / sum_s)^-beta / (min_t p_min_t / sum_t)^-beta
+        sample["weights"] *= np.single((ratio / ratio_s) ** beta)
+        return sample
+
+    def update_priorities(self, indexes, priorities):
+        """
+        Update priorities
+
+        Parameters
+        ----------
+        indexes : array_like
+            Global indexes
+        priorities : array_like
+            Priorities
+        """
+        s_of, local = self._split(indexes)
+        priorities = np.ravel(np.asarray(priorities, dtype=np.single))
+        if s_of.shape[0] != priorities.shape[0]:
+            raise ValueError("`indexes` and `priorities` must have the same size")
+
+        for s in np.unique(s_of):
+            if not (0 <= s < self.n_shards):
+                raise IndexError("index is out of bounds")
+            m = (s_of == s)
+            with self._locks[s]:
+                self.shards[s].update_priorities(local[m], priorities[m])
+                self._refresh(s)
+
+    def clear(self):
+        """
+        Clear all shards
+        """
+        for s in range(self.n_shards):
+            with self._locks[s]:
+                self.shards[s].clear()
+                self._refresh(s)
+
+    def get_stored_size(self):
+        """
+        Get the total stored size over shards
+        """
+        return sum(shard.get_stored_size() for shard in self.shards)
+
+    def get_buffer_size(self):
+        """
+        Get the total buffer size over shards
+        """
+        return self.shard_size * self.n_shards
+
+    def get_max_priority(self):
+        """
+        Get the max priority over shards
+        """
+        return max(shard.get_max_priority() for shard in self.shards)
@@ -0,0 +1,558 @@
+"""
+Tiered replay buffers (hot ring on RAM, cold segment files on storage)
+
+Recent transitions are kept in an in-RAM ring (hot tier), and every
+completed chunk of the ring is written sequentially into segment files
+(cold tier) in background. Sampled cold transitions are read with batched
+`pread` over I/O threads, and reads of the next batch are issued in
+advance, so that random sampling does not page fault on files.
+"""
+import os
+import threading
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from .PyReplayBuffer import dict2buffer, PrioritizedSampler
+
+
+if hasattr(os, "preadv"):
+    def _read_into(fd, buf, offset):
+        view = memoryview(buf).cast("B")
+        while view.nbytes > 0:
+            n = os.preadv(fd, [view], offset)
+            if n <= 0:
+                view[:] = b"\0" * view.nbytes
+                return
+            view = view[n:]
+            offset += n
+
+    def _write_from(fd, buf, offset):
+        view = memoryview(buf).cast("B")
+        while view.nbytes > 0:
+            n = os.pwritev(fd, [view], offset)
+            view = view[n:]
+            offset += n
+else:
+    # Without positional I/O (e.g. Windows), seek and read/write are locked.
+    _io_lock = threading.Lock()
+
+    def _read_into(fd, buf, offset):
+        view = memoryview(buf).cast("B")
+        with _io_lock:
+            os.lseek(fd, offset, os.SEEK_SET)
+            data = os.read(fd, view.nbytes)
+        view[:len(data)] = data
+        view[len(data):] = b"\0" * (view.nbytes - len(data))
+
+    def _write_from(fd, buf, offset):
+        view = memoryview(buf).cast("B")
+        with _io_lock:
+            os.lseek(fd, offset, os.SEEK_SET)
+            while view.nbytes > 0:
+                view = view[os.write(fd, view):]
+
+
+class TieredReplayBuffer:
+    def __init__(self, size, env_dict=None, *, path: str, hot_size: int,
+                 chunk_size=None, cold_fraction=None, io_threads: int = 4,
+                 prefetch: bool = True, default_dtype=None, seed=None,
+                 memory_policy=None):
+        """
+        Initialize TieredReplayBuffer
+
+        Parameters
+        ----------
+        size : int
+            Total buffer size (hot and cold). It must be a multiple of
+            `hot_size`.
+        env_dict : dict of dict, optional
+            Environment definition. (See `ReplayBuffer`)
+        path : str
+            File name prefix of segment files. `f"{path}_{name}.seg"` is
+            created (or truncated) for each value.
+        hot_size : int
+            The number of the latest transitions kept on RAM. It must be a
+            multiple of `chunk_size`, and at least `2 * chunk_size`.
+        chunk_size : int, optional
+            The number of transitions written into segment files at once.
+            Default is `hot_size // 4`.
+        cold_fraction : float, optional
+            Fraction of a batch sampled from cold transitions (older than
+            `hot_size`). If `None` (default), every stored transition is
+            sampled uniformly.
+        io_threads : int, optional
+            The number of threads reading segment files. Default is `4`.
+        prefetch : bool, optional
+            If `True` (default), indexes of the next batch (with the same
+            batch size) are drawn at `sample()`, and their cold reads are
+            issued in background.
+        default_dtype : numpy.dtype, optional
+            Fallback dtype. Default is `numpy.single`.
+        seed : int, optional
+            Seed of sampling
+        memory_policy : dict, optional
+            Memory policy of the hot ring (See `PolicyMemory`)
+
+        Raises
+        ------
+        ValueError
+            If sizes are inconsistent, or any value has object dtype.
+
+        Notes
+        -----
+        A completed chunk is written to segment files while it is still on
+        RAM, and the hot ring waits for the write before overwriting it.
+        Unless all transitions are hot, transitions are read from the
+        segment files, whose pages are cached by OS unless they are evicted.
+
+        Neither `next_of`, `stack_compress` nor `Nstep` is supported.
+        """
+        self.buffer_size = int(size)
+        self.hot_size = int(hot_size)
+        self.chunk_size = int(chunk_size or max(self.hot_size // 4, 1))
+        if ((self.chunk_size <= 0) or (self.hot_size < 2 * self.chunk_size) or
+            (self.hot_size % self.chunk_size != 0) or
+            (self.buffer_size < self.hot_size) or
+            (self.buffer_size % self.hot_size != 0)):
+            raise ValueError("`size` must be a multiple of `hot_size`, which " +
+                             "must be a multiple of `chunk_size` and at " +
+                             "least `2 * chunk_size`")
+
+        if (cold_fraction is not None) and not (0.0 <= cold_fraction <= 1.0):
+            raise ValueError("`cold_fraction` must be in [0, 1]")
+        self.cold_fraction = cold_fraction
+
+        self.env_dict = {k: v.copy() for k, v in (env_dict or {}).items()}
+        self.default_dtype = default_dtype or np.single
+        for name, defs in self.env_dict.items():
+            if np.dtype(defs.get("dtype", self.default_dtype)).hasobject:
+                raise ValueError(f"\"{name}\" with object dtype cannot be stored " +
+                                 "at segment files")
+
+        # side effect: Add "add_shape" key into self.env_dict
+        self.hot = dict2buffer(self.hot_size, self.env_dict,
+                               default_dtype=self.default_dtype,
+                               memory_policy=memory_policy)
+
+        self.path = path
+        self._files = {}
+        for name, b in self.hot.items():
+            row_bytes = b[0].nbytes
+            fd = os.open(f"{path}_{name}.seg",
+                         os.O_RDWR | os.O_CREAT | os.O_TRUNC |
+                         getattr(os, "O_BINARY", 0))
+            os.ftruncate(fd, self.buffer_size * row_bytes)
+            self._files[name] = (fd, row_bytes)
+
+        self.io_threads = max(int(io_threads), 1)
+        self._reader = ThreadPoolExecutor(self.io_threads)
+        self._writer = ThreadPoolExecutor(1)
+
+        # Pending writes of hot chunks: {hot chunk: future}
+        self._pending = {}
+
+        self.prefetch = prefetch
+        self._prefetched = None
+
+        self.next_index = 0
+        self.stored_size = 0
+        self.added = 0
+        self.rng = np.random.default_rng(seed)
+
+        self.counters = {"hot_reads": 0, "cold_reads": 0, "prefetch_hits": 0,
+                         "chunks_written": 0}
+
+    def _rows(self, kwargs):
+        # Returns (values, N). Values of a single row are broadcasted.
+        values = {}
+        N = None
+        for name, b in self.hot.items():
+            v = np.reshape(np.asarray(kwargs[name], dtype=b.dtype),
+                           self.env_dict[name]["add_shape"])
+            values[name] = v
+            if v.shape[0] != 1:
+                if (N is not None) and (N != v.shape[0]):
+                    raise ValueError("All values must have the same step size")
+                N = v.shape[0]
+        return values, (N or 1)
+
+    def _write_chunk(self, g, h):
+        for name, (fd, row_bytes) in self._files.items():
+            _write_from(fd, self.hot[name][h:h+self.chunk_size], g * row_bytes)
+        self.counters["chunks_written"] += 1
+
+    def _wait_chunk(self, hc):
+        f = self._pending.pop(hc, None)
+        if f is not None:
+            f.result()
+
+    def _store(self, kwargs):
+        values, N = self._rows(kwargs)
+        index = self.next_index
+
+        i = 0
+        while i < N:
+            # A piece never crosses chunk boundaries.
+            g = self.next_index
+            n = min(N - i, self.chunk_size - g % self.chunk_size)
+            h = g % self.hot_size
+            if h % self.chunk_size == 0:
+                self._wait_chunk(h // self.chunk_size)
+
+            for name, b in self.hot.items():
+                v = values[name]
+                b[h:h+n] = v if v.shape[0] == 1 else v[i:i+n]
+
+            self.next_index = (g + n) % self.buffer_size
+            self.stored_size = min(self.stored_size + n, self.buffer_size)
+            self.added += n
+            if (g + n) % self.chunk_size == 0:
+                c0 = g + n - self.chunk_size
+                self._pending[h // self.chunk_size] = \
+                    self._writer.submit(self._write_chunk, c0,
+                                        c0 % self.hot_size)
+            i += n
+        return index, N
+
+    def add(self, **kwargs):
+        """
+        Add transition(s) into hot ring
+
+        Parameters
+        ----------
+        **kwargs : array like or float or int
+            Transitions to be stored.
+
+        Returns
+        -------
+        int
+            The first index of stored position
+
+        Raises
+        ------
+        KeyError
+            If any values defined at constructor are missing.
+        ValueError
+            If values have different step sizes.
+        """
+        return self._store(kwargs)[0]
+
+    def _ages(self, indexes):
+        # The number of transitions added after `indexes`
+        return (np.int64(self.next_index) - 1 - indexes.astype(np.int64)) % \
+            self.buffer_size
+
+    def _draw(self, batch_size):
+        S = self.stored_size
+        n_hot = min(S, self.hot_size)
+        n_cold = S - n_hot
+        if (self.cold_fraction is None) or (n_cold == 0):
+            ages = self.rng.integers(0, S, batch_size)
+        else:
+            k = int(round(self.cold_fraction * batch_size))
+            ages = np.concatenate((self.rng.integers(0, n_hot, batch_size - k),
+                                   self.hot_size +
+                                   self.rng.integers(0, n_cold, k)))
+        return ((np.int64(self.next_index) - 1 - ages) %
+                self.buffer_size).astype(np.uint64)
+
+    def _read_runs(self, u, starts, ends, out):
+        for name, (fd, row_bytes) in self._files.items():
+            o = out[name]
+            for s, e in zip(starts, ends):
+                _read_into(fd, o[s:e], int(u[s]) * row_bytes)
+
+    def _submit_cold(self, indexes):
+        # Returns (inverse, values, futures)
+        u, inv = np.unique(indexes, return_inverse=True)
+        out = {name: np.empty((u.shape[0], *b.shape[1:]), dtype=b.dtype)
+               for name, b in self.hot.items()}
+        if u.shape[0] == 0:
+            return inv, out, []
+
+        # Consecutive indexes are read at once.
+        breaks = np.flatnonzero(np.diff(u) != 1) + 1
+        starts = np.concatenate(([0], breaks))
+        ends = np.concatenate((breaks, [u.shape[0]]))
+        parts = np.array_split(np.arange(starts.shape[0]),
+                               min(self.io_threads, starts.shape[0]))
+        futures = [self._reader.submit(self._read_runs, u, starts[p], ends[p], out)
+                   for p in parts]
+        return inv, out, futures
+
+    def _issue(self, indexes):
+        # Cold reads of indexes which are not hot. (Ages at issue are kept
+        # to detect transitions overwritten before resolution.)
+        ages = self._ages(indexes)
+        cold = ages >= self.hot_size
+        return {"indexes": indexes, "ages": ages, "added": self.added,
+                "cold": cold, "read": self._submit_cold(indexes[cold])}
+
+    @staticmethod
+    def _wait(read):
+        inv, values, futures = read
+        for f in futures:
+            f.result()
+        return {name: v[inv] for name, v in values.items()}
+
+    def _resolve(self, issued):
+        indexes = issued["indexes"]
+        B = indexes.shape[0]
+        moved = self.added - issued["added"]
+
+        # Issued cold reads are valid unless their transitions are overwritten.
+        cold = issued["cold"]
+        valid = cold & (issued["ages"] + moved < self.buffer_size)
+        ages = self._ages(indexes)
+        hot = (~valid) & (ages < self.hot_size)
+        late = (~valid) & (~hot)
+        late_read = self._submit_cold(indexes[late])
+
+        sample = {name: np.empty((B, *b.shape[1:]), dtype=b.dtype)
+                  for name, b in self.hot.items()}
+
+        h = (indexes[hot] % np.uint64(self.hot_size)).astype(np.int64)
+        for name, b in self.hot.items():
+            sample[name][hot] = b[h]
+
+        issued_values = self._wait(issued["read"])
+        late_values = self._wait(late_read)
+        for name in self.hot:
+            sample[name][valid] = issued_values[name][valid[cold]]
+            sample[name][late] = late_values[name]
+
+        self.counters["hot_reads"] += int(hot.sum())
+        self.counters["cold_reads"] += int(valid.sum() + late.sum())
+        sample["indexes"] = indexes
+        return sample
+
+    def _sample_indexes(self, batch_size):
+        # Returns (issued request, extra values for sample)
+        return self._issue(self._draw(batch_size)), {}
+
+    def sample(self, batch_size):
+        """
+        Sample transitions from hot ring and segment files
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            Sampled transitions with their 'indexes'
+
+        Raises
+        ------
+        ValueError
+            If no transitions are stored.
+        """
+        if self.stored_size == 0:
+            raise ValueError("Cannot sample from empty buffer")
+
+        p = self._prefetched
+        self._prefetched = None
+        if (p is not None) and (p[0]["indexes"].shape[0] == batch_size):
+            self.counters["prefetch_hits"] += 1
+            issued, extra = p
+        else:
+            issued, extra = self._sample_indexes(batch_size)
+
+        sample = self._resolve(issued)
+        sample.update(extra)
+
+        if self.prefetch:
+            self._prefetched = self._sample_indexes(batch_size)
+        return sample
+
+    def flush(self):
+        """
+        Wait for pending writes of segment files
+        """
+        for hc in list(self._pending):
+            self._wait_chunk(hc)
+
+    def clear(self):
+        """
+        Clear replay buffer
+        """
+        self.flush()
+        self._drop_prefetched()
+        self.next_index = 0
+        self.stored_size = 0
+        self.added = 0
+
+    def _drop_prefetched(self):
+        if self._prefetched is not None:
+            for f in self._prefetched[0]["read"][2]:
+                f.result()
+            self._prefetched = None
+
+    def close(self):
+        """
+        Close segment files. The buffer cannot be used any more.
+        """
+        if self._files is None:
+            return
+        self.flush()
+        self._drop_prefetched()
+        self._reader.shutdown()
+        self._writer.shutdown()
+        for fd, _ in self._files.values():
+            os.close(fd)
+        self._files = None
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+    def on_episode_end(self):
+        pass
+
+    def get_stored_size(self):
+        return self.stored_size
+
+    def get_buffer_size(self):
+        return self.buffer_size
+
+    def get_next_index(self):
+        return self.next_index
+
+    def get_stats(self):
+        """
+        Get stats
+
+        Returns
+        -------
+        stats : dict
+            `{"gauges": {name: value}, "counters": {name: int},
+            "latency": {}}`, which can be formatted by
+            `cpprb.metrics.to_prometheus()`
+        """
+        hot = min(self.stored_size, self.hot_size)
+        return {"gauges": {"stored_size": self.stored_size,
+                           "buffer_size": self.buffer_size,
+                           "hot_stored_size": hot,
+                           "cold_stored_size": self.stored_size - hot,
+                           "pending_chunks": len(self._pending)},
+                "counters": dict(self.counters),
+                "latency": {}}
+
+
+class TieredPrioritizedReplayBuffer(TieredReplayBuffer):
+    def __init__(self, size, env_dict=None, *, alpha=0.6, eps=1e-4,
+                 num_threads=1, seed=None, **kwargs):
+        """
+        Initialize TieredPrioritizedReplayBuffer
+
+        Parameters
+        ----------
+        size : int
+            Total buffer size
+        env_dict : dict of dict, optional
+            Environment definition. (See `ReplayBuffer`)
+        alpha : float, optional
+            :math:`\\alpha` the exponent of the priorities. Default is `0.6`.
+        eps : float, optional
+            :math:`\\epsilon` small positive constant. Default is `1e-4`.
+        num_threads : int, optional
+            The number of threads of priority sampling. Default is `1`.
+        seed : int, optional
+            Seed of sampling
+        **kwargs
+            Other parameters of `TieredReplayBuffer` except `cold_fraction`
+
+        Notes
+        -----
+        Priorities of all (hot and cold) transitions are kept at in-memory
+        segment tree (`PrioritizedSampler`), and transitions are sampled
+        proportionally to them regardless of tiers. With `prefetch=True`,
+        the next batch is drawn before `update_priorities()` of the current
+        batch, and its weights are the ones at drawing.
+        """
+        if kwargs.get("cold_fraction") is not None:
+            raise ValueError("`cold_fraction` cannot be used with priorities")
+        super().__init__(size, env_dict, seed=seed, **kwargs)
+        self.per = PrioritizedSampler(self.buffer_size, alpha=alpha, eps=eps,
+                                      seed=seed, num_threads=num_threads)
+
+    def add(self, *, priorities=None, **kwargs):
+        """
+        Add transition(s) with priorities
+
+        Parameters
+        ----------
+        priorities : array like or float, optional
+            Priorities. If `None` (default), the max priority is used.
+        **kwargs : array like or float or int
+            Transitions to be stored.
+
+        Returns
+        -------
+        int
+            The first index of stored position
+        """
+        index, N = self._store(kwargs)
+        if priorities is not None:
+            priorities = np.ravel(np.asarray(priorities, dtype=np.single))
+        self.per.set_priorities(index, N, priorities)
+        return index
+
+    def _sample_indexes(self, batch_size):
+        indexes, weights = self.per.sample(batch_size, self._beta,
+                                           self.stored_size)
+        return self._issue(indexes), {"weights": weights}
+
+    def sample(self, batch_size, beta=0.4):
+        """
+        Sample transitions depending on priorities
+
+        Parameters
+        ----------
+        batch_size : int
+            Sampled batch size
+        beta : float, optional
+            The exponent of weight. Default is `0.4`.
+
+        Returns
+        -------
+        sample : dict of numpy.ndarray
+            Sampled transitions with 'weights' and 'indexes'
+        """
+        if (self._prefetched is not None) and (beta != self._beta):
+            self._drop_prefetched()
+        self._beta = beta
+        return super().sample(batch_size)
+
+    def update_priorities(self, indexes, priorities):
+        """
+        Update priorities
+
+        Parameters
+        ----------
+        indexes : array_like
+            Indexes to update
+        priorities : array_like
+            Priorities
+        """
+        self.per.update_priorities(indexes, priorities)
+
+    def get_max_priority(self):
+        return self.per.get_max_priority()
+
+    def get_priority_sum(self):
+        return self.per.get_priority_sum(self.stored_size)
+
+    def get_priority_min(self):
+        return self.per.get_priority_min(self.stored_size)
+
+    def clear(self):
+        super().clear()
+        self.per.clear()
+
+    _beta = 0.4
@@ -4,7 +4,17 @@ from .PyReplayBuffer import (ReplayBuffer,PrioritizedReplayBuffer,
 
 from .LaBER import LaBERmean, LaBERlazy, LaBERmax
 
-from .PyReplayBuffer import create_buffer, train
+from .Prefetcher import Prefetcher
+
+from .Sharded import ShardedPrioritizedReplayBuffer
+
+from .Server import ReplayServer, ReplayClient
+
+from .GPU import GPUReplayBuffer, GPUPrioritizedReplayBuffer
+
+from .Tiered import TieredReplayBuffer, TieredPrioritizedReplayBuffer
+
+from .PyReplayBuffer import create_buffer, train, set_memory_policy
 
 try:
     from .util import create_env_dict, create_before_add_func
@@ -0,0 +1,336 @@
+"""
+Chunked binary checkpoint (format version 2)
+
+Layout
+------
+MAGIC | chunk ... | header (JSON) | header size (uint64 LE) | MAGIC
+
+Each array is split into chunks of raw bytes, which are optionally
+compressed one by one. The header at the tail keeps `dtype`, `shape` and
+chunk list (`[offset, size, raw_size]`) of every array together with small
+JSON meta data. No pickle is used, so that only plain numeric arrays can be
+stored.
+"""
+import collections
+from concurrent.futures import ThreadPoolExecutor
+import json
+import os
+import struct
+
+import numpy as np
+
+MAGIC = b"CPPRBCK2"
+VERSION = 2
+
+_TAIL = struct.Struct("<Q8s")
+_ALIGN = 4096
+DEFAULT_CHUNK_SIZE = 64 * 1024 * 1024
+
+
+def _codec(compression):
+    if compression is None:
+        return None, None
+
+    if compression == "lz4":
+        try:
+            import lz4.frame
+        except ImportError as e:
+            raise ImportError("`compression=\"lz4\"` requires `lz4`") from e
+        return lz4.frame.compress, lz4.frame.decompress
+
+    if compression == "zstd":
+        try:
+            import zstandard
+        except ImportError as e:
+            raise ImportError("`compression=\"zstd\"` requires `zstandard`") from e
+        return (lambda b: zstandard.ZstdCompressor().compress(b),
+                lambda b: zstandard.ZstdDecompressor().decompress(b))
+
+    raise ValueError(f"Unknown compression: {compression}")
+
+
+def _as_bytes(a):
+    a = np.ascontiguousarray(a)
+    if a.dtype.hasobject:
+        raise ValueError("Object dtype cannot be stored without pickle")
+    return a.reshape(-1).view(np.uint8)
+
+
+def _num_threads(num_threads):
+    return num_threads or min(8, os.cpu_count() or 1)
+
+
+# Positional I/O is not available on some platforms (e.g. Windows), where
+# chunks are written and read sequentially through file object instead.
+_POSITIONAL_IO = hasattr(os, "pwrite") and hasattr(os, "preadv")
+
+
+def _pwrite(fd, data, offset):
+    view = memoryview(data).cast("B")
+    while view.nbytes > 0:
+        n = os.pwrite(fd, view, offset)
+        view = view[n:]
+        offset += n
+
+
+def _pread(fd, out, offset):
+    view = memoryview(out).cast("B")
+    while view.nbytes > 0:
+        n = os.preadv(fd, [view], offset)
+        if n == 0:
+            raise ValueError("Checkpoint file is truncated")
+        view = view[n:]
+        offset += n
+
+
+def is_checkpoint(file):
+    """
+    Check whether file is chunked checkpoint
+
+    Parameters
+    ----------
+    file : str or file-like object
+        File to check. File position is kept.
+
+    Returns
+    -------
+    bool
+        Whether file starts with checkpoint magic
+    """
+    if isinstance(file, (str, os.PathLike)):
+        if not os.path.isfile(file):
+            return False
+        with open(file, "rb") as f:
+            return f.read(len(MAGIC)) == MAGIC
+
+    pos = file.tell()
+    try:
+        return file.read(len(MAGIC)) == MAGIC
+    finally:
+        file.seek(pos)
+
+
+def write(file, meta, arrays, *, compression=None,
+          chunk_size=DEFAULT_CHUNK_SIZE, num_threads=None):
+    """
+    Write arrays into chunked checkpoint
+
+    Parameters
+    ----------
+    file : str or file-like object
+        File to write. When path is passed, raw chunks are written
+        by multiple threads with `os.pwrite` (if available).
+    meta : dict
+        JSON serializable meta data
+    arrays : dict of numpy.ndarray
+        Arrays to be stored
+    compression : {None, "lz4", "zstd"}, optional
+        Per chunk compression. Chunks are compressed by multiple threads.
+    chunk_size : int, optional
+        Raw bytes of a chunk. Default value is 64 MiB.
+    num_threads : int, optional
+        The number of threads. Default value is `min(8, os.cpu_count())`.
+    """
+    compress, _ = _codec(compression)
+    chunk_size = max(int(chunk_size), 1)
+
+    raws = {k: _as_bytes(v) for k, v in arrays.items()}
+    fields = {k: {"dtype": np.asarray(v).dtype.str,
+                  "shape": list(np.shape(v)),
+                  "chunks": []}
+              for k, v in arrays.items()}
+    jobs = [(k, raw[b:b+chunk_size])
+            for k, raw in raws.items()
+            for b in range(0, raw.shape[0], chunk_size)]
+
+    is_path = isinstance(file, (str, os.PathLike))
+    f = open(file, "wb") if is_path else file
+    try:
+        base = f.tell()
+        f.write(MAGIC)
+        offset = len(MAGIC)
+
+        with ThreadPoolExecutor(_num_threads(num_threads)) as pool:
+            if compress is None:
+                # Offsets are known in advance, each field is page aligned.
+                placed = []
+                last = None
+                for k, c in jobs:
+                    if k != last:
+                        offset = -(-offset // _ALIGN) * _ALIGN
+                        last = k
+                    placed.append((offset, c))
+                    fields[k]["chunks"].append([offset, c.shape[0], c.shape[0]])
+                    offset += c.shape[0]
+
+                if is_path and _POSITIONAL_IO:
+                    f.flush()
+                    fd = f.fileno()
+                    list(pool.map(lambda oc: _pwrite(fd, oc[1], base + oc[0]),
+                                  placed))
+                    f.seek(base + offset)
+                else:
+                    for o, c in placed:
+                        f.seek(base + o)
+                        f.write(c)
+                    f.seek(base + offset)
+            else:
+                # Compress in parallel, but write (and place) in order.
+                # At most 2 * threads compressed chunks are kept in memory.
+                window = 2 * _num_threads(num_threads)
+                pending = collections.deque()
+                for n, (k, c) in enumerate(jobs):
+                    pending.append((k, c.shape[0], pool.submit(compress, c)))
+                    while pending and ((len(pending) > window) or
+                                       (n + 1 == len(jobs))):
+                        name, raw_size, z = pending.popleft()
+                        z = z.result()
+                        fields[name]["chunks"].append([offset, len(z), raw_size])
+                        f.write(z)
+                        offset += len(z)
+
+        header = json.dumps({"version": VERSION,
+                             "compression": compression,
+                             "meta": meta,
+                             "fields": fields}).encode("utf-8")
+        f.write(header)
+        f.write(_TAIL.pack(len(header), MAGIC))
+    finally:
+        if is_path:
+            f.close()
+
+
+class Reader:
+    def __init__(self, file, *, num_threads=None):
+        """
+        Open chunked checkpoint
+
+        Parameters
+        ----------
+        file : str or file-like object
+            File to read. It must be seekable and the checkpoint must last
+            until its end. When path is passed, uncompressed chunks are read
+            by multiple threads with `os.preadv` (if available).
+        num_threads : int, optional
+            The number of threads. Default value is `min(8, os.cpu_count())`.
+
+        Raises
+        ------
+        ValueError
+            If file is not checkpoint or its version is unknown.
+        """
+        self.is_path = isinstance(file, (str, os.PathLike))
+        self.f = open(file, "rb") if self.is_path else file
+        self.num_threads = _num_threads(num_threads)
+        try:
+            self.base = self.f.tell()
+            if self.f.read(len(MAGIC)) != MAGIC:
+                raise ValueError("File is not cpprb checkpoint")
+
+            end = self.f.seek(0, os.SEEK_END)
+            if end - self.base < len(MAGIC) + _TAIL.size:
+                raise ValueError("Checkpoint file is truncated")
+            self.f.seek(end - _TAIL.size)
+            size, magic = _TAIL.unpack(self.f.read(_TAIL.size))
+            if magic != MAGIC:
+                raise ValueError("Checkpoint file is truncated")
+
+            self.f.seek(end - _TAIL.size - size)
+            header = json.loads(self.f.read(size).decode("utf-8"))
+            if header.get("version") != VERSION:
+                raise ValueError(f"Unknown Format Version: {header.get('version')}")
+        except BaseException:
+            self.close()
+            raise
+
+        self.meta = header["meta"]
+        self.fields = header["fields"]
+        _, self._decompress = _codec(header["compression"])
+
+    def __contains__(self, name):
+        return name in self.fields
+
+    def dtype(self, name):
+        return np.dtype(self.fields[name]["dtype"])
+
+    def shape(self, name):
+        return tuple(self.fields[name]["shape"])
+
+    def read_into(self, name, out):
+        """
+        Read array directly into preallocated array
+
+        Parameters
+        ----------
+        name : str
+            Array name
+        out : numpy.ndarray
+            C-contiguous array with the same dtype and shape as stored one
+
+        Raises
+        ------
+        ValueError
+            If dtype or shape mismatch.
+        """
+        if name not in self.fields:
+            raise ValueError(f"Checkpoint does not have \"{name}\"")
+        if (out.dtype != self.dtype(name)) or (out.shape != self.shape(name)):
+            raise ValueError(f"Stored \"{name}\" and Buffer mismatch for " +
+                             f"dtype/shape: {self.dtype(name)}{self.shape(name)}" +
+                             f" vs {out.dtype}{out.shape}")
+        if not out.flags.c_contiguous:
+            raise ValueError("`out` must be C-contiguous")
+
+        raw = out.reshape(-1).view(np.uint8)
+        jobs = []
+        pos = 0
+        for offset, size, raw_size in self.fields[name]["chunks"]:
+            jobs.append((self.base + offset, size, raw[pos:pos+raw_size]))
+            pos += raw_size
+        if pos != raw.shape[0]:
+            raise ValueError(f"Stored \"{name}\" is broken")
+
+        if (self._decompress is None and self.is_path and len(jobs) > 1 and
+            _POSITIONAL_IO):
+            fd = self.f.fileno()
+            with ThreadPoolExecutor(self.num_threads) as pool:
+                list(pool.map(lambda j: _pread(fd, j[2], j[0]), jobs))
+            return out
+
+        for offset, size, chunk in jobs:
+            self.f.seek(offset)
+            if self._decompress is None:
+                if self.f.readinto(chunk) != size:
+                    raise ValueError("Checkpoint file is truncated")
+            else:
+                chunk[:] = np.frombuffer(self._decompress(self.f.read(size)),
+                                         dtype=np.uint8)
+        return out
+
+    def read(self, name):
+        """
+        Read array
+
+        Parameters
+        ----------
+        name : str
+            Array name
+
+        Returns
+        -------
+        numpy.ndarray
+            Stored array
+        """
+        return self.read_into(name, np.empty(self.shape(name),
+                                             dtype=self.dtype(name)))
+
+    def close(self):
+        if self.is_path and self.f is not None:
+            self.f.close()
+        self.f = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
@@ -0,0 +1,205 @@
+"""
+Low overhead metrics of buffers
+
+Buffers constructed with `stats=True` record call counts, latency
+histograms, transferred items and bytes into `Metrics`. Without it, the hot
+paths only check `None`.
+"""
+from time import perf_counter_ns as now
+
+# Upper bounds of latency buckets: 1 us * 2^k (k = 0, ..., 24; ~16.8 s)
+BUCKETS_NS = tuple(1000 << k for k in range(25))
+
+
+class LatencyHistogram:
+    __slots__ = ("counts", "count", "sum_ns", "max_ns")
+
+    def __init__(self):
+        self.counts = [0] * (len(BUCKETS_NS) + 1)
+        self.count = 0
+        self.sum_ns = 0
+        self.max_ns = 0
+
+    def observe(self, ns):
+        # Bucket k holds (1000 << (k-1), 1000 << k]
+        k = (max(ns - 1, 0) // 1000).bit_length()
+        self.counts[min(k, len(BUCKETS_NS))] += 1
+        self.count += 1
+        self.sum_ns += ns
+        if ns > self.max_ns:
+            self.max_ns = ns
+
+    def quantile(self, q):
+        """
+        Approximate quantile (upper bound of bucket) in seconds
+        """
+        if self.count == 0:
+            return 0.0
+        rank = q * self.count
+        acc = 0
+        for k, c in enumerate(self.counts):
+            acc += c
+            if acc >= rank and c > 0:
+                return (BUCKETS_NS[k] if k < len(BUCKETS_NS)
+                        else self.max_ns) * 1e-9
+        return self.max_ns * 1e-9
+
+    def to_dict(self):
+        return {"count": self.count,
+                "sum": self.sum_ns * 1e-9,
+                "max": self.max_ns * 1e-9,
+                "p50": self.quantile(0.5),
+                "p99": self.quantile(0.99),
+                "buckets": {b / 1e9: c for b, c in zip(BUCKETS_NS, self.counts)},
+                "overflow": self.counts[-1]}
+
+
+class Metrics:
+    def __init__(self):
+        """
+        Counters and latency histograms of a buffer
+
+        Notes
+        -----
+        Metrics are process local. Buffers shared with other processes
+        (e.g. `MPReplayBuffer`) record only calls of the process.
+        """
+        self.counters = {}
+        self.histograms = {}
+
+    def observe(self, name, t0, items=0, nbytes=0):
+        """
+        Record a call started at `t0` (`time.perf_counter_ns()`)
+
+        Parameters
+        ----------
+        name : str
+            Operation name (e.g. "add")
+        t0 : int
+            Start time in nanoseconds
+        items : int, optional
+            The number of processed transitions
+        nbytes : int, optional
+            Copied bytes
+        """
+        ns = now() - t0
+        h = self.histograms.get(name)
+        if h is None:
+            h = self.histograms[name] = LatencyHistogram()
+        h.observe(ns)
+        if items:
+            self.count(f"{name}_items", items)
+        if nbytes:
+            self.count(f"{name}_bytes", nbytes)
+
+    def count(self, name, n=1):
+        self.counters[name] = self.counters.get(name, 0) + n
+
+    def reset(self):
+        self.counters.clear()
+        self.histograms.clear()
+
+    def to_dict(self):
+        """
+        Get snapshot
+
+        Returns
+        -------
+        dict
+            `{"counters": {name: int}, "latency": {name: dict}}`. Latency
+            values are in seconds.
+        """
+        return {"counters": dict(self.counters),
+                "latency": {k: h.to_dict() for k, h in self.histograms.items()}}
+
+
+def _labels(labels, extra=None):
+    items = dict(labels or {})
+    if extra:
+        items.update(extra)
+    if not items:
+        return ""
+    escaped = (str(v).replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n")
+               for v in items.values())
+    return "{" + ",".join(f"{k}=\"{v}\"" for k, v in zip(items.keys(), escaped)) + "}"
+
+
+def _families(stats, prefix, labels):
+    # {metric family: (type, lines)}
+    families = {}
+    for name, v in sorted(stats.get("gauges", {}).items()):
+        families[f"{prefix}_{name}"] = ("gauge",
+                                        [f"{prefix}_{name}{_labels(labels)} {v}"])
+
+    for name, v in sorted(stats.get("counters", {}).items()):
+        metric = f"{prefix}_{name}_total"
+        families[metric] = ("counter", [f"{metric}{_labels(labels)} {v}"])
+
+    for name, h in sorted(stats.get("latency", {}).items()):
+        metric = f"{prefix}_{name}_seconds"
+        lines = []
+        acc = 0
+        for bound, c in h["buckets"].items():
+            acc += c
+            lines.append(f"{metric}_bucket{_labels(labels, {'le': repr(bound)})} {acc}")
+        lines.append(f"{metric}_bucket{_labels(labels, {'le': '+Inf'})} {h['count']}")
+        lines.append(f"{metric}_sum{_labels(labels)} {h['sum']}")
+        lines.append(f"{metric}_count{_labels(labels)} {h['count']}")
+        families[metric] = ("histogram", lines)
+    return families
+
+
+def _format(families):
+    lines = []
+    for metric, (kind, samples) in families.items():
+        lines.append(f"# TYPE {metric} {kind}")
+        lines.extend(samples)
+    return "\n".join(lines) + "\n"
+
+
+def to_prometheus(stats, *, prefix="cpprb", labels=None):
+    """
+    Format stats as Prometheus text exposition format
+
+    Parameters
+    ----------
+    stats : dict
+        Stats returned by `get_stats()` of buffers
+    prefix : str, optional
+        Metric name prefix. Default value is "cpprb".
+    labels : dict, optional
+        Labels attached to all metrics (e.g. `{"buffer": "learner0"}`)
+
+    Returns
+    -------
+    str
+        Metrics text
+    """
+    return _format(_families(stats, prefix, labels))
+
+
+def prometheus_text(buffers, *, prefix="cpprb", label="buffer"):
+    """
+    Export stats of buffers as Prometheus text
+
+    Parameters
+    ----------
+    buffers : dict
+        `{label value: buffer}` whose buffers are constructed with
+        `stats=True`
+    prefix : str, optional
+        Metric name prefix. Default value is "cpprb".
+    label : str, optional
+        Label name distinguishing buffers. Default value is "buffer".
+
+    Returns
+    -------
+    str
+        Metrics text, which can be served at `/metrics` endpoint.
+    """
+    merged = {}
+    for value, buffer in buffers.items():
+        for metric, (kind, samples) in _families(buffer.get_stats(), prefix,
+                                                 {label: value}).items():
+            merged.setdefault(metric, (kind, []))[1].extend(samples)
+    return _format(merged)
@@ -0,0 +1,136 @@
+import unittest
+
+import numpy as np
+
+from cpprb import (GPUReplayBuffer, GPUPrioritizedReplayBuffer,
+                   PrioritizedReplayBuffer)
+from cpprb.PyReplayBuffer import dict2buffer
+
+try:
+    import cupy as cp
+    cp.cuda.runtime.getDeviceCount()
+except Exception:
+    cp = None
+
+
+class TestDeviceDict2Buffer(unittest.TestCase):
+    def test_incompatible(self):
+        with self.assertRaises(ValueError):
+            dict2buffer(4, {"a": {"shape": (2, 2)}}, stack_compress="a",
+                        device=0)
+
+        with self.assertRaises(ValueError):
+            dict2buffer(4, {"a": {}}, shared=True, device=0)
+
+
+@unittest.skipIf(cp is None, "CuPy or CUDA device is not available")
+class TestGPUReplayBuffer(unittest.TestCase):
+    def test_buffer(self):
+        b = dict2buffer(4, {"a": {"shape": 3}}, device=0)
+        self.assertIsInstance(b["a"], cp.ndarray)
+        self.assertEqual(b["a"].shape, (4, 3))
+
+    def test_add(self):
+        rb = GPUReplayBuffer(4, {"a": {"shape": 2}, "b": {"dtype": np.int32}})
+        self.assertEqual(rb.add(a=np.ones((3, 2)), b=np.arange(3)), 0)
+        self.assertEqual(rb.add(a=cp.zeros((2, 2)), b=cp.arange(3, 5)), 3)
+        self.assertEqual(rb.get_stored_size(), 4)
+        self.assertEqual(rb.get_next_index(), 1)
+
+        t = rb.get_all_transitions()
+        self.assertIsInstance(t["b"], cp.ndarray)
+        self.assertEqual(t["b"].dtype, np.int32)
+        np.testing.assert_array_equal(cp.asnumpy(t["b"]).ravel(), [4, 1, 2, 3])
+
+        # Longer than buffer size
+        rb.add(a=np.zeros((6, 2)), b=np.arange(6))
+        np.testing.assert_array_equal(cp.asnumpy(rb.get_all_transitions()["b"]).ravel(),
+                                      [3, 4, 5, 2])
+
+        with self.assertRaises(ValueError):
+            rb.add(a=np.zeros((2, 2)), b=np.zeros(3))
+
+    def test_sample(self):
+        rb = GPUReplayBuffer(32, {"a": {}}, seed=1)
+        with self.assertRaises(ValueError):
+            rb.sample(4)
+
+        rb.add(a=np.arange(10))
+        s = rb.sample(64)
+        self.assertIsInstance(s["a"], cp.ndarray)
+        self.assertEqual(s["a"].shape, (64, 1))
+        a = cp.asnumpy(s["a"])
+        self.assertTrue(((0 <= a) & (a < 10)).all())
+
+        rb2 = GPUReplayBuffer(32, {"a": {}}, seed=1)
+        rb2.add(a=np.arange(10))
+        np.testing.assert_array_equal(cp.asnumpy(rb2.sample(64)["a"]), a)
+
+    def test_dlpack(self):
+        rb = GPUReplayBuffer(8, {"a": {}})
+        rb.add(a=np.arange(4))
+        s = rb.sample(2)
+        self.assertTrue(hasattr(s["a"], "__cuda_array_interface__"))
+        self.assertTrue(hasattr(s["a"], "__dlpack__"))
+
+
+@unittest.skipIf(cp is None, "CuPy or CUDA device is not available")
+class TestGPUPrioritizedReplayBuffer(unittest.TestCase):
+    def test_tree(self):
+        rb = GPUPrioritizedReplayBuffer(6, {"a": {}}, alpha=1.0, eps=0.0)
+        rb.add(a=np.arange(4), priorities=[1.0, 2.0, 3.0, 4.0])
+        self.assertAlmostEqual(rb.get_priority_sum(), 10.0)
+        self.assertAlmostEqual(rb.get_priority_min(), 1.0)
+        self.assertAlmostEqual(rb.get_max_priority(), 4.0)
+
+        # Without priorities, the max priority is used.
+        rb.add(a=4)
+        self.assertAlmostEqual(rb.get_priority_sum(), 14.0)
+
+        rb.update_priorities(cp.asarray([0, 4]), cp.asarray([5.0, 0.5]))
+        self.assertAlmostEqual(rb.get_priority_sum(), 14.5)
+        self.assertAlmostEqual(rb.get_priority_min(), 0.5)
+        self.assertAlmostEqual(rb.get_max_priority(), 5.0)
+
+        with self.assertRaises(ValueError):
+            rb.update_priorities([0, 1], [1.0])
+
+        rb.clear()
+        self.assertEqual(rb.get_stored_size(), 0)
+        self.assertAlmostEqual(rb.get_priority_sum(), 0.0)
+
+    def test_sample(self):
+        rb = GPUPrioritizedReplayBuffer(32, {"a": {}}, alpha=1.0, eps=0.0,
+                                        seed=0)
+        rb.add(a=[5, 7], priorities=[1.0, 3.0])
+
+        s = rb.sample(4096, beta=1.0)
+        idx = cp.asnumpy(s["indexes"])
+        self.assertEqual(set(np.unique(idx)), {0, 1})
+        self.assertAlmostEqual((idx == 1).mean(), 0.75, delta=0.05)
+        np.testing.assert_array_equal(cp.asnumpy(s["a"]).ravel(),
+                                      np.where(idx == 0, 5, 7))
+
+        w = cp.asnumpy(s["weights"])
+        np.testing.assert_allclose(w[idx == 0], 1.0, rtol=1e-5)
+        np.testing.assert_allclose(w[idx == 1], 1.0 / 3.0, rtol=1e-5)
+
+    def test_compatible_with_cpu(self):
+        ps = np.arange(1, 33, dtype=np.single) % 7 + 1.0
+        gpu = GPUPrioritizedReplayBuffer(32, {"a": {}})
+        cpu = PrioritizedReplayBuffer(32, {"a": {}})
+        gpu.add(a=np.arange(32), priorities=ps)
+        cpu.add(a=np.arange(32), priorities=ps)
+
+        self.assertAlmostEqual(gpu.get_priority_sum(), cpu.get_priority_sum(),
+                               places=4)
+        self.assertAlmostEqual(gpu.get_priority_min(), cpu.get_priority_min(),
+                               places=5)
+
+        np.testing.assert_allclose(np.unique(cp.asnumpy(gpu.sample(256)["weights"])),
+                                   np.unique(cpu.sample(256)["weights"]),
+                                   rtol=1e-4)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1,7 +1,8 @@
 import unittest
 import numpy as np
 
-from cpprb import LaBERmean, LaBERlazy, LaBERmax
+from cpprb import (LaBERmean, LaBERlazy, LaBERmax,
+                   ReplayBuffer, PrioritizedReplayBuffer)
 
 class TestLaBER:
     def test_init(self):
@@ -57,6 +58,47 @@ class TestLaBER:
         np.testing.assert_array_equal(sample["indexes"], [0, 0])
         np.testing.assert_array_equal(sample["weights"], self.onehot)
 
+    def test_two_stage(self):
+        rb = ReplayBuffer(32, {"obs": {"shape": 3}, "act": {}})
+        rb.add(obs=np.arange(32*3).reshape(32, 3), act=np.arange(32))
+
+        laber = self.cls(2, 2, eps=0, seed=1)
+        candidates = laber.sample_candidates(rb, fields=["act"])
+        self.assertEqual(set(candidates.keys()), {"act", "indexes"})
+        np.testing.assert_array_equal(candidates["act"].ravel(),
+                                      candidates["indexes"])
+
+        sample = laber.subsample(rb, candidates, priorities=[1, 0, 0, 0])
+        np.testing.assert_array_equal(sample["indexes"],
+                                      [candidates["indexes"][0]] * 2)
+        np.testing.assert_array_equal(sample["act"].ravel(), sample["indexes"])
+        np.testing.assert_array_equal(sample["obs"][:, 0], sample["indexes"] * 3)
+        np.testing.assert_allclose(sample["weights"], self.onehot)
+
+        sample = laber.subsample(rb, candidates, priorities=[1, 1, 1, 1])
+        np.testing.assert_allclose(sample["weights"], self.uniform, rtol=1e-5)
+
+        with self.assertRaises(ValueError):
+            laber.subsample(rb, candidates, priorities=[1, 1])
+
+        with self.assertRaises(KeyError):
+            laber.sample_candidates(rb, fields=["rew"])
+
+    def test_two_stage_prioritized(self):
+        rb = PrioritizedReplayBuffer(32, {"obs": {}})
+        rb.add(obs=np.arange(32), priorities=np.ones(32))
+
+        laber = self.cls(2, 2, eps=0)
+        candidates = laber.sample_candidates(rb, fields=["obs"])
+        self.assertEqual(set(candidates.keys()), {"obs", "indexes", "weights"})
+        np.testing.assert_allclose(candidates["weights"], 1)
+
+        sample = laber.subsample(rb, candidates, priorities=[0, 0, 1, 0])
+        np.testing.assert_array_equal(sample["indexes"],
+                                      [candidates["indexes"][2]] * 2)
+        np.testing.assert_array_equal(sample["obs"].ravel(), sample["indexes"])
+        np.testing.assert_allclose(sample["weights"], self.onehot)
+
 
 class TestLaBERmean(TestLaBER, unittest.TestCase):
     @classmethod
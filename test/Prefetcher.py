@@ -0,0 +1,90 @@
+import unittest
+
+import numpy as np
+
+from cpprb import ReplayBuffer, PrioritizedReplayBuffer, Prefetcher
+
+
+class TestPrefetcher(unittest.TestCase):
+    def test_init(self):
+        rb = ReplayBuffer(32, {"a": {}})
+
+        with self.assertRaises(ValueError):
+            Prefetcher(rb, 0)
+
+        with self.assertRaises(ValueError):
+            Prefetcher(rb, 4, 0)
+
+        with self.assertRaises(ValueError):
+            Prefetcher(rb, 4, on_update="unknown")
+
+    def test_next_batch(self):
+        rb = ReplayBuffer(32, {"a": {"shape": 3}})
+        rb.add(a=np.ones((10, 3)))
+
+        with Prefetcher(rb, 4) as p:
+            for _ in range(10):
+                s = p.next_batch(timeout=5)
+                self.assertEqual(s["a"].shape, (4, 3))
+                np.testing.assert_array_equal(s["a"], np.ones((4, 3)))
+
+    def test_wait_for_add(self):
+        rb = ReplayBuffer(32, {"a": {}})
+
+        with Prefetcher(rb, 4) as p:
+            with self.assertRaises(TimeoutError):
+                p.next_batch(timeout=0.1)
+
+            p.add(a=3)
+            np.testing.assert_array_equal(p.next_batch(timeout=5)["a"],
+                                          np.full((4, 1), 3))
+
+    def test_clear(self):
+        rb = ReplayBuffer(32, {"a": {}})
+
+        with Prefetcher(rb, 4) as p:
+            p.add(a=1)
+            p.next_batch(timeout=5)
+            p.clear()
+            self.assertEqual(rb.get_stored_size(), 0)
+            with self.assertRaises(TimeoutError):
+                p.next_batch(timeout=0.1)
+
+    def test_iterator(self):
+        rb = ReplayBuffer(32, {"a": {}})
+        rb.add(a=np.arange(5))
+
+        with Prefetcher(rb, 2) as p:
+            for i, s in enumerate(p):
+                self.assertEqual(s["a"].shape, (2, 1))
+                if i > 5:
+                    break
+
+    def test_invalidate(self):
+        rb = PrioritizedReplayBuffer(4, {"a": {}}, eps=0)
+        rb.add(a=np.arange(4), priorities=[1.0, 0.0, 0.0, 0.0])
+
+        with Prefetcher(rb, 8, 2, on_update="invalidate") as p:
+            s = p.next_batch(timeout=5)
+            np.testing.assert_array_equal(s["indexes"], np.zeros(8))
+
+            p.update_priorities([0, 1], [0.0, 1.0])
+            s = p.next_batch(timeout=5)
+            np.testing.assert_array_equal(s["indexes"], np.ones(8))
+
+    def test_check_for_update(self):
+        rb = PrioritizedReplayBuffer(4, {"a": {}}, eps=0, check_for_update=True)
+        rb.add(a=np.arange(4), priorities=[1.0, 0.0, 0.0, 0.0])
+
+        with Prefetcher(rb, 8, 1, on_update="carry") as p:
+            s = p.next_batch(timeout=5)
+            np.testing.assert_array_equal(s["indexes"], np.zeros(8))
+
+            # Overwrite index 0 after sampling
+            p.add(a=4, priorities=1e-8)
+            p.update_priorities(s["indexes"], np.full(8, 5.0))
+            self.assertNotEqual(rb.get_max_priority(), 5.0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -354,6 +354,44 @@ class TestSelectiveReplayBuffer(TestReplayBuffer):
         delete_len = self.srb.delete_episode(2)
         self.assertEqual(self.srb.get_next_index(), old_index - delete_len)
 
+    def test_episode_blocks(self):
+        srb = SelectiveReplayBuffer(4, 1, 1, Nepisodes=3, episode_blocks=True)
+
+        def add(i, n):
+            done = np.zeros(n)
+            done[-1] = 1
+            srb.add(np.full(n, i), np.zeros(n), np.zeros(n), np.full(n, i), done)
+
+        for i, n in enumerate([2, 3, 4]):
+            add(i, n)
+        self.assertEqual(srb.get_stored_size(), 9)
+
+        self.assertEqual(srb.delete_episode(1), 3)
+        self.assertEqual(srb.get_stored_episode_size(), 2)
+        np.testing.assert_allclose(srb.get_episode(1)["obs"].ravel(), [2] * 4)
+
+        # Deleted block is reused, then the oldest episode is evicted.
+        add(3, 1)
+        add(4, 2)
+        self.assertEqual(srb.get_stored_episode_size(), 3)
+        self.assertEqual(srb.get_stored_size(), 7)
+        for i, v in enumerate([2, 3, 4]):
+            self.assertEqual(srb.get_episode(i)["obs"][0, 0], v)
+
+        s = srb.sample(64)
+        self.assertTrue(np.isin(s["obs"], [2, 3, 4]).all())
+
+        # Episode longer than block is rejected, and nothing is stored.
+        with self.assertRaises(ValueError):
+            add(5, 5)
+        srb.add(5, 0, 0, 5, 0)
+        with self.assertRaises(ValueError):
+            add(5, 4)
+        self.assertEqual(srb.get_stored_size(), 4)
+        add(5, 3)
+        self.assertEqual(srb.get_stored_episode_size(), 3)
+        np.testing.assert_allclose(srb.get_episode(2)["obs"].ravel(), [5] * 4)
+
 
 class TestReverseReplayBuffer(unittest.TestCase):
     def test_simple(self):
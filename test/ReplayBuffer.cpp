@@ -90,6 +90,123 @@ void test_PrioritizedSampler(){
   ymd::show_vector(ps_i,"indexes [0.5,.,1e+10,..,0.5]");
 
   ALMOST_EQUAL(ps.get_max_priority(),LARGE_P);
+
+  // Sum and min of stored (p + eps)^alpha
+  auto stats = ymd::CppPrioritizedSampler(N_buffer_size,alpha);
+  stats.set_priorities(0,1.0);
+  stats.set_priorities(1,3.0);
+  ALMOST_EQUAL(stats.get_sum(2),std::pow(1.0+1e-4,alpha) + std::pow(3.0+1e-4,alpha));
+  ALMOST_EQUAL(stats.get_min(2),std::pow(1.0+1e-4,alpha));
+  ALMOST_EQUAL(stats.get_min(1),std::pow(1.0+1e-4,alpha));
+
+  // Restore from raw tree storage (checkpoint)
+  auto src = ymd::CppPrioritizedSampler(N_buffer_size,alpha);
+  auto restored = ymd::CppPrioritizedSampler(N_buffer_size,alpha);
+  for(auto i = 0ul; i < N_buffer_size; ++i){
+    src.set_priorities(i,0.5 + i % 7);
+  }
+  EQUAL(restored.tree_data_size(),src.tree_data_size());
+  std::copy_n(src.tree_data(),src.tree_data_size(),restored.tree_data());
+  restored.set_max_priority(src.get_max_priority());
+  ALMOST_EQUAL(restored.get_max_priority(),src.get_max_priority());
+
+  auto rs_w = std::vector<Priority>{};
+  auto rs_i = std::vector<std::size_t>{};
+  restored.sample(N_batch_size,beta,rs_w,rs_i,N_buffer_size);
+  for(auto i = 0ul; i < N_batch_size; ++i){
+    // weight = (p / p_min)^(-beta), where p = (priority + eps)^alpha
+    auto p = std::pow((0.5 + rs_i[i] % 7 + 1e-4)/(0.5 + 1e-4),alpha);
+    ALMOST_EQUAL(rs_w[i],std::pow(p,-beta));
+  }
+
+  // Seeded sampling does not depend on the number of threads
+  constexpr const auto N_large_batch = 4096ul;
+  auto seq = ymd::CppPrioritizedSampler(N_buffer_size,alpha);
+  auto par = ymd::CppPrioritizedSampler(N_buffer_size,alpha);
+  par.set_num_threads(4);
+  EQUAL(par.get_num_threads(),4ul);
+  for(auto* s : {&seq,&par}){
+    for(auto i = 0ul; i < N_buffer_size; ++i){ s->set_priorities(i,0.5 + i % 7); }
+    s->set_seed(42);
+  }
+
+  auto seq_w = std::vector<Priority>{}, par_w = std::vector<Priority>{};
+  auto seq_i = std::vector<std::size_t>{}, par_i = std::vector<std::size_t>{};
+  for(auto n = 0; n < 3; ++n){
+    seq.sample(N_large_batch,beta,seq_w,seq_i,N_buffer_size);
+    par.sample(N_large_batch,beta,par_w,par_i,N_buffer_size);
+    EQUAL(par_i == seq_i,true);
+    EQUAL(par_w == seq_w,true);
+  }
+
+  // Stratified: the i-th index is sampled from the i-th region.
+  auto total = 0.0;
+  for(auto i = 0ul; i < N_buffer_size; ++i){
+    total += std::pow(0.5 + i % 7 + 1e-4,alpha);
+  }
+  auto prefix = 0.0;
+  auto j = 0ul;
+  for(auto i = 0ul; i < N_large_batch; ++i){
+    while(j < par_i[i]){ prefix += std::pow(0.5 + (j++) % 7 + 1e-4,alpha); }
+    EQUAL(prefix <= total * (i + 1) / N_large_batch * (1 + 1e-9),true);
+  }
+
+  par.set_seed(42);
+  par.sample(N_large_batch,beta,par_w,par_i,N_buffer_size);
+  seq.set_seed(43);
+  seq.sample(N_large_batch,beta,seq_w,seq_i,N_buffer_size);
+  EQUAL(par_i == seq_i,false);
+
+  // pow_float (used for float priorities) agrees with std::pow within 2 ulp
+  auto max_ulp = 0.0;
+  for(auto a : {0.1,0.6,1.0,2.0}){
+    for(auto x = 1e-40f; x < 1e+30f; x *= 1.37f){
+      const auto expected = std::pow(double(x),a);
+      if(expected > std::numeric_limits<float>::max()){ break; }
+      const auto ulp = std::max(double(std::numeric_limits<float>::denorm_min()),
+				expected * std::numeric_limits<float>::epsilon());
+      max_ulp = std::max(max_ulp,std::abs(ymd::pow_float(x,a) - expected) / ulp);
+    }
+  }
+  EQUAL(max_ulp <= 2.0,true);
+  EQUAL(ymd::pow_float(0.0f,0.6),0.0f);
+  EQUAL(ymd::pow_float(std::numeric_limits<float>::infinity(),0.6),
+	std::numeric_limits<float>::infinity());
+  EQUAL(ymd::pow_float(3e+38f,2.0),std::numeric_limits<float>::infinity());
+  EQUAL(std::isnan(ymd::pow_float(-1.0f,0.6)),true);
+  EQUAL(std::isnan(ymd::pow_float(std::nanf(""),0.6)),true);
+
+  auto ps_f = ymd::CppPrioritizedSampler<float>(N_buffer_size,alpha);
+  auto pf_i = std::vector<std::size_t>{0,1};
+  auto pf_p = std::vector<float>{1.0f,3.0f};
+  ps_f.update_priorities(pf_i,pf_p);
+  ALMOST_EQUAL(ps_f.get_sum(2),
+	       float(std::pow(1.0+1e-4,alpha) + std::pow(3.0+1e-4,alpha)));
+
+  // Scalar, batch and max priority paths store identical leaves.
+  auto scalar_f = ymd::CppPrioritizedSampler<float>(N_buffer_size,alpha);
+  auto batch_f = ymd::CppPrioritizedSampler<float>(N_buffer_size,alpha);
+  auto max_f = ymd::CppPrioritizedSampler<float>(N_buffer_size,alpha);
+  auto pf = std::vector<float>(N_buffer_size);
+  for(auto i = 0ul; i < N_buffer_size; ++i){
+    pf[i] = 0.37f + 0.013f * (i % 97);
+    scalar_f.set_priorities(i,pf[i]);
+  }
+  batch_f.set_priorities(0,pf.data(),N_buffer_size,N_buffer_size);
+  max_f.set_max_priority(pf[5]);
+  max_f.set_priorities(0,N_buffer_size,N_buffer_size);
+  EQUAL(std::equal(scalar_f.tree_data(),
+		   scalar_f.tree_data() + scalar_f.tree_data_size(),
+		   batch_f.tree_data()),true);
+
+  // Leaf of pf[5] through single index, batch update and max priority
+  auto one_f = ymd::CppPrioritizedSampler<float>(N_buffer_size,alpha);
+  one_f.set_priorities(0,pf[5]);
+  const auto leaf = one_f.get_sum(1);
+  one_f.update_priorities(pf_i.data(),pf.data() + 5,1);
+  EQUAL(one_f.get_sum(1),leaf);
+  EQUAL(max_f.get_sum(1),leaf);
+  EQUAL(max_f.get_min(N_buffer_size),leaf);
 }
 
 void test_SelectiveEnvironment(){
@@ -217,11 +334,936 @@ void test_SelectiveEnvironment(){
   EQUAL(se.get_stored_episode_size(),1ul);
 }
 
+void test_BlockSelectiveEnvironment(){
+  constexpr const auto obs_dim = 2ul;
+  constexpr const auto act_dim = 1ul;
+  constexpr const auto episode_len = 4ul;
+  constexpr const auto Nepisodes = 3ul;
+
+  std::cout << std::endl << "BlockSelectiveEnvironment" << std::endl;
+
+  auto se = ymd::CppSelectiveEnvironment<Observation,Action,Reward,Done>(episode_len,
+									 Nepisodes,
+									 obs_dim,
+									 act_dim,
+									 1ul,true);
+  EQUAL(se.is_block(),true);
+  EQUAL(se.get_next_index(),0ul);
+
+  // Observation of a transition is its episode id.
+  auto store = [&](Observation id,std::size_t len,bool terminal){
+    auto obs = std::vector(obs_dim*len,id);
+    auto act = std::vector(act_dim*len,Action{0});
+    auto rew = std::vector(len,Reward{0});
+    auto done = std::vector(len,Done{0});
+    if(terminal){ done.back() = Done{1}; }
+    return se.store(obs.data(),act.data(),rew.data(),obs.data(),done.data(),len);
+  };
+  auto check_episode = [&](std::size_t i,Observation id,std::size_t len){
+    auto [obs_,act_,rew_,next_obs_,done_,ep_len] = se.get_episode(i);
+    EQUAL(ep_len,len);
+    ALMOST_EQUAL(obs_[0],id);
+  };
+
+  // 2 episodes in a single call are stored into different blocks
+  auto obs = std::vector<Observation>{0,0,0,0,1,1,1,1,1,1};
+  auto act = std::vector(5ul,Action{0});
+  auto rew = std::vector(5ul,Reward{0});
+  auto done = std::vector<Done>{0,1,0,0,1};
+  EQUAL(se.store(obs.data(),act.data(),rew.data(),obs.data(),done.data(),5ul),0ul);
+  EQUAL(se.get_stored_episode_size(),2ul);
+  EQUAL(se.get_stored_size(),5ul);
+  check_episode(0,0,2);
+  check_episode(1,1,3);
+  EQUAL(se.get_next_index(),2*episode_len);
+
+  // Deletion in the middle never moves transitions, and the block is reused.
+  EQUAL(store(2,4,true),2*episode_len);
+  EQUAL(se.delete_episode(1),3ul);
+  EQUAL(se.get_stored_size(),6ul);
+  check_episode(1,2,4);
+  EQUAL(store(3,1,true),episode_len);
+  check_episode(2,3,1);
+
+  // All blocks are used, so that the oldest episode is evicted.
+  EQUAL(store(4,2,false),0ul);
+  EQUAL(se.get_stored_episode_size(),3ul);
+  check_episode(0,2,4);
+  check_episode(2,4,2);
+
+  // Episode longer than block is rejected without storing anything.
+  EQUAL(store(4,3,true),se.npos);
+  EQUAL(se.get_stored_size(),7ul);
+  check_episode(2,4,2);
+
+  // Open episode continues in its block.
+  EQUAL(store(4,2,true),2ul);
+  check_episode(2,4,4);
+  EQUAL(se.get_stored_size(),9ul);
+
+  // Positions ordered by episodes are mapped into buffer indexes
+  const std::size_t positions[] = {0ul,4ul,5ul,8ul};
+  std::size_t indexes[4];
+  EQUAL(se.get_indexes(positions,4,indexes),true);
+  EQUAL(indexes[0],2*episode_len);
+  EQUAL(indexes[1],1*episode_len);
+  EQUAL(indexes[2],0*episode_len);
+  EQUAL(indexes[3],0*episode_len + 3ul);
+  const std::size_t out_of_range[] = {9ul};
+  EQUAL(se.get_indexes(out_of_range,1,indexes),false);
+
+  // Page table agrees with std::deque over compactions.
+  {
+    constexpr const auto capacity = 16ul;
+    auto table = ymd::EpisodeTable(capacity);
+    auto expected = std::deque<std::size_t>{};
+    auto gen = std::mt19937{1};
+    for(auto t = 0ul; t < 20000ul; ++t){
+      const auto op = gen() % 3;
+      if((op == 0) && !expected.empty()){
+	const auto i = gen() % expected.size();
+	table.erase(i);
+	expected.erase(expected.begin() + i);
+      }else if((op == 1) && !expected.empty()){
+	table.pop_front();
+	expected.pop_front();
+      }else if(expected.size() < capacity){
+	table.push_back(t);
+	expected.push_back(t);
+      }
+
+      EQUAL(table.size(),expected.size());
+      for(auto i = 0ul; i < expected.size(); ++i){ EQUAL(table[i],expected[i]); }
+      if(!expected.empty()){
+	EQUAL(table.front(),expected.front());
+	EQUAL(table.back(),expected.back());
+      }
+    }
+  }
+
+  // Random insertion and deletion agree with ordered list of episodes.
+  {
+    constexpr const auto N_blocks = 16ul;
+    auto many = ymd::CppSelectiveEnvironment<Observation,Action,Reward,Done>(episode_len,
+									     N_blocks,
+									     obs_dim,
+									     act_dim,
+									     1ul,true);
+    auto expected = std::deque<std::pair<Observation,std::size_t>>{};
+    auto gen = std::mt19937{0};
+    for(auto t = 0ul; t < 5000ul; ++t){
+      if(!expected.empty() && (gen() % 3 == 0)){
+	const auto i = gen() % expected.size();
+	EQUAL(many.delete_episode(i),expected[i].second);
+	expected.erase(expected.begin() + i);
+      }else{
+	const auto len = 1 + gen() % episode_len;
+	auto o = std::vector(obs_dim*len,Observation(t));
+	auto a = std::vector(act_dim*len,Action{0});
+	auto r = std::vector(len,Reward{0});
+	auto d = std::vector(len,Done{0});
+	d.back() = Done{1};
+	many.store(o.data(),a.data(),r.data(),o.data(),d.data(),len);
+	if(expected.size() == N_blocks){ expected.pop_front(); }
+	expected.emplace_back(Observation(t),len);
+      }
+
+      EQUAL(many.get_stored_episode_size(),expected.size());
+      for(auto i = 0ul; i < expected.size(); ++i){
+	auto [obs_,act_,rew_,next_obs_,done_,ep_len] = many.get_episode(i);
+	EQUAL(ep_len,expected[i].second);
+	ALMOST_EQUAL(obs_[0],expected[i].first);
+      }
+    }
+  }
+
+  se.clear();
+  EQUAL(se.get_stored_size(),0ul);
+  EQUAL(se.get_stored_episode_size(),0ul);
+  EQUAL(se.get_next_index(),0ul);
+}
+
+void test_SampleGather(){
+  constexpr const std::size_t buffer_size = 8;
+  constexpr const std::size_t dim = 3;
+  constexpr const std::size_t stack = 4;
+
+  std::cout << std::endl;
+  std::cout << "SampleGather" << std::endl;
+
+  auto obs = std::vector<double>(buffer_size * dim);
+  std::iota(obs.begin(),obs.end(),0.0);
+  auto latest = std::vector<double>{-1.0,-2.0,-3.0};
+
+  // Stacked frames: memory[buffer_size + stack - 1], view[i][k] = memory[i+k]
+  auto memory = std::vector<std::uint8_t>(buffer_size + stack - 1);
+  std::iota(memory.begin(),memory.end(),std::uint8_t(0));
+
+  const std::ptrdiff_t obs_shape[] = {buffer_size,dim};
+  const std::ptrdiff_t obs_strides[] = {dim*sizeof(double),sizeof(double)};
+  const std::ptrdiff_t stack_shape[] = {buffer_size,stack};
+  const std::ptrdiff_t stack_strides[] = {1,1};
+
+  auto g = ymd::CppSampleGather{buffer_size};
+  g.add_field(obs.data(),sizeof(double),2,obs_shape,obs_strides);
+  g.add_field(obs.data(),sizeof(double),2,obs_shape,obs_strides,
+	      1,latest.data());
+  g.add_field(memory.data(),1,2,stack_shape,stack_strides);
+  EQUAL(g.get_field_size(),3ul);
+
+  const std::size_t idx[] = {0,5,7,2};
+  constexpr const std::size_t N = 4;
+  constexpr const std::size_t next_index = 6;
+  auto o = std::vector<double>(N*dim);
+  auto no = std::vector<double>(N*dim);
+  auto st = std::vector<std::uint8_t>(N*stack);
+  void* const out[] = {o.data(),no.data(),st.data()};
+
+  auto cached = std::vector<std::uint8_t>(buffer_size,0);
+  cached[7] = 1;
+  auto hits = std::vector<std::size_t>{};
+
+  EQUAL(g.gather(idx,N,next_index,out,cached.data(),hits),true);
+  for(std::size_t n = 0; n < N; ++n){
+    const auto next = (idx[n] + 1) % buffer_size;
+    for(std::size_t d = 0; d < dim; ++d){
+      ALMOST_EQUAL(o[n*dim+d],obs[idx[n]*dim+d]);
+      ALMOST_EQUAL(no[n*dim+d],
+		   (next == next_index) ? latest[d] : obs[next*dim+d]);
+    }
+    for(std::size_t k = 0; k < stack; ++k){
+      EQUAL(int(st[n*stack+k]),int(memory[idx[n]+k]));
+    }
+  }
+  EQUAL(hits.size(),1ul);
+  EQUAL(hits[0],2ul);
+
+  // Out of range index
+  const std::size_t bad[] = {1,buffer_size};
+  EQUAL(g.gather(bad,2,next_index,out,nullptr,hits),false);
+
+  // Reduced precision storage expanded at gather
+  // half: 1.0 = 0x3C00, -2.5 = 0xC100, 2^-24 (subnormal) = 0x0001
+  const std::uint16_t half[] = {0x3C00,0xC100,0x0001,0x7C00};
+  const std::uint16_t bf16[] = {0x3F80,0xC020,0x0000,0xFF80};
+  const std::uint8_t  q[]    = {0,1,128,255};
+  const std::ptrdiff_t h_shape[] = {4,1};
+  const std::ptrdiff_t h_strides[] = {2,2};
+  const std::ptrdiff_t q_strides[] = {1,1};
+
+  auto s = ymd::CppSampleGather{4};
+  s.add_field(half,2,2,h_shape,h_strides);
+  s.add_field(bf16,2,2,h_shape,h_strides);
+  s.add_field(q,1,2,h_shape,q_strides);
+  s.add_field(q,1,2,h_shape,q_strides);
+  EQUAL(s.set_storage(0,int(ymd::StorageType::Float16),4),true);
+  EQUAL(s.set_storage(1,int(ymd::StorageType::BFloat16),8),true);
+  EQUAL(s.set_storage(2,int(ymd::StorageType::UInt8),4,0.5,-1.0),true);
+  EQUAL(s.set_storage(3,int(ymd::StorageType::Float16),4),false);
+  EQUAL(s.set_storage(3,int(ymd::StorageType::UInt8),2),false);
+
+  auto hf = std::vector<float>(4);
+  auto bd = std::vector<double>(4);
+  auto qf = std::vector<float>(4);
+  auto qr = std::vector<std::uint8_t>(4);
+  void* const s_out[] = {hf.data(),bd.data(),qf.data(),qr.data()};
+  const std::size_t s_idx[] = {0,1,2,3};
+  EQUAL(s.gather(s_idx,4,0,s_out,nullptr,hits),true);
+
+  ALMOST_EQUAL(hf[0],1.0);
+  ALMOST_EQUAL(hf[1],-2.5);
+  EQUAL(hf[2] == std::ldexp(1.0f,-24),true);
+  EQUAL(std::isinf(hf[3]) && hf[3] > 0,true);
+  ALMOST_EQUAL(bd[0],1.0);
+  ALMOST_EQUAL(bd[1],-2.5);
+  ALMOST_EQUAL(bd[2],0.0);
+  EQUAL(std::isinf(bd[3]) && bd[3] < 0,true);
+  for(std::size_t i = 0; i < 4; ++i){
+    ALMOST_EQUAL(qf[i],0.5*q[i] - 1.0);
+    EQUAL(int(qr[i]),int(q[i]));
+  }
+}
+
+void test_NstepBuffer(){
+  constexpr const std::size_t Nstep = 4;
+  constexpr const double gamma = 0.5;
+
+  std::cout << std::endl;
+  std::cout << "NstepBuffer" << std::endl;
+
+  auto nb = ymd::CppNstepBuffer<double>{Nstep,gamma};
+  nb.add_field(sizeof(int));
+  nb.add_reward(1);
+  nb.add_next(sizeof(int));
+
+  // Step: obs = t, rew = 1, next_obs = t+1, done at t = 1
+  auto step = [&](std::size_t t0,std::size_t N,
+		  std::vector<double>& done_out,std::vector<int>& obs_out,
+		  std::vector<double>& rew_out,std::vector<int>& next_out){
+    auto obs = std::vector<int>(N);
+    auto next = std::vector<int>(N);
+    auto rew = std::vector<double>(N,1.0);
+    auto done = std::vector<double>(N,0.0);
+    for(std::size_t n = 0; n < N; ++n){
+      obs[n] = int(t0 + n);
+      next[n] = int(t0 + n + 1);
+      if(t0 + n == 1){ done[n] = 1.0; }
+    }
+
+    const auto M = nb.output_size(N);
+    done_out.resize(M);
+    obs_out.resize(M);
+    rew_out.resize(M);
+    next_out.resize(M);
+
+    const void* fields_in[] = {obs.data()};
+    const double* rews_in[] = {rew.data()};
+    const void* nexts_in[] = {next.data()};
+    void* const fields_out[] = {obs_out.data()};
+    double* const rews_out[] = {rew_out.data()};
+    void* const nexts_out[] = {next_out.data()};
+    nb.add(N,done.data(),fields_in,rews_in,nexts_in,
+	   done_out.data(),fields_out,rews_out,nexts_out);
+    return M;
+  };
+
+  auto d = std::vector<double>{};
+  auto o = std::vector<int>{};
+  auto r = std::vector<double>{};
+  auto n = std::vector<int>{};
+
+  EQUAL(step(0,3,d,o,r,n),0ul);
+  EQUAL(nb.get_stored_size(),3ul);
+
+  // t = 0 with done at t = 1
+  EQUAL(step(3,1,d,o,r,n),1ul);
+  EQUAL(o[0],0);
+  ALMOST_EQUAL(r[0],1.0 + gamma);
+  ALMOST_EQUAL(d[0],1.0);
+  EQUAL(n[0],4);
+
+  // t = 1, 2, 3
+  EQUAL(step(4,3,d,o,r,n),3ul);
+  EQUAL(o[0],1);
+  ALMOST_EQUAL(r[0],1.0);
+  ALMOST_EQUAL(d[0],1.0);
+  EQUAL(o[2],3);
+  ALMOST_EQUAL(r[2],1.0 + gamma + gamma*gamma + gamma*gamma*gamma);
+  ALMOST_EQUAL(d[2],0.0);
+  EQUAL(n[2],7);
+  EQUAL(nb.get_stored_size(),3ul);
+
+  // Remaining t = 4, 5, 6 with the newest next
+  const auto M = nb.get_stored_size();
+  d.resize(M); o.resize(M); r.resize(M); n.resize(M);
+  void* const fields_out[] = {o.data()};
+  double* const rews_out[] = {r.data()};
+  void* const nexts_out[] = {n.data()};
+  nb.on_episode_end(d.data(),fields_out,rews_out,nexts_out);
+  EQUAL(nb.get_stored_size(),0ul);
+  EQUAL(o[0],4);
+  EQUAL(o[2],6);
+  ALMOST_EQUAL(r[0],1.0 + gamma + gamma*gamma);
+  ALMOST_EQUAL(r[2],1.0);
+  EQUAL(n[0],7);
+  EQUAL(n[2],7);
+}
+
+void test_FrameStore(){
+  constexpr const std::size_t buffer_size = 8;
+  constexpr const std::size_t elems = 3;
+  constexpr const std::size_t stack = 4;
+  constexpr const std::size_t row = elems * stack;
+
+  std::cout << std::endl;
+  std::cout << "FrameStore" << std::endl;
+
+  // Stacked row (elems, stack): row[e*stack + k] = frame(t+k)[e]
+  auto stacked = [](std::size_t t,std::vector<std::uint8_t>& v){
+    v.resize(row);
+    for(std::size_t e = 0; e < elems; ++e){
+      for(std::size_t k = 0; k < stack; ++k){
+	v[e*stack + k] = std::uint8_t((t + k)*elems + e);
+      }
+    }
+  };
+
+  auto fs = ymd::CppFrameStore{buffer_size,elems,1,stack,true};
+  EQUAL(fs.has_next(),true);
+
+  auto obs = std::vector<std::uint8_t>{};
+  auto next = std::vector<std::uint8_t>{};
+  constexpr const std::size_t T = 10;
+  for(std::size_t t = 0; t < T; ++t){
+    stacked(t,obs);
+    stacked(t+1,next);
+    fs.store(t % buffer_size,1,obs.data(),next.data());
+  }
+
+  // Transitions 2..9 refer to frames 2..13
+  EQUAL(fs.get_stored_frames(),buffer_size + stack);
+
+  const std::size_t idx[] = {0,1,5,7};
+  auto o = std::vector<std::uint8_t>(4*row);
+  auto no = std::vector<std::uint8_t>(4*row);
+  fs.gather(idx,4,o.data(),no.data());
+  for(std::size_t n = 0; n < 4; ++n){
+    const auto t = (idx[n] < T - buffer_size) ? idx[n] + buffer_size : idx[n];
+    stacked(t,obs);
+    stacked(t+1,next);
+    for(std::size_t j = 0; j < row; ++j){
+      EQUAL(int(o[n*row + j]),int(obs[j]));
+      EQUAL(int(no[n*row + j]),int(next[j]));
+    }
+  }
+
+  // New episode starts with the same frame stacked.
+  fs.on_episode_end();
+  auto reset = std::vector<std::uint8_t>(row,std::uint8_t(200));
+  fs.store(T % buffer_size,1,reset.data(),reset.data());
+  EQUAL(fs.get_stored_frames(),buffer_size + stack - 1 + 1);
+
+  const std::size_t last[] = {T % buffer_size};
+  fs.gather(last,1,o.data(),no.data());
+  for(std::size_t j = 0; j < row; ++j){
+    EQUAL(int(o[j]),200);
+    EQUAL(int(no[j]),200);
+  }
+
+  // No sharing: the frame ring grows instead of overwriting live frames.
+  auto random = ymd::CppFrameStore{buffer_size,elems,sizeof(int),stack,true};
+  auto ro = std::vector<int>(2*buffer_size*row);
+  auto rn = std::vector<int>(2*buffer_size*row);
+  std::iota(ro.begin(),ro.end(),0);
+  std::iota(rn.begin(),rn.end(),int(ro.size()));
+  random.store(0,2*buffer_size,ro.data(),rn.data());
+  EQUAL(random.get_stored_frames(),buffer_size * 2 * stack);
+
+  auto all = std::vector<std::size_t>(buffer_size);
+  std::iota(all.begin(),all.end(),0);
+  auto go = std::vector<int>(buffer_size*row);
+  auto gn = std::vector<int>(buffer_size*row);
+  random.gather(all.data(),buffer_size,go.data(),gn.data());
+  for(std::size_t j = 0; j < buffer_size*row; ++j){
+    EQUAL(go[j],ro[buffer_size*row + j]);
+    EQUAL(gn[j],rn[buffer_size*row + j]);
+  }
+
+  // Without stack (e.g. plain "next_of"), obs shares the previous next.
+  auto plain = ymd::CppFrameStore{buffer_size,elems,1,1,true};
+  auto po = std::vector<std::uint8_t>(T*elems);
+  std::iota(po.begin(),po.end(),std::uint8_t(0));
+  plain.store(0,T-1,po.data(),po.data()+elems);
+  EQUAL(plain.get_stored_frames(),buffer_size + 1);
+
+  // Restore from raw state (checkpoint)
+  auto state = std::vector<std::uint64_t>(fs.get_state_size());
+  fs.get_state(state.data());
+  auto copied = ymd::CppFrameStore{buffer_size,elems,1,stack,true};
+  copied.set_state(state.data());
+  EQUAL(copied.frames_size(),fs.frames_size());
+  std::copy_n(fs.ids_data(),fs.ids_size(),copied.ids_data());
+  auto raw = std::vector<std::uint8_t>(fs.frames_size());
+  fs.copy_frames(raw.data());
+  copied.restore_frames(raw.data());
+  EQUAL(copied.get_stored_frames(),fs.get_stored_frames());
+
+  auto co = std::vector<std::uint8_t>(4*row);
+  auto cn = std::vector<std::uint8_t>(4*row);
+  fs.gather(idx,4,o.data(),no.data());
+  copied.gather(idx,4,co.data(),cn.data());
+  for(std::size_t j = 0; j < 4*row; ++j){
+    EQUAL(int(co[j]),int(o[j]));
+    EQUAL(int(cn[j]),int(no[j]));
+  }
+
+  // Copy does not share frames.
+  auto deep = fs;
+  auto other = std::vector<std::uint8_t>(row,std::uint8_t(100));
+  fs.on_episode_end();
+  for(std::size_t t = 0; t < buffer_size; ++t){ fs.store(t,1,other.data(),other.data()); }
+  deep.gather(idx,4,co.data(),cn.data());
+  for(std::size_t j = 0; j < 4*row; ++j){
+    EQUAL(int(co[j]),int(o[j]));
+    EQUAL(int(cn[j]),int(no[j]));
+  }
+
+  plain.clear();
+  EQUAL(plain.get_stored_frames(),0ul);
+
+  // Segments of dead frames are reused, so that frames are bounded
+  // without sharing, too.
+  constexpr const std::size_t big_elems = 1 << 16;
+  auto seg = ymd::CppFrameStore{buffer_size,big_elems,1,1,true};
+  auto so = std::vector<std::uint8_t>(big_elems);
+  auto sn = std::vector<std::uint8_t>(big_elems);
+  auto capacity = std::size_t(0);
+  for(std::size_t t = 0; t < 64 * buffer_size; ++t){
+    so[0] = std::uint8_t(2*t);
+    sn[0] = std::uint8_t(2*t+1);
+    seg.on_episode_end();
+    seg.store(t % buffer_size,1,so.data(),sn.data());
+    capacity = std::max(capacity,seg.get_capacity());
+  }
+  EQUAL(seg.get_stored_frames(),2*buffer_size);
+  EQUAL(capacity < 8*buffer_size,true);
+
+  const std::size_t newest[] = {(64 * buffer_size - 1) % buffer_size};
+  seg.gather(newest,1,so.data(),sn.data());
+  EQUAL(int(so[0]),int(std::uint8_t(2*(64 * buffer_size - 1))));
+  EQUAL(int(sn[0]),int(std::uint8_t(2*(64 * buffer_size - 1) + 1)));
+}
+
+void test_SequenceIndex(){
+  constexpr const std::size_t buffer_size = 8;
+  constexpr const std::size_t T = 4;
+  constexpr const std::size_t burn_in = 1;
+
+  std::cout << std::endl;
+  std::cout << "SequenceIndex" << std::endl;
+
+  // Full ring (next_index = 3): slot 3 is the oldest, slot 2 is the newest.
+  // Episodes: slots [3,4,5], [6,7,0,1,2]
+  const std::uint64_t episodes[] = {1,1,1,0,0,0,1,1};
+  const std::size_t starts[] = {4,7,1,3};
+  constexpr const std::size_t B = 4;
+
+  auto idx = std::vector<std::size_t>(B*T);
+  auto mask = std::vector<std::uint8_t>(B*T);
+  ymd::sequence_indexes(starts,B,T,burn_in,buffer_size,buffer_size,3,
+			episodes,idx.data(),mask.data());
+
+  const std::size_t expected_idx[] = {3,4,5,5,
+				      6,7,0,1,
+				      0,1,2,2,
+				      3,3,4,5};
+  const std::uint8_t expected_mask[] = {1,1,1,0,
+					1,1,1,1,
+					1,1,1,0,
+					0,1,1,1};
+  for(std::size_t i = 0; i < B*T; ++i){
+    EQUAL(idx[i],expected_idx[i]);
+    EQUAL(int(mask[i]),int(expected_mask[i]));
+  }
+
+  // Sequence priority: eta * max + (1 - eta) * mean of valid steps
+  auto ps = ymd::CppPrioritizedSampler<double>(buffer_size,1.0);
+  ps.set_eps(0.0);
+  std::size_t seq[] = {0,2,4};
+  double p[] = {1.0,3.0, 10.0,10.0, 2.0,100.0};
+  const std::uint8_t m[] = {1,1, 0,0, 1,0};
+  ps.update_sequence_priorities(seq,p,3,2,0.5,m);
+  ALMOST_EQUAL(ps.get_max_priority(),2.5);
+}
+
+void test_RingBufferIndex(){
+  constexpr const std::size_t buffer_size = 10;
+
+  std::cout << std::endl;
+  std::cout << "RingBufferIndex" << std::endl;
+
+  auto ri = ymd::CppRingBufferIndex<false>{buffer_size};
+  EQUAL(ri.get_next_index(),0ul);
+  EQUAL(ri.get_stored_size(),0ul);
+
+  EQUAL(ri.fetch_add(4),0ul);
+  EQUAL(ri.get_next_index(),4ul);
+  EQUAL(ri.get_stored_size(),4ul);
+
+  EQUAL(ri.fetch_add(7),4ul);
+  EQUAL(ri.get_next_index(),1ul);
+  EQUAL(ri.get_stored_size(),buffer_size);
+
+  ri.clear();
+  EQUAL(ri.get_next_index(),0ul);
+  EQUAL(ri.get_stored_size(),0ul);
+
+  // Shared counter
+  constexpr const std::size_t N_add = 10000;
+  auto counter = std::uint64_t{0};
+  auto si = ymd::CppThreadSafeRingBufferIndex{buffer_size,&counter};
+  auto si2 = ymd::CppThreadSafeRingBufferIndex{buffer_size,&counter,false};
+
+  std::vector<std::thread> threads{};
+  for(cores_t i = 0; i < std::max(cores,cores_t(2)); ++i){
+    threads.emplace_back([&si,&si2,i](){
+      auto& s = (i % 2) ? si : si2;
+      for(std::size_t n = 0; n < N_add; ++n){ s.fetch_add(1); }
+    });
+  }
+  for(auto& t : threads){ t.join(); }
+
+  const auto total = threads.size() * N_add;
+  EQUAL(si.get_count(),std::uint64_t(total));
+  EQUAL(si2.get_next_index(),total % buffer_size);
+  EQUAL(si2.get_stored_size(),buffer_size);
+}
+
+void test_SlotSeqLock(){
+  constexpr const std::size_t buffer_size = 8;
+  constexpr const std::size_t N_write = 20000;
+
+  std::cout << std::endl;
+  std::cout << "SlotSeqLock" << std::endl;
+
+  auto seq = std::vector<std::uint64_t>(buffer_size,0);
+  auto writer_lock = ymd::CppSlotSeqLock{buffer_size,seq.data()};
+  auto reader_lock = ymd::CppSlotSeqLock{buffer_size,seq.data()};
+
+  // Slot holds a pair which must be read consistently.
+  auto data = std::vector<std::atomic<std::uint64_t>>(2*buffer_size);
+  for(auto& d : data){ d.store(0); }
+
+  auto ri = ymd::CppThreadSafeRingBufferIndex{buffer_size};
+  auto writers = std::vector<std::thread>{};
+  for(auto w = 0; w < 2; ++w){
+    writers.emplace_back([&,w](){
+      for(std::size_t n = 0; n < N_write; ++n){
+	const auto i = ri.fetch_add(1);
+	writer_lock.write_begin(i,1);
+	data[2*i  ].store(n*2+w,std::memory_order_relaxed);
+	data[2*i+1].store(n*2+w,std::memory_order_relaxed);
+	writer_lock.write_end(i,1);
+      }
+    });
+  }
+
+  const std::size_t idx[] = {0,3,5,7};
+  constexpr const std::size_t N = 4;
+  std::uint64_t begin[N];
+  std::uint8_t retry[N];
+  std::uint64_t v[2*N];
+  auto total_retry = std::size_t(0);
+  for(std::size_t t = 0; t < N_write; ++t){
+    reader_lock.read_begin(idx,N,begin);
+    for(std::size_t n = 0; n < N; ++n){
+      v[2*n  ] = data[2*idx[n]  ].load(std::memory_order_relaxed);
+      v[2*n+1] = data[2*idx[n]+1].load(std::memory_order_relaxed);
+    }
+    total_retry += reader_lock.read_validate(idx,N,begin,retry);
+    for(std::size_t n = 0; n < N; ++n){
+      if(!retry[n]){ EQUAL(v[2*n],v[2*n+1]); }
+    }
+  }
+  for(auto& w : writers){ w.join(); }
+  std::cout << "retry: " << total_retry << std::endl;
+
+  // No writer: always valid
+  reader_lock.read_begin(idx,N,begin);
+  EQUAL(reader_lock.read_validate(idx,N,begin,retry),0ul);
+
+  // Unfinished write (e.g. dead writer) is reported without waiting.
+  reader_lock.write_begin(3,1);
+  reader_lock.read_begin(idx,N,begin);
+  EQUAL(reader_lock.read_validate(idx,N,begin,retry),1ul);
+  EQUAL(int(retry[0]),0);
+  EQUAL(int(retry[1]),2);
+  reader_lock.write_end(3,1);
+  EQUAL(reader_lock.read_validate(idx,N,begin,retry),1ul);
+  EQUAL(int(retry[1]),1);
+  reader_lock.read_begin(idx,N,begin);
+  EQUAL(reader_lock.read_validate(idx,N,begin,retry),0ul);
+}
+
+void test_MemoryPolicy(){
+  std::cout << std::endl;
+  std::cout << "MemoryPolicy" << std::endl;
+
+  const ymd::MemoryPolicy policies[] = {
+    ymd::MemoryPolicy{},
+    ymd::make_memory_policy(int(ymd::HugePage::Transparent),-1,false,0),
+    ymd::make_memory_policy(int(ymd::HugePage::Huge2MB),0,false,4),
+    ymd::make_memory_policy(int(ymd::HugePage::Huge1GB),-1,true,2),
+  };
+
+  for(const auto& policy : policies){
+    for(std::size_t bytes : {std::size_t(100),std::size_t(3) << 20}){
+      auto mapped = std::size_t(0);
+      auto p = static_cast<std::uint8_t*>(ymd::allocate_memory(bytes,policy,
+							       mapped));
+      EQUAL(reinterpret_cast<std::uintptr_t>(p) % 64,0ul);
+      EQUAL(std::all_of(p,p+bytes,[](auto v){ return v == 0; }),true);
+      p[0] = 1;
+      p[bytes-1] = 2;
+      ymd::deallocate_memory(p,mapped);
+    }
+  }
+
+#if defined(__linux__)
+  // Small allocation does not take a whole huge page.
+  {
+    auto mapped = std::size_t(0);
+    auto p = ymd::allocate_memory(std::size_t(1) << 20,policies[3],mapped);
+    EQUAL(mapped < (std::size_t(1) << 30),true);
+    ymd::deallocate_memory(p,mapped);
+  }
+
+  // Every page is touched even when huge pages are not obtained.
+  for(const auto& policy : {policies[2],policies[3]}){
+    const auto bytes = std::size_t(3) << 20;
+    auto mapped = std::size_t(0);
+    auto p = ymd::allocate_memory(bytes,policy,mapped);
+    const auto page = std::size_t(sysconf(_SC_PAGESIZE));
+    auto resident = std::vector<unsigned char>((mapped + page - 1) / page);
+    if(mapped && (mincore(p,mapped,resident.data()) == 0)){
+      EQUAL(std::all_of(resident.begin(),resident.end(),
+			[](auto r){ return r & 1; }),true);
+    }
+    ymd::deallocate_memory(p,mapped);
+  }
+#endif
+
+  // Internal buffers follow the default policy.
+  ymd::set_default_memory_policy(policies[1]);
+  auto b = ymd::DimensionalBuffer<double>(1 << 20,2);
+  double* v = nullptr;
+  b.get_data((1 << 20) - 1,v);
+  ALMOST_EQUAL(v[1],0.0);
+
+  auto st = ymd::SegmentTree<double>(1 << 18,[](auto a,auto b){ return a+b; });
+  st.set(12,1.5);
+  ALMOST_EQUAL(st.reduce(0,1 << 18),1.5);
+  ymd::set_default_memory_policy(policies[0]);
+}
+
+void test_LaBER(){
+  std::cout << std::endl;
+  std::cout << "LaBER" << std::endl;
+
+  constexpr const auto N = 8ul;
+  constexpr const auto B = 4096ul;
+  const float priorities[N] = {0.0f, 1.0f, 2.0f, 0.0f, 4.0f, 1.0f, 0.0f, 0.0f};
+
+  auto laber = ymd::CppLaBER<float>{};
+  laber.set_seed(3);
+  auto idx = std::vector<std::size_t>(B);
+  auto w = std::vector<float>(B);
+
+  for(int mode : {0, 1, 2}){
+    EQUAL(laber.sample(priorities,N,B,0.0f,mode,idx.data(),w.data()),true);
+
+    auto count = std::vector<std::size_t>(N,0);
+    auto max_w = 0.0f;
+    for(auto b = 0ul; b < B; ++b){
+      EQUAL(priorities[idx[b]] > 0.0f,true);
+      ++count[idx[b]];
+      max_w = std::max(max_w,w[b]);
+
+      const auto p = priorities[idx[b]] / 8.0f;
+      switch(mode){
+      case 0: ALMOST_EQUAL(w[b],(1.0f / N) / p); break;
+      case 1: ALMOST_EQUAL(w[b],1.0f / p); break;
+      }
+    }
+    if(mode == 2){ ALMOST_EQUAL(max_w,1.0f); }
+    EQUAL(count[4] > count[2] && count[2] > count[1],true);
+  }
+
+  // The same seed reproduces the same sub-samples.
+  auto idx2 = idx;
+  laber.set_seed(3);
+  for(int mode : {0, 1, 2}){
+    laber.sample(priorities,N,B,0.0f,mode,idx2.data(),w.data());
+  }
+  EQUAL(idx2 == idx,true);
+
+  const float invalid[2] = {-1.0f, 0.5f};
+  EQUAL(laber.sample(invalid,2,B,0.0f,0,idx.data(),w.data()),false);
+  const float zeros[2] = {0.0f, 0.0f};
+  EQUAL(laber.sample(zeros,2,B,0.0f,0,idx.data(),w.data()),false);
+  EQUAL(laber.sample(zeros,2,B,1e-6f,0,idx.data(),w.data()),true);
+}
+
+void test_BatchStore(){
+  std::cout << std::endl;
+  std::cout << "BatchStore" << std::endl;
+
+  constexpr const auto buffer_size = 5ul;
+  auto obs = std::vector<float>(buffer_size*2,0.0f);
+  auto done = std::vector<std::uint8_t>(buffer_size,0);
+  auto id = std::vector<std::uint64_t>(buffer_size,0);
+
+  auto store = ymd::CppBatchStore(buffer_size);
+  store.add_field(obs.data(),2,int(ymd::DType::Float32));
+  store.add_field(done.data(),1,int(ymd::DType::Bool));
+  store.add_field(id.data(),1,int(ymd::DType::UInt64));
+  EQUAL(store.get_field_size(),3ul);
+
+  // Wrapped store of double and int64 values with broadcast id
+  const double obs_in[] = {1,2,3,4,5,6};
+  const std::int64_t done_in[] = {0,3,0};
+  const std::uint64_t id_in = 7;
+  const void* srcs[] = {obs_in,done_in,&id_in};
+  const int dtypes[] = {int(ymd::DType::Float64),int(ymd::DType::Int64),
+			int(ymd::DType::UInt64)};
+  const std::uint8_t broadcast[] = {0,0,1};
+  EQUAL(store.store(srcs,dtypes,broadcast,3,4),true);
+
+  ALMOST_EQUAL(obs[8],1.0f);
+  ALMOST_EQUAL(obs[9],2.0f);
+  ALMOST_EQUAL(obs[0],3.0f);
+  ALMOST_EQUAL(obs[3],6.0f);
+  EQUAL(int(done[4]),0);
+  EQUAL(int(done[0]),1);
+  EQUAL(int(done[1]),0);
+  EQUAL(id[4],7ul);
+  EQUAL(id[1],7ul);
+  EQUAL(id[2],0ul);
+
+  // Longer than buffer: only the last rows are stored.
+  const float long_obs[] = {0,0,1,1,2,2,3,3,4,4,5,5,6,6};
+  const std::uint8_t long_done[7] = {};
+  const void* long_srcs[] = {long_obs,long_done,&id_in};
+  const int long_dtypes[] = {int(ymd::DType::Float32),int(ymd::DType::UInt8),
+			     int(ymd::DType::UInt64)};
+  EQUAL(store.store(long_srcs,long_dtypes,broadcast,7,1),true);
+  // The first stored row (2) goes to (1 + 2) % 5 = 3
+  ALMOST_EQUAL(obs[6],2.0f);
+  ALMOST_EQUAL(obs[2*2],6.0f);
+  ALMOST_EQUAL(obs[0],4.0f);
+
+  EQUAL(ymd::CppBatchStore::can_convert(int(ymd::DType::Float16),
+					int(ymd::DType::Float32)),false);
+  EQUAL(ymd::CppBatchStore::can_convert(int(ymd::DType::Float16),
+					int(ymd::DType::Float16)),true);
+}
+
+void test_CounterRNG(){
+  std::cout << std::endl;
+  std::cout << "CounterRNG" << std::endl;
+
+  constexpr const auto N = 4096ul;
+  constexpr const auto high = 7ul;
+  const auto rng = ymd::CppCounterRNG{42};
+
+  auto idx = std::vector<std::size_t>(N);
+  ymd::uniform_indexes(rng,0,N,high,idx.data());
+
+  auto count = std::vector<std::size_t>(high,0);
+  for(auto i : idx){
+    EQUAL(i < high,true);
+    ++count[i];
+  }
+  for(auto c : count){ EQUAL((c > N / high / 2) && (c < 2 * N / high),true); }
+
+  // The same (seed, stream) reproduces, and another stream differs.
+  auto idx2 = std::vector<std::size_t>(N);
+  ymd::uniform_indexes(ymd::CppCounterRNG{42},0,N,high,idx2.data());
+  EQUAL(idx2 == idx,true);
+  ymd::uniform_indexes(rng,1,N,high,idx2.data());
+  EQUAL(idx2 == idx,false);
+
+  // Split streams are reproducible and independent of each other.
+  EQUAL(rng.split(3).get_seed(),ymd::CppCounterRNG{42}.split(3).get_seed());
+  EQUAL(rng.split(3).get_seed() == rng.split(4).get_seed(),false);
+  EQUAL(rng.split(3).get_seed() == rng.get_seed(),false);
+  EQUAL(rng.index(0,0,1),0ul);
+  EQUAL(rng.index(0,0,std::uint64_t(-1)) == rng.index(1,0,std::uint64_t(-1)),
+	false);
+
+  // Reverse (stride) indexes over ring buffer
+  auto rev = std::vector<std::size_t>(5);
+  ymd::reverse_indexes(3,4,10,5,rev.data());
+  EQUAL(rev == (std::vector<std::size_t>{3,9,5,1,7}),true);
+  ymd::reverse_indexes(3,25,10,3,rev.data());
+  EQUAL(rev[0],3ul);
+  EQUAL(rev[1],8ul);
+  EQUAL(rev[2],3ul);
+}
+
+void test_CompressedStore(){
+  std::cout << std::endl;
+  std::cout << "CompressedStore" << std::endl;
+
+  // Run length coding round trip (runs, literals and long literals)
+  auto raw = std::vector<std::uint8_t>(1000,0);
+  for(std::size_t i = 300; i < 600; ++i){ raw[i] = std::uint8_t(i * 7); }
+  auto coded = std::vector<std::uint8_t>(ymd::rle_bound(raw.size()));
+  const auto len = ymd::rle_encode(raw.data(),raw.size(),coded.data());
+  EQUAL(len < 400,true);
+  auto decoded = std::vector<std::uint8_t>(raw.size());
+  EQUAL(ymd::rle_decode(coded.data(),len,decoded.data(),decoded.size()),true);
+  EQUAL(decoded == raw,true);
+  EQUAL(ymd::rle_decode(coded.data(),len,decoded.data(),decoded.size()-1),false);
+
+  constexpr const std::size_t buffer_size = 8;
+  constexpr const std::size_t elems = 256;
+  constexpr const std::size_t row = elems * sizeof(float);
+
+  // Sparse rows: a few non zero values at t
+  auto rows = [](std::size_t t,std::size_t N){
+    auto v = std::vector<float>(N * elems,0.0f);
+    for(std::size_t n = 0; n < N; ++n){
+      for(std::size_t e = 0; e < 4; ++e){
+	v[n*elems + (t + n + 31*e) % elems] = float(t + n) + 0.5f;
+      }
+    }
+    return v;
+  };
+
+  for(auto threads : {1ul, 4ul}){
+    auto cs = ymd::CppCompressedStore{buffer_size,row,sizeof(float)};
+    cs.set_num_threads(threads);
+    EQUAL(cs.get_num_threads(),threads);
+
+    // Rows never stored are 0.
+    const std::size_t first[] = {0};
+    auto out = std::vector<float>(elems,1.0f);
+    cs.gather(first,1,out.data());
+    EQUAL(out == std::vector<float>(elems,0.0f),true);
+
+    // 3 + 12 rows: the last 8 rows (t = 7 ... 14) are kept.
+    auto v = rows(0,3);
+    cs.store(0,3,v.data());
+    v = rows(3,12);
+    cs.store(3,12,v.data());
+    EQUAL(cs.get_stored_size(),buffer_size);
+    EQUAL(cs.get_compressed_bytes() < buffer_size * row / 4,true);
+    EQUAL(cs.get_allocated_bytes() > 0ul,true);
+
+    const std::size_t idx[] = {7,0,6,7};
+    out.resize(4 * elems);
+    cs.gather(idx,4,out.data());
+    for(std::size_t n = 0; n < 4; ++n){
+      const auto t = (idx[n] < 7) ? idx[n] + buffer_size : idx[n];
+      const auto expected = rows(t,1);
+      EQUAL(std::equal(expected.begin(),expected.end(),out.begin() + n*elems),
+	    true);
+    }
+
+    // Incompressible rows are stored as they are.
+    auto noise = std::vector<float>(elems);
+    auto g = std::mt19937{0};
+    for(auto& e : noise){ e = std::uniform_real_distribution<float>{}(g); }
+    const auto before = cs.get_compressed_bytes();
+    cs.store(0,1,noise.data());
+    EQUAL(cs.get_compressed_bytes() - before > row / 2,true);
+    cs.gather(first,1,out.data());
+    EQUAL(std::equal(noise.begin(),noise.end(),out.begin()),true);
+
+    cs.clear();
+    EQUAL(cs.get_stored_size(),0ul);
+    EQUAL(cs.get_compressed_bytes(),0ul);
+  }
+}
+
 int main(){
 
   test_DimensionalBuffer();
   test_PrioritizedSampler();
   test_SelectiveEnvironment();
+  test_BlockSelectiveEnvironment();
+  test_SampleGather();
+  test_NstepBuffer();
+  test_FrameStore();
+  test_SequenceIndex();
+  test_RingBufferIndex();
+  test_SlotSeqLock();
+  test_MemoryPolicy();
+  test_LaBER();
+  test_BatchStore();
+  test_CounterRNG();
+  test_CompressedStore();
 
   return 0;
 }
@@ -2,7 +2,10 @@
 #include <cassert>
 #include <type_traits>
 #include <future>
+#include <numeric>
 #include <thread>
+#include <random>
+#include <vector>
 
 #include <SegmentTree.hh>
 
@@ -33,6 +36,214 @@ void multi_thread_test(){
   std::cout << std::endl;
 }
 
+template<bool MultiThread>
+void largest_region_index_test(){
+  constexpr auto buffer_size = 1024ul;
+  auto st = ymd::SegmentTree<double,MultiThread>(buffer_size,
+						 [](auto a,auto b){ return a+b; });
+  auto g = std::mt19937{0};
+  auto d = std::uniform_real_distribution<double>{0.0,1.0};
+
+  auto v = std::vector<double>(buffer_size);
+  for(auto i = 0ul; i < buffer_size; ++i){
+    v[i] = (i % 7 == 0) ? 0.0: d(g);
+    st.set(i,v[i]);
+  }
+
+  auto total = std::accumulate(v.begin(),v.end(),0.0);
+  for(auto n : {1ul, 3ul, 500ul, buffer_size}){
+    for(auto k = 0ul; k < 100ul; ++k){
+      auto mass = d(g) * total * 1.1;
+
+      // Reference: max index of sum( [0,index) ) <= mass in [0,n)
+      auto expected = 0ul;
+      auto prefix = 0.0;
+      for(auto i = 0ul; i+1 < n; ++i){
+	prefix += v[i];
+	if(prefix <= mass){ expected = i+1; }else{ break; }
+      }
+
+      ymd::Equal(st.largest_region_index([=](auto p){ return p <= mass; },n),
+		 expected);
+    }
+  }
+  std::cout << "largest_region_index (MultiThread=" << MultiThread << "): OK"
+	    << std::endl;
+}
+
+void operator_policy_test(){
+  constexpr auto buffer_size = 16ul;
+  auto sum = ymd::SegmentTree<double,false,ymd::SumOp<double>>(buffer_size,
+							       ymd::SumOp<double>{});
+  auto min = ymd::SegmentTree<double,true,ymd::MinOp<double>>(buffer_size,
+							      ymd::MinOp<double>{},
+							      1e+10);
+  for(auto i = 0ul; i < buffer_size; ++i){
+    sum.set(i,i*1.0);
+    min.set(i,(buffer_size - i)*1.0);
+  }
+
+  std::cout << "SumOp [0,11): " << ymd::AlmostEqual(sum.reduce(0,11),55)
+	    << std::endl;
+  std::cout << "MinOp [3,7): " << ymd::AlmostEqual(min.reduce(3,7),10)
+	    << std::endl;
+
+  min.set(0,-1.0,3);
+  std::cout << "MinOp [0,16): " << ymd::AlmostEqual(min.reduce(0,16),-1)
+	    << std::endl;
+  std::cout << "MinOp [3,16): " << ymd::AlmostEqual(min.reduce(3,16),1)
+	    << std::endl;
+}
+
+template<std::size_t Arity>
+void arity_test(){
+  constexpr auto buffer_size = 1000ul;
+  using Node = ymd::SumMin<double>;
+  auto binary = ymd::SegmentTree<Node,false,ymd::SumMinOp<double>>(buffer_size,
+								    ymd::SumMinOp<double>{},
+								    Node{0,1e+10});
+  auto wide = ymd::SegmentTree<Node,false,ymd::SumMinOp<double>,Arity>(buffer_size,
+								       ymd::SumMinOp<double>{},
+								       Node{0,1e+10});
+  auto g = std::mt19937{1};
+  auto d = std::uniform_real_distribution<double>{0.0,1.0};
+  for(auto i = 0ul; i < buffer_size; ++i){
+    auto v = d(g);
+    binary.set(i,Node{v,v});
+    wide.set(i,Node{v,v});
+  }
+  wide.set(990,Node{0.5,0.5},20,buffer_size);
+  binary.set(990,Node{0.5,0.5},20,buffer_size);
+
+  for(auto k = 0ul; k < 100ul; ++k){
+    auto s = std::size_t(d(g) * (buffer_size - 1));
+    auto e = s + 1 + std::size_t(d(g) * (buffer_size - s - 1));
+    ymd::AlmostEqual(wide.reduce(s,e).sum,binary.reduce(s,e).sum);
+    ymd::AlmostEqual(wide.reduce(s,e).min,binary.reduce(s,e).min);
+
+    auto mass = d(g) * binary.reduce(0,buffer_size).sum;
+    auto cond = [=](const auto& v){ return v.sum <= mass; };
+    ymd::Equal(wide.largest_region_index(cond,buffer_size),
+	       binary.largest_region_index(cond,buffer_size));
+  }
+  std::cout << "SegmentTree (Arity=" << Arity << "): OK" << std::endl;
+}
+
+void incremental_update_test(){
+  constexpr auto buffer_size = 1024ul;
+  auto st = ymd::SegmentTree<double,false,ymd::SumOp<double>>(buffer_size,
+							      ymd::SumOp<double>{});
+  auto mt = ymd::SegmentTree<double,true,ymd::SumOp<double>>(buffer_size,
+							     ymd::SumOp<double>{});
+
+  // Shared flag without dirty bitmap falls back to full rebuild
+  bool flag = true;
+  auto fb = ymd::SegmentTree<double,true,ymd::SumOp<double>>(buffer_size,
+							     ymd::SumOp<double>{},
+							     0.0,nullptr,&flag);
+
+  auto g = std::mt19937{2};
+  auto d = std::uniform_real_distribution<double>{0.0,1.0};
+  for(auto n : {1ul, 5ul, 100ul, 2000ul}){
+    for(auto k = 0ul; k < n; ++k){
+      auto i = std::size_t(d(g) * buffer_size);
+      auto v = d(g);
+      st.set(i,v);
+      mt.set(i,v);
+      fb.set(i,v);
+    }
+    st.set(1000,0.25,50,1010);
+    mt.set(1000,0.25,50,1010);
+    fb.set(1000,0.25,50,1010);
+
+    for(auto k = 0ul; k < 10ul; ++k){
+      auto s = std::size_t(d(g) * (buffer_size - 1));
+      auto e = s + 1 + std::size_t(d(g) * (buffer_size - s - 1));
+      ymd::AlmostEqual(mt.reduce(s,e),st.reduce(s,e));
+      ymd::AlmostEqual(fb.reduce(s,e),st.reduce(s,e));
+    }
+  }
+  std::cout << "Incremental update: OK" << std::endl;
+}
+
+void batch_set_test(){
+  constexpr auto buffer_size = 256ul;
+  auto seq = ymd::SegmentTree<double,false,ymd::SumOp<double>>(buffer_size,
+							       ymd::SumOp<double>{});
+  auto batch = ymd::SegmentTree<double,false,ymd::SumOp<double>>(buffer_size,
+								 ymd::SumOp<double>{});
+  auto g = std::mt19937{3};
+  auto d = std::uniform_real_distribution<double>{0.0,1.0};
+
+  auto idx = std::vector<std::size_t>{};
+  auto v = std::vector<double>{};
+  for(auto k = 0ul; k < 300ul; ++k){
+    idx.push_back(std::size_t(d(g) * buffer_size));
+    v.push_back(d(g));
+    seq.set(idx.back(),v.back());
+  }
+  batch.set(idx.data(),v.data(),idx.size());
+
+  for(auto i = 0ul; i < buffer_size; ++i){
+    ymd::AlmostEqual(batch.get(i),seq.get(i));
+  }
+  ymd::AlmostEqual(batch.reduce(0,buffer_size),seq.reduce(0,buffer_size));
+  ymd::AlmostEqual(batch.reduce(10,100),seq.reduce(10,100));
+
+  // Stateful generator continues at wraparound
+  batch.set(250,[i=0.0]() mutable { return i++; },10,buffer_size);
+  for(auto i = 0ul; i < 6ul; ++i){ ymd::AlmostEqual(batch.get(250+i),i); }
+  for(auto i = 0ul; i < 4ul; ++i){ ymd::AlmostEqual(batch.get(i),6+i); }
+  ymd::AlmostEqual(batch.reduce(0,4),6+7+8+9);
+  ymd::AlmostEqual(batch.reduce(250,256),0+1+2+3+4+5);
+
+  std::cout << "Batch set: OK" << std::endl;
+}
+
+void stats_test(){
+  constexpr auto buffer_size = 1024ul;
+  auto st = ymd::SegmentTree<double,false,ymd::SumOp<double>>(buffer_size,
+							      ymd::SumOp<double>{});
+  auto mt = ymd::SegmentTree<double,true,ymd::SumOp<double>>(buffer_size,
+							     ymd::SumOp<double>{});
+
+  // Disabled by default
+  st.set(0,1.0);
+  ymd::Equal(st.get_stats().incremental_updates,0ul);
+
+  st.enable_stats(true);
+  mt.enable_stats(true);
+
+  st.set(1,1.0);
+  st.set(10,1.0,5);
+  auto idx = std::vector<std::size_t>{3,7,3};
+  auto v = std::vector<double>{1.0,2.0,3.0};
+  st.set(idx.data(),v.data(),idx.size());
+  ymd::Equal(st.get_stats().incremental_updates,3ul);
+  ymd::Equal(st.get_stats().updated_leaves,1ul+5ul+2ul);
+
+  st.clear();
+  ymd::Equal(st.get_stats().full_rebuilds,1ul);
+
+  // Multi thread tree updates at reduce, incrementally for a few leaves
+  mt.set(1,1.0);
+  mt.set(2,1.0);
+  mt.reduce(0,buffer_size);
+  mt.reduce(0,buffer_size);
+  ymd::Equal(mt.get_stats().incremental_updates,1ul);
+  ymd::Equal(mt.get_stats().updated_leaves,2ul);
+  ymd::Equal(mt.get_stats().full_rebuilds,0ul);
+
+  mt.set(0,1.0,buffer_size);
+  mt.reduce(0,buffer_size);
+  ymd::Equal(mt.get_stats().full_rebuilds,1ul);
+
+  st.enable_stats(false);
+  ymd::Equal(st.get_stats().full_rebuilds,0ul);
+
+  std::cout << "Stats: OK" << std::endl;
+}
+
 int main(){
   constexpr auto buffer_size = 16;
 
@@ -76,5 +287,19 @@ int main(){
 
   multi_thread_test();
 
+  largest_region_index_test<false>();
+  largest_region_index_test<true>();
+
+  operator_policy_test();
+
+  arity_test<4>();
+  arity_test<8>();
+
+  incremental_update_test();
+
+  batch_set_test();
+
+  stats_test();
+
   return 0;
 }
@@ -0,0 +1,191 @@
+import os
+import socket
+import tempfile
+import time
+import unittest
+
+import numpy as np
+
+from cpprb import (ReplayBuffer, PrioritizedReplayBuffer, MPReplayBuffer,
+                   MPPrioritizedReplayBuffer, ReplayServer, ReplayClient)
+from cpprb.Server import (RemoteError, UnixTransport, make_transport,
+                          MAGIC, VERSION, OP_ADD, _FRAME)
+
+
+class TestReplayServer(unittest.TestCase):
+    def test_make_transport(self):
+        t = make_transport("tcp://localhost:1234")
+        self.assertEqual((t.host, t.port), ("localhost", 1234))
+
+        t = make_transport("unix:///tmp/cpprb.sock")
+        self.assertEqual(t.path, "/tmp/cpprb.sock")
+
+        with self.assertRaises(ValueError):
+            make_transport("udp://localhost:1234")
+
+    def test_add_sample(self):
+        rb = ReplayBuffer(32, {"obs": {"shape": 3}, "act": {"dtype": np.int32}})
+        with ReplayServer(rb) as server, ReplayClient(server.address) as client:
+            self.assertEqual(client.get_buffer_size(), 32)
+            self.assertEqual(client.get_stored_size(), 0)
+
+            with self.assertRaises(RemoteError):
+                client.sample(4)
+
+            self.assertEqual(client.add(obs=np.ones((5, 3)),
+                                        act=np.arange(5)), 0)
+            self.assertEqual(client.add(obs=[2, 2, 2], act=5), 5)
+            self.assertEqual(client.get_stored_size(), 6)
+
+            s = client.sample(16)
+            self.assertEqual(s["obs"].shape, (16, 3))
+            self.assertEqual(s["act"].dtype, np.int32)
+            np.testing.assert_array_equal(s["obs"][:, 0],
+                                          np.where(s["act"].ravel() < 5, 1, 2))
+
+            client.clear()
+            self.assertEqual(rb.get_stored_size(), 0)
+
+    def test_out(self):
+        rb = ReplayBuffer(32, {"a": {"shape": 2}})
+        rb.add(a=np.ones((4, 2)))
+        with ReplayServer(rb) as server, ReplayClient(server.address) as client:
+            out = rb.empty_sample(8)
+            s = client.sample(8, out=out)
+            self.assertIs(s, out)
+            np.testing.assert_array_equal(out["a"], np.ones((8, 2)))
+
+            with self.assertRaises(ValueError):
+                client.sample(4, out=out)
+
+            # Connection is still usable
+            self.assertEqual(client.get_stored_size(), 4)
+
+    def test_pipeline(self):
+        rb = PrioritizedReplayBuffer(256, {"a": {}})
+        with ReplayServer(rb) as server, ReplayClient(server.address,
+                                                      max_pending=4) as client:
+            futures = [client.add_async(a=np.full(4, i), priorities=np.full(4, i+1))
+                       for i in range(16)]
+            np.testing.assert_array_equal([f.result() for f in futures],
+                                          np.arange(0, 64, 4))
+            self.assertAlmostEqual(rb.get_max_priority(), 16.0)
+
+            futures = [client.sample_async(8, beta=0.5) for _ in range(8)]
+            for f in futures:
+                s = f.result()
+                self.assertEqual(s["indexes"].shape, (8,))
+                self.assertEqual(s["weights"].shape, (8,))
+
+            client.update_priorities(s["indexes"], np.full(8, 100))
+            self.assertAlmostEqual(rb.get_max_priority(), 100.0)
+
+    def test_update_without_priorities(self):
+        rb = ReplayBuffer(32, {"a": {}})
+        with ReplayServer(rb) as server, ReplayClient(server.address) as client:
+            client.add(a=1)
+            with self.assertRaises(RemoteError):
+                client.update_priorities([0], [1.0])
+            self.assertEqual(client.add(a=2), 1)
+
+    def test_multi_clients(self):
+        rb = MPReplayBuffer(64, {"a": {}})
+        with ReplayServer(rb) as server:
+            clients = [ReplayClient(server.address) for _ in range(4)]
+            futures = [c.add_async(a=np.ones(4)) for c in clients for _ in range(2)]
+            for f in futures:
+                f.result()
+            self.assertEqual(rb.get_stored_size(), 32)
+            for c in clients:
+                c.close()
+
+    def test_single_learner(self):
+        rb = MPPrioritizedReplayBuffer(64, {"a": {}})
+        rb.add(a=np.arange(8), priorities=np.arange(1, 9))
+        with ReplayServer(rb) as server:
+            learner = ReplayClient(server.address)
+            other = ReplayClient(server.address)
+
+            s = learner.sample(4)
+            s_next = learner.sample(4)
+
+            with self.assertRaises(RemoteError):
+                other.sample(4)
+            with self.assertRaises(RemoteError):
+                other.update_priorities(s["indexes"], np.ones(4))
+
+            # Adding is allowed to every client
+            other.add(a=8, priorities=1.0)
+            learner.update_priorities(s_next["indexes"], np.full(4, 100))
+            self.assertAlmostEqual(rb.get_max_priority(), 100.0)
+
+            # After disconnection, another client can be learner.
+            learner.close()
+            for _ in range(100):
+                try:
+                    other.sample(4)
+                    break
+                except RemoteError:
+                    time.sleep(0.01)
+            else:
+                self.fail("Learner is not released")
+            other.close()
+
+    def test_max_message_size(self):
+        rb = ReplayBuffer(2048, {"a": {}})
+        with ReplayServer(rb, max_message_size=1024) as server:
+            with ReplayClient(server.address) as client:
+                with self.assertRaises(ConnectionError):
+                    client.add(a=np.ones(1024))
+            self.assertEqual(rb.get_stored_size(), 0)
+
+            # Frame claiming huge data is rejected before allocation.
+            t = make_transport(server.address)
+            with socket.create_connection((t.host, t.port)) as sock:
+                sock.sendall(_FRAME.pack(MAGIC, VERSION, OP_ADD, 0, 0, 0, 1 << 60))
+                self.assertEqual(sock.recv(1), b"")
+
+            with ReplayClient(server.address) as client:
+                client.add(a=np.ones(16))
+                self.assertEqual(client.get_stored_size(), 16)
+
+    def test_secret(self):
+        rb = ReplayBuffer(32, {"a": {}})
+        with ReplayServer(rb, secret="key") as server:
+            with ReplayClient(server.address, secret="key") as client:
+                client.add(a=np.arange(3))
+                self.assertEqual(client.get_stored_size(), 3)
+
+            for secret in ("wrong", None):
+                with ReplayClient(server.address, secret=secret) as client:
+                    with self.assertRaises(ConnectionError):
+                        client.add(a=1)
+            self.assertEqual(rb.get_stored_size(), 3)
+
+    def test_unix(self):
+        with tempfile.TemporaryDirectory() as d:
+            path = os.path.join(d, "rb.sock")
+            rb = ReplayBuffer(32, {"a": {}})
+            with ReplayServer(rb, UnixTransport(path)) as server:
+                self.assertEqual(server.address, f"unix://{path}")
+                with ReplayClient(server.address) as client:
+                    client.add(a=np.arange(3))
+                    self.assertEqual(client.get_stored_size(), 3)
+                    client.on_episode_end()
+            self.assertFalse(os.path.exists(path))
+
+    def test_server_close(self):
+        rb = ReplayBuffer(32, {"a": {}})
+        server = ReplayServer(rb)
+        client = ReplayClient(server.address)
+        client.add(a=1)
+        server.close()
+
+        with self.assertRaises(ConnectionError):
+            for _ in range(10):
+                client.add(a=1)
+        client.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
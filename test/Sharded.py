@@ -0,0 +1,155 @@
+import threading
+import unittest
+
+import numpy as np
+
+from cpprb import PrioritizedReplayBuffer, ShardedPrioritizedReplayBuffer
+
+
+class TestShardedPrioritizedReplayBuffer(unittest.TestCase):
+    def test_init(self):
+        with self.assertRaises(ValueError):
+            ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=0)
+
+        with self.assertRaises(ValueError):
+            ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=2,
+                                           routing="unknown")
+
+        rb = ShardedPrioritizedReplayBuffer(30, {"a": {}}, n_shards=4)
+        self.assertEqual(rb.shard_size, 8)
+        self.assertEqual(rb.get_buffer_size(), 32)
+        self.assertEqual(rb.get_stored_size(), 0)
+
+        with self.assertRaises(ValueError):
+            rb.sample(4)
+
+    def test_round_robin(self):
+        rb = ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=4)
+
+        idx = [rb.add(a=i) for i in range(8)]
+        np.testing.assert_array_equal(idx, [0, 8, 16, 24, 1, 9, 17, 25])
+        for shard in rb.shards:
+            self.assertEqual(shard.get_stored_size(), 2)
+
+        self.assertEqual(rb.add(a=8, shard=3), 26)
+
+    def test_actor(self):
+        rb = ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=4,
+                                            routing="actor")
+
+        with self.assertRaises(ValueError):
+            rb.add(a=1)
+
+        self.assertEqual(rb.add(a=np.ones(3), actor=5), 8)
+        self.assertEqual(rb.shards[1].get_stored_size(), 3)
+        self.assertEqual(rb.get_stored_size(), 3)
+
+        with self.assertRaises(ValueError):
+            rb.add(a=1, shard=4)
+
+    def test_update_priorities(self):
+        rb = ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=2,
+                                            alpha=1.0, eps=0.0)
+        rb.add(a=np.arange(4), priorities=np.ones(4), shard=0)
+        rb.add(a=np.arange(4), priorities=np.ones(4), shard=1)
+
+        rb.update_priorities([1, 17], [3.0, 5.0])
+        self.assertAlmostEqual(rb.shards[0].get_priority_sum(), 6.0)
+        self.assertAlmostEqual(rb.shards[1].get_priority_sum(), 8.0)
+        self.assertAlmostEqual(rb.get_max_priority(), 5.0)
+
+        with self.assertRaises(IndexError):
+            rb.update_priorities([40], [1.0])
+
+        with self.assertRaises(ValueError):
+            rb.update_priorities([0, 1], [1.0])
+
+    def test_sample(self):
+        rb = ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=2,
+                                            alpha=1.0, eps=0.0, seed=42)
+        rb.add(a=np.arange(4), priorities=np.full(4, 1.0), shard=0)
+        rb.add(a=np.arange(4), priorities=np.full(4, 3.0), shard=1)
+
+        s = rb.sample(64, beta=1.0)
+        self.assertEqual(s["a"].shape, (64, 1))
+        self.assertEqual(s["indexes"].shape, (64,))
+
+        # Allocation follows shard sums (4 : 12)
+        from0 = s["indexes"] < rb.shard_size
+        self.assertEqual(from0.sum(), 16)
+
+        # Weights are normalized by the global minimum priority
+        np.testing.assert_allclose(s["weights"][from0], 1.0, rtol=1e-6)
+        np.testing.assert_allclose(s["weights"][~from0], 1.0 / 3.0, rtol=1e-6)
+
+        per = PrioritizedReplayBuffer(32, {"a": {}}, alpha=1.0, eps=0.0)
+        per.add(a=np.arange(8), priorities=[1, 1, 1, 1, 3, 3, 3, 3])
+        ps = per.sample(64, beta=1.0)
+        np.testing.assert_allclose(np.unique(s["weights"]),
+                                   np.unique(ps["weights"]), rtol=1e-6)
+
+    def test_sample_shard(self):
+        rb = ShardedPrioritizedReplayBuffer(32, {"a": {}}, n_shards=2,
+                                            alpha=1.0, eps=0.0, seed=0)
+        rb.add(a=np.arange(2), priorities=[1.0, 1.0], shard=0)
+
+        with self.assertRaises(ValueError):
+            rb.sample_shard(1, 4)
+
+        rb.add(a=np.arange(4), priorities=[1.0, 1.0, 2.0, 2.0], shard=1)
+
+        # sum_0 = 2, min_0 = 1 / sum_1 = 6, min_1 = 1
+        s0 = rb.sample_shard(0, 16, beta=1.0)
+        np.testing.assert_array_less(s0["indexes"], rb.shard_size)
+        np.testing.assert_allclose(s0["weights"], 1.0 / 3.0, rtol=1e-6)
+
+        s1 = rb.sample_shard(1, 16, beta=1.0)
+        self.assertTrue((s1["indexes"] >= rb.shard_size).all())
+        w = np.where(s1["a"].ravel() < 2, 1.0, 0.5)
+        np.testing.assert_allclose(s1["weights"], w, rtol=1e-6)
+
+    def test_seed(self):
+        def run():
+            rb = ShardedPrioritizedReplayBuffer(64, {"a": {}}, n_shards=4,
+                                                seed=7)
+            rb.add(a=np.arange(40), priorities=np.arange(1, 41))
+            return rb.sample(32)
+
+        s1 = run()
+        s2 = run()
+        np.testing.assert_array_equal(s1["indexes"], s2["indexes"])
+        np.testing.assert_array_equal(s1["weights"], s2["weights"])
+
+    def test_threads(self):
+        n_shards = 4
+        rb = ShardedPrioritizedReplayBuffer(4096, {"a": {}}, n_shards=n_shards,
+                                            routing="actor")
+        errors = []
+
+        def actor(i):
+            try:
+                for j in range(200):
+                    rb.add(a=np.full(4, j), actor=i)
+                    if rb.shards[i].get_stored_size() > 0:
+                        s = rb.sample_shard(i, 8)
+                        rb.update_priorities(s["indexes"], np.ones(8))
+            except BaseException as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=actor, args=(i,))
+                   for i in range(n_shards)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        self.assertEqual(errors, [])
+        self.assertEqual(rb.get_stored_size(), n_shards * 200 * 4)
+        self.assertEqual(rb.sample(16)["a"].shape, (16, 1))
+
+        rb.clear()
+        self.assertEqual(rb.get_stored_size(), 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
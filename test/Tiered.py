@@ -0,0 +1,136 @@
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+from cpprb import TieredReplayBuffer, TieredPrioritizedReplayBuffer
+
+
+class TestTieredReplayBuffer(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.dir.name, "rb")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def make(self, **kwargs):
+        rb = TieredReplayBuffer(64, {"a": {"dtype": np.int64}, "b": {"shape": 3}},
+                                path=self.path, hot_size=16, chunk_size=4,
+                                seed=0, **kwargs)
+        self.addCleanup(rb.close)
+        return rb
+
+    def test_sizes(self):
+        with self.assertRaises(ValueError):
+            TieredReplayBuffer(60, {"a": {}}, path=self.path, hot_size=16)
+        with self.assertRaises(ValueError):
+            TieredReplayBuffer(64, {"a": {}}, path=self.path, hot_size=16,
+                               chunk_size=16)
+        with self.assertRaises(ValueError):
+            TieredReplayBuffer(64, {"a": {}}, path=self.path, hot_size=16,
+                               cold_fraction=1.5)
+
+    def test_add(self):
+        rb = self.make()
+        self.assertEqual(rb.add(a=np.arange(3), b=np.ones((3, 3))), 0)
+        self.assertEqual(rb.add(a=np.arange(3, 40), b=1.0), 3)
+        self.assertEqual(rb.get_stored_size(), 40)
+        self.assertEqual(rb.get_next_index(), 40)
+        self.assertTrue(os.path.exists(f"{self.path}_a.seg"))
+
+        with self.assertRaises(ValueError):
+            rb.add(a=np.arange(2), b=np.ones((3, 3)))
+
+        gauges = rb.get_stats()["gauges"]
+        self.assertEqual(gauges["hot_stored_size"], 16)
+        self.assertEqual(gauges["cold_stored_size"], 24)
+
+    def test_cold_fraction(self):
+        rb = self.make(cold_fraction=1.0, prefetch=False)
+        rb.add(a=np.arange(40), b=np.zeros((40, 3)))
+
+        s = rb.sample(32)
+        np.testing.assert_array_equal(s["a"].ravel(), s["indexes"])
+        self.assertTrue((s["indexes"] < 40 - 16).all())
+
+        rb.cold_fraction = 0.0
+        s = rb.sample(32)
+        self.assertTrue((s["indexes"] >= 40 - 16).all())
+        self.assertTrue((s["indexes"] < 40).all())
+
+    def test_wrap(self):
+        rb = self.make()
+        for t in range(0, 100, 5):
+            rb.add(a=np.arange(t, t + 5), b=np.zeros((5, 3)))
+
+        s = rb.sample(256)
+        a = s["a"].ravel()
+        np.testing.assert_array_equal(a % 64, s["indexes"])
+        self.assertTrue((a >= 100 - 64).all())
+
+        counters = rb.get_stats()["counters"]
+        self.assertGreater(counters["cold_reads"], 0)
+        self.assertGreater(counters["hot_reads"], 0)
+
+    def test_prefetch_overwritten(self):
+        rb = self.make(cold_fraction=1.0)
+        rb.add(a=np.arange(64), b=np.zeros((64, 3)))
+        rb.sample(16)
+
+        # Prefetched cold transitions are overwritten.
+        rb.add(a=np.arange(64, 128), b=np.zeros((64, 3)))
+        s = rb.sample(16)
+        a = s["a"].ravel()
+        self.assertTrue((a >= 64).all())
+        np.testing.assert_array_equal(a % 64, s["indexes"])
+        self.assertEqual(rb.get_stats()["counters"]["prefetch_hits"], 1)
+
+    def test_clear(self):
+        rb = self.make()
+        rb.add(a=np.arange(8), b=np.zeros((8, 3)))
+        rb.sample(4)
+        rb.clear()
+        self.assertEqual(rb.get_stored_size(), 0)
+        with self.assertRaises(ValueError):
+            rb.sample(4)
+
+
+class TestTieredPrioritizedReplayBuffer(unittest.TestCase):
+    def test_priorities(self):
+        with tempfile.TemporaryDirectory() as d:
+            rb = TieredPrioritizedReplayBuffer(64, {"a": {}},
+                                               path=os.path.join(d, "rb"),
+                                               hot_size=16, chunk_size=4,
+                                               alpha=1.0, eps=0.0, seed=0)
+            ps = np.ones(48)
+            ps[40] = 49.0
+            rb.add(a=np.arange(48), priorities=ps)
+            self.assertAlmostEqual(rb.get_priority_sum(), 96.0, places=4)
+
+            s = rb.sample(1024)
+            idx = s["indexes"]
+            self.assertAlmostEqual((idx == 40).mean(), 49.0 / 96.0, delta=0.05)
+            np.testing.assert_array_equal(s["a"].ravel(), idx)
+            np.testing.assert_allclose(s["weights"][idx != 40], 1.0, rtol=1e-5)
+            np.testing.assert_allclose(s["weights"][idx == 40], 49.0 ** -0.4,
+                                       rtol=1e-5)
+
+            rb.update_priorities([3, 40], [2.0, 2.0])
+            self.assertAlmostEqual(rb.get_priority_sum(), 50.0, places=4)
+            self.assertAlmostEqual(rb.get_max_priority(), 49.0)
+
+            # Without priorities, the max priority is used.
+            rb.add(a=48)
+            self.assertAlmostEqual(rb.get_priority_sum(), 99.0, places=4)
+
+            with self.assertRaises(ValueError):
+                TieredPrioritizedReplayBuffer(64, {"a": {}},
+                                              path=os.path.join(d, "x"),
+                                              hot_size=16, cold_fraction=0.5)
+            rb.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
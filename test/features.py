@@ -3,7 +3,8 @@ import os
 import numpy as np
 import unittest
 
-from cpprb import create_buffer, ReplayBuffer, PrioritizedReplayBuffer
+from cpprb import (create_buffer, ReplayBuffer, PrioritizedReplayBuffer,
+                   ReverseReplayBuffer, MPReplayBuffer, MPPrioritizedReplayBuffer)
 
 class TestFeatureHighDimensionalObs(unittest.TestCase):
     def test_RGB_screen_obs(self):
@@ -69,6 +70,54 @@ class TestMemmap(unittest.TestCase):
 
         self.assertTrue(os.path.exists("mmap_done.dat"))
 
+    def test_warm_restart(self):
+        env_dict = {"a": {"shape": 2}, "done": {}}
+        rb1 = ReplayBuffer(8,env_dict,mmap_prefix="mmap_warm")
+        rb1.add(a=np.arange(20).reshape(-1,2),done=np.zeros(10))
+        rb1.on_episode_end()
+        rb1.add(a=[1,2],done=0)
+
+        rb2 = ReplayBuffer(8,env_dict,mmap_prefix="mmap_warm",mmap_mode="r+")
+        self.assertEqual(rb2.get_stored_size(),rb1.get_stored_size())
+        self.assertEqual(rb2.get_next_index(),rb1.get_next_index())
+        self.assertEqual(rb2.get_current_episode_len(),1)
+        np.testing.assert_allclose(rb2.get_all_transitions()["a"],
+                                   rb1.get_all_transitions()["a"])
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(16,env_dict,mmap_prefix="mmap_warm",mmap_mode="r+")
+
+    def test_warm_restart_next_of_stack_compress(self):
+        env_dict = {"obs": {"shape": (3,4)}, "done": {}}
+        kwargs = {"next_of": "obs", "stack_compress": "obs",
+                  "mmap_prefix": "mmap_warm_stack"}
+        obs = np.arange(3*30).reshape(3,30)
+
+        rb1 = ReplayBuffer(8,env_dict,**kwargs)
+        for i in range(5):
+            rb1.add(obs=obs[:,i:i+4],next_obs=obs[:,i+1:i+5],done=0)
+        rb1.on_episode_end()
+        for i in range(10,16):
+            rb1.add(obs=obs[:,i:i+4],next_obs=obs[:,i+1:i+5],done=0)
+
+        rb2 = ReplayBuffer(8,env_dict,mmap_mode="r+",**kwargs)
+        t1 = rb1.get_all_transitions()
+        t2 = rb2.get_all_transitions()
+        np.testing.assert_allclose(t2["obs"],t1["obs"])
+        np.testing.assert_allclose(t2["next_obs"],t1["next_obs"])
+
+    def test_warm_restart_PER(self):
+        env_dict = {"a": {}}
+        rb1 = PrioritizedReplayBuffer(8,env_dict,mmap_prefix="mmap_warm_per")
+        rb1.add(a=np.arange(10),priorities=np.arange(10)+1.0)
+
+        rb2 = PrioritizedReplayBuffer(8,env_dict,mmap_prefix="mmap_warm_per",
+                                      mmap_mode="r+")
+        self.assertAlmostEqual(rb2.get_max_priority(),rb1.get_max_priority())
+
+        s = rb2.sample(64)
+        np.testing.assert_allclose(s["a"].ravel() % 8,s["indexes"])
+
 class TestShuffleTransitions(unittest.TestCase):
     def test_shuffle_transitions(self):
         rb = ReplayBuffer(64,{"a": {}})
@@ -84,6 +133,431 @@ class TestShuffleTransitions(unittest.TestCase):
         s = np.intersect1d(s1,s2,assume_unique=True)
         np.testing.assert_allclose(np.ravel(s),np.ravel(s1))
 
+class TestFrameStore(unittest.TestCase):
+    def _episode(self, T, stack, offset):
+        frames = (np.arange(T + stack) + offset).astype(np.uint8)
+        frames = np.broadcast_to(frames.reshape(-1,1,1),(T + stack,2,3))
+        obs = np.stack([frames[i:i+T] for i in range(stack)],axis=-1)
+        next_obs = np.stack([frames[i+1:i+1+T] for i in range(stack)],axis=-1)
+        return obs, next_obs
+
+    def test_stack_with_next_of(self):
+        buffer_size = 16
+        stack = 4
+        env_dict = {"obs": {"shape": (2,3,stack), "dtype": np.uint8}}
+
+        rb = ReplayBuffer(buffer_size, env_dict,
+                          next_of="obs", stack_compress="obs")
+        plain = ReplayBuffer(buffer_size,
+                             {**env_dict, "next_obs": env_dict["obs"]})
+
+        for T, offset in ((7, 0), (5, 100), (9, 200)):
+            obs, next_obs = self._episode(T, stack, offset)
+            for o, no in zip(obs, next_obs):
+                rb.add(obs=o, next_obs=no)
+                plain.add(obs=o, next_obs=no)
+            rb.on_episode_end()
+            plain.on_episode_end()
+
+            t1 = rb.get_all_transitions()
+            t2 = plain.get_all_transitions()
+            np.testing.assert_array_equal(t1["obs"], t2["obs"])
+            np.testing.assert_array_equal(t1["next_obs"], t2["next_obs"])
+
+    def test_unshared_next_of(self):
+        rb = ReplayBuffer(8, {"a": {"shape": 3}}, next_of="a")
+
+        a = np.random.rand(12,3)
+        next_a = np.random.rand(12,3)
+        rb.add(a=a, next_a=next_a)
+
+        t = rb.get_all_transitions()
+        np.testing.assert_allclose(t["a"], np.roll(a[4:],4,axis=0))
+        np.testing.assert_allclose(t["next_a"], np.roll(next_a[4:],4,axis=0))
+
+    def test_without_frame_store(self):
+        buffer_size = 16
+        stack = 4
+        env_dict = {"obs": {"shape": (2,3,stack), "dtype": np.uint8}}
+
+        rb = ReplayBuffer(buffer_size, env_dict, next_of="obs",
+                          stack_compress="obs",
+                          memory_policy={"huge_page": "thp"})
+        strided = ReplayBuffer(buffer_size, env_dict, next_of="obs",
+                               stack_compress="obs", frame_store=False)
+
+        for T, offset in ((7, 0), (12, 100), (9, 200)):
+            obs, next_obs = self._episode(T, stack, offset)
+            rb.add(obs=obs, next_obs=next_obs)
+            strided.add(obs=obs, next_obs=next_obs)
+            rb.on_episode_end()
+            strided.on_episode_end()
+
+            t1 = rb.get_all_transitions()
+            t2 = strided.get_all_transitions()
+            np.testing.assert_array_equal(t1["obs"], t2["obs"])
+            np.testing.assert_array_equal(t1["next_obs"], t2["next_obs"])
+
+class TestSequenceSampling(unittest.TestCase):
+    def test_sequences(self):
+        rb = ReplayBuffer(8, {"a": {}, "b": {"shape": 2}})
+
+        # Episodes: [0,1,2], [3,4,5,6,7,8,9] (slot 0 and 1 are overwritten)
+        for i in range(10):
+            rb.add(a=i, b=(i, -i))
+            if i == 2:
+                rb.on_episode_end()
+
+        s = rb._encode_sequences(np.asarray([2,5,4]), 4, 1)
+        self.assertEqual(s["a"].shape, (3,4,1))
+        self.assertEqual(s["b"].shape, (3,4,2))
+        self.assertEqual(s["mask"].shape, (3,4))
+
+        # index 2 is the oldest (episode 0) at next_index 2
+        np.testing.assert_allclose(s["a"][:,:,0],
+                                   np.asarray([[2,2,2,2],
+                                               [4,5,6,7],
+                                               [3,4,5,6]]))
+        np.testing.assert_array_equal(s["mask"],
+                                      np.asarray([[False,True,False,False],
+                                                  [True,True,True,True],
+                                                  [True,True,True,True]]))
+
+        # Wraparound to the newest (index 1), then not stored yet
+        s = rb._encode_sequences(np.asarray([0]), 4, 0)
+        np.testing.assert_allclose(s["a"][0,:,0], np.asarray([8,9,9,9]))
+        np.testing.assert_array_equal(s["mask"][0],
+                                      np.asarray([True,True,False,False]))
+
+        s = rb.sample_sequences(16, 5, 2)
+        self.assertEqual(s["a"].shape, (16,5,1))
+        self.assertTrue(s["mask"][:,2].all())
+
+        for seq_len, burn_in in [(2, 2), (4, -1), (0, 0), (-2, -3)]:
+            with self.subTest(seq_len=seq_len, burn_in=burn_in):
+                with self.assertRaises(ValueError):
+                    rb.sample_sequences(16, seq_len, burn_in)
+
+    def test_prioritized_sequences(self):
+        rb = PrioritizedReplayBuffer(8, {"a": {}}, eps=0.0, alpha=1.0)
+        rb.add(a=np.arange(8), priorities=np.zeros(8))
+
+        rb.update_sequence_priorities([3, 5],
+                                      [[1.0, 3.0], [10.0, 10.0]],
+                                      eta=0.5, mask=[[True, True],
+                                                     [False, False]])
+        self.assertAlmostEqual(rb.get_max_priority(), 2.5)
+
+        with self.assertRaises(ValueError):
+            rb.sample_sequences(4, 3, -1)
+
+        s = rb.sample_sequences(4, 3, 1)
+        np.testing.assert_array_equal(s["indexes"], np.full(4, 3))
+        np.testing.assert_allclose(s["a"][:,:,0], np.tile([2,3,4], (4,1)))
+        self.assertEqual(s["weights"].shape, (4,))
+
+class TestPreallocatedSample(unittest.TestCase):
+    def test_out(self):
+        rb = ReplayBuffer(32,{"obs": {"shape": (4,4)}, "act": {"dtype": np.int16}},
+                          next_of="obs", stack_compress="obs")
+        rb.add(obs=np.random.rand(20,4,4), act=np.arange(20),
+               next_obs=np.random.rand(20,4,4))
+        rb.on_episode_end()
+
+        out = rb.empty_sample(16)
+        rb.set_seed(42)
+        s1 = rb.sample(16,out=out)
+        rb.set_seed(42)
+        s2 = rb.sample(16)
+
+        self.assertIs(s1,out)
+        for k in s2:
+            np.testing.assert_array_equal(s1[k],s2[k])
+            self.assertEqual(s1[k].dtype,s2[k].dtype)
+
+    def test_wrong_out(self):
+        rb = ReplayBuffer(32,{"a": {"shape": 3}})
+        rb.add(a=np.ones((5,3)))
+
+        with self.assertRaises(ValueError):
+            rb.sample(16,out={"a": np.empty((8,3),dtype=np.single)})
+
+        with self.assertRaises(ValueError):
+            rb.sample(16,out={"a": np.empty((16,3),dtype=np.double)})
+
+        with self.assertRaises(KeyError):
+            rb.sample(16,out={})
+
+    def test_prioritized_out(self):
+        rb = PrioritizedReplayBuffer(32,{"a": {"shape": 3}})
+        rb.add(a=np.arange(30).reshape(10,3),priorities=np.arange(10)+1)
+
+        out = rb.empty_sample(8)
+        s = rb.sample(8,out=out)
+
+        self.assertIs(s,out)
+        self.assertEqual(out["indexes"].dtype,np.uint64)
+        self.assertEqual(out["weights"].dtype,np.single)
+        np.testing.assert_allclose(out["a"][:,0],out["indexes"]*3)
+
+
+class TestGatherFields(unittest.TestCase):
+    def test_skip_leading_fields(self):
+        rb = ReplayBuffer(32,{"obs": {"shape": 3}, "act": {"dtype": np.int16},
+                              "rew": {"shape": 2}, "done": {}},
+                          next_of="obs", stack_compress="obs")
+        rb.add(obs=np.arange(20*3).reshape(20,3), act=np.arange(20),
+               rew=np.arange(20*2).reshape(20,2), done=np.zeros(20),
+               next_obs=np.arange(3,21*3).reshape(20,3))
+        rb.on_episode_end()
+
+        idx = np.arange(0,20,3)
+        full = rb.gather_transitions(idx)
+        for fields in (["act"],["rew"],["act","done"],["next_obs"],[]):
+            with self.subTest(fields=fields):
+                s = rb.gather_transitions(idx,fields=fields)
+                self.assertEqual(set(s.keys()),set(fields))
+                for k in fields:
+                    np.testing.assert_array_equal(s[k],full[k])
+                    self.assertEqual(s[k].dtype,full[k].dtype)
+
+
+class TestStorageDtype(unittest.TestCase):
+    def test_half(self):
+        rb = ReplayBuffer(8,{"a": {"shape": 3, "storage_dtype": np.half}})
+        a = np.linspace(-2,2,24).reshape(8,3)
+        rb.add(a=a)
+
+        t = rb.get_all_transitions()
+        self.assertEqual(t["a"].dtype,np.single)
+        np.testing.assert_allclose(t["a"],a.astype(np.half),rtol=1e-3)
+
+    def test_bfloat16(self):
+        rb = ReplayBuffer(4,{"a": {"storage_dtype": "bfloat16",
+                                   "dtype": np.double}})
+        rb.add(a=[1.0,-2.5,3.140625,np.inf])
+
+        t = rb.get_all_transitions()
+        self.assertEqual(t["a"].dtype,np.double)
+        np.testing.assert_allclose(t["a"].ravel(),[1.0,-2.5,3.140625,np.inf])
+
+    def test_quantize(self):
+        rb = ReplayBuffer(4,{"a": {"storage_dtype": np.uint8,
+                                   "scale": 0.5, "offset": -10}})
+        rb.add(a=[-10,-9.5,0,200])
+
+        t = rb.get_all_transitions()
+        np.testing.assert_allclose(t["a"].ravel(),[-10,-9.5,0,117.5])
+
+        s = rb.sample(16)
+        self.assertTrue(np.isin(s["a"],[-10,-9.5,0,117.5]).all())
+
+    def test_incompatible(self):
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4,{"a": {"storage_dtype": np.half, "dtype": np.int32}})
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4,{"a": {"storage_dtype": np.half}},next_of="a")
+
+
+class TestCompressedStorage(unittest.TestCase):
+    def test_compress(self):
+        rb = ReplayBuffer(8, {"obs": {"shape": (16, 16), "compress": "rle"},
+                              "act": {"dtype": np.int32}}, stats=True)
+
+        obs = np.zeros((10, 16, 16), dtype=np.single)
+        obs[np.arange(10), np.arange(10), np.arange(10)] = np.arange(10) + 1.0
+        rb.add(obs=obs, act=np.arange(10))
+
+        t = rb.get_all_transitions()
+        self.assertEqual(t["obs"].dtype, np.single)
+        np.testing.assert_array_equal(t["act"].ravel(), [8, 9, 2, 3, 4, 5, 6, 7])
+        np.testing.assert_array_equal(t["obs"], obs[t["act"].ravel()])
+
+        s = rb.sample(32)
+        np.testing.assert_array_equal(s["obs"], obs[s["act"].ravel()])
+
+        gauges = rb.get_stats()["gauges"]
+        self.assertEqual(gauges["obs_raw_bytes"], 8 * 16 * 16 * 4)
+        self.assertLess(gauges["obs_compressed_bytes"],
+                        gauges["obs_raw_bytes"] / 4)
+
+        rb.clear()
+        self.assertEqual(rb.get_stats()["gauges"]["obs_compressed_bytes"], 0)
+
+    def test_threads(self):
+        obs = np.zeros((64, 64, 64), dtype=np.uint8)
+        obs[:, :8, :] = np.arange(64, dtype=np.uint8)[:, None, None]
+
+        per = PrioritizedReplayBuffer(64, {"obs": {"shape": (64, 64),
+                                                   "dtype": np.uint8,
+                                                   "compress": True},
+                                           "i": {}}, num_threads=4)
+        per.add(obs=obs, i=np.arange(64))
+        s = per.sample(128)
+        np.testing.assert_array_equal(s["obs"], obs[s["indexes"]])
+
+    def test_incompatible(self):
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"a": {"compress": "lz4"}})
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"a": {"compress": True}}, next_of="a")
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"a": {"compress": True, "storage_dtype": np.half}})
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"a": {"compress": True}, "b": {"dtype": object}})
+
+
+class TestMemoryPolicy(unittest.TestCase):
+    def test_policy(self):
+        policy = {"huge_page": "2MB", "interleave": True, "prefault_threads": 2}
+
+        rb = ReplayBuffer(1024,{"a": {"shape": 3}},memory_policy=policy)
+        rb.add(a=np.ones((2000,3)))
+        np.testing.assert_allclose(rb.sample(16)["a"],np.ones((16,3)))
+
+        per = PrioritizedReplayBuffer(1024,{"a": {}},memory_policy=policy)
+        per.add(a=np.arange(10),priorities=np.arange(10)+1.0)
+        self.assertAlmostEqual(per.get_max_priority(),10.0)
+        s = per.sample(32)
+        np.testing.assert_allclose(s["a"].ravel(),s["indexes"])
+
+    def test_unknown_policy(self):
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4,{"a": {}},memory_policy={"huge_page": "4MB"})
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4,{"a": {}},memory_policy={"node": 0})
+
+
+class TestParallelSampling(unittest.TestCase):
+    def test_seed(self):
+        def make(**kwargs):
+            per = PrioritizedReplayBuffer(4096,{"a": {}},seed=7,**kwargs)
+            per.add(a=np.arange(4096),priorities=np.arange(4096) % 13 + 1.0)
+            return per
+
+        seq = make()
+        par = make(num_threads=4)
+        for _ in range(3):
+            s = seq.sample(2048)
+            p = par.sample(2048)
+            np.testing.assert_array_equal(s["indexes"],p["indexes"])
+            np.testing.assert_allclose(s["weights"],p["weights"])
+            np.testing.assert_array_equal(np.diff(p["indexes"].astype(np.int64)) >= 0,
+                                          True)
+
+        other = PrioritizedReplayBuffer(4096,{"a": {}},seed=8)
+        other.add(a=np.arange(4096),priorities=np.arange(4096) % 13 + 1.0)
+        self.assertFalse(np.array_equal(other.sample(2048)["indexes"],
+                                        make().sample(2048)["indexes"]))
+
+
+class TestSeededSampling(unittest.TestCase):
+    def test_seed(self):
+        def make(cls=ReplayBuffer,**kwargs):
+            rb = cls(64,{"a": {}},**kwargs)
+            rb.add(a=np.arange(40))
+            return rb
+
+        rb1 = make(seed=3)
+        rb2 = make(seed=3)
+        for _ in range(3):
+            s1 = rb1.sample(32)["a"]
+            np.testing.assert_array_equal(s1,rb2.sample(32)["a"])
+            self.assertTrue(((0 <= s1) & (s1 < 40)).all())
+
+        self.assertFalse(np.array_equal(make(seed=4).sample(32)["a"],
+                                        make(seed=3).sample(32)["a"]))
+
+        # Sequential calls use different streams, and `set_seed` resets them.
+        first = make(seed=3).sample(32)["a"]
+        self.assertFalse(np.array_equal(rb1.sample(32)["a"],first))
+        rb1.set_seed(3)
+        np.testing.assert_array_equal(rb1.sample(32)["a"],first)
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4,{"a": {}},seed=0).sample(2)
+
+    def test_split(self):
+        rb1 = ReplayBuffer(64,{"a": {}},seed=3)
+        rb2 = ReplayBuffer(64,{"a": {}},seed=3)
+        rb1.add(a=np.arange(64))
+        rb2.add(a=np.arange(64))
+
+        self.assertEqual(rb1.split(1),rb2.split(1))
+        np.testing.assert_array_equal(rb1.sample(32)["a"],rb2.sample(32)["a"])
+
+        rb1.set_seed(3)
+        rb2.set_seed(3)
+        rb1.split(1)
+        rb2.split(2)
+        self.assertFalse(np.array_equal(rb1.sample(32)["a"],rb2.sample(32)["a"]))
+
+    def test_mp(self):
+        def make(**kwargs):
+            rb = MPReplayBuffer(64,{"a": {}},**kwargs)
+            rb.add(a=np.arange(40))
+            return rb
+
+        np.testing.assert_array_equal(make(seed=5).sample(16)["a"],
+                                      make(seed=5).sample(16)["a"])
+
+        per1 = MPPrioritizedReplayBuffer(64,{"a": {}},seed=5)
+        per2 = MPPrioritizedReplayBuffer(64,{"a": {}},seed=5)
+        per1.add(a=np.arange(40),priorities=np.arange(40) + 1.0)
+        per2.add(a=np.arange(40),priorities=np.arange(40) + 1.0)
+        per1.split(1)
+        per2.split(1)
+        np.testing.assert_array_equal(per1.sample(16)["indexes"],
+                                      per2.sample(16)["indexes"])
+
+    def test_reverse_large_stride(self):
+        rb = ReverseReplayBuffer(10,{"a": {}},stride=25)
+        rb.add(a=np.arange(10))
+        np.testing.assert_array_equal(rb.sample(3)["a"].ravel(),[9,4,9])
+
+
+class TestNativeAdd(unittest.TestCase):
+    def test_wrapped_conversion(self):
+        rb = ReplayBuffer(5, {"obs": {"shape": 2}, "act": {"dtype": np.int32},
+                              "done": {"dtype": np.bool_}})
+        rb.add(obs=np.zeros((4, 2)), act=np.zeros(4), done=np.zeros(4))
+        rb.add(obs=[[1, 1], [2, 2], [3, 3]], act=[1.0, 2.0, 3.0], done=[0, 2, 0])
+
+        t = rb.get_all_transitions()
+        np.testing.assert_allclose(t["obs"][:, 0], [2, 3, 0, 0, 1])
+        np.testing.assert_array_equal(t["act"].ravel(), [2, 3, 0, 0, 1])
+        np.testing.assert_array_equal(t["done"].ravel(),
+                                      [True, False, False, False, False])
+        self.assertEqual(t["act"].dtype, np.int32)
+
+    def test_broadcast_and_long(self):
+        rb = ReplayBuffer(4, {"obs": {"shape": 3}, "rew": {}})
+        rb.add(obs=np.arange(6*3).reshape(6, 3), rew=1.5)
+
+        t = rb.get_all_transitions()
+        np.testing.assert_allclose(t["obs"][:, 0], [12, 15, 6, 9])
+        np.testing.assert_allclose(t["rew"], 1.5)
+        self.assertEqual(rb.get_next_index(), 2)
+
+    def test_shape_mismatch(self):
+        rb = ReplayBuffer(4, {"obs": {"shape": 3}, "rew": {}})
+        with self.assertRaises(ValueError):
+            rb.add(obs=np.zeros((2, 3)), rew=np.zeros(3))
+        with self.assertRaises(ValueError):
+            rb.add(obs=np.zeros(4), rew=0)
+
+    def test_object_fallback(self):
+        rb = ReplayBuffer(4, {"obs": {"dtype": object}, "rew": {}})
+        rb.add(obs=[{"a": 1}, {"b": 2}], rew=[1, 2])
+        t = rb.get_all_transitions()
+        self.assertEqual(t["obs"][1, 0], {"b": 2})
+        np.testing.assert_allclose(t["rew"].ravel(), [1, 2])
+
 
 if __name__ == '__main__':
     unittest.main()
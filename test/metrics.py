@@ -0,0 +1,166 @@
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+from cpprb import (ReplayBuffer, PrioritizedReplayBuffer,
+                   MPReplayBuffer, MPPrioritizedReplayBuffer)
+from cpprb.metrics import (Metrics, LatencyHistogram, BUCKETS_NS,
+                           to_prometheus, prometheus_text)
+
+
+class TestLatencyHistogram(unittest.TestCase):
+    def test_observe(self):
+        h = LatencyHistogram()
+        self.assertEqual(h.quantile(0.5), 0.0)
+
+        for ns in [500, 1000, 1001, 3000, 8000]:
+            h.observe(ns)
+        self.assertEqual(h.count, 5)
+        self.assertEqual(h.sum_ns, 13501)
+        self.assertEqual(h.max_ns, 8000)
+        self.assertEqual(h.counts[:5], [2, 1, 1, 1, 0])
+
+        self.assertAlmostEqual(h.quantile(0.5), 2e-6)
+        self.assertAlmostEqual(h.quantile(0.99), 8e-6)
+
+    def test_overflow(self):
+        h = LatencyHistogram()
+        h.observe(BUCKETS_NS[-1] + 1)
+        d = h.to_dict()
+        self.assertEqual(d["overflow"], 1)
+        self.assertAlmostEqual(d["p99"], (BUCKETS_NS[-1] + 1) * 1e-9)
+
+
+class TestMetrics(unittest.TestCase):
+    def test_observe(self):
+        m = Metrics()
+        m.observe("add", 0, items=3, nbytes=24)
+        m.observe("add", 0, items=1)
+        m.count("hits")
+
+        d = m.to_dict()
+        self.assertEqual(d["counters"], {"add_items": 4, "add_bytes": 24,
+                                         "hits": 1})
+        self.assertEqual(d["latency"]["add"]["count"], 2)
+
+        m.reset()
+        self.assertEqual(m.to_dict(), {"counters": {}, "latency": {}})
+
+    def test_prometheus(self):
+        m = Metrics()
+        m.observe("sample", 0, items=32)
+        stats = m.to_dict()
+        stats["gauges"] = {"stored_size": 10}
+
+        text = to_prometheus(stats, labels={"buffer": "a"})
+        self.assertIn("# TYPE cpprb_stored_size gauge", text)
+        self.assertIn('cpprb_stored_size{buffer="a"} 10', text)
+        self.assertIn('cpprb_sample_items_total{buffer="a"} 32', text)
+        self.assertIn("# TYPE cpprb_sample_seconds histogram", text)
+        self.assertIn('cpprb_sample_seconds_bucket{buffer="a",le="+Inf"} 1', text)
+        self.assertIn('cpprb_sample_seconds_count{buffer="a"} 1', text)
+
+
+class TestBufferStats(unittest.TestCase):
+    def test_disabled(self):
+        rb = ReplayBuffer(32, {"a": {"shape": 3}})
+        rb.add(a=np.ones((4, 3)))
+        rb.sample(2)
+
+        stats = rb.get_stats()
+        self.assertEqual(stats["counters"], {})
+        self.assertEqual(stats["latency"], {})
+        self.assertEqual(stats["gauges"]["stored_size"], 4)
+        self.assertEqual(stats["gauges"]["buffer_size"], 32)
+
+    def test_replay_buffer(self):
+        rb = ReplayBuffer(32, {"a": {"shape": 3}, "b": {"dtype": np.int64}},
+                          stats=True)
+        rb.add(a=np.ones((4, 3)), b=np.ones(4))
+        rb.sample(16)
+
+        stats = rb.get_stats()
+        self.assertEqual(stats["counters"]["add_items"], 4)
+        self.assertEqual(stats["counters"]["add_bytes"], 4 * (3 * 4 + 8))
+        self.assertEqual(stats["counters"]["sample_items"], 16)
+        self.assertEqual(stats["counters"]["encode_sample_bytes"],
+                         16 * (3 * 4 + 8))
+        self.assertEqual(stats["latency"]["add"]["count"], 1)
+        self.assertEqual(stats["latency"]["sample"]["count"], 1)
+
+        rb.reset_stats()
+        self.assertEqual(rb.get_stats()["counters"], {})
+
+    def test_next_of(self):
+        rb = ReplayBuffer(32, {"obs": {}, "done": {}}, next_of="obs",
+                          stats=True)
+        rb.add(obs=np.arange(4), next_obs=np.arange(1, 5), done=np.zeros(4))
+        self.assertEqual(rb.get_stats()["counters"]["add_bytes"], 4 * 12)
+
+    def test_cache(self):
+        with tempfile.TemporaryDirectory() as d:
+            rb = ReplayBuffer(32, {"obs": {}, "done": {}}, next_of="obs",
+                              mmap_prefix=os.path.join(d, "rb"), stats=True)
+            rb.add(obs=np.arange(4), next_obs=np.arange(1, 5), done=np.zeros(4))
+            rb.on_episode_end()
+            rb.sample(8)
+            counters = rb.get_stats()["counters"]
+            del rb
+
+        self.assertEqual(counters["cache_lookups"], 8)
+        self.assertGreaterEqual(counters["cache_hits"], 0)
+        self.assertLessEqual(counters["cache_hits"], 8)
+
+    def test_prioritized(self):
+        rb = PrioritizedReplayBuffer(32, {"a": {}}, stats=True)
+        rb.add(a=np.arange(8), priorities=np.ones(8))
+        s = rb.sample(4)
+        rb.update_priorities(s["indexes"], np.full(4, 2.0))
+
+        stats = rb.get_stats()
+        self.assertEqual(stats["counters"]["set_priorities_items"], 8)
+        self.assertEqual(stats["counters"]["update_priorities_items"], 4)
+        self.assertEqual(stats["latency"]["sample"]["count"], 1)
+        self.assertIn("sample_priorities", stats["latency"])
+        self.assertGreater(stats["counters"]["tree_incremental_updates"] +
+                           stats["counters"]["tree_full_rebuilds"], 0)
+        self.assertAlmostEqual(stats["gauges"]["max_priority"], 2.0)
+
+        rb.reset_stats()
+        self.assertEqual(rb.get_stats()["counters"]["tree_updated_leaves"], 0)
+
+    def test_mp(self):
+        rb = MPReplayBuffer(32, {"a": {}}, stats=True)
+        rb.add(a=np.arange(4))
+        rb.sample(8)
+
+        stats = rb.get_stats()
+        self.assertEqual(stats["counters"]["add_items"], 4)
+        self.assertEqual(stats["counters"]["seqlock_retries"], 0)
+        self.assertEqual(stats["latency"]["seqlock_wait"]["count"], 1)
+
+        per = MPPrioritizedReplayBuffer(32, {"a": {}}, stats=True)
+        per.add(a=np.arange(4))
+        s = per.sample(4)
+        per.update_priorities(s["indexes"], np.ones(4))
+
+        stats = per.get_stats()
+        self.assertEqual(stats["counters"]["update_priorities_items"], 4)
+        self.assertIn("tree_full_rebuilds", stats["counters"])
+
+    def test_prometheus_text(self):
+        a = ReplayBuffer(32, {"a": {}}, stats=True)
+        b = ReplayBuffer(32, {"a": {}}, stats=True)
+        a.add(a=1)
+        b.add(a=np.arange(2))
+
+        text = prometheus_text({"a": a, "b": b})
+        self.assertEqual(text.count("# TYPE cpprb_add_items_total counter"), 1)
+        self.assertIn('cpprb_add_items_total{buffer="a"} 1', text)
+        self.assertIn('cpprb_add_items_total{buffer="b"} 2', text)
+
+
+if __name__ == '__main__':
+    unittest.main()
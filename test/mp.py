@@ -1,4 +1,5 @@
 from multiprocessing import Process
+import os
 import unittest
 
 import numpy as np
@@ -160,6 +161,57 @@ class TestReplayBuffer(unittest.TestCase):
         self.assertEqual(rb.get_next_index() ,200)
         self.assertEqual(rb.get_stored_size(),200)
 
+class RewritingReplayBuffer(ReplayBuffer):
+    """
+    Rewrite all slots during every copy, as if explorers keep writing
+    """
+    rounds = 0
+
+    def _encode_sample(self, idx):
+        sample = super()._encode_sample(idx)
+        if self.rounds > 0:
+            self.rounds -= 1
+            self.add(a=np.full(self.get_buffer_size(), self.rounds))
+        return sample
+
+
+class TestConsistentSample(unittest.TestCase):
+    def test_many_retries(self):
+        rb = RewritingReplayBuffer(4, {"a": {}}, stats=True)
+        rb.add(a=np.arange(4))
+
+        # More retry rounds than recursion limit
+        rb.rounds = 1100
+        t = rb.get_all_transitions()
+        np.testing.assert_array_equal(t["a"].ravel(), np.zeros(4))
+        self.assertEqual(rb.get_stats()["counters"]["seqlock_retries"],
+                         4 * 1100)
+
+
+class Dying:
+    """
+    Kill the explorer process between write_begin() and write_end()
+    """
+    def __array__(self, dtype=None):
+        os._exit(0)
+
+
+class TestDeadWriter(unittest.TestCase):
+    def test_dead_writer(self):
+        rb = ReplayBuffer(4, {"a": {}}, write_timeout=0.2)
+        rb.add(a=np.arange(4))
+
+        p = Process(target=add_args, args=[rb, [{"a": Dying()}]])
+        p.start()
+        p.join()
+
+        with self.assertRaises(RuntimeError):
+            rb.get_all_transitions()
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"a": {}}, write_timeout=0)
+
+
 class TestPrioritizedReplayBuffer(unittest.TestCase):
     def test_add(self):
         buffer_size = 500
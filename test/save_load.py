@@ -506,5 +506,191 @@ class TestReplayBuffer(unittest.TestCase):
         np.testing.assert_allclose(t1["a"], t3["a"])
         np.testing.assert_allclose(t1["next_a"], t3["next_a"])
 
+
+class TestCheckpoint(unittest.TestCase):
+    """
+    Chunked binary format (version 2)
+    """
+    def test_basic(self):
+        buffer_size = 8
+        env_dict = {"a": {"shape": 3}, "done": {}}
+
+        rb1 = ReplayBuffer(buffer_size, env_dict)
+        rb2 = ReplayBuffer(buffer_size, env_dict)
+
+        rb1.add(a=np.arange(30).reshape(-1, 3), done=np.zeros(10))
+        rb1.on_episode_end()
+        rb1.add(a=[1, 2, 3], done=0)
+
+        fname = "checkpoint_basic.bin"
+        rb1.save_transitions(fname, version=2)
+        rb2.load_transitions(fname)
+
+        self.assertEqual(rb1.get_stored_size(), rb2.get_stored_size())
+        self.assertEqual(rb1.get_next_index(), rb2.get_next_index())
+        self.assertEqual(rb1.get_current_episode_len(),
+                         rb2.get_current_episode_len())
+
+        t1 = rb1.get_all_transitions()
+        t2 = rb2.get_all_transitions()
+        np.testing.assert_allclose(t1["a"], t2["a"])
+        np.testing.assert_allclose(t1["done"], t2["done"])
+
+        rb1.add(a=[4, 5, 6], done=1)
+        rb2.add(a=[4, 5, 6], done=1)
+        np.testing.assert_allclose(rb1.get_all_transitions()["a"],
+                                   rb2.get_all_transitions()["a"])
+
+    def test_not_full(self):
+        buffer_size = 8
+        env_dict = {"a": {}}
+
+        rb1 = ReplayBuffer(buffer_size, env_dict)
+        rb2 = ReplayBuffer(buffer_size, env_dict)
+        rb2.add(a=[9, 9, 9, 9, 9, 9])
+
+        rb1.add(a=[1, 2, 3])
+
+        fname = "checkpoint_not_full.bin"
+        rb1.save_transitions(fname, version=2)
+        rb2.load_transitions(fname)
+
+        self.assertEqual(rb2.get_stored_size(), 3)
+        np.testing.assert_allclose(rb2.get_all_transitions()["a"].ravel(),
+                                   [1, 2, 3])
+
+    def test_file_like(self):
+        import io
+
+        rb1 = ReplayBuffer(4, {"a": {}})
+        rb2 = ReplayBuffer(4, {"a": {}})
+        rb1.add(a=[1, 2, 3, 4, 5])
+
+        f = io.BytesIO()
+        rb1.save_transitions(f, version=2)
+        f.seek(0)
+        rb2.load_transitions(f)
+
+        np.testing.assert_allclose(rb1.get_all_transitions()["a"],
+                                   rb2.get_all_transitions()["a"])
+
+    def test_small_chunk(self):
+        from cpprb import checkpoint
+
+        a = np.arange(100, dtype=np.int32).reshape(25, 4)
+        fname = "checkpoint_chunk.bin"
+        checkpoint.write(fname, {"x": 1}, {"a": a, "e": a[:0]},
+                         chunk_size=7, num_threads=3)
+
+        with checkpoint.Reader(fname) as r:
+            self.assertEqual(r.meta, {"x": 1})
+            np.testing.assert_equal(r.read("a"), a)
+            self.assertEqual(r.read("e").shape, (0, 4))
+
+            with self.assertRaises(ValueError):
+                r.read_into("a", np.empty((25, 4), dtype=np.int64))
+
+    def test_without_positional_io(self):
+        from cpprb import checkpoint
+
+        a = np.arange(100, dtype=np.int32).reshape(25, 4)
+        fname = "checkpoint_sequential.bin"
+
+        positional_io = checkpoint._POSITIONAL_IO
+        checkpoint._POSITIONAL_IO = False
+        try:
+            checkpoint.write(fname, {"x": 1}, {"a": a}, chunk_size=7)
+            with checkpoint.Reader(fname) as r:
+                np.testing.assert_equal(r.read("a"), a)
+        finally:
+            checkpoint._POSITIONAL_IO = positional_io
+
+        # Compatible with positional I/O
+        with checkpoint.Reader(fname) as r:
+            np.testing.assert_equal(r.read("a"), a)
+
+    def test_stack_compress_next_of(self):
+        buffer_size = 8
+        env_dict = {"obs": {"shape": (3, 4)}, "done": {}}
+
+        rb1 = ReplayBuffer(buffer_size, env_dict, stack_compress="obs",
+                           next_of="obs")
+        rb2 = ReplayBuffer(buffer_size, env_dict, stack_compress="obs",
+                           next_of="obs")
+
+        obs = np.arange(3 * 15).reshape(3, 15)
+        for i in range(10):
+            rb1.add(obs=obs[:, i:i+4], next_obs=obs[:, i+1:i+5], done=0)
+
+        fname = "checkpoint_stack.bin"
+        rb1.save_transitions(fname, version=2)
+        rb2.load_transitions(fname)
+
+        t1 = rb1.get_all_transitions()
+        t2 = rb2.get_all_transitions()
+        np.testing.assert_allclose(t1["obs"], t2["obs"])
+        np.testing.assert_allclose(t1["next_obs"], t2["next_obs"])
+
+        rb1.add(obs=obs[:, 10:14], next_obs=obs[:, 11:15], done=1)
+        rb2.add(obs=obs[:, 10:14], next_obs=obs[:, 11:15], done=1)
+        np.testing.assert_allclose(rb1.get_all_transitions()["obs"],
+                                   rb2.get_all_transitions()["obs"])
+
+    def test_incompatible(self):
+        rb1 = ReplayBuffer(4, {"a": {}})
+        rb1.add(a=[1, 2])
+
+        fname = "checkpoint_incompatible.bin"
+        rb1.save_transitions(fname, version=2)
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(8, {"a": {}}).load_transitions(fname)
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"b": {}}).load_transitions(fname)
+
+        with self.assertRaises(ValueError):
+            ReplayBuffer(4, {"a": {"dtype": np.int32}}).load_transitions(fname)
+
+        with self.assertRaises(ValueError):
+            PrioritizedReplayBuffer(4, {"a": {}}).load_transitions(fname)
+
+    def test_PER(self):
+        buffer_size = 8
+        env_dict = {"a": {}}
+
+        rb1 = PrioritizedReplayBuffer(buffer_size, env_dict)
+        rb2 = PrioritizedReplayBuffer(buffer_size, env_dict)
+
+        rb1.add(a=np.arange(10), priorities=np.arange(10) + 1.0)
+
+        fname = "checkpoint_per.bin"
+        rb1.save_transitions(fname, version=2)
+        rb2.load_transitions(fname)
+
+        self.assertAlmostEqual(rb1.get_max_priority(), rb2.get_max_priority())
+
+        s1 = rb1.sample(buffer_size)
+        s2 = rb2.sample(buffer_size)
+        w1 = dict(zip(s1["indexes"], s1["weights"]))
+        w2 = dict(zip(s2["indexes"], s2["weights"]))
+        for i in set(w1) & set(w2):
+            self.assertAlmostEqual(w1[i], w2[i], places=5)
+
+    @unittest.skipUnless(__import__("importlib").util.find_spec("lz4"),
+                         "lz4 is not installed")
+    def test_lz4(self):
+        rb1 = ReplayBuffer(32, {"a": {}})
+        rb2 = ReplayBuffer(32, {"a": {}})
+        rb1.add(a=np.arange(40))
+
+        fname = "checkpoint_lz4.bin"
+        rb1.save_transitions(fname, version=2, compression="lz4")
+        rb2.load_transitions(fname)
+
+        np.testing.assert_allclose(rb1.get_all_transitions()["a"],
+                                   rb2.get_all_transitions()["a"])
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -2,7 +2,8 @@ import unittest
 
 import numpy as np
 
-from cpprb import ReplayBuffer, PrioritizedReplayBuffer, train
+from cpprb import (ReplayBuffer, PrioritizedReplayBuffer,
+                   MPPrioritizedReplayBuffer, train)
 
 class Env:
     def __init__(self,shape=(1,)):
@@ -15,6 +16,25 @@ class Env:
         return np.zeros(self.shape), 1.0, np.random.choice([0.0,1.0],p=[0.99,0.01]), {}
 
 
+class VecEnv:
+    def __init__(self,num_envs,shape=(1,)):
+        self.num_envs = num_envs
+        self.shape = shape
+
+    def reset(self):
+        return np.zeros((self.num_envs,*self.shape))
+
+    def step(self,action):
+        self.assertion(action)
+        return (np.zeros((self.num_envs,*self.shape)),
+                np.ones(self.num_envs),
+                np.random.choice([0.0,1.0],size=self.num_envs,p=[0.9,0.1]),
+                {})
+
+    def assertion(self,action):
+        assert np.asarray(action).shape[0] == self.num_envs
+
+
 class TestTrain(unittest.TestCase):
     def setUp(self):
         self.env = Env(shape=(3,))
@@ -209,5 +229,109 @@ class TestTrain(unittest.TestCase):
               done_check=lambda tr: True)
 
 
+class TestPipelineTrain(unittest.TestCase):
+    env_dict = {"obs": {"shape": (3,)},
+                "act": {},
+                "rew": {},
+                "next_obs": {"shape": (3,)},
+                "done": {}}
+
+    def setUp(self):
+        self.env = VecEnv(4,shape=(3,))
+
+    def _train(self,rb,**kwargs):
+        updates = []
+        def update(sample,step,episode):
+            updates.append(step)
+            return np.full(sample["obs"].shape[0],0.5)
+
+        train(rb,self.env,
+              lambda obs, step, episode, is_warmup: np.ones(obs.shape[0]),
+              update,
+              max_steps=40,
+              batch_size=8,
+              n_warmups=8,
+              replay_ratio=0.5,
+              **kwargs)
+        return updates
+
+    def test_vectorized(self):
+        """
+        Add batches of vectorized environments
+        """
+        rb = ReplayBuffer(64,self.env_dict)
+        updates = self._train(rb,vectorized=True)
+        self.assertEqual(rb.get_stored_size(),40)
+        self.assertEqual(len(updates),16)
+        self.assertGreaterEqual(min(updates),12)
+
+    def test_pipeline(self):
+        """
+        Update policy at learner thread
+        """
+        rb = ReplayBuffer(64,self.env_dict)
+        self.assertEqual(len(self._train(rb,vectorized=True,pipeline=True)),16)
+        self.assertEqual(rb.get_stored_size(),40)
+
+    def test_per_pipeline(self):
+        """
+        Update priorities at learner thread
+        """
+        rb = PrioritizedReplayBuffer(64,self.env_dict)
+        self.assertEqual(len(self._train(rb,vectorized=True,pipeline=True)),16)
+        self.assertAlmostEqual(rb.get_max_priority(),1.0)
+
+        rb = MPPrioritizedReplayBuffer(64,self.env_dict)
+        self.assertEqual(len(self._train(rb,vectorized=True,pipeline=True)),16)
+
+    def test_single_env_pipeline(self):
+        """
+        Pipeline with non vectorized environment
+        """
+        rb = ReplayBuffer(64,self.env_dict)
+        train(rb,Env(shape=(3,)),
+              lambda obs, step, episode, is_warmup: 1.0,
+              lambda sample,step,episode: 0.5,
+              max_steps=10,
+              pipeline=True)
+        self.assertEqual(rb.get_stored_size(),10)
+
+    def test_learner_error(self):
+        """
+        Raise error of learner thread
+        """
+        rb = ReplayBuffer(64,self.env_dict)
+        def update(sample,step,episode):
+            raise KeyError("update")
+
+        with self.assertRaises(RuntimeError):
+            train(rb,self.env,
+                  lambda obs, step, episode, is_warmup: np.ones(obs.shape[0]),
+                  update,
+                  max_steps=40,
+                  vectorized=True,
+                  pipeline=True)
+
+    def test_invalid(self):
+        """
+        Raise ValueError for negative replay_ratio or Nstep with multiple envs
+        """
+        rb = ReplayBuffer(64,self.env_dict)
+        with self.assertRaises(ValueError):
+            train(rb,self.env,
+                  lambda obs, step, episode, is_warmup: np.ones(obs.shape[0]),
+                  lambda sample,step,episode: 0.5,
+                  vectorized=True,
+                  replay_ratio=-1.0)
+
+        rb = ReplayBuffer(64,self.env_dict,Nstep={"size": 3, "rew": "rew",
+                                                  "gamma": 0.99})
+        with self.assertRaises(ValueError):
+            train(rb,self.env,
+                  lambda obs, step, episode, is_warmup: np.ones(obs.shape[0]),
+                  lambda sample,step,episode: 0.5,
+                  vectorized=True)
+
+
 if __name__ == "__main__":
     unittest.main()
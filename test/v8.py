@@ -399,6 +399,32 @@ class TestNstepBuffer(unittest.TestCase):
                 np.testing.assert_allclose(nb.add(next_obs=(i),done=0)["next_obs"],
                                            np.array(i,dtype=np.float32).reshape(-1,1))
 
+    def test_next_on_episode_end(self):
+        nb = NstepBuffer({'obs': {}, 'next_obs': {}, 'done': {}},
+                         {"size": 4, "next": "next_obs"})
+
+        for i in range(5):
+            nb.add(obs=i,next_obs=i+1,done=0)
+
+        remain = nb.on_episode_end()
+        np.testing.assert_allclose(remain["obs"],
+                                   np.asarray([[2],[3],[4]]))
+        np.testing.assert_allclose(remain["next_obs"],
+                                   np.asarray([[5],[5],[5]]))
+        self.assertIs(nb.add(obs=0,next_obs=1,done=0),None)
+
+    def test_dtype(self):
+        nb = NstepBuffer({"obs": {"dtype": np.int32},
+                          "rew": {"dtype": np.float64}, "done": {}},
+                         {"size": 2, "rew": "rew", "gamma": 0.5})
+
+        self.assertIs(nb.add(obs=1,rew=1,done=0),None)
+        transition = nb.add(obs=2,rew=1,done=0)
+        self.assertEqual(transition["obs"].dtype,np.int32)
+        self.assertEqual(transition["rew"].dtype,np.float64)
+        self.assertEqual(transition["done"].dtype,np.single)
+        np.testing.assert_allclose(transition["rew"],np.asarray([[1.5]]))
+
     def test_rew(self):
         nb = NstepBuffer({"rew": {}, "done": {}},
                          {"size": 4, "rew": "rew", "gamma": 0.5})